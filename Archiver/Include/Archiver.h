@@ -40,12 +40,28 @@ public:
 	virtual uint64_t GetLength() = NULL;
 
 	// Returns the offset position for the handle from the beginning
+	// IArchiver only asks for this when it is created and after a Span; from there on, it keeps count of what it has written itself,
+	// so a pipe only needs to account for what preceded the archive plus anything reported through Advance
 	virtual uint64_t GetOffset() = NULL;
 
+	// Called by IArchiver::CreateArchiver after it writes the archive header, before the archiver asks for its offset;
+	// handles that can seek don't need to do anything, but one that can't (a pipe) must add this to what GetOffset returns
+	virtual void Advance(uint64_t bytes) { }
+
 	// Releases any resources allocated by the archive handle
 	virtual void Release() = NULL;
 };
 
+// Implement this to be told how far an archiver has gotten; it's called on the thread that is adding files
+class IArchiveProgress
+{
+public:
+
+	// Called as a file's data is written; sz_uncomp is how much of the source file has been dealt with since the last call and
+	// sz_comp is how much was written to the archive for it. Over a whole file, the sz_uncomp values add up to the file's size
+	virtual void Progress(uint64_t sz_uncomp, uint64_t sz_comp) = NULL;
+};
+
 class IArchiver
 {
 
@@ -64,6 +80,8 @@ public:
 
 		CT_FASTLZ,
 
+		CT_TARGZIP,			// a standard .tar.gz rather than one of our archives; flags don't apply and it's never spanned
+
 		CT_NUMTYPES
 	};
 
@@ -71,6 +89,11 @@ public:
 	{
 		AR_OK = 0,
 		AR_OK_UNCOMPRESSED,
+		AR_OK_REUSED,			// the file was unchanged; its compressed blocks were copied from the reference archive as they were
+		AR_OK_CACHED,			// the file's compressed blocks were found in the build cache and copied from there
+		AR_OK_UNCHANGED,		// (AF_PATCH) the file is identical to the reference archive's; only its entry was added
+		AR_OK_DELTA,			// (AF_PATCH) the file was stored as the difference from the reference archive's version of it
+		AR_OK_NODELTA,			// (AF_PATCH) the file changed, but it and its old version were too big to diff in memory; it was compressed whole
 
 		AR_SPANFAIL,
 
@@ -91,10 +114,18 @@ public:
 		IM_SPAN				// information about only the current span
 	};
 
+	enum ARCHIVE_FLAGS
+	{
+		AF_STREAMING		= 0x0000000000000001,		// every file's blocks are preceded by a local header and followed by an end marker, so the archive can be read from a forward-only stream
+		AF_TRAILER			= 0x0000000000000002,		// the file table offset goes in a footer instead of being patched into the header, so the archive can be written to a handle that can't seek
+		AF_PATCH			= 0x0000000000000004,		// the archive updates an install of the reference archive: unchanged files carry no data and changed ones only a delta; it is never spanned
+	};
+
 	enum { MAGIC = 'MAGI' };
 
 	// Creates and destroys the archiver
-	static CREATE_RESULT CreateArchiver(IArchiver **ppia, IArchiveHandle *pah, COMPRESSOR_TYPE ct);
+	// flags is a combination of ARCHIVE_FLAGS and is stored in the archive header
+	static CREATE_RESULT CreateArchiver(IArchiver **ppia, IArchiveHandle *pah, COMPRESSOR_TYPE ct, uint64_t flags = 0);
 	static void DestroyArchiver(IArchiver **ppia);
 
 	// This is the maximum number of bytes that will be written to the stream before the Span method is called
@@ -108,6 +139,26 @@ public:
 	// dst_filename should always be relative
 	virtual ADD_RESULT AddFile(const TCHAR *src_filename, const TCHAR *dst_filename, uint64_t *sz_uncomp = nullptr, uint64_t *sz_comp = nullptr, const TCHAR *scriptsnippet = nullptr) = NULL;
 
+	// Provides a previously built archive (or the exe it is embedded in) to update from; any file added afterward whose
+	// destination, size, modification time, and content hash match an entry in it has that entry's compressed blocks copied
+	// verbatim instead of being recompressed. pah must remain valid until the archiver is destroyed; pass NULL to stop using it
+	// With AF_PATCH, files are compared by destination, size, and content hash alone, and a file that differs from the
+	// reference's version is stored as a delta against that version if it comes out smaller that way
+	virtual bool SetReferenceArchive(IArchiveHandle *pah) = NULL;
+
+	// Keeps the compressed blocks of every file added in a cache directory that persists between builds, keyed by the file's
+	// source path, size, modification time, content hash, and compressor; a file that is found there is copied from it rather
+	// than compressed. The least recently used entries are evicted when the archiver is destroyed if the cache has grown beyond
+	// max_size bytes. Pass NULL to stop using it
+	virtual bool SetCache(const TCHAR *cache_path, uint64_t max_size) = NULL;
+
+	// Returns how many files were copied from the cache and how many had to be compressed while it was in use
+	virtual void GetCacheStats(size_t *hits, size_t *misses) = NULL;
+
+	// Reports progress through pprog as each block is written; pprog must remain valid until the archiver is destroyed or this
+	// is called again with NULL
+	virtual void SetProgress(IArchiveProgress *pprog) = NULL;
+
 	// Finalizes the output, performing any operations that may be necessary to later extract and decompress the data (writing file tables, etc)
 	virtual FINALIZE_RESULT Finalize() = NULL;
 };
@@ -126,9 +177,27 @@ public:
 
 		CR_COMPRESSORUNK,
 
+		CR_NOTSTREAMABLE,		// sequential extraction was requested, but the archive wasn't built with AF_STREAMING
+
 		CR_UNKNOWN_ERROR
 	};
 
+	enum EXTRACT_MODE
+	{
+		EM_RANDOMACCESS = 0,	// the file table is read up front; requires a seekable handle
+
+		EM_SEQUENTIAL			// files are discovered one at a time from their local headers; the handle is never seeked
+	};
+
+	enum UPDATE_MODE
+	{
+		UM_OVERWRITE = 0,		// every file is written out, whatever is already on disk
+
+		UM_SKIPUNCHANGED,		// a file already on disk with the archived file's size and modification time is left alone
+
+		UM_SKIPVERIFIED			// as UM_SKIPUNCHANGED, but the file on disk must also hash the same as the archived one
+	};
+
 	enum COMPRESSOR_TYPE
 	{
 		CT_STOREONLY = 0,
@@ -148,17 +217,26 @@ public:
 
 		ER_MUSTDOWNLOAD,
 
+		ER_PATCHMISMATCH,		// the installed file that a patch entry applies to is missing or isn't the version the patch was made against
+
+		ER_UNCHANGED,			// the file on disk was already the archived version, so nothing was written (see SetUpdateMode)
+
 		ER_UNKNOWN_ERROR
 	};
 
 	// Creates and destroys the extractor
-	static CREATE_RESULT CreateExtractor(IExtractor **ppie, IArchiveHandle *pah);
+	// In EM_SEQUENTIAL mode, the extractor only ever reads forward, so pah may be a pipe or a download in progress
+	static CREATE_RESULT CreateExtractor(IExtractor **ppie, IArchiveHandle *pah, EXTRACT_MODE mode = EM_RANDOMACCESS);
 	static void DestroyExtractor(IExtractor **ppie);
 
 	// Returns the number of files that are in the archive
+	// In EM_SEQUENTIAL mode, this is only the number of files whose local headers have been read so far;
+	// GetFileInfo or ExtractFile with file_idx == GetFileCount() reads the next one, and fails (or returns ER_DONE) at the end of the stream
 	virtual size_t GetFileCount() = NULL;
 
-	virtual bool GetFileInfo(size_t file_idx, tstring *filename = NULL, tstring *filepath = NULL, uint64_t *csize = NULL, uint64_t *usize = NULL, FILETIME *ctime = NULL, FILETIME *mtime = NULL, tstring *scriptsnippet = nullptr) = NULL;
+	// crc is the checksum of the file's uncompressed contents, as FLZAHashFile would compute it; it's 0 when the archive
+	// doesn't have one for the file (older archives, and a stream's local headers)
+	virtual bool GetFileInfo(size_t file_idx, tstring *filename = NULL, tstring *filepath = NULL, uint64_t *csize = NULL, uint64_t *usize = NULL, FILETIME *ctime = NULL, FILETIME *mtime = NULL, tstring *scriptsnippet = nullptr, uint32_t *crc = nullptr) = NULL;
 
 	// Extracts the next file from the archive - this is assumed to be a serial process where the whole
 	// archive will be extracted at once, so no choice as to which file to extract is provided
@@ -168,4 +246,8 @@ public:
 
 	// Sets the base output path of the extractor
 	virtual void SetBaseOutputPath(const TCHAR *path) = NULL;
+
+	// Sets whether files that are already on disk get written again; the default is UM_OVERWRITE
+	// Skipping only applies in EM_RANDOMACCESS mode, since a stream's local headers don't have the sizes or checksums
+	virtual void SetUpdateMode(UPDATE_MODE mode) = NULL;
 };
@@ -11,13 +11,21 @@
 
 #include "..\Include\Archiver.h"
 #include "FastLZArchiver.h"
+#include "TarGzArchiver.h"
 
 
-IArchiver::CREATE_RESULT IArchiver::CreateArchiver(IArchiver **ppia, IArchiveHandle *pah, COMPRESSOR_TYPE ct)
+IArchiver::CREATE_RESULT IArchiver::CreateArchiver(IArchiver **ppia, IArchiveHandle *pah, COMPRESSOR_TYPE ct, uint64_t flags)
 {
 
 	if (ppia)
 	{
+		// a tarball has a format of its own, so it doesn't start with our header
+		if (ct == CT_TARGZIP)
+		{
+			*ppia = new CTarGzArchiver(pah);
+			return CR_OK;
+		}
+
 		DWORD bw;
 		uint32_t comp_magic;
 
@@ -38,13 +46,14 @@ IArchiver::CREATE_RESULT IArchiver::CreateArchiver(IArchiver **ppia, IArchiveHan
 
 		WriteFile(pah->GetHandle(), &comp_magic, sizeof(uint32_t), &bw, NULL);
 
-		uint64_t flags = 0;
 		WriteFile(pah->GetHandle(), &flags, sizeof(uint64_t), &bw, NULL);
 
+		pah->Advance(sizeof(uint32_t) + sizeof(uint32_t) + sizeof(uint64_t));
+
 		switch (ct)
 		{
 			case CT_FASTLZ:
-				*ppia = new CFastLZArchiver(pah);
+				*ppia = new CFastLZArchiver(pah, flags);
 				break;
 
 			case CT_STOREONLY:
@@ -69,7 +78,7 @@ void IArchiver::DestroyArchiver(IArchiver **ppia)
 }
 
 
-IExtractor::CREATE_RESULT IExtractor::CreateExtractor(IExtractor **ppie, IArchiveHandle *pah)
+IExtractor::CREATE_RESULT IExtractor::CreateExtractor(IExtractor **ppie, IArchiveHandle *pah, EXTRACT_MODE mode)
 {
 	if (ppie)
 	{
@@ -87,10 +96,14 @@ IExtractor::CREATE_RESULT IExtractor::CreateExtractor(IExtractor **ppie, IArchiv
 		UINT64 flags;
 		ReadFile(pah->GetHandle(), &flags, sizeof(uint64_t), &br, NULL);
 
+		// without local headers, there's no way to find the files in order without first seeking to the file table
+		if ((mode == EM_SEQUENTIAL) && !(flags & IArchiver::AF_STREAMING))
+			return CR_NOTSTREAMABLE;
+
 		switch (magic)
 		{
 			case CFastLZArchiver::MAGIC_FASTLZ:
-				*ppie = new CFastLZExtractor(pah, flags);
+				*ppie = new CFastLZExtractor(pah, flags, mode);
 				break;
 
 			default:
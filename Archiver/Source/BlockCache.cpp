@@ -0,0 +1,289 @@
+/*
+	Copyright © 2013-2020, Keelan Stuart (hereafter referenced as AUTHOR). All Rights Reserved.
+	Permission to use, copy, modify, and distribute this software is hereby granted, without fee and without a signed licensing agreement,
+	provided that the above copyright notice appears in all copies, modifications, and distributions.
+	Furthermore, AUTHOR assumes no responsibility for any damages caused either directly or indirectly by the use of this software, nor vouches for
+	any fitness of purpose of this software.
+	All other copyrighted material contained herein is noted and rights attributed to individual copyright holders.
+	
+	For inquiries, contact: keelanstuart@gmail.com
+*/
+
+
+#include <Windows.h>
+#include "BlockCache.h"
+#include <Shlwapi.h>
+#include <filesystem>
+#include <vector>
+#include <algorithm>
+
+
+// 64-bit FNV-1a, only used to name cache files
+static uint64_t BCHash(uint64_t h, const void *buf, size_t len)
+{
+	const BYTE *p = (const BYTE *)buf;
+	while (len--)
+	{
+		h ^= *(p++);
+		h *= 0x100000001B3ULL;
+	}
+
+	return h;
+}
+
+
+CBlockCache::CBlockCache(const TCHAR *path, uint64_t max_size, uint32_t codec, uint32_t level)
+{
+	_tcscpy_s(m_Path, MAX_PATH, path);
+	PathAddBackslash(m_Path);
+
+	m_MaxSize = max_size;
+	m_Codec = codec;
+	m_Level = level;
+
+	m_Hits = 0;
+	m_Misses = 0;
+
+	m_hEntry = INVALID_HANDLE_VALUE;
+
+	// nothing has been cached the first time around
+	std::error_code ec;
+	std::filesystem::create_directories(m_Path, ec);
+}
+
+
+CBlockCache::~CBlockCache()
+{
+	EndEntry(SFileTableEntry(), false);
+
+	Trim();
+}
+
+
+bool CBlockCache::IsValid() const
+{
+	return PathIsDirectory(m_Path) ? true : false;
+}
+
+
+void CBlockCache::GetEntryFilename(const TCHAR *src_filename, const SFileTableEntry &fte, const TCHAR *ext, TCHAR *filename)
+{
+	tstring src = src_filename;
+	for (tstring::iterator it = src.begin(), last_it = src.end(); it != last_it; it++)
+		*it = _totlower(*it);
+
+	uint64_t h = 0xCBF29CE484222325ULL;
+	h = BCHash(h, src.c_str(), src.size() * sizeof(TCHAR));
+	h = BCHash(h, &fte.m_UncompressedSize, sizeof(fte.m_UncompressedSize));
+	h = BCHash(h, &fte.m_FTModified, sizeof(fte.m_FTModified));
+	h = BCHash(h, &m_Codec, sizeof(m_Codec));
+	h = BCHash(h, &m_Level, sizeof(m_Level));
+
+	_stprintf_s(filename, MAX_PATH, _T("%s%016llx%s"), m_Path, h, ext);
+}
+
+
+HANDLE CBlockCache::OpenEntry(const TCHAR *src_filename, const SFileTableEntry &fte, SBlockCacheEntryHeader &hdr)
+{
+	TCHAR filename[MAX_PATH];
+	GetEntryFilename(src_filename, fte, _T(".blk"), filename);
+
+	// writing attributes is needed to mark the entry as used; sharing delete lets another build replace it in the meantime
+	HANDLE h = CreateFile(filename, GENERIC_READ | FILE_WRITE_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (h == INVALID_HANDLE_VALUE)
+		return h;
+
+	bool ok = FLZAReadFully(h, &hdr, sizeof(SBlockCacheEntryHeader)) &&
+		(hdr.m_Magic == SBlockCacheEntryHeader::MAGIC) && (hdr.m_Codec == m_Codec) && (hdr.m_Level == m_Level) &&
+		(hdr.m_UncompressedSize == fte.m_UncompressedSize) && !CompareFileTime(&hdr.m_FTModified, &fte.m_FTModified) &&
+		(hdr.m_PathLength < MAX_PATH);
+
+	// the name is only a hash, so make sure that it's really the same source
+	if (ok)
+	{
+		TCHAR src[MAX_PATH];
+		ok = FLZAReadFully(h, src, hdr.m_PathLength * sizeof(TCHAR));
+		src[hdr.m_PathLength] = _T('\0');
+
+		ok = ok && !_tcsicmp(src, src_filename);
+	}
+
+	// an entry that was cut short would only be found out in the middle of the copy
+	if (ok)
+	{
+		LARGE_INTEGER sz;
+		GetFileSizeEx(h, &sz);
+		ok = ((uint64_t)sz.QuadPart == (sizeof(SBlockCacheEntryHeader) + (hdr.m_PathLength * sizeof(TCHAR)) + hdr.m_DataSize));
+	}
+
+	if (!ok)
+	{
+		CloseHandle(h);
+		return INVALID_HANDLE_VALUE;
+	}
+
+	return h;
+}
+
+
+void CBlockCache::CloseEntry(HANDLE h, bool used)
+{
+	if (used)
+	{
+		m_Hits++;
+
+		// the last write time is what eviction goes by
+		FILETIME now;
+		GetSystemTimeAsFileTime(&now);
+		SetFileTime(h, NULL, NULL, &now);
+	}
+
+	CloseHandle(h);
+}
+
+
+bool CBlockCache::BeginEntry(const TCHAR *src_filename, const SFileTableEntry &fte)
+{
+	m_Misses++;
+
+	EndEntry(fte, false);
+
+	GetEntryFilename(src_filename, fte, _T(".blk"), m_EntryFilename);
+
+	// other builds may be sharing the cache, so the partial entry is private to this process until it's complete
+	TCHAR ext[32];
+	_stprintf_s(ext, 32, _T(".%u.tmp"), GetCurrentProcessId());
+	GetEntryFilename(src_filename, fte, ext, m_EntryTempFilename);
+
+	m_hEntry = CreateFile(m_EntryTempFilename, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (m_hEntry == INVALID_HANDLE_VALUE)
+		return false;
+
+	m_EntrySource = src_filename;
+	m_EntryUncompressedSize = 0;
+
+	ZeroMemory(&m_EntryHeader, sizeof(SBlockCacheEntryHeader));
+	m_EntryHeader.m_Magic = SBlockCacheEntryHeader::MAGIC;
+	m_EntryHeader.m_Codec = m_Codec;
+	m_EntryHeader.m_Level = m_Level;
+	m_EntryHeader.m_PathLength = (uint32_t)m_EntrySource.size();
+
+	// the header gets written again once the blocks are all in
+	DWORD bw;
+	WriteFile(m_hEntry, &m_EntryHeader, sizeof(SBlockCacheEntryHeader), &bw, NULL);
+	WriteFile(m_hEntry, m_EntrySource.c_str(), m_EntryHeader.m_PathLength * sizeof(TCHAR), &bw, NULL);
+
+	return true;
+}
+
+
+void CBlockCache::AddBlock(SFileBlock &b)
+{
+	if (m_hEntry == INVALID_HANDLE_VALUE)
+		return;
+
+	// a full disk shouldn't fail the build, just the caching
+	if (!b.WriteCompressedData(m_hEntry))
+	{
+		CloseHandle(m_hEntry);
+		m_hEntry = INVALID_HANDLE_VALUE;
+
+		DeleteFile(m_EntryTempFilename);
+		return;
+	}
+
+	uint32_t datasize = (b.m_Header.m_SizeC == (uint32_t)-1) ? b.m_Header.m_SizeU : b.m_Header.m_SizeC;
+
+	m_EntryHeader.m_BlockCount++;
+	m_EntryHeader.m_CompressedSize += datasize;
+	m_EntryHeader.m_DataSize += sizeof(sFileBlock::sFileBlockHeader) + datasize;
+
+	m_EntryUncompressedSize += b.m_Header.m_SizeU;
+}
+
+
+void CBlockCache::EndEntry(const SFileTableEntry &fte, bool commit)
+{
+	if (m_hEntry == INVALID_HANDLE_VALUE)
+		return;
+
+	// a read error ends the file early, too
+	commit &= (m_EntryUncompressedSize == fte.m_UncompressedSize);
+
+	if (commit)
+	{
+		m_EntryHeader.m_Crc = fte.m_Crc;
+		m_EntryHeader.m_UncompressedSize = fte.m_UncompressedSize;
+		m_EntryHeader.m_FTModified = fte.m_FTModified;
+
+		LARGE_INTEGER z;
+		z.QuadPart = 0;
+		SetFilePointerEx(m_hEntry, z, NULL, FILE_BEGIN);
+
+		DWORD bw;
+		commit = WriteFile(m_hEntry, &m_EntryHeader, sizeof(SBlockCacheEntryHeader), &bw, NULL) ? true : false;
+	}
+
+	CloseHandle(m_hEntry);
+	m_hEntry = INVALID_HANDLE_VALUE;
+
+	if (!commit || !MoveFileEx(m_EntryTempFilename, m_EntryFilename, MOVEFILE_REPLACE_EXISTING))
+		DeleteFile(m_EntryTempFilename);
+}
+
+
+void CBlockCache::Trim()
+{
+	struct sCachedFile
+	{
+		FILETIME m_Used;
+		uint64_t m_Size;
+		tstring m_Name;
+	};
+
+	std::vector<sCachedFile> files;
+	uint64_t total = 0;
+
+	TCHAR spec[MAX_PATH];
+	_stprintf_s(spec, MAX_PATH, _T("%s*.blk"), m_Path);
+
+	WIN32_FIND_DATA fd;
+	HANDLE hfind = FindFirstFile(spec, &fd);
+	if (hfind == INVALID_HANDLE_VALUE)
+		return;
+
+	do
+	{
+		if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+			continue;
+
+		sCachedFile cf;
+		cf.m_Used = fd.ftLastWriteTime;
+		cf.m_Size = ((uint64_t)fd.nFileSizeHigh << 32) | fd.nFileSizeLow;
+		cf.m_Name = fd.cFileName;
+
+		total += cf.m_Size;
+		files.push_back(cf);
+	}
+	while (FindNextFile(hfind, &fd));
+
+	FindClose(hfind);
+
+	if (total <= m_MaxSize)
+		return;
+
+	// least recently used first
+	std::sort(files.begin(), files.end(), [](const sCachedFile &a, const sCachedFile &b)
+	{
+		return (CompareFileTime(&a.m_Used, &b.m_Used) < 0);
+	});
+
+	for (std::vector<sCachedFile>::const_iterator it = files.begin(), last_it = files.end(); (it != last_it) && (total > m_MaxSize); it++)
+	{
+		TCHAR filename[MAX_PATH];
+		_stprintf_s(filename, MAX_PATH, _T("%s%s"), m_Path, it->m_Name.c_str());
+
+		if (DeleteFile(filename))
+			total -= it->m_Size;
+	}
+}
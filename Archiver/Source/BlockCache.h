@@ -0,0 +1,71 @@
+/*
+	Copyright © 2013-2020, Keelan Stuart (hereafter referenced as AUTHOR). All Rights Reserved.
+	Permission to use, copy, modify, and distribute this software is hereby granted, without fee and without a signed licensing agreement,
+	provided that the above copyright notice appears in all copies, modifications, and distributions.
+	Furthermore, AUTHOR assumes no responsibility for any damages caused either directly or indirectly by the use of this software, nor vouches for
+	any fitness of purpose of this software.
+	All other copyrighted material contained herein is noted and rights attributed to individual copyright holders.
+	
+	For inquiries, contact: keelanstuart@gmail.com
+*/
+
+
+#pragma once
+
+#include "FastLZArchiver.h"
+
+
+// Keeps the compressed block streams of previously archived files in a directory, one file per source, so that an unchanged
+// file can be spliced into a new archive without compressing it again
+class CBlockCache
+{
+public:
+
+	CBlockCache(const TCHAR *path, uint64_t max_size, uint32_t codec, uint32_t level);
+
+	// evicts the least recently used entries if the cache has outgrown its maximum size
+	~CBlockCache();
+
+	bool IsValid() const;
+
+	// Opens the cached blocks for the source file described by fte, if there are any; the returned handle is positioned at the
+	// first block. The caller still has to compare the content hash before using them, then call CloseEntry
+	HANDLE OpenEntry(const TCHAR *src_filename, const SFileTableEntry &fte, SBlockCacheEntryHeader &hdr);
+
+	// used is true if the blocks went into the archive, which counts as a hit and makes the entry the most recently used
+	void CloseEntry(HANDLE h, bool used);
+
+	// Collects the blocks of a file as it is being compressed (every file that has to be compressed counts as a miss); if
+	// commit is true when it's ended and all of the file's data was seen, they replace whatever was cached for that source
+	bool BeginEntry(const TCHAR *src_filename, const SFileTableEntry &fte);
+	void AddBlock(SFileBlock &b);
+	void EndEntry(const SFileTableEntry &fte, bool commit);
+
+	size_t GetHits() const { return m_Hits; }
+	size_t GetMisses() const { return m_Misses; }
+
+protected:
+
+	// builds the name of the cache file for a source: 16 hex digits of an FNV-1a hash of the lower-cased source path, its size
+	// and modification time, and the codec and level, plus ext, directly in the cache directory; a changed file gets a new name,
+	// so its stale entry is left for Trim to evict
+	void GetEntryFilename(const TCHAR *src_filename, const SFileTableEntry &fte, const TCHAR *ext, TCHAR *filename);
+
+	void Trim();
+
+	TCHAR m_Path[MAX_PATH];
+	uint64_t m_MaxSize;
+	uint32_t m_Codec;
+	uint32_t m_Level;
+
+	size_t m_Hits;
+	size_t m_Misses;
+
+	// the entry being written
+	HANDLE m_hEntry;
+	TCHAR m_EntryFilename[MAX_PATH];
+	TCHAR m_EntryTempFilename[MAX_PATH];
+	tstring m_EntrySource;
+	SBlockCacheEntryHeader m_EntryHeader;
+	uint64_t m_EntryUncompressedSize;
+};
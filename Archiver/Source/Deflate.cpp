@@ -0,0 +1,682 @@
+/*
+	Copyright © 2013-2020, Keelan Stuart (hereafter referenced as AUTHOR). All Rights Reserved.
+	Permission to use, copy, modify, and distribute this software is hereby granted, without fee and without a signed licensing agreement,
+	provided that the above copyright notice appears in all copies, modifications, and distributions.
+	Furthermore, AUTHOR assumes no responsibility for any damages caused either directly or indirectly by the use of this software, nor vouches for
+	any fitness of purpose of this software.
+	All other copyrighted material contained herein is noted and rights attributed to individual copyright holders.
+	
+	For inquiries, contact: keelanstuart@gmail.com
+*/
+
+
+#include <Windows.h>
+#include "Deflate.h"
+#include <vector>
+#include <algorithm>
+
+
+#define DEFLATE_WINDOW			32768
+#define DEFLATE_MIN_MATCH		3
+#define DEFLATE_MAX_MATCH		258
+#define DEFLATE_HASH_BITS		15
+#define DEFLATE_MAX_CHAIN		48			// how many earlier occurrences are tried for each match
+#define DEFLATE_NICE_MATCH		128			// a match at least this long is taken without looking for a better one
+#define DEFLATE_LAZY_LIMIT		32			// a match at least this long isn't second-guessed by looking one byte ahead
+#define DEFLATE_TOO_FAR			4096		// a 3 byte match further back than this costs more than the literals
+#define DEFLATE_BLOCK_SYMBOLS	16384		// symbols per block, after which new codes are built for what follows
+
+#define DEFLATE_NUM_LITLEN		286
+#define DEFLATE_NUM_DIST		30
+#define DEFLATE_NUM_CODELEN		19
+
+
+static const struct sDeflateTables
+{
+	uint16_t len_base[29];
+	BYTE len_extra[29];
+	uint16_t dist_base[30];
+	BYTE dist_extra[30];
+
+	BYTE len_code[DEFLATE_MAX_MATCH + 1];	// match length -> length code - 257
+	BYTE dist_code[512];					// see DistCode
+
+	sDeflateTables()
+	{
+		static const uint16_t lb[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+		static const BYTE le[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+		static const uint16_t db[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+		static const BYTE de[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+		memcpy(len_base, lb, sizeof(lb));
+		memcpy(len_extra, le, sizeof(le));
+		memcpy(dist_base, db, sizeof(db));
+		memcpy(dist_extra, de, sizeof(de));
+
+		memset(len_code, 0, sizeof(len_code));
+		for (int c = 0; c < 29; c++)
+		{
+			for (int l = lb[c], last_l = lb[c] + (1 << le[c]); (l < last_l) && (l <= DEFLATE_MAX_MATCH); l++)
+				len_code[l] = (BYTE)c;
+		}
+
+		// 258 has a code of its own, even though it's also in the range of the one before it
+		len_code[DEFLATE_MAX_MATCH] = 28;
+
+		for (int c = 0; c < 30; c++)
+		{
+			for (int d = db[c], last_d = db[c] + (1 << de[c]); d < last_d; d++)
+			{
+				if (d <= 256)
+					dist_code[d - 1] = (BYTE)c;
+				else
+					dist_code[256 + ((d - 1) >> 7)] = (BYTE)c;
+			}
+		}
+	}
+
+	// distances up to 256 are looked up directly, and beyond that by 128s, which the codes are aligned to
+	inline BYTE DistCode(uint32_t dist) const
+	{
+		return (dist <= 256) ? dist_code[dist - 1] : dist_code[256 + ((dist - 1) >> 7)];
+	}
+
+} s_Tables;
+
+
+// Packs bits least significant first, as deflate wants them
+class CDeflateBitWriter
+{
+protected:
+	BYTE *m_pOut;
+	BYTE *m_pEnd;
+	uint64_t m_Bits;
+	int m_Count;
+	bool m_Overflow;
+
+public:
+	CDeflateBitWriter(BYTE *dst, size_t dst_size)
+	{
+		m_pOut = dst;
+		m_pEnd = dst + dst_size;
+		m_Bits = 0;
+		m_Count = 0;
+		m_Overflow = false;
+	}
+
+	inline void Put(uint32_t bits, int n)
+	{
+		m_Bits |= (uint64_t)bits << m_Count;
+		m_Count += n;
+
+		while (m_Count >= 8)
+		{
+			if (m_pOut < m_pEnd)
+				*(m_pOut++) = (BYTE)m_Bits;
+			else
+				m_Overflow = true;
+
+			m_Bits >>= 8;
+			m_Count -= 8;
+		}
+	}
+
+	// Pads to a byte boundary with zero bits
+	void Align()
+	{
+		if (m_Count)
+			Put(0, 8 - m_Count);
+	}
+
+	// Only valid at a byte boundary
+	void PutBytes(const BYTE *src, size_t len)
+	{
+		if ((size_t)(m_pEnd - m_pOut) < len)
+		{
+			m_Overflow = true;
+			return;
+		}
+
+		memcpy(m_pOut, src, len);
+		m_pOut += len;
+	}
+
+	BYTE *GetPos() const { return m_pOut; }
+
+	bool Overflowed() const { return m_Overflow; }
+};
+
+
+// A literal (m_Dist == 0, m_LitLen is the byte) or a match (m_LitLen is its length)
+struct sDeflateSymbol
+{
+	uint16_t m_LitLen;
+	uint16_t m_Dist;
+};
+
+
+static uint32_t ReverseBits(uint32_t code, int len)
+{
+	uint32_t ret = 0;
+	while (len--)
+	{
+		ret = (ret << 1) | (code & 1);
+		code >>= 1;
+	}
+
+	return ret;
+}
+
+
+// Assigns the canonical code for each length (RFC 1951, 3.2.2), bit-reversed so it can be written as-is
+static void AssignCodes(const BYTE *lens, int n, uint16_t *codes)
+{
+	uint16_t count[16] = {0}, next[16];
+	for (int i = 0; i < n; i++)
+		count[lens[i]]++;
+	count[0] = 0;
+
+	uint16_t code = 0;
+	for (int b = 1; b < 16; b++)
+	{
+		code = (code + count[b - 1]) << 1;
+		next[b] = code;
+	}
+
+	for (int i = 0; i < n; i++)
+		codes[i] = lens[i] ? (uint16_t)ReverseBits(next[lens[i]]++, lens[i]) : 0;
+}
+
+
+// Builds Huffman code lengths of no more than max_bits for the given symbol frequencies, then their codes. There are always at
+// least two codes, even if fewer symbols are used, since inflaters may reject an incomplete code
+static void BuildCode(const uint32_t *freq, int n, int max_bits, BYTE *lens, uint16_t *codes)
+{
+	memset(lens, 0, n);
+
+	std::vector<std::pair<uint32_t, int>> syms;		// (frequency, symbol), to be sorted by frequency
+	syms.reserve(n);
+
+	for (int i = 0; i < n; i++)
+	{
+		if (freq[i])
+			syms.push_back(std::make_pair(freq[i], i));
+	}
+
+	for (int i = 0; (i < n) && (syms.size() < 2); i++)
+	{
+		if (!freq[i])
+			syms.push_back(std::make_pair(0, i));
+	}
+
+	std::sort(syms.begin(), syms.end());
+
+	size_t m = syms.size();
+
+	// leaves are already in order and internal nodes are made in order, so the two smallest are always at the front of one
+	// queue or the other
+	std::vector<uint64_t> weight(m * 2);
+	std::vector<int> parent(m * 2, -1);
+	for (size_t i = 0; i < m; i++)
+		weight[i] = syms[i].first;
+
+	size_t leaf = 0, node = m, next_node = m;
+	for (size_t k = 0; k < (m - 1); k++)
+	{
+		size_t pick[2];
+		for (int j = 0; j < 2; j++)
+		{
+			if ((leaf < m) && ((node >= next_node) || (weight[leaf] <= weight[node])))
+				pick[j] = leaf++;
+			else
+				pick[j] = node++;
+		}
+
+		weight[next_node] = weight[pick[0]] + weight[pick[1]];
+		parent[pick[0]] = parent[pick[1]] = (int)next_node;
+		next_node++;
+	}
+
+	// depths from the root down; parents always come after their children
+	std::vector<int> depth(m * 2, 0);
+	for (size_t i = next_node - 1; i-- > 0; )
+		depth[i] = depth[parent[i]] + 1;
+
+	int num[64] = {0};
+	for (size_t i = 0; i < m; i++)
+		num[std::min<int>(depth[i], 63)]++;
+
+	// limit the lengths by moving overlong codes up to max_bits, then lengthening shorter ones until the code is complete again
+	for (int b = max_bits + 1; b < 64; b++)
+	{
+		num[max_bits] += num[b];
+		num[b] = 0;
+	}
+
+	uint32_t total = 0;
+	for (int b = max_bits; b > 0; b--)
+		total += (uint32_t)num[b] << (max_bits - b);
+
+	while (total > (1U << max_bits))
+	{
+		num[max_bits]--;
+		for (int b = max_bits - 1; b > 0; b--)
+		{
+			if (num[b])
+			{
+				num[b]--;
+				num[b + 1] += 2;
+				break;
+			}
+		}
+
+		total--;
+	}
+
+	// the most frequent symbols get the shortest codes
+	size_t j = m;
+	for (int b = 1; b <= max_bits; b++)
+	{
+		for (int k = num[b]; k > 0; k--)
+			lens[syms[--j].second] = (BYTE)b;
+	}
+
+	AssignCodes(lens, n, codes);
+}
+
+
+// Compresses one block's worth of symbols, covering src[0, src_len)
+class CDeflateBlockWriter
+{
+protected:
+	CDeflateBitWriter &m_Out;
+
+	uint32_t m_LitFreq[DEFLATE_NUM_LITLEN];
+	uint32_t m_DistFreq[DEFLATE_NUM_DIST];
+
+	BYTE m_LitLens[DEFLATE_NUM_LITLEN];
+	uint16_t m_LitCodes[DEFLATE_NUM_LITLEN];
+	BYTE m_DistLens[DEFLATE_NUM_DIST];
+	uint16_t m_DistCodes[DEFLATE_NUM_DIST];
+
+	// the run-length encoded code lengths of a dynamic block, with their extra bits
+	std::vector<std::pair<BYTE, BYTE>> m_CodeLenSyms;
+
+	void CountSymbols(const sDeflateSymbol *syms, size_t nsyms)
+	{
+		memset(m_LitFreq, 0, sizeof(m_LitFreq));
+		memset(m_DistFreq, 0, sizeof(m_DistFreq));
+
+		for (size_t i = 0; i < nsyms; i++)
+		{
+			if (!syms[i].m_Dist)
+			{
+				m_LitFreq[syms[i].m_LitLen]++;
+			}
+			else
+			{
+				m_LitFreq[257 + s_Tables.len_code[syms[i].m_LitLen]]++;
+				m_DistFreq[s_Tables.DistCode(syms[i].m_Dist)]++;
+			}
+		}
+
+		m_LitFreq[256]++;
+	}
+
+	// The cost, in bits, of the symbols themselves with the given code lengths
+	uint64_t SymbolCost(const BYTE *litlens, const BYTE *distlens) const
+	{
+		uint64_t bits = 0;
+
+		for (int i = 0; i < DEFLATE_NUM_LITLEN; i++)
+			bits += (uint64_t)m_LitFreq[i] * (litlens[i] + ((i >= 257) ? s_Tables.len_extra[i - 257] : 0));
+
+		for (int i = 0; i < DEFLATE_NUM_DIST; i++)
+			bits += (uint64_t)m_DistFreq[i] * (distlens[i] + s_Tables.dist_extra[i]);
+
+		return bits;
+	}
+
+	void EncodeCodeLengths(const BYTE *lens, size_t n)
+	{
+		m_CodeLenSyms.clear();
+
+		size_t i = 0;
+		while (i < n)
+		{
+			BYTE v = lens[i];
+
+			size_t run = 1;
+			while (((i + run) < n) && (lens[i + run] == v))
+				run++;
+
+			i += run;
+
+			if (!v)
+			{
+				while (run >= 11)
+				{
+					size_t r = std::min<size_t>(run, 138);
+					m_CodeLenSyms.push_back(std::make_pair(18, (BYTE)(r - 11)));
+					run -= r;
+				}
+
+				if (run >= 3)
+				{
+					m_CodeLenSyms.push_back(std::make_pair(17, (BYTE)(run - 3)));
+					run = 0;
+				}
+			}
+			else
+			{
+				m_CodeLenSyms.push_back(std::make_pair(v, 0));
+				run--;
+
+				while (run >= 3)
+				{
+					size_t r = std::min<size_t>(run, 6);
+					m_CodeLenSyms.push_back(std::make_pair(16, (BYTE)(r - 3)));
+					run -= r;
+				}
+			}
+
+			while (run--)
+				m_CodeLenSyms.push_back(std::make_pair(v, 0));
+		}
+	}
+
+	void WriteSymbols(const sDeflateSymbol *syms, size_t nsyms, const BYTE *litlens, const uint16_t *litcodes, const BYTE *distlens, const uint16_t *distcodes)
+	{
+		for (size_t i = 0; i < nsyms; i++)
+		{
+			if (!syms[i].m_Dist)
+			{
+				m_Out.Put(litcodes[syms[i].m_LitLen], litlens[syms[i].m_LitLen]);
+			}
+			else
+			{
+				int lc = s_Tables.len_code[syms[i].m_LitLen];
+				m_Out.Put(litcodes[257 + lc], litlens[257 + lc]);
+				m_Out.Put(syms[i].m_LitLen - s_Tables.len_base[lc], s_Tables.len_extra[lc]);
+
+				int dc = s_Tables.DistCode(syms[i].m_Dist);
+				m_Out.Put(distcodes[dc], distlens[dc]);
+				m_Out.Put(syms[i].m_Dist - s_Tables.dist_base[dc], s_Tables.dist_extra[dc]);
+			}
+		}
+
+		m_Out.Put(litcodes[256], litlens[256]);
+	}
+
+public:
+	CDeflateBlockWriter(CDeflateBitWriter &out) : m_Out(out)
+	{
+	}
+
+	void Write(const sDeflateSymbol *syms, size_t nsyms, const BYTE *src, size_t src_len, bool final)
+	{
+		static const BYTE order[DEFLATE_NUM_CODELEN] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+		static const struct sFixedCodes
+		{
+			BYTE litlens[288];
+			uint16_t litcodes[288];
+			BYTE distlens[32];
+			uint16_t distcodes[32];
+
+			sFixedCodes()
+			{
+				for (int i = 0; i < 288; i++)
+					litlens[i] = (i < 144) ? 8 : (i < 256) ? 9 : (i < 280) ? 7 : 8;
+
+				for (int i = 0; i < 32; i++)
+					distlens[i] = 5;
+
+				AssignCodes(litlens, 288, litcodes);
+				AssignCodes(distlens, 32, distcodes);
+			}
+		} fixed;
+
+		CountSymbols(syms, nsyms);
+
+		BuildCode(m_LitFreq, DEFLATE_NUM_LITLEN, 15, m_LitLens, m_LitCodes);
+		BuildCode(m_DistFreq, DEFLATE_NUM_DIST, 15, m_DistLens, m_DistCodes);
+
+		int hlit = DEFLATE_NUM_LITLEN;
+		while ((hlit > 257) && !m_LitLens[hlit - 1])
+			hlit--;
+
+		int hdist = DEFLATE_NUM_DIST;
+		while ((hdist > 1) && !m_DistLens[hdist - 1])
+			hdist--;
+
+		// the literal / length and distance code lengths are run-length encoded as one sequence
+		BYTE lens[DEFLATE_NUM_LITLEN + DEFLATE_NUM_DIST];
+		memcpy(lens, m_LitLens, hlit);
+		memcpy(lens + hlit, m_DistLens, hdist);
+		EncodeCodeLengths(lens, hlit + hdist);
+
+		uint32_t clfreq[DEFLATE_NUM_CODELEN] = {0};
+		for (const auto &cls : m_CodeLenSyms)
+			clfreq[cls.first]++;
+
+		BYTE cllens[DEFLATE_NUM_CODELEN];
+		uint16_t clcodes[DEFLATE_NUM_CODELEN];
+		BuildCode(clfreq, DEFLATE_NUM_CODELEN, 7, cllens, clcodes);
+
+		int hclen = DEFLATE_NUM_CODELEN;
+		while ((hclen > 4) && !cllens[order[hclen - 1]])
+			hclen--;
+
+		uint64_t dynamic_bits = 3 + 5 + 5 + 4 + (3 * hclen) + SymbolCost(m_LitLens, m_DistLens);
+		for (int i = 0; i < DEFLATE_NUM_CODELEN; i++)
+			dynamic_bits += (uint64_t)clfreq[i] * (cllens[i] + ((i == 16) ? 2 : (i == 17) ? 3 : (i == 18) ? 7 : 0));
+
+		uint64_t fixed_bits = 3 + SymbolCost(fixed.litlens, fixed.distlens);
+
+		// stored blocks hold at most 64KB each, and each one costs its header, padding to a byte boundary, and the length
+		uint64_t stored_pieces = std::max<uint64_t>(1, (src_len + 65534) / 65535);
+		uint64_t stored_bits = (stored_pieces * (3 + 7 + 32)) + ((uint64_t)src_len * 8);
+
+		if ((stored_bits <= dynamic_bits) && (stored_bits <= fixed_bits))
+		{
+			do
+			{
+				uint16_t len = (uint16_t)std::min<size_t>(src_len, 65535);
+				src_len -= len;
+
+				m_Out.Put((final && !src_len) ? 1 : 0, 1);
+				m_Out.Put(0, 2);
+				m_Out.Align();
+				m_Out.Put(len, 16);
+				m_Out.Put((uint16_t)~len, 16);
+				m_Out.PutBytes(src, len);
+
+				src += len;
+			}
+			while (src_len);
+		}
+		else if (fixed_bits <= dynamic_bits)
+		{
+			m_Out.Put(final ? 1 : 0, 1);
+			m_Out.Put(1, 2);
+
+			WriteSymbols(syms, nsyms, fixed.litlens, fixed.litcodes, fixed.distlens, fixed.distcodes);
+		}
+		else
+		{
+			m_Out.Put(final ? 1 : 0, 1);
+			m_Out.Put(2, 2);
+
+			m_Out.Put(hlit - 257, 5);
+			m_Out.Put(hdist - 1, 5);
+			m_Out.Put(hclen - 4, 4);
+
+			for (int i = 0; i < hclen; i++)
+				m_Out.Put(cllens[order[i]], 3);
+
+			for (const auto &cls : m_CodeLenSyms)
+			{
+				m_Out.Put(clcodes[cls.first], cllens[cls.first]);
+
+				if (cls.first == 16)
+					m_Out.Put(cls.second, 2);
+				else if (cls.first == 17)
+					m_Out.Put(cls.second, 3);
+				else if (cls.first == 18)
+					m_Out.Put(cls.second, 7);
+			}
+
+			WriteSymbols(syms, nsyms, m_LitLens, m_LitCodes, m_DistLens, m_DistCodes);
+		}
+	}
+};
+
+
+size_t FLZADeflateBound(size_t src_size)
+{
+	// besides the data itself, a few bytes for every stored piece and every block
+	return src_size + (src_size >> 11) + 64;
+}
+
+
+size_t FLZADeflate(const BYTE *src, size_t src_size, BYTE *dst, size_t dst_size)
+{
+	if (dst_size < FLZADeflateBound(src_size))
+		return 0;
+
+	CDeflateBitWriter out(dst, dst_size);
+	CDeflateBlockWriter block(out);
+
+	std::vector<int32_t> head(1 << DEFLATE_HASH_BITS, -1);
+	std::vector<int32_t> prev(DEFLATE_WINDOW, -1);
+
+	std::vector<sDeflateSymbol> syms;
+	syms.reserve(DEFLATE_BLOCK_SYMBOLS);
+
+	size_t block_start = 0;		// where the current block's data begins
+	size_t emitted = 0;			// how much of src the symbols so far account for
+
+	auto hash = [src](size_t pos) -> uint32_t
+	{
+		uint32_t v = (uint32_t)src[pos] | ((uint32_t)src[pos + 1] << 8) | ((uint32_t)src[pos + 2] << 16);
+		return (v * 2654435761U) >> (32 - DEFLATE_HASH_BITS);
+	};
+
+	auto insert = [&](size_t pos)
+	{
+		if ((pos + DEFLATE_MIN_MATCH) <= src_size)
+		{
+			uint32_t h = hash(pos);
+			prev[pos & (DEFLATE_WINDOW - 1)] = head[h];
+			head[h] = (int32_t)pos;
+		}
+	};
+
+	auto find_match = [&](size_t pos, uint32_t *match_dist) -> uint32_t
+	{
+		if ((pos + DEFLATE_MIN_MATCH) > src_size)
+			return 0;
+
+		uint32_t max_len = (uint32_t)std::min<size_t>(DEFLATE_MAX_MATCH, src_size - pos);
+		uint32_t best = 0;
+
+		int32_t cand = head[hash(pos)];
+		for (int chain = DEFLATE_MAX_CHAIN; (cand >= 0) && chain; chain--)
+		{
+			size_t dist = pos - cand;
+			if (dist > DEFLATE_WINDOW)
+				break;
+
+			const BYTE *a = src + cand, *b = src + pos;
+
+			// anything that doesn't beat the best so far can be rejected on the byte that would have to differ
+			if (a[best] == b[best])
+			{
+				uint32_t len = 0;
+				while ((len < max_len) && (a[len] == b[len]))
+					len++;
+
+				if ((len > best) && ((len > DEFLATE_MIN_MATCH) || (dist <= DEFLATE_TOO_FAR)))
+				{
+					best = len;
+					*match_dist = (uint32_t)dist;
+
+					if (len >= std::min<uint32_t>(max_len, DEFLATE_NICE_MATCH))
+						break;
+				}
+			}
+
+			int32_t next = prev[cand & (DEFLATE_WINDOW - 1)];
+			if (next >= cand)
+				break;
+
+			cand = next;
+		}
+
+		return (best >= DEFLATE_MIN_MATCH) ? best : 0;
+	};
+
+	auto emit = [&](uint16_t litlen, uint16_t dist)
+	{
+		sDeflateSymbol s = {litlen, dist};
+		syms.push_back(s);
+		emitted += dist ? litlen : 1;
+
+		if (syms.size() >= DEFLATE_BLOCK_SYMBOLS)
+		{
+			block.Write(syms.data(), syms.size(), src + block_start, emitted - block_start, false);
+			syms.clear();
+			block_start = emitted;
+		}
+	};
+
+	// lazy matching: a match is only taken if the one starting at the next byte isn't longer
+	uint32_t prev_len = 0, prev_dist = 0;
+	bool have_prev = false;
+
+	size_t pos = 0;
+	while (pos < src_size)
+	{
+		uint32_t len = 0, dist = 0;
+		if (!have_prev || (prev_len < DEFLATE_LAZY_LIMIT))
+			len = find_match(pos, &dist);
+
+		insert(pos);
+
+		if (have_prev && (prev_len >= DEFLATE_MIN_MATCH) && (len <= prev_len))
+		{
+			emit((uint16_t)prev_len, (uint16_t)prev_dist);
+
+			// the previous match started at pos - 1 and pos is already in the hash chains
+			size_t match_end = pos - 1 + prev_len;
+			for (size_t k = pos + 1; k < match_end; k++)
+				insert(k);
+
+			pos = match_end;
+			have_prev = false;
+		}
+		else
+		{
+			if (have_prev)
+				emit(src[pos - 1], 0);
+
+			prev_len = len;
+			prev_dist = dist;
+			have_prev = true;
+			pos++;
+		}
+	}
+
+	if (have_prev)
+		emit(src[src_size - 1], 0);
+
+	block.Write(syms.data(), syms.size(), src + block_start, emitted - block_start, true);
+
+	out.Align();
+
+	if (out.Overflowed())
+		return 0;
+
+	return (size_t)(out.GetPos() - dst);
+}
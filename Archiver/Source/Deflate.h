@@ -0,0 +1,25 @@
+/*
+	Copyright © 2013-2020, Keelan Stuart (hereafter referenced as AUTHOR). All Rights Reserved.
+	Permission to use, copy, modify, and distribute this software is hereby granted, without fee and without a signed licensing agreement,
+	provided that the above copyright notice appears in all copies, modifications, and distributions.
+	Furthermore, AUTHOR assumes no responsibility for any damages caused either directly or indirectly by the use of this software, nor vouches for
+	any fitness of purpose of this software.
+	All other copyrighted material contained herein is noted and rights attributed to individual copyright holders.
+	
+	For inquiries, contact: keelanstuart@gmail.com
+*/
+
+
+#pragma once
+
+#include <Windows.h>
+#include <stdint.h>
+
+
+// The most that FLZADeflate can produce from src_size bytes; data that doesn't compress is stored, growing only a little
+size_t FLZADeflateBound(size_t src_size);
+
+// Compresses src into dst as one complete raw deflate stream (RFC 1951) whose last block is marked final, using hash-chained
+// LZ77 with lazy matching and, per block, whichever of dynamic Huffman codes, the fixed codes, or storing comes out smallest.
+// Returns the number of bytes written, or 0 if dst_size wasn't at least FLZADeflateBound(src_size)
+size_t FLZADeflate(const BYTE *src, size_t src_size, BYTE *dst, size_t dst_size);
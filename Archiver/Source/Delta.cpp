@@ -0,0 +1,319 @@
+/*
+	Copyright © 2013-2020, Keelan Stuart (hereafter referenced as AUTHOR). All Rights Reserved.
+	Permission to use, copy, modify, and distribute this software is hereby granted, without fee and without a signed licensing agreement,
+	provided that the above copyright notice appears in all copies, modifications, and distributions.
+	Furthermore, AUTHOR assumes no responsibility for any damages caused either directly or indirectly by the use of this software, nor vouches for
+	any fitness of purpose of this software.
+	All other copyrighted material contained herein is noted and rights attributed to individual copyright holders.
+	
+	For inquiries, contact: keelanstuart@gmail.com
+*/
+
+
+#include <Windows.h>
+#include "Delta.h"
+#include "FastLZArchiver.h"
+#include <vector>
+#include <algorithm>
+
+
+// Buffers the delta on its way to disk and keeps track of how big it's gotten
+class CDeltaWriter
+{
+protected:
+	HANDLE m_hOut;
+	BYTE m_Buf[64 * (1 << 10)];
+	DWORD m_Used;
+	uint64_t m_Total;
+	uint64_t m_MaxSize;
+
+public:
+	CDeltaWriter(HANDLE hout, uint64_t max_size)
+	{
+		m_hOut = hout;
+		m_Used = 0;
+		m_Total = 0;
+		m_MaxSize = max_size;
+	}
+
+	bool Flush()
+	{
+		DWORD bw;
+		bool ret = !m_Used || (WriteFile(m_hOut, m_Buf, m_Used, &bw, NULL) && (bw == m_Used));
+		m_Used = 0;
+
+		return ret;
+	}
+
+	bool Write(const void *buf, uint64_t sz)
+	{
+		m_Total += sz;
+		if (m_Total >= m_MaxSize)
+			return false;
+
+		const BYTE *p = (const BYTE *)buf;
+		while (sz)
+		{
+			DWORD n = (DWORD)std::min<uint64_t>(sz, sizeof(m_Buf) - m_Used);
+			memcpy(m_Buf + m_Used, p, n);
+			m_Used += n;
+			p += n;
+			sz -= n;
+
+			if ((m_Used == sizeof(m_Buf)) && !Flush())
+				return false;
+		}
+
+		return true;
+	}
+
+	bool Insert(const BYTE *p, uint64_t len)
+	{
+		while (len)
+		{
+			uint32_t n = (uint32_t)std::min<uint64_t>(len, 1 << 20);
+
+			BYTE op = DELTA_OP_INSERT;
+			if (!Write(&op, sizeof(BYTE)) || !Write(&n, sizeof(uint32_t)) || !Write(p, n))
+				return false;
+
+			p += n;
+			len -= n;
+		}
+
+		return true;
+	}
+
+	bool Copy(uint64_t ofs, uint64_t len)
+	{
+		while (len)
+		{
+			uint32_t n = (uint32_t)std::min<uint64_t>(len, 1 << 30);
+
+			BYTE op = DELTA_OP_COPY;
+			if (!Write(&op, sizeof(BYTE)) || !Write(&ofs, sizeof(uint64_t)) || !Write(&n, sizeof(uint32_t)))
+				return false;
+
+			ofs += n;
+			len -= n;
+		}
+
+		return true;
+	}
+
+	uint64_t GetTotal() const { return m_Total; }
+};
+
+
+// The rsync weak checksum; s1 is the sum of the bytes in the window and s2 the sum of those weighted by their distance from its end
+static inline uint32_t DeltaWeakSum(uint32_t s1, uint32_t s2)
+{
+	return (s1 & 0xFFFF) | (s2 << 16);
+}
+
+static void DeltaInitSums(const BYTE *p, uint32_t bs, uint32_t &s1, uint32_t &s2)
+{
+	s1 = s2 = 0;
+	for (uint32_t i = 0; i < bs; i++)
+	{
+		s1 += p[i];
+		s2 += (bs - i) * p[i];
+	}
+}
+
+
+bool FLZACreateDelta(const BYTE *base, uint64_t base_size, const BYTE *target, uint64_t target_size, HANDLE hout, uint64_t max_size, uint64_t *delta_size)
+{
+	CDeltaWriter dw(hout, max_size);
+
+	uint32_t magic = DELTA_MAGIC;
+	uint32_t base_crc = FLZACrc32(0, base, (size_t)base_size);
+	if (!dw.Write(&magic, sizeof(uint32_t)) || !dw.Write(&base_size, sizeof(uint64_t)) || !dw.Write(&base_crc, sizeof(uint32_t)))
+		return false;
+
+	// bigger files get bigger blocks, which keeps the index small; a match is extended past the block anyway
+	uint32_t bs = 256;
+	while (((uint64_t)bs * bs < base_size) && (bs < 8192))
+		bs <<= 1;
+
+	// index every whole block of the base by its weak checksum
+	size_t nblocks = (size_t)(base_size / bs);
+
+	uint32_t hashbits = 1;
+	while (((size_t)1 << hashbits) < (nblocks * 2))
+		hashbits++;
+
+	std::vector<int64_t> head((size_t)1 << hashbits, -1);
+	std::vector<int64_t> next(nblocks);
+	std::vector<uint32_t> weak(nblocks);
+
+	for (size_t k = 0; k < nblocks; k++)
+	{
+		uint32_t s1, s2;
+		DeltaInitSums(base + (k * bs), bs, s1, s2);
+		weak[k] = DeltaWeakSum(s1, s2);
+
+		size_t bucket = (size_t)((weak[k] * 0x9E3779B1u) >> (32 - hashbits));
+		next[k] = head[bucket];
+		head[bucket] = (int64_t)k;
+	}
+
+	uint64_t p = 0, lit = 0;
+	uint32_t s1 = 0, s2 = 0;
+	bool have_sums = false;
+
+	while (nblocks && ((p + bs) <= target_size))
+	{
+		if (!have_sums)
+		{
+			DeltaInitSums(target + p, bs, s1, s2);
+			have_sums = true;
+		}
+
+		uint32_t w = DeltaWeakSum(s1, s2);
+
+		uint64_t match_ofs = 0, match_len = 0;
+
+		// the weak checksum only narrows it down; the bytes themselves decide, and a match runs for as long as they agree
+		int64_t k = head[(size_t)((w * 0x9E3779B1u) >> (32 - hashbits))];
+		for (int chain = 0; (k >= 0) && (chain < 32); k = next[(size_t)k], chain++)
+		{
+			if (weak[(size_t)k] != w)
+				continue;
+
+			uint64_t o = (uint64_t)k * bs;
+			if (memcmp(base + o, target + p, bs))
+				continue;
+
+			uint64_t len = bs;
+			while (((o + len) < base_size) && ((p + len) < target_size) && (base[o + len] == target[p + len]))
+				len++;
+
+			if (len > match_len)
+			{
+				match_ofs = o;
+				match_len = len;
+			}
+		}
+
+		if (match_len)
+		{
+			// the match may also have started before the window did
+			while ((p > lit) && (match_ofs > 0) && (base[match_ofs - 1] == target[p - 1]))
+			{
+				p--;
+				match_ofs--;
+				match_len++;
+			}
+
+			if (!dw.Insert(target + lit, p - lit) || !dw.Copy(match_ofs, match_len))
+				return false;
+
+			p += match_len;
+			lit = p;
+			have_sums = false;
+		}
+		else
+		{
+			// slide the window forward a byte
+			if ((p + bs) < target_size)
+			{
+				uint32_t out = target[p], in = target[p + bs];
+				s1 = s1 - out + in;
+				s2 = s2 - (bs * out) + s1;
+			}
+
+			p++;
+		}
+	}
+
+	BYTE op = DELTA_OP_END;
+	if (!dw.Insert(target + lit, target_size - lit) || !dw.Write(&op, sizeof(BYTE)) || !dw.Flush())
+		return false;
+
+	if (delta_size)
+		*delta_size = dw.GetTotal();
+
+	return true;
+}
+
+
+bool FLZAReadDeltaHeader(IDeltaReader *pdr, uint64_t *base_size, uint32_t *base_crc)
+{
+	uint32_t magic;
+	if (!pdr->Read(&magic, sizeof(uint32_t)) || (magic != DELTA_MAGIC))
+		return false;
+
+	return pdr->Read(base_size, sizeof(uint64_t)) && pdr->Read(base_crc, sizeof(uint32_t));
+}
+
+
+bool FLZAApplyDelta(IDeltaReader *pdr, HANDLE hbase, HANDLE hout, uint32_t *crc)
+{
+	std::vector<BYTE> buf(64 * (1 << 10));
+	DWORD bw;
+
+	*crc = 0;
+
+	while (true)
+	{
+		BYTE op;
+		if (!pdr->Read(&op, sizeof(BYTE)))
+			return false;
+
+		switch (op)
+		{
+			case DELTA_OP_COPY:
+			{
+				uint64_t ofs;
+				uint32_t len;
+				if (!pdr->Read(&ofs, sizeof(uint64_t)) || !pdr->Read(&len, sizeof(uint32_t)))
+					return false;
+
+				LARGE_INTEGER p;
+				p.QuadPart = ofs;
+				if (!SetFilePointerEx(hbase, p, NULL, FILE_BEGIN))
+					return false;
+
+				while (len)
+				{
+					DWORD n = std::min<DWORD>(len, (DWORD)buf.size());
+					if (!FLZAReadFully(hbase, buf.data(), n) || !WriteFile(hout, buf.data(), n, &bw, NULL))
+						return false;
+
+					*crc = FLZACrc32(*crc, buf.data(), n);
+					len -= n;
+				}
+
+				break;
+			}
+
+			case DELTA_OP_INSERT:
+			{
+				uint32_t len;
+				if (!pdr->Read(&len, sizeof(uint32_t)))
+					return false;
+
+				while (len)
+				{
+					DWORD n = std::min<DWORD>(len, (DWORD)buf.size());
+					if (!pdr->Read(buf.data(), n) || !WriteFile(hout, buf.data(), n, &bw, NULL))
+						return false;
+
+					*crc = FLZACrc32(*crc, buf.data(), n);
+					len -= n;
+				}
+
+				break;
+			}
+
+			case DELTA_OP_END:
+				return true;
+
+			default:
+				return false;
+		}
+	}
+
+	return false;
+}
@@ -0,0 +1,45 @@
+/*
+	Copyright © 2013-2020, Keelan Stuart (hereafter referenced as AUTHOR). All Rights Reserved.
+	Permission to use, copy, modify, and distribute this software is hereby granted, without fee and without a signed licensing agreement,
+	provided that the above copyright notice appears in all copies, modifications, and distributions.
+	Furthermore, AUTHOR assumes no responsibility for any damages caused either directly or indirectly by the use of this software, nor vouches for
+	any fitness of purpose of this software.
+	All other copyrighted material contained herein is noted and rights attributed to individual copyright holders.
+	
+	For inquiries, contact: keelanstuart@gmail.com
+*/
+
+
+#pragma once
+
+#include <Windows.h>
+#include <stdint.h>
+
+
+// A delta rebuilds a file from an older version of it; a header identifying the version it was made against is followed
+// by operations that either copy a run of bytes from that version or insert bytes carried in the delta itself
+enum
+{
+	DELTA_MAGIC = 'DLTA',		// followed by the base size (uint64_t) and base CRC (uint32_t)
+
+	DELTA_OP_COPY = 'C',		// uint64_t base offset, uint32_t length
+	DELTA_OP_INSERT = 'I',		// uint32_t length, followed by that many bytes
+	DELTA_OP_END = 'E'
+};
+
+// Where a delta comes from when it is applied
+class IDeltaReader
+{
+public:
+	virtual bool Read(void *buf, uint32_t sz) = NULL;
+};
+
+// Writes the delta that turns base into target to hout, matching blocks of base against every offset in target by a rolling
+// hash (as rsync does); returns false as soon as the delta would be max_size bytes or more, since it wouldn't be worth using
+bool FLZACreateDelta(const BYTE *base, uint64_t base_size, const BYTE *target, uint64_t target_size, HANDLE hout, uint64_t max_size, uint64_t *delta_size);
+
+// Reads the header of a delta; the file it is applied to must have this size and CRC
+bool FLZAReadDeltaHeader(IDeltaReader *pdr, uint64_t *base_size, uint32_t *base_crc);
+
+// Applies the operations that follow the header, reading from hbase and writing to hout; crc receives the CRC-32 of the result
+bool FLZAApplyDelta(IDeltaReader *pdr, HANDLE hbase, HANDLE hout, uint32_t *crc);
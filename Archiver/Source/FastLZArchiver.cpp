@@ -11,41 +11,156 @@
 
 #include <Windows.h>
 #include "FastLZArchiver.h"
+#include "BlockCache.h"
+#include "Delta.h"
 #include <Shlwapi.h>
 #include <direct.h>
 #include <filesystem>
+#include <vector>
+#include <algorithm>
 
 #include "fastlz.h"
 
 #pragma warning( disable : 4800 )	// 'BOOL': forcing value to bool 'true' or 'false' (performance warning)
 
-CFastLZArchiver::CFastLZArchiver(IArchiveHandle *pah)
+bool FLZAReadFully(HANDLE hIn, void *buf, DWORD sz)
+{
+	BYTE *p = (BYTE *)buf;
+
+	while (sz)
+	{
+		DWORD br = 0;
+		if (!ReadFile(hIn, p, sz, &br, NULL) || !br)
+			return false;
+
+		p += br;
+		sz -= br;
+	}
+
+	return true;
+}
+
+// Standard (reflected, 0xEDB88320) CRC-32, eight bytes at a time
+uint32_t FLZACrc32(uint32_t crc, const void *buf, size_t len)
+{
+	static const struct sCrcTables
+	{
+		uint32_t t[8][256];
+
+		sCrcTables()
+		{
+			for (uint32_t i = 0; i < 256; i++)
+			{
+				uint32_t c = i;
+				for (int k = 0; k < 8; k++)
+					c = (c & 1) ? (0xEDB88320 ^ (c >> 1)) : (c >> 1);
+
+				t[0][i] = c;
+			}
+
+			for (uint32_t i = 0; i < 256; i++)
+			{
+				for (int s = 1; s < 8; s++)
+					t[s][i] = (t[s - 1][i] >> 8) ^ t[0][t[s - 1][i] & 0xFF];
+			}
+		}
+	} tables;
+
+	const BYTE *p = (const BYTE *)buf;
+
+	crc = ~crc;
+
+	while (len >= 8)
+	{
+		uint32_t lo = crc ^ ((uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24));
+		uint32_t hi = (uint32_t)p[4] | ((uint32_t)p[5] << 8) | ((uint32_t)p[6] << 16) | ((uint32_t)p[7] << 24);
+
+		crc = tables.t[7][lo & 0xFF] ^ tables.t[6][(lo >> 8) & 0xFF] ^ tables.t[5][(lo >> 16) & 0xFF] ^ tables.t[4][lo >> 24] ^
+			tables.t[3][hi & 0xFF] ^ tables.t[2][(hi >> 8) & 0xFF] ^ tables.t[1][(hi >> 16) & 0xFF] ^ tables.t[0][hi >> 24];
+
+		p += 8;
+		len -= 8;
+	}
+
+	while (len--)
+		crc = tables.t[0][(crc ^ *(p++)) & 0xFF] ^ (crc >> 8);
+
+	return ~crc;
+}
+
+// Entries are matched by where they get installed, without regard to case
+static tstring FLZAEntryKey(const SFileTableEntry &fte)
+{
+	tstring ret = fte.m_Path;
+	if (!ret.empty())
+		ret += _T('\\');
+	ret += fte.m_Filename;
+
+	for (tstring::iterator it = ret.begin(), last_it = ret.end(); it != last_it; it++)
+		*it = _totlower(*it);
+
+	return ret;
+}
+
+uint32_t FLZAHashFile(HANDLE hIn)
+{
+	LARGE_INTEGER z;
+	z.QuadPart = 0;
+	SetFilePointerEx(hIn, z, NULL, FILE_BEGIN);
+
+	uint32_t crc = 0;
+
+	BYTE buf[sFileBlock::FB_UNCOMPRESSED_BUFSIZE];
+	DWORD br;
+	while (ReadFile(hIn, buf, sizeof(buf), &br, NULL) && br)
+		crc = FLZACrc32(crc, buf, br);
+
+	SetFilePointerEx(hIn, z, NULL, FILE_BEGIN);
+
+	return crc;
+}
+
+CFastLZArchiver::CFastLZArchiver(IArchiveHandle *pah, uint64_t flags)
 {
 	m_LastFileTableItemCount = 0;
 	m_LastFileTableSize = 0;
 	m_OverallFileCount = 0;
 
+	m_Flags = flags;
+
 	m_MaxSize = -1;
 
+	m_pRefHandle = nullptr;
+	m_pRefExtractor = nullptr;
+
+	m_pCache = nullptr;
+
+	m_pProgress = nullptr;
+	m_FileProgress = 0;
+
 	m_pah = pah;
 	m_InitialOffset = m_pah->GetOffset();
-
-	DWORD bw;
+	m_StreamOffset = m_InitialOffset;
+	m_WriteFailed = false;
 
 	// temporary file table offset
 	uint64_t fto_place_holder = 0;
-	WriteFile(m_pah->GetHandle(), &fto_place_holder, sizeof(uint64_t), &bw, NULL);
+	WriteData(&fto_place_holder, sizeof(uint64_t));
 }
 
 
 CFastLZArchiver::~CFastLZArchiver()
 {
+	IExtractor::DestroyExtractor(&m_pRefExtractor);
+
+	delete m_pCache;
 }
 
 
 void CFastLZArchiver::SetMaximumSize(uint64_t maxsize)
 {
-	m_MaxSize = maxsize;
+	// a delta can't be applied in pieces, so patches aren't spanned
+	m_MaxSize = (m_Flags & AF_PATCH) ? UINT64_MAX : maxsize;
 }
 
 size_t CFastLZArchiver::GetFileCount(IArchiver::INFO_MODE mode)
@@ -100,6 +215,13 @@ CFastLZArchiver::ADD_RESULT CFastLZArchiver::AddFile(const TCHAR *src_filename,
 
 	if (fte.m_Flags & SFileTableEntry::FTEFLAG_DOWNLOAD)
 	{
+		// download references have no data, but a sequential reader still needs to see them
+		if (m_Flags & AF_STREAMING)
+		{
+			WriteLocalHeader(fte);
+			WriteEndOfFileMarker();
+		}
+
 		ret = AR_OK_UNCOMPRESSED;
 	}
 	else
@@ -117,65 +239,116 @@ CFastLZArchiver::ADD_RESULT CFastLZArchiver::AddFile(const TCHAR *src_filename,
 			// store the file time
 			GetFileTime(hin, &(fte.m_FTCreated), NULL, &(fte.m_FTModified));
 
-			SFileBlock b;
+			m_FileProgress = 0;
+
+			bool hashed = false, toolarge = false;
+			const SFileTableEntry *pref = nullptr;
+			HANDLE hdelta = INVALID_HANDLE_VALUE;
+
+			// a patch goes onto an existing install, where an unchanged file needs no data at all and a changed one only what's
+			// different; otherwise, an unchanged file can have its compressed blocks taken from the reference archive as they are
+			if (m_Flags & AF_PATCH)
+				hdelta = PreparePatchEntry(hin, fte, hashed, toolarge);
+			else
+				pref = FindReferenceEntry(hin, fte, hashed);
+
+			bool patched = (fte.m_Flags & (SFileTableEntry::FTEFLAG_UNCHANGED | SFileTableEntry::FTEFLAG_DELTA)) ? true : false;
+
+			// failing that, an earlier build may have compressed the same file already
+			SBlockCacheEntryHeader chdr;
+			HANDLE hcache = (pref || patched) ? INVALID_HANDLE_VALUE : FindCachedEntry(hin, src_filename, fte, hashed, chdr);
 
-			fte.m_Offset = m_pah->GetOffset();
+			SEntryStart start;
+			MarkEntryStart(start);
 
-			// read uncompressed blocks of data from the file
-			while (b.ReadUncompressedData(hin))
+			if (m_Flags & AF_STREAMING)
+				WriteLocalHeader(fte);
+			else
+				fte.m_Offset = m_StreamOffset;
+
+			bool compress = false;
+
+			if (fte.m_Flags & SFileTableEntry::FTEFLAG_UNCHANGED)
+			{
+				ret = AR_OK_UNCHANGED;
+			}
+			else if (fte.m_Flags & SFileTableEntry::FTEFLAG_DELTA)
 			{
-				fte.m_BlockCount++;
+				SFileBlock b;
 
-				// compress and write the data to the archive
-				if (b.CompressData())
+				while (b.ReadUncompressedData(hdelta))
 				{
-					// update the compressed size of the file
-					fte.m_CompressedSize += b.m_Header.m_SizeC;
-				}
-				else
-				{
-					fte.m_CompressedSize += b.m_Header.m_SizeU;
+					b.CompressData();
+					WriteBlock(b, fte);
 				}
 
-				b.WriteCompressedData(m_pah->GetHandle());
+				// the delta was a temporary file that goes away when it's closed
+				CloseHandle(hdelta);
 
-				// spanning logic
-				if ((m_MaxSize != UINT64_MAX) && ((m_pah->GetLength() + (uint64_t)ComputeFileTableSize()) >= m_MaxSize))
-				{
-					// if we're spanning, then we need to add this entry to the file table now and do some cleanup
-					m_FileTable.push_back(fte);
+				ret = AR_OK_DELTA;
+			}
+			else if (pref)
+			{
+				// what's been copied of a reference entry that couldn't be read completely is taken back out, and the file
+				// is compressed as if it had never been found; if that can't be done, the file isn't added at all
+				if (CopyReferenceBlocks(*pref, fte))
+					ret = AR_OK_REUSED;
+				else
+					compress = RewindEntry(start, fte);
+			}
+			else if (hcache != INVALID_HANDLE_VALUE)
+			{
+				bool copied = CopyCachedBlocks(hcache, chdr, fte);
+				m_pCache->CloseEntry(hcache, copied);
 
-					// reset the block count and compressed size (because this should technically be a new data stream)
-					fte.m_BlockCount = 0;
-					fte.m_CompressedSize = 0;
+				// same as above; compressing the file also replaces the entry that couldn't be read
+				if (copied)
+					ret = AR_OK_CACHED;
+				else
+					compress = RewindEntry(start, fte);
+			}
+			else
+			{
+				compress = true;
+			}
 
-					// have the stream handle spanning behind the scenes
-					m_pah->Span();
+			if (compress)
+			{
+				bool caching = m_pCache && m_pCache->BeginEntry(src_filename, fte);
 
-					DWORD bw;
-					uint32_t magic = IArchiver::MAGIC;
-					WriteFile(m_pah->GetHandle(), &magic, sizeof(uint32_t), &bw, NULL);
+				SFileBlock b;
 
-					uint32_t comp_magic = CFastLZArchiver::MAGIC_FASTLZ;
-					WriteFile(m_pah->GetHandle(), &comp_magic, sizeof(uint32_t), &bw, NULL);
+				// read uncompressed blocks of data from the file
+				while (b.ReadUncompressedData(hin))
+				{
+					if (!hashed)
+						fte.m_Crc = FLZACrc32(fte.m_Crc, b.m_BufU, b.m_Header.m_SizeU);
 
-					uint64_t flags = 0;
-					WriteFile(m_pah->GetHandle(), &flags, sizeof(uint64_t), &bw, NULL);
+					// compress and write the data to the archive
+					b.CompressData();
+					WriteBlock(b, fte);
 
-					// after the span, we should expect that offset will be different
-					m_InitialOffset = m_pah->GetOffset();
+					if (caching)
+						m_pCache->AddBlock(b);
+				}
 
-					fte.m_Offset = m_pah->GetOffset();
+				if (caching)
+					m_pCache->EndEntry(fte, true);
 
-					// mark it as spanned so that the next archive can append to, rather than create, the file
-					fte.m_Flags |= SFileTableEntry::FTEFLAG_SPANNED;
-				}
+				if (toolarge)
+					ret = AR_OK_NODELTA;
+				else if (fte.m_CompressedSize >= fte.m_UncompressedSize)
+					ret = AR_OK_UNCOMPRESSED;
+				else
+					ret = AR_OK;
 			}
 
-			if (fte.m_CompressedSize >= fte.m_UncompressedSize)
-				ret = AR_OK_UNCOMPRESSED;
-			else
-				ret = AR_OK;
+			if (m_Flags & AF_STREAMING)
+				WriteEndOfFileMarker();
+
+			// whatever wasn't written a block at a time (copied, delta'd, or not stored at all) is accounted for in one go
+			if (m_FileProgress < fte.m_UncompressedSize)
+				ReportProgress(fte, fte.m_UncompressedSize - m_FileProgress, ((ret == AR_OK_REUSED) || (ret == AR_OK_CACHED) || (ret == AR_OK_DELTA)) ? fte.m_CompressedSize : 0);
 
 			if (sz_comp)
 				*sz_comp = (fte.m_CompressedSize != (uint64_t)-1) ? fte.m_CompressedSize : fte.m_UncompressedSize;
@@ -184,42 +357,588 @@ CFastLZArchiver::ADD_RESULT CFastLZArchiver::AddFile(const TCHAR *src_filename,
 		}
 	}
 
-	if (ret <= AR_OK_UNCOMPRESSED)
+	// offsets recorded after a failed write can't be trusted, so nothing more goes into the file table
+	if (m_WriteFailed)
+		ret = AR_UNKNOWN_ERROR;
+
+	if (ret < AR_SPANFAIL)
 	{
 		// add the file to the file table
 		m_FileTable.push_back( fte );
 
-		m_OverallFileCount++;
+		m_OverallFileCount++;
+	}
+
+	return ret;
+}
+
+
+bool CFastLZArchiver::SetCache(const TCHAR *cache_path, uint64_t max_size)
+{
+	delete m_pCache;
+	m_pCache = nullptr;
+
+	if (!cache_path || !*cache_path)
+		return true;
+
+	// the blocks are only good for another archive that compresses the same way
+	m_pCache = new CBlockCache(cache_path, max_size, MAGIC_FASTLZ, sFileBlock::FB_UNCOMPRESSED_BUFSIZE);
+	if (!m_pCache->IsValid())
+	{
+		delete m_pCache;
+		m_pCache = nullptr;
+
+		return false;
+	}
+
+	return true;
+}
+
+
+void CFastLZArchiver::SetProgress(IArchiveProgress *pprog)
+{
+	m_pProgress = pprog;
+}
+
+
+void CFastLZArchiver::ReportProgress(const SFileTableEntry &fte, uint64_t sz_uncomp, uint64_t sz_comp)
+{
+	sz_uncomp = std::min<uint64_t>(sz_uncomp, fte.m_UncompressedSize - m_FileProgress);
+	m_FileProgress += sz_uncomp;
+
+	if (m_pProgress)
+		m_pProgress->Progress(sz_uncomp, sz_comp);
+}
+
+
+void CFastLZArchiver::GetCacheStats(size_t *hits, size_t *misses)
+{
+	if (hits)
+		*hits = m_pCache ? m_pCache->GetHits() : 0;
+
+	if (misses)
+		*misses = m_pCache ? m_pCache->GetMisses() : 0;
+}
+
+
+bool CFastLZArchiver::SetReferenceArchive(IArchiveHandle *pah)
+{
+	IExtractor::DestroyExtractor(&m_pRefExtractor);
+	m_RefIndex.clear();
+	m_pRefHandle = nullptr;
+
+	if (!pah)
+		return true;
+
+	// like the sfx, find the beginning of the archive from the initial offset at the very end
+	uint64_t arcofs = 0;
+	LARGE_INTEGER p;
+	p.QuadPart = -(LONGLONG)sizeof(uint64_t);
+	SetFilePointerEx(pah->GetHandle(), p, NULL, FILE_END);
+	if (!FLZAReadFully(pah->GetHandle(), &arcofs, sizeof(uint64_t)))
+		return false;
+
+	p.QuadPart = arcofs;
+	SetFilePointerEx(pah->GetHandle(), p, NULL, FILE_BEGIN);
+
+	if (IExtractor::CreateExtractor(&m_pRefExtractor, pah) != IExtractor::CR_OK)
+	{
+		IExtractor::DestroyExtractor(&m_pRefExtractor);
+		return false;
+	}
+
+	CFastLZExtractor *pe = dynamic_cast<CFastLZExtractor *>(m_pRefExtractor);
+	if (!pe)
+	{
+		IExtractor::DestroyExtractor(&m_pRefExtractor);
+		return false;
+	}
+
+	m_pRefHandle = pah;
+
+	for (size_t i = 0, maxi = pe->GetFileCount(); i < maxi; i++)
+	{
+		const SFileTableEntry *pfte = pe->GetFileTableEntry(i);
+
+		// pieces of spanned files aren't complete in any one archive, download references have nothing to copy, and a
+		// patch's entries don't hold the files themselves
+		if (pfte->m_Flags & (SFileTableEntry::FTEFLAG_SPANNED | SFileTableEntry::FTEFLAG_DOWNLOAD | SFileTableEntry::FTEFLAG_UNCHANGED | SFileTableEntry::FTEFLAG_DELTA))
+			continue;
+
+		m_RefIndex[FLZAEntryKey(*pfte)] = i;
+	}
+
+	return true;
+}
+
+
+CFastLZArchiver::FINALIZE_RESULT CFastLZArchiver::Finalize()
+{
+	// a sequential reader will find this where it would otherwise expect another local header
+	if (m_Flags & AF_STREAMING)
+	{
+		uint32_t magic = MAGIC_INDEX;
+		WriteData(&magic, sizeof(uint32_t));
+	}
+
+	// store the file position before writing the file table
+	uint64_t file_table_ofs = m_StreamOffset;
+
+	// write and clear the file table
+	WriteFileTable();
+	ClearFileTable();
+
+	if (m_Flags & AF_TRAILER)
+	{
+		// nothing goes back into the header; the file table offset sits right in front of the initial offset instead
+		WriteData(&file_table_ofs, sizeof(file_table_ofs));
+	}
+	else
+	{
+		LARGE_INTEGER iofs;
+		iofs.QuadPart = m_InitialOffset;
+		SetFilePointerEx(m_pah->GetHandle(), iofs, NULL, FILE_BEGIN);
+
+		// write the offset of the file table from the beginning of the stream
+		DWORD bw = 0;
+		if (!WriteFile(m_pah->GetHandle(), &file_table_ofs, sizeof(file_table_ofs), &bw, NULL) || (bw != sizeof(file_table_ofs)))
+			m_WriteFailed = true;
+
+		SetFilePointer(m_pah->GetHandle(), 0, NULL, FILE_END);
+	}
+
+	// store the initial offset in the stream (file header)
+	m_InitialOffset -= (sizeof(uint32_t) + sizeof(uint32_t) + sizeof(uint64_t));
+	WriteData(&m_InitialOffset, sizeof(m_InitialOffset));
+
+	return m_WriteFailed ? FR_UNKNOWN_ERROR : FR_OK;
+}
+
+
+bool CFastLZArchiver::WriteData(const void *buf, DWORD sz)
+{
+	DWORD bw = 0;
+	bool ret = WriteFile(m_pah->GetHandle(), buf, sz, &bw, NULL) && (bw == sz);
+
+	m_StreamOffset += bw;
+
+	if (!ret)
+		m_WriteFailed = true;
+
+	return ret;
+}
+
+
+void CFastLZArchiver::WriteLocalHeader(SFileTableEntry &fte)
+{
+	// the file's data immediately follows the header; sizes and block counts aren't known yet, so only the trailing index has those
+	fte.m_Offset = m_StreamOffset + sizeof(uint32_t) + fte.Size();
+
+	uint32_t magic = MAGIC_LOCALHEADER;
+	WriteData(&magic, sizeof(uint32_t));
+
+	// the entry is written a field at a time, so there's no counting how much of it got out if it fails; it doesn't matter,
+	// since nothing after it will be used
+	if (fte.Write(m_pah->GetHandle()))
+		m_StreamOffset += fte.Size();
+	else
+		m_WriteFailed = true;
+}
+
+
+void CFastLZArchiver::WriteEndOfFileMarker()
+{
+	sFileBlock::sFileBlockHeader eof;
+	eof.m_Flags = sFileBlock::sFileBlockHeader::FBHFLAG_ENDOFFILE;
+
+	WriteData(&eof, sizeof(sFileBlock::sFileBlockHeader));
+}
+
+
+void CFastLZArchiver::WriteBlock(SFileBlock &b, SFileTableEntry &fte)
+{
+	fte.m_BlockCount++;
+
+	// update the compressed size of the file
+	uint32_t datasize = (b.m_Header.m_SizeC == (uint32_t)-1) ? b.m_Header.m_SizeU : b.m_Header.m_SizeC;
+	fte.m_CompressedSize += datasize;
+
+	WriteData(&b.m_Header, sizeof(sFileBlock::sFileBlockHeader));
+	WriteData((b.m_Header.m_SizeC == (uint32_t)-1) ? b.m_BufU : b.m_BufC, datasize);
+
+	// a delta's blocks don't correspond to any part of the file, so those are reported when the file is done
+	if (!(fte.m_Flags & SFileTableEntry::FTEFLAG_DELTA))
+		ReportProgress(fte, b.m_Header.m_SizeU, datasize);
+
+	// spanning logic; we only ever append, so the stream offset is the length of the span
+	if ((m_MaxSize != UINT64_MAX) && ((m_StreamOffset + (uint64_t)ComputeFileTableSize()) >= m_MaxSize))
+	{
+		// if we're spanning, then we need to add this entry to the file table now and do some cleanup
+		m_FileTable.push_back(fte);
+
+		// reset the block count and compressed size (because this should technically be a new data stream)
+		fte.m_BlockCount = 0;
+		fte.m_CompressedSize = 0;
+
+		// the piece of the file in this span ends here, as far as a sequential reader is concerned
+		if (m_Flags & AF_STREAMING)
+			WriteEndOfFileMarker();
+
+		// have the stream handle spanning behind the scenes; if it can't, the rest of the file has nowhere to go
+		if (!m_pah->Span())
+			m_WriteFailed = true;
+
+		// after the span, we should expect that offset will be different
+		m_StreamOffset = m_pah->GetOffset();
+
+		uint32_t magic = IArchiver::MAGIC;
+		WriteData(&magic, sizeof(uint32_t));
+
+		uint32_t comp_magic = CFastLZArchiver::MAGIC_FASTLZ;
+		WriteData(&comp_magic, sizeof(uint32_t));
+
+		WriteData(&m_Flags, sizeof(uint64_t));
+
+		m_InitialOffset = m_StreamOffset;
+
+		// every span carries its own file table offset place holder
+		uint64_t fto_place_holder = 0;
+		WriteData(&fto_place_holder, sizeof(uint64_t));
+
+		// mark it as spanned so that the next archive can append to, rather than create, the file
+		fte.m_Flags |= SFileTableEntry::FTEFLAG_SPANNED;
+
+		if (m_Flags & AF_STREAMING)
+			WriteLocalHeader(fte);
+		else
+			fte.m_Offset = m_StreamOffset;
+	}
+}
+
+
+void CFastLZArchiver::MarkEntryStart(SEntryStart &start)
+{
+	start.m_StreamOffset = m_StreamOffset;
+	start.m_TableSize = m_FileTable.size();
+
+	LARGE_INTEGER z;
+	z.QuadPart = 0;
+	start.m_Valid = (GetFileType(m_pah->GetHandle()) == FILE_TYPE_DISK) && SetFilePointerEx(m_pah->GetHandle(), z, &start.m_FilePos, FILE_CURRENT);
+}
+
+
+bool CFastLZArchiver::RewindEntry(const SEntryStart &start, SFileTableEntry &fte)
+{
+	// once a piece of the entry has gone into the file table, a span has closed off what came before; and whatever kept a
+	// write from going through would most likely do it again
+	if (!start.m_Valid || (m_FileTable.size() != start.m_TableSize) || m_WriteFailed)
+		return false;
+
+	if (!SetFilePointerEx(m_pah->GetHandle(), start.m_FilePos, NULL, FILE_BEGIN) || !SetEndOfFile(m_pah->GetHandle()))
+		return false;
+
+	m_StreamOffset = start.m_StreamOffset;
+
+	fte.m_BlockCount = 0;
+	fte.m_CompressedSize = 0;
+
+	if (m_Flags & AF_STREAMING)
+		WriteLocalHeader(fte);
+	else
+		fte.m_Offset = m_StreamOffset;
+
+	return true;
+}
+
+
+const SFileTableEntry *CFastLZArchiver::FindReferenceEntry(HANDLE hin, SFileTableEntry &fte, bool &hashed)
+{
+	hashed = false;
+
+	if (!m_pRefExtractor)
+		return nullptr;
+
+	TReferenceIndex::const_iterator it = m_RefIndex.find(FLZAEntryKey(fte));
+	if (it == m_RefIndex.end())
+		return nullptr;
+
+	const SFileTableEntry *pref = ((CFastLZExtractor *)m_pRefExtractor)->GetFileTableEntry(it->second);
+
+	// size and time are free to check; only a file that passes those is worth reading to hash
+	if ((pref->m_UncompressedSize != fte.m_UncompressedSize) || CompareFileTime(&pref->m_FTModified, &fte.m_FTModified))
+		return nullptr;
+
+	// archives built before the hash was recorded have zeroes there; a non-empty file can't be trusted against that
+	if (!pref->m_Crc && pref->m_UncompressedSize)
+		return nullptr;
+
+	fte.m_Crc = FLZAHashFile(hin);
+	hashed = true;
+
+	if ((pref->m_Crc != fte.m_Crc) || !ValidateReferenceBlocks(*pref))
+		return nullptr;
+
+	return pref;
+}
+
+
+HANDLE CFastLZArchiver::FindCachedEntry(HANDLE hin, const TCHAR *src_filename, SFileTableEntry &fte, bool &hashed, SBlockCacheEntryHeader &hdr)
+{
+	if (!m_pCache)
+		return INVALID_HANDLE_VALUE;
+
+	HANDLE h = m_pCache->OpenEntry(src_filename, fte, hdr);
+	if (h == INVALID_HANDLE_VALUE)
+		return h;
+
+	// the size and time matched; only now is it worth reading the file
+	if (!hashed)
+	{
+		fte.m_Crc = FLZAHashFile(hin);
+		hashed = true;
+	}
+
+	if ((hdr.m_Crc != fte.m_Crc) || !ValidateCachedBlocks(h, hdr))
+	{
+		m_pCache->CloseEntry(h, false);
+		return INVALID_HANDLE_VALUE;
+	}
+
+	return h;
+}
+
+
+bool CFastLZArchiver::ValidateCachedBlocks(HANDLE hcache, const SBlockCacheEntryHeader &hdr)
+{
+	LARGE_INTEGER start, z;
+	z.QuadPart = 0;
+	if (!SetFilePointerEx(hcache, z, &start, FILE_CURRENT))
+		return false;
+
+	// the cache lives outside of the build and anything can happen to it, so the blocks are decompressed and hashed before
+	// any of them go into the archive; that's still far cheaper than compressing the file again
+	SFileBlock b;
+	uint64_t total = 0, compressed = 0;
+	uint32_t crc = 0;
+	for (uint32_t i = 0; i < hdr.m_BlockCount; i++)
+	{
+		if (!FLZAReadFully(hcache, &b.m_Header, sizeof(sFileBlock::sFileBlockHeader)) || b.m_Header.m_Flags ||
+			(b.m_Header.m_SizeU > sFileBlock::FB_UNCOMPRESSED_BUFSIZE))
+			return false;
+
+		uint32_t sizeu = b.m_Header.m_SizeU;
+		if (b.m_Header.m_SizeC == (uint32_t)-1)
+		{
+			if (!FLZAReadFully(hcache, b.m_BufU, sizeu))
+				return false;
+
+			compressed += sizeu;
+		}
+		else
+		{
+			if ((b.m_Header.m_SizeC > sFileBlock::FB_COMPRESSED_BUFSIZE) || !FLZAReadFully(hcache, b.m_BufC, b.m_Header.m_SizeC))
+				return false;
+
+			compressed += b.m_Header.m_SizeC;
+
+			b.DecompressData();
+			if (b.m_Header.m_SizeU != sizeu)
+				return false;
+		}
+
+		crc = FLZACrc32(crc, b.m_BufU, sizeu);
+		total += sizeu;
+	}
+
+	uint64_t data = compressed + ((uint64_t)hdr.m_BlockCount * sizeof(sFileBlock::sFileBlockHeader));
+	if ((total != hdr.m_UncompressedSize) || (compressed != hdr.m_CompressedSize) || (data != hdr.m_DataSize) || (crc != hdr.m_Crc))
+		return false;
+
+	return SetFilePointerEx(hcache, start, NULL, FILE_BEGIN) ? true : false;
+}
+
+
+bool CFastLZArchiver::CopyCachedBlocks(HANDLE hcache, const SBlockCacheEntryHeader &hdr, SFileTableEntry &fte)
+{
+	// if the whole stream fits in this span, it can go across in large pieces without looking at the blocks at all
+	if ((m_MaxSize == UINT64_MAX) || ((m_StreamOffset + hdr.m_DataSize + (uint64_t)ComputeFileTableSize() + (uint64_t)fte.Size()) < m_MaxSize))
+	{
+		const DWORD maxcopy = 4 * (1 << 20);
+		std::vector<BYTE> buf((size_t)std::min<uint64_t>(hdr.m_DataSize, maxcopy));
+
+		for (uint64_t remaining = hdr.m_DataSize; remaining > 0; )
+		{
+			DWORD sz = (DWORD)std::min<uint64_t>(remaining, maxcopy);
+			if (!FLZAReadFully(hcache, buf.data(), sz) || !WriteData(buf.data(), sz))
+				return false;
+
+			remaining -= sz;
+		}
+
+		fte.m_BlockCount += hdr.m_BlockCount;
+		fte.m_CompressedSize += hdr.m_CompressedSize;
+
+		return true;
+	}
+
+	// otherwise it has to be split where the span ends, so it goes a block at a time
+	SFileBlock b;
+	for (uint32_t i = 0; i < hdr.m_BlockCount; i++)
+	{
+		if (!b.ReadCompressedData(hcache))
+			return false;
+
+		WriteBlock(b, fte);
+	}
+
+	return true;
+}
+
+
+HANDLE CFastLZArchiver::PreparePatchEntry(HANDLE hin, SFileTableEntry &fte, bool &hashed, bool &toolarge)
+{
+	toolarge = false;
+
+	if (!m_pRefExtractor)
+		return INVALID_HANDLE_VALUE;
+
+	// a file that isn't in the reference archive is new, and is compressed as usual
+	TReferenceIndex::const_iterator it = m_RefIndex.find(FLZAEntryKey(fte));
+	if (it == m_RefIndex.end())
+		return INVALID_HANDLE_VALUE;
+
+	const SFileTableEntry *pref = ((CFastLZExtractor *)m_pRefExtractor)->GetFileTableEntry(it->second);
+
+	// the installed copy is what gets compared, and its modification time will be whatever the install gave it
+	fte.m_Crc = FLZAHashFile(hin);
+	hashed = true;
+
+	if ((pref->m_UncompressedSize == fte.m_UncompressedSize) && (pref->m_Crc == fte.m_Crc) && (pref->m_Crc || !pref->m_UncompressedSize))
+	{
+		fte.m_Flags |= SFileTableEntry::FTEFLAG_UNCHANGED;
+		return INVALID_HANDLE_VALUE;
+	}
+
+	if (!pref->m_UncompressedSize || !fte.m_UncompressedSize || !ValidateReferenceBlocks(*pref))
+		return INVALID_HANDLE_VALUE;
+
+	// rather than have a mapping fail part way in, a file that's this big is stored whole and the caller is told why
+	if ((pref->m_UncompressedSize + fte.m_UncompressedSize) > ((uint64_t)MAX_DELTA_MAPPING_MB << 20))
+	{
+		toolarge = true;
+		return INVALID_HANDLE_VALUE;
+	}
+
+	// the old version has to be decompressed in full to find what it has in common with the new one
+	TCHAR temppath[MAX_PATH], basefile[MAX_PATH], deltafile[MAX_PATH];
+	GetTempPath(MAX_PATH, temppath);
+	GetTempFileName(temppath, _T("flz"), 0, basefile);
+	GetTempFileName(temppath, _T("flz"), 0, deltafile);
+
+	HANDLE hdelta = INVALID_HANDLE_VALUE;
+
+	if (m_pRefExtractor->ExtractFile(it->second, nullptr, basefile) == IExtractor::ER_OK)
+	{
+		HANDLE hbase = CreateFile(basefile, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		HANDLE hbasemap = (hbase != INVALID_HANDLE_VALUE) ? CreateFileMapping(hbase, NULL, PAGE_READONLY, 0, 0, NULL) : NULL;
+		HANDLE hinmap = CreateFileMapping(hin, NULL, PAGE_READONLY, 0, 0, NULL);
+
+		const BYTE *base = hbasemap ? (const BYTE *)MapViewOfFile(hbasemap, FILE_MAP_READ, 0, 0, 0) : nullptr;
+		const BYTE *target = hinmap ? (const BYTE *)MapViewOfFile(hinmap, FILE_MAP_READ, 0, 0, 0) : nullptr;
+
+		if (base && target)
+		{
+			hdelta = CreateFile(deltafile, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, NULL);
+
+			// a delta that isn't even smaller than the file itself isn't worth applying
+			if ((hdelta != INVALID_HANDLE_VALUE) && FLZACreateDelta(base, pref->m_UncompressedSize, target, fte.m_UncompressedSize, hdelta, fte.m_UncompressedSize, nullptr))
+			{
+				LARGE_INTEGER z;
+				z.QuadPart = 0;
+				SetFilePointerEx(hdelta, z, NULL, FILE_BEGIN);
+
+				fte.m_Flags |= SFileTableEntry::FTEFLAG_DELTA;
+			}
+			else if (hdelta != INVALID_HANDLE_VALUE)
+			{
+				CloseHandle(hdelta);
+				hdelta = INVALID_HANDLE_VALUE;
+			}
+		}
+
+		if (target)
+			UnmapViewOfFile(target);
+
+		if (base)
+			UnmapViewOfFile(base);
+
+		if (hinmap)
+			CloseHandle(hinmap);
+
+		if (hbasemap)
+			CloseHandle(hbasemap);
+
+		if (hbase != INVALID_HANDLE_VALUE)
+			CloseHandle(hbase);
+	}
+
+	DeleteFile(basefile);
+
+	if (hdelta == INVALID_HANDLE_VALUE)
+		DeleteFile(deltafile);
+
+	return hdelta;
+}
+
+
+bool CFastLZArchiver::ValidateReferenceBlocks(const SFileTableEntry &ref)
+{
+	HANDLE h = m_pRefHandle->GetHandle();
+
+	LARGE_INTEGER p;
+	p.QuadPart = ref.m_Offset;
+	if (!SetFilePointerEx(h, p, NULL, FILE_BEGIN))
+		return false;
+
+	// an entry that was cut off by the end of its span (and continues in the next one) has fewer blocks than its size calls for
+	uint64_t total = 0;
+	for (uint32_t i = 0; i < ref.m_BlockCount; i++)
+	{
+		sFileBlock::sFileBlockHeader hdr;
+		if (!FLZAReadFully(h, &hdr, sizeof(sFileBlock::sFileBlockHeader)) || hdr.m_Flags)
+			return false;
+
+		total += hdr.m_SizeU;
+
+		p.QuadPart = (hdr.m_SizeC == (uint32_t)-1) ? hdr.m_SizeU : hdr.m_SizeC;
+		if (!SetFilePointerEx(h, p, NULL, FILE_CURRENT))
+			return false;
 	}
 
-	return ret;
+	return (total == ref.m_UncompressedSize);
 }
 
 
-CFastLZArchiver::FINALIZE_RESULT CFastLZArchiver::Finalize()
+bool CFastLZArchiver::CopyReferenceBlocks(const SFileTableEntry &ref, SFileTableEntry &fte)
 {
-	// store the file position before writing the file table
-	uint64_t file_table_ofs = m_pah->GetOffset();
-
-	// write and clear the file table
-	WriteFileTable();
-	ClearFileTable();
+	HANDLE h = m_pRefHandle->GetHandle();
 
-	DWORD bw;
+	LARGE_INTEGER p;
+	p.QuadPart = ref.m_Offset;
+	SetFilePointerEx(h, p, NULL, FILE_BEGIN);
 
-	LARGE_INTEGER iofs;
-	iofs.QuadPart = m_InitialOffset;
-	SetFilePointerEx(m_pah->GetHandle(), iofs, NULL, FILE_BEGIN);
+	SFileBlock b;
 
-	// write the offset of the file table from the beginning of the stream
-	WriteFile(m_pah->GetHandle(), &file_table_ofs, sizeof(file_table_ofs), &bw, NULL);
+	// the blocks go through the same path as freshly compressed ones, so spanning still works
+	for (uint32_t i = 0; i < ref.m_BlockCount; i++)
+	{
+		if (!b.ReadCompressedData(h))
+			return false;
 
-	// store the initial offset in the stream (file header)
-	m_InitialOffset -= (sizeof(uint32_t) + sizeof(uint32_t) + sizeof(uint64_t));
-	SetFilePointer(m_pah->GetHandle(), 0, NULL, FILE_END);
-	WriteFile(m_pah->GetHandle(), &m_InitialOffset, sizeof(m_InitialOffset), &bw, NULL);
+		WriteBlock(b, fte);
+	}
 
-	return FR_OK;
+	return true;
 }
 
 
@@ -250,16 +969,23 @@ size_t CFastLZArchiver::ComputeFileTableSize()
 bool CFastLZArchiver::WriteFileTable()
 {
 	bool ret = true;
-	DWORD bw;
 
 	// store the number of entries in the file table
 	size_t ftec = m_FileTable.size();
-	ret &= (bool)WriteFile(m_pah->GetHandle(), &ftec, sizeof(size_t), &bw, NULL);
+	ret &= WriteData(&ftec, sizeof(size_t));
 
 	for (TFileTable::const_iterator it = m_FileTable.begin(), last_it = m_FileTable.end(); it != last_it; it++)
 	{
 		// write each entry in the file table
-		ret &= it->Write(m_pah->GetHandle());
+		if (it->Write(m_pah->GetHandle()))
+		{
+			m_StreamOffset += it->Size();
+		}
+		else
+		{
+			m_WriteFailed = true;
+			ret = false;
+		}
 	}
 
 	return ret;
@@ -323,47 +1049,46 @@ bool sFileTableEntry::Read(HANDLE hIn)
 	bool ret = true;
 
 	uint32_t sz;
-	DWORD rb;
 
-	ret &= (bool)ReadFile(hIn, &m_Flags, sizeof(m_Flags), &rb, NULL);
+	ret &= FLZAReadFully(hIn, &m_Flags, sizeof(m_Flags));
 
-	ret &= (bool)ReadFile(hIn, &sz, sizeof(sz), &rb, NULL);
+	ret &= FLZAReadFully(hIn, &sz, sizeof(sz));
 	if (sz)
 	{
 		m_Filename.resize(sz, _T('#'));
-		ret &= (bool)ReadFile(hIn, (TCHAR *)(m_Filename.data()), sizeof(TCHAR) * sz, &rb, NULL);
+		ret &= FLZAReadFully(hIn, (TCHAR *)(m_Filename.data()), sizeof(TCHAR) * sz);
 	}
 	else
 	{
 		m_Filename.clear();
 	}
 
-	ret &= (bool)ReadFile(hIn, &sz, sizeof(sz), &rb, NULL);
+	ret &= FLZAReadFully(hIn, &sz, sizeof(sz));
 	if (sz)
 	{
 		m_Path.resize(sz, _T('#'));
-		ret &= (bool)ReadFile(hIn, (TCHAR *)(m_Path.data()), sizeof(TCHAR) * sz, &rb, NULL);
+		ret &= FLZAReadFully(hIn, (TCHAR *)(m_Path.data()), sizeof(TCHAR) * sz);
 	}
 	else
 	{
 		m_Path.clear();
 	}
 
-	ret &= (bool)ReadFile(hIn, &m_UncompressedSize, sizeof(m_UncompressedSize), &rb, NULL);
-	ret &= (bool)ReadFile(hIn, &m_CompressedSize, sizeof(m_CompressedSize), &rb, NULL);
-	ret &= (bool)ReadFile(hIn, &m_Crc, sizeof(m_Crc), &rb, NULL);
+	ret &= FLZAReadFully(hIn, &m_UncompressedSize, sizeof(m_UncompressedSize));
+	ret &= FLZAReadFully(hIn, &m_CompressedSize, sizeof(m_CompressedSize));
+	ret &= FLZAReadFully(hIn, &m_Crc, sizeof(m_Crc));
 
-	ret &= (bool)ReadFile(hIn, &m_FTCreated, sizeof(m_FTCreated), &rb, NULL);
-	ret &= (bool)ReadFile(hIn, &m_FTModified, sizeof(m_FTModified), &rb, NULL);
+	ret &= FLZAReadFully(hIn, &m_FTCreated, sizeof(m_FTCreated));
+	ret &= FLZAReadFully(hIn, &m_FTModified, sizeof(m_FTModified));
 
-	ret &= (bool)ReadFile(hIn, &m_BlockCount, sizeof(m_BlockCount), &rb, NULL);
-	ret &= (bool)ReadFile(hIn, &m_Offset, sizeof(m_Offset), &rb, NULL);
+	ret &= FLZAReadFully(hIn, &m_BlockCount, sizeof(m_BlockCount));
+	ret &= FLZAReadFully(hIn, &m_Offset, sizeof(m_Offset));
 
-	ret &= (bool)ReadFile(hIn, &sz, sizeof(sz), &rb, NULL);
+	ret &= FLZAReadFully(hIn, &sz, sizeof(sz));
 	if (sz)
 	{
 		m_ScriptSnippet.resize(sz, _T('#'));
-		ret &= (bool)ReadFile(hIn, (TCHAR *)(m_ScriptSnippet.data()), sizeof(TCHAR) * sz, &rb, NULL);
+		ret &= FLZAReadFully(hIn, (TCHAR *)(m_ScriptSnippet.data()), sizeof(TCHAR) * sz);
 	}
 	else
 	{
@@ -429,19 +1154,18 @@ bool sFileBlock::CompressData()
 
 bool sFileBlock::ReadCompressedData(HANDLE hIn)
 {
-	DWORD br;
-	if (ReadFile(hIn, &m_Header, sizeof(sFileBlock::sFileBlockHeader), &br, NULL))
+	if (FLZAReadFully(hIn, &m_Header, sizeof(sFileBlock::sFileBlockHeader)))
 	{
 		if (m_Header.m_SizeC == (uint32_t)-1)
 		{
-			if (ReadFile(hIn, m_BufU, m_Header.m_SizeU, &br, NULL))
+			if (FLZAReadFully(hIn, m_BufU, m_Header.m_SizeU))
 			{
 				return true;
 			}
 		}
 		else
 		{
-			if (ReadFile(hIn, m_BufC, m_Header.m_SizeC, &br, NULL))
+			if (FLZAReadFully(hIn, m_BufC, m_Header.m_SizeC))
 			{
 				return true;
 			}
@@ -503,9 +1227,18 @@ bool sFileBlock::WriteUncompressedData(HANDLE hOut)
 }
 
 
-CFastLZExtractor::CFastLZExtractor(IArchiveHandle *pah, UINT64 flags)
+CFastLZExtractor::CFastLZExtractor(IArchiveHandle *pah, UINT64 flags, EXTRACT_MODE mode)
 {
 	m_pah = pah;
+	m_Flags = flags;
+	m_Mode = mode;
+	m_UpdateMode = UM_OVERWRITE;
+	m_PendingBlocks = false;
+	m_EndOfStream = false;
+	m_CachedFilePosition = 0;
+	m_ExpansionGeneration = -1;
+
+	_tgetcwd(m_BasePath, MAX_PATH);
 
 	DWORD br;
 	LARGE_INTEGER p;
@@ -513,8 +1246,20 @@ CFastLZExtractor::CFastLZExtractor(IArchiveHandle *pah, UINT64 flags)
 	uint64_t ftofs;
 	ReadFile(m_pah->GetHandle(), &ftofs, sizeof(uint64_t), &br, NULL);
 
+	// the file table is built up from the local headers as we go
+	if (m_Mode == EM_SEQUENTIAL)
+		return;
+
 	uint64_t dataofs = m_pah->GetOffset();
 
+	// the header only has a place holder; the real offset was written just before the initial offset, at the very end
+	if (m_Flags & IArchiver::AF_TRAILER)
+	{
+		p.QuadPart = -(LONGLONG)(sizeof(uint64_t) + sizeof(uint64_t));
+		SetFilePointerEx(m_pah->GetHandle(), p, NULL, FILE_END);
+		ReadFile(m_pah->GetHandle(), &ftofs, sizeof(uint64_t), &br, NULL);
+	}
+
 	p.QuadPart = ftofs;
 	SetFilePointerEx(m_pah->GetHandle(), p, NULL, FILE_BEGIN);
 
@@ -524,8 +1269,6 @@ CFastLZExtractor::CFastLZExtractor(IArchiveHandle *pah, UINT64 flags)
 	SetFilePointerEx(m_pah->GetHandle(), p, NULL, FILE_BEGIN);
 
 	m_CachedFilePosition = m_pah->GetOffset();
-
-	_tgetcwd(m_BasePath, MAX_PATH);
 }
 
 
@@ -690,8 +1433,49 @@ bool ReplaceRegistryKeys(const tstring &src, tstring &dst)
 	return true;
 }
 
-bool CFastLZExtractor::GetFileInfo(size_t file_idx, tstring *filename, tstring *filepath, uint64_t *csize, uint64_t *usize, FILETIME *ctime, FILETIME *mtime, tstring *snippet)
+// bumped whenever something happens that could change what an environment variable or registry key expands to
+static volatile LONG s_ExpansionGeneration = 0;
+
+void FLZAInvalidatePathExpansions()
+{
+	InterlockedIncrement(&s_ExpansionGeneration);
+}
+
+bool CFastLZExtractor::ExpandPath(const tstring &raw, tstring &expanded)
+{
+	// most names have nothing in them to expand and aren't worth remembering
+	if (raw.find_first_of(_T("%@")) == tstring::npos)
+	{
+		expanded = raw;
+		return true;
+	}
+
+	LONG gen = s_ExpansionGeneration;
+	if (gen != m_ExpansionGeneration)
+	{
+		m_Expansions.clear();
+		m_ExpansionGeneration = gen;
+	}
+
+	TExpansionMap::const_iterator it = m_Expansions.find(raw);
+	if (it == m_Expansions.cend())
+	{
+		tstring tmp, val;
+		bool ok = ReplaceEnvironmentVariables(raw, tmp);
+		ReplaceRegistryKeys(tmp, val);
+
+		it = m_Expansions.insert(TExpansionMap::value_type(raw, std::make_pair(val, ok))).first;
+	}
+
+	expanded = it->second.first;
+	return it->second.second;
+}
+
+bool CFastLZExtractor::GetFileInfo(size_t file_idx, tstring *filename, tstring *filepath, uint64_t *csize, uint64_t *usize, FILETIME *ctime, FILETIME *mtime, tstring *snippet, uint32_t *crc)
 {
+	if ((m_Mode == EM_SEQUENTIAL) && (file_idx == m_FileTable.size()))
+		ReadLocalHeader();
+
 	if (file_idx >= m_FileTable.size())
 		return false;
 
@@ -699,20 +1483,14 @@ bool CFastLZExtractor::GetFileInfo(size_t file_idx, tstring *filename, tstring *
 
 	if (filename)
 	{
-		tstring tmp, _tmp;
-		if (!ReplaceEnvironmentVariables(fte.m_Filename, _tmp))
+		if (!ExpandPath(fte.m_Filename, *filename))
 			return false;
-		ReplaceRegistryKeys(_tmp, tmp);
-		*filename = tmp;
 	}
 
 	if (filepath)
 	{
-		tstring tmp, _tmp;
-		if (!ReplaceEnvironmentVariables(fte.m_Path, _tmp))
+		if (!ExpandPath(fte.m_Path, *filepath))
 			return false;
-		ReplaceRegistryKeys(_tmp, tmp);
-		*filepath = tmp;
 	}
 
 	if (csize)
@@ -730,6 +1508,9 @@ bool CFastLZExtractor::GetFileInfo(size_t file_idx, tstring *filename, tstring *
 	if (snippet)
 		*snippet = fte.m_ScriptSnippet;
 
+	if (crc)
+		*crc = fte.m_Crc;
+
 	return true;
 }
 
@@ -764,44 +1545,52 @@ bool FLZACreateDirectories(const TCHAR *dir)
 
 IExtractor::EXTRACT_RESULT CFastLZExtractor::ExtractFile(size_t file_idx, tstring *output_filename, const TCHAR *override_filename, bool test_only)
 {
+	if ((m_Mode == EM_SEQUENTIAL) && (file_idx == m_FileTable.size()))
+		ReadLocalHeader();
+
 	if (file_idx >= m_FileTable.size())
 		return IExtractor::ER_DONE;
 
+	// a forward-only stream can only give us the file whose data is up next
+	if ((m_Mode == EM_SEQUENTIAL) && (!m_PendingBlocks || (file_idx != (m_FileTable.size() - 1))))
+		return IExtractor::ER_UNKNOWN_ERROR;
+
 	IExtractor::EXTRACT_RESULT ret = IExtractor::ER_OK;
 
 	SFileTableEntry &fte = m_FileTable.at(file_idx);
 
 	TCHAR path[MAX_PATH];
 
-	tstring _cvtpath, cvtpath;
-	tstring _cvtfile, cvtfile;
+	tstring cvtpath;
+	tstring cvtfile;
 
 	if (!(fte.m_Flags & SFileTableEntry::FTEFLAG_DOWNLOAD))
 	{
 		// if we're not where we're supposed to be for the file indicated, then we need to move the file pointer
-		if ((m_CachedFilePosition != m_pah->GetOffset()) || (m_CachedFilePosition != fte.m_Offset))
+		if ((m_Mode == EM_RANDOMACCESS) && ((m_CachedFilePosition != m_pah->GetOffset()) || (m_CachedFilePosition != fte.m_Offset)))
 		{
 			LARGE_INTEGER p;
 			p.QuadPart = fte.m_Offset;
 			SetFilePointerEx(m_pah->GetHandle(), p, NULL, FILE_BEGIN);
 		}
 
-		ReplaceEnvironmentVariables(fte.m_Filename, _cvtfile);
-		ReplaceRegistryKeys(_cvtfile, cvtfile);
+		ExpandPath(fte.m_Filename, cvtfile);
 	}
 	else
 	{
 		cvtfile = fte.m_Filename;
 	}
 
-	ReplaceEnvironmentVariables(fte.m_Path, _cvtpath);
-	ReplaceRegistryKeys(_cvtpath, cvtpath);
+	ExpandPath(fte.m_Path, cvtpath);
 
 	if (fte.m_Flags & SFileTableEntry::FTEFLAG_DOWNLOAD)
 	{
 		if (output_filename)
 			*output_filename = cvtpath;
 
+		if (m_PendingBlocks)
+			SkipFileBlocks();
+
 		return IExtractor::ER_MUSTDOWNLOAD;
 	}
 
@@ -826,20 +1615,41 @@ IExtractor::EXTRACT_RESULT CFastLZExtractor::ExtractFile(size_t file_idx, tstrin
 		}
 
 		if (!test_only)
-			if (!FLZACreateDirectories(path))
+		{
+			if (!EnsureDirectory(path))
+			{
+				if (m_PendingBlocks)
+					SkipFileBlocks();
+
 				return IExtractor::ER_UNKNOWN_ERROR;
+			}
+		}
 
 		PathAddBackslash(path);
 		_tcscat_s(path, MAX_PATH, cvtfile.c_str());
 	}
 	else
 	{
-		_tcscat_s(path, MAX_PATH, override_filename);
+		_tcscpy_s(path, MAX_PATH, override_filename);
 	}
 
 	if (output_filename)
 		*output_filename = path;
 
+	// nothing is read for a file that's already there; the next file extracted seeks straight past this one's data
+	if (!test_only && !override_filename && IsUnchanged(fte, path))
+		return IExtractor::ER_UNCHANGED;
+
+	if (fte.m_Flags & (SFileTableEntry::FTEFLAG_UNCHANGED | SFileTableEntry::FTEFLAG_DELTA))
+	{
+		ret = ApplyPatch(fte, path, test_only);
+
+		if (m_Mode == EM_RANDOMACCESS)
+			m_CachedFilePosition = m_pah->GetOffset();
+
+		return ret;
+	}
+
 	bool append = false;
 	// if we're spanned and the file index we want is 0, then we need to append to the file rather than creating a new one
 	if ((fte.m_Flags & SFileTableEntry::FTEFLAG_SPANNED) && (file_idx == 0))
@@ -847,20 +1657,63 @@ IExtractor::EXTRACT_RESULT CFastLZExtractor::ExtractFile(size_t file_idx, tstrin
 
 	HANDLE hf = INVALID_HANDLE_VALUE;
 	if (!test_only)
+	{
 		hf = CreateFile(path, GENERIC_WRITE, FILE_SHARE_READ, NULL, append ? OPEN_EXISTING : CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
 
+		// a directory we made earlier may have been removed out from under us (by a script, say); make it again and try once more
+		if ((hf == INVALID_HANDLE_VALUE) && !override_filename && (GetLastError() == ERROR_PATH_NOT_FOUND))
+		{
+			TCHAR dir[MAX_PATH];
+			_tcscpy_s(dir, path);
+			PathRemoveFileSpec(dir);
+
+			ForgetDirectory(dir);
+			if (EnsureDirectory(dir))
+				hf = CreateFile(path, GENERIC_WRITE, FILE_SHARE_READ, NULL, append ? OPEN_EXISTING : CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+		}
+	}
+
 	if ((hf != INVALID_HANDLE_VALUE) || test_only)
 	{
 		if (append && !test_only)
 			SetFilePointer(hf, 0, NULL, FILE_END);
 
 		SFileBlock b;
-		for (UINT32 i = 0; i < fte.m_BlockCount; i++)
+		if (m_Mode == EM_SEQUENTIAL)
 		{
-			b.ReadCompressedData(m_pah->GetHandle());
-			b.DecompressData();
-			if (!test_only)
-				b.WriteUncompressedData(hf);
+			// the local header's block count isn't valid; the end marker is what terminates the file's data
+			bool ended = false;
+			while (b.ReadCompressedData(m_pah->GetHandle()))
+			{
+				if (b.m_Header.m_Flags & sFileBlock::sFileBlockHeader::FBHFLAG_ENDOFFILE)
+				{
+					ended = true;
+					break;
+				}
+
+				b.DecompressData();
+				if (!test_only)
+					b.WriteUncompressedData(hf);
+			}
+
+			m_PendingBlocks = false;
+
+			// a stream that stops short of the end marker has left the file incomplete, and has nothing more to give
+			if (!ended)
+			{
+				m_EndOfStream = true;
+				ret = IExtractor::ER_UNKNOWN_ERROR;
+			}
+		}
+		else
+		{
+			for (UINT32 i = 0; i < fte.m_BlockCount; i++)
+			{
+				b.ReadCompressedData(m_pah->GetHandle());
+				b.DecompressData();
+				if (!test_only)
+					b.WriteUncompressedData(hf);
+			}
 		}
 
 		if (!test_only)
@@ -872,10 +1725,14 @@ IExtractor::EXTRACT_RESULT CFastLZExtractor::ExtractFile(size_t file_idx, tstrin
 	}
 	else
 	{
+		if (m_PendingBlocks)
+			SkipFileBlocks();
+
 		ret = IExtractor::ER_UNKNOWN_ERROR;
 	}
 
-	m_CachedFilePosition = m_pah->GetOffset();
+	if (m_Mode == EM_RANDOMACCESS)
+		m_CachedFilePosition = m_pah->GetOffset();
 
 	return ret;
 }
@@ -887,6 +1744,137 @@ void CFastLZExtractor::SetBaseOutputPath(const TCHAR *path)
 }
 
 
+void CFastLZExtractor::SetUpdateMode(UPDATE_MODE mode)
+{
+	m_UpdateMode = mode;
+}
+
+
+bool CFastLZExtractor::IsUnchanged(const SFileTableEntry &fte, const TCHAR *path) const
+{
+	if ((m_UpdateMode == UM_OVERWRITE) || (m_Mode != EM_RANDOMACCESS))
+		return false;
+
+	// spanned files are written in pieces, and patch entries already know what they need from the installed file
+	if (fte.m_Flags & (SFileTableEntry::FTEFLAG_SPANNED | SFileTableEntry::FTEFLAG_UNCHANGED | SFileTableEntry::FTEFLAG_DELTA))
+		return false;
+
+	// extracted files are given the archived modification time, so a re-install of the same build matches exactly
+	WIN32_FILE_ATTRIBUTE_DATA fad;
+	if (!GetFileAttributesEx(path, GetFileExInfoStandard, &fad) || (fad.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+		return false;
+
+	if (((((uint64_t)fad.nFileSizeHigh) << 32) | fad.nFileSizeLow) != fte.m_UncompressedSize)
+		return false;
+
+	if (CompareFileTime(&fad.ftLastWriteTime, &fte.m_FTModified))
+		return false;
+
+	if (m_UpdateMode == UM_SKIPVERIFIED)
+	{
+		// archives from before the file table had checksums can't be verified against
+		if (!fte.m_Crc && fte.m_UncompressedSize)
+			return false;
+
+		HANDLE hf = CreateFile(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (hf == INVALID_HANDLE_VALUE)
+			return false;
+
+		bool same = (FLZAHashFile(hf) == fte.m_Crc);
+
+		CloseHandle(hf);
+
+		return same;
+	}
+
+	return true;
+}
+
+
+tstring CFastLZExtractor::DirectoryKey(const TCHAR *dir)
+{
+	tstring key = dir;
+	if (!key.empty())
+		CharLowerBuff(&key[0], (DWORD)key.length());
+
+	return key;
+}
+
+
+bool CFastLZExtractor::EnsureDirectory(const TCHAR *dir)
+{
+	if (!dir || !*dir)
+		return false;
+
+	if (m_EnsuredDirs.find(DirectoryKey(dir)) != m_EnsuredDirs.end())
+		return true;
+
+	TCHAR parent[MAX_PATH];
+	_tcscpy_s(parent, dir);
+	PathRemoveFileSpec(parent);
+
+	bool ret;
+
+	// if the parent's already there, only this level can be missing; otherwise, do it the long way
+	if (*parent && _tcscmp(parent, dir) && (m_EnsuredDirs.find(DirectoryKey(parent)) != m_EnsuredDirs.end()))
+		ret = (CreateDirectory(dir, NULL) || (GetLastError() == ERROR_ALREADY_EXISTS));
+	else
+		ret = FLZACreateDirectories(dir);
+
+	if (!ret)
+		return false;
+
+	// dir and everything above it exist now
+	m_EnsuredDirs.insert(DirectoryKey(dir));
+	while (*parent && !PathIsRoot(parent) && m_EnsuredDirs.insert(DirectoryKey(parent)).second)
+	{
+		TCHAR *end = parent + _tcslen(parent);
+		PathRemoveFileSpec(parent);
+		if ((parent + _tcslen(parent)) == end)
+			break;
+	}
+
+	return true;
+}
+
+
+void CFastLZExtractor::ForgetDirectory(const TCHAR *dir)
+{
+	if (!dir || !*dir)
+		return;
+
+	// whatever took dir away may have taken its parents and children with it
+	tstring under = DirectoryKey(dir);
+	under += _T('\\');
+	for (auto it = m_EnsuredDirs.begin(); it != m_EnsuredDirs.end(); )
+	{
+		if (!it->compare(0, under.length(), under))
+			it = m_EnsuredDirs.erase(it);
+		else
+			++it;
+	}
+
+	TCHAR parent[MAX_PATH];
+	_tcscpy_s(parent, dir);
+	while (*parent && m_EnsuredDirs.erase(DirectoryKey(parent)))
+	{
+		TCHAR *end = parent + _tcslen(parent);
+		PathRemoveFileSpec(parent);
+		if ((parent + _tcslen(parent)) == end)
+			break;
+	}
+}
+
+
+const SFileTableEntry *CFastLZExtractor::GetFileTableEntry(size_t file_idx) const
+{
+	if (file_idx >= m_FileTable.size())
+		return nullptr;
+
+	return &(m_FileTable[file_idx]);
+}
+
+
 bool CFastLZExtractor::ReadFileTable()
 {
 	bool ret = true;
@@ -907,3 +1895,193 @@ bool CFastLZExtractor::ReadFileTable()
 
 	return ret;
 }
+
+
+bool CFastLZExtractor::ReadLocalHeader()
+{
+	if (m_EndOfStream)
+		return false;
+
+	// we can't come back for the previous file's data later, so if it wasn't extracted, pass over it now
+	if (m_PendingBlocks)
+		SkipFileBlocks();
+
+	uint32_t magic;
+	if (!FLZAReadFully(m_pah->GetHandle(), &magic, sizeof(uint32_t)) || (magic != CFastLZArchiver::MAGIC_LOCALHEADER))
+	{
+		// the trailing index (or the end of a truncated stream) follows the last file
+		m_EndOfStream = true;
+		return false;
+	}
+
+	SFileTableEntry fte;
+	if (!fte.Read(m_pah->GetHandle()))
+	{
+		m_EndOfStream = true;
+		return false;
+	}
+
+	m_FileTable.push_back(fte);
+	m_PendingBlocks = true;
+
+	return true;
+}
+
+
+void CFastLZExtractor::SkipFileBlocks()
+{
+	SFileBlock b;
+	while (b.ReadCompressedData(m_pah->GetHandle()) && !(b.m_Header.m_Flags & sFileBlock::sFileBlockHeader::FBHFLAG_ENDOFFILE)) { }
+
+	m_PendingBlocks = false;
+}
+
+
+// Presents the decompressed blocks of one file as a single stream, since delta operations don't line up with blocks
+class CBlockDeltaReader : public IDeltaReader
+{
+protected:
+	HANDLE m_hIn;
+	bool m_Sequential;
+	uint32_t m_BlocksLeft;
+	uint32_t m_Pos;
+	bool m_End;
+	SFileBlock m_Block;
+
+	bool NextBlock()
+	{
+		if (m_End || (!m_Sequential && !m_BlocksLeft) || !m_Block.ReadCompressedData(m_hIn) || (m_Block.m_Header.m_Flags & sFileBlock::sFileBlockHeader::FBHFLAG_ENDOFFILE))
+		{
+			m_End = true;
+			return false;
+		}
+
+		m_BlocksLeft--;
+		m_Block.DecompressData();
+		m_Pos = 0;
+
+		return true;
+	}
+
+public:
+	CBlockDeltaReader(HANDLE hin, bool sequential, uint32_t block_count)
+	{
+		m_hIn = hin;
+		m_Sequential = sequential;
+		m_BlocksLeft = block_count;
+		m_Pos = 0;
+		m_End = false;
+		m_Block.m_Header.m_SizeU = 0;
+	}
+
+	virtual bool Read(void *buf, uint32_t sz)
+	{
+		BYTE *p = (BYTE *)buf;
+
+		while (sz)
+		{
+			if ((m_Pos >= m_Block.m_Header.m_SizeU) && !NextBlock())
+				return false;
+
+			uint32_t n = std::min<uint32_t>(sz, m_Block.m_Header.m_SizeU - m_Pos);
+			memcpy(p, m_Block.m_BufU + m_Pos, n);
+
+			m_Pos += n;
+			p += n;
+			sz -= n;
+		}
+
+		return true;
+	}
+
+	// consumes whatever is left of the file's data, including a sequential stream's end marker
+	void Finish()
+	{
+		while (NextBlock()) { }
+	}
+};
+
+
+IExtractor::EXTRACT_RESULT CFastLZExtractor::ApplyPatch(SFileTableEntry &fte, const TCHAR *path, bool test_only)
+{
+	IExtractor::EXTRACT_RESULT ret = IExtractor::ER_OK;
+
+	if (fte.m_Flags & SFileTableEntry::FTEFLAG_UNCHANGED)
+	{
+		if (m_PendingBlocks)
+			SkipFileBlocks();
+
+		// nothing gets written; the file only has to be there already, and be the same version the patch was built against
+		if (!test_only)
+		{
+			HANDLE hf = CreateFile(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+
+			LARGE_INTEGER fsz;
+			if ((hf == INVALID_HANDLE_VALUE) || !GetFileSizeEx(hf, &fsz) || ((uint64_t)fsz.QuadPart != fte.m_UncompressedSize) || (FLZAHashFile(hf) != fte.m_Crc))
+				ret = IExtractor::ER_PATCHMISMATCH;
+
+			if (hf != INVALID_HANDLE_VALUE)
+				CloseHandle(hf);
+		}
+
+		return ret;
+	}
+
+	CBlockDeltaReader dr(m_pah->GetHandle(), (m_Mode == EM_SEQUENTIAL), fte.m_BlockCount);
+
+	uint64_t base_size;
+	uint32_t base_crc;
+	if (!FLZAReadDeltaHeader(&dr, &base_size, &base_crc))
+	{
+		ret = IExtractor::ER_UNKNOWN_ERROR;
+	}
+	else if (!test_only)
+	{
+		HANDLE hbase = CreateFile(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+
+		// the delta only makes sense applied to the exact version it was made from
+		LARGE_INTEGER bsz;
+		if ((hbase == INVALID_HANDLE_VALUE) || !GetFileSizeEx(hbase, &bsz) || ((uint64_t)bsz.QuadPart != base_size) || (FLZAHashFile(hbase) != base_crc))
+		{
+			ret = IExtractor::ER_PATCHMISMATCH;
+		}
+		else
+		{
+			// the new version is built next to the old one, which is only replaced once the result checks out
+			tstring patched = path;
+			patched += _T(".sfxpatch");
+
+			HANDLE hout = CreateFile(patched.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+
+			uint32_t crc = 0;
+			bool ok = (hout != INVALID_HANDLE_VALUE) && FLZAApplyDelta(&dr, hbase, hout, &crc) && (crc == fte.m_Crc);
+
+			if (hout != INVALID_HANDLE_VALUE)
+			{
+				if (ok)
+					SetFileTime(hout, &(fte.m_FTCreated), NULL, &(fte.m_FTModified));
+
+				CloseHandle(hout);
+			}
+
+			CloseHandle(hbase);
+			hbase = INVALID_HANDLE_VALUE;
+
+			if (!ok || !MoveFileEx(patched.c_str(), path, MOVEFILE_REPLACE_EXISTING))
+			{
+				DeleteFile(patched.c_str());
+				ret = IExtractor::ER_UNKNOWN_ERROR;
+			}
+		}
+
+		if (hbase != INVALID_HANDLE_VALUE)
+			CloseHandle(hbase);
+	}
+
+	dr.Finish();
+
+	if (m_Mode == EM_SEQUENTIAL)
+		m_PendingBlocks = false;
+
+	return ret;
+}
@@ -16,6 +16,9 @@
 #include <tchar.h>
 #include <string>
 #include <deque>
+#include <map>
+#include <unordered_set>
+#include <unordered_map>
 
 
 typedef std::basic_string<TCHAR> tstring;
@@ -26,6 +29,8 @@ struct sFileTableEntry
 	{
 		FTEFLAG_SPANNED		= 0x0000000000000001,		// a spanned file will be partially in multiple files
 		FTEFLAG_DOWNLOAD	= 0x0000000000000002,		// an empty file that is just a download reference
+		FTEFLAG_UNCHANGED	= 0x0000000000000004,		// patch only; no data, the installed file is already this version
+		FTEFLAG_DELTA		= 0x0000000000000008,		// patch only; the data is a delta to apply to the installed file
 	};
 
 	uint64_t m_Flags;
@@ -74,6 +79,11 @@ struct sFileBlock
 
 	struct sFileBlockHeader
 	{
+		enum
+		{
+			FBHFLAG_ENDOFFILE	= 0x0000000000000001,	// carries no data; terminates a file's blocks in a streaming archive
+		};
+
 		sFileBlockHeader() { m_Flags = 0; m_SizeC = m_SizeU = 0; }
 
 		uint64_t m_Flags;							// flags
@@ -95,10 +105,42 @@ struct sFileBlock
 typedef sFileBlock SFileBlock;
 
 
+// Standard (reflected, 0xEDB88320) CRC-32; pass the previous result as crc to continue a running hash, or 0 to start one
+uint32_t FLZACrc32(uint32_t crc, const void *buf, size_t len);
+
+// Reads exactly sz bytes; pipes and other forward-only handles are allowed to return less than was asked for
+bool FLZAReadFully(HANDLE hIn, void *buf, DWORD sz);
+
+// Returns the CRC-32 of a whole file, leaving the file pointer at the beginning
+uint32_t FLZAHashFile(HANDLE hIn);
+
+
+// The header of each file in a build cache; the source path and then the file's block stream follow it
+struct sBlockCacheEntryHeader
+{
+	enum { MAGIC = 'FLZC' };
+
+	uint32_t m_Magic;
+	uint32_t m_Codec;					// the compressor's magic number
+	uint32_t m_Level;					// what the compressor's output depends on besides the data; for FastLZ, the block size
+	uint32_t m_Crc;						// the content hash of the source
+	uint64_t m_UncompressedSize;
+	FILETIME m_FTModified;
+	uint32_t m_BlockCount;
+	uint32_t m_PathLength;				// in TCHARs
+	uint64_t m_CompressedSize;			// the data size of the blocks, as the file table counts it
+	uint64_t m_DataSize;				// the size of the block stream, block headers included
+};
+
+typedef struct sBlockCacheEntryHeader SBlockCacheEntryHeader;
+
+class CBlockCache;
+
+
 class CFastLZArchiver : public IArchiver
 {
 public:
-	CFastLZArchiver(IArchiveHandle *pah);
+	CFastLZArchiver(IArchiveHandle *pah, uint64_t flags);
 
 	virtual ~CFastLZArchiver();
 
@@ -110,12 +152,71 @@ public:
 	// Adds a file to the archive
 	virtual ADD_RESULT AddFile(const TCHAR *src_filename, const TCHAR *dst_filename, uint64_t *sz_uncomp = nullptr, uint64_t *sz_comp = nullptr, const TCHAR *scriptsnippet = nullptr);
 
+	virtual bool SetReferenceArchive(IArchiveHandle *pah);
+
+	virtual bool SetCache(const TCHAR *cache_path, uint64_t max_size);
+
+	virtual void GetCacheStats(size_t *hits, size_t *misses);
+
+	virtual void SetProgress(IArchiveProgress *pprog);
+
 	virtual FINALIZE_RESULT Finalize();
 
 	enum { MAGIC_FASTLZ = 'FSTL' };
 
+	// streaming archives mark what follows so that a sequential reader can tell a file's local header from the trailing index
+	enum { MAGIC_LOCALHEADER = 'LHDR', MAGIC_INDEX = 'INDX' };
+
+	// a delta is made with both versions of a file mapped in whole, so together they have to fit in the address space
+	enum { MAX_DELTA_MAPPING_MB = (sizeof(void *) > 4) ? (64 * 1024) : 768 };
+
 protected:
 
+	// writes to the archive handle and keeps track of where we are in the stream, so that we never have to ask the handle;
+	// the offset only moves by what was actually written, and a failed or short write sets m_WriteFailed
+	bool WriteData(const void *buf, DWORD sz);
+
+	void WriteLocalHeader(SFileTableEntry &fte);
+	void WriteEndOfFileMarker();
+
+	// writes a block that belongs to fte, spanning afterward if the maximum size has been reached
+	void WriteBlock(SFileBlock &b, SFileTableEntry &fte);
+
+	// where an entry's data (or, when streaming, its local header) begins; an entry whose copied blocks turn out to be
+	// bad partway through can be cut back off at this point and compressed from its source instead
+	struct SEntryStart
+	{
+		uint64_t m_StreamOffset;
+		LARGE_INTEGER m_FilePos;
+		size_t m_TableSize;
+		bool m_Valid;			// the archive handle can be seeked and truncated (a pipe can't)
+	};
+
+	void MarkEntryStart(SEntryStart &start);
+
+	// discards everything written for fte since start and begins it again, empty; fails if the handle can't be truncated
+	// or the entry has already been spanned, in which case the archive can't be made right
+	bool RewindEntry(const SEntryStart &start, SFileTableEntry &fte);
+
+	// tells the progress sink about data belonging to the current file, never going past the file's size in total
+	void ReportProgress(const SFileTableEntry &fte, uint64_t sz_uncomp, uint64_t sz_comp);
+
+	// returns the reference archive's entry for fte if the file behind hin is identical to it; if the file had to be hashed
+	// to find out, fte's CRC is filled in and hashed is set
+	const SFileTableEntry *FindReferenceEntry(HANDLE hin, SFileTableEntry &fte, bool &hashed);
+	bool ValidateReferenceBlocks(const SFileTableEntry &ref);
+	bool CopyReferenceBlocks(const SFileTableEntry &ref, SFileTableEntry &fte);
+
+	// for AF_PATCH; flags fte as unchanged if it matches the reference archive's version, or returns a temporary file holding
+	// the delta from that version (and flags it as such) if that's smaller than the file; toolarge is set if a delta wasn't
+	// attempted because the two versions together exceed MAX_DELTA_MAPPING_MB
+	HANDLE PreparePatchEntry(HANDLE hin, SFileTableEntry &fte, bool &hashed, bool &toolarge);
+
+	// same as above, but for the build cache; the returned handle goes back to the cache when the copy is done
+	HANDLE FindCachedEntry(HANDLE hin, const TCHAR *src_filename, SFileTableEntry &fte, bool &hashed, SBlockCacheEntryHeader &hdr);
+	bool ValidateCachedBlocks(HANDLE hcache, const SBlockCacheEntryHeader &hdr);
+	bool CopyCachedBlocks(HANDLE hcache, const SBlockCacheEntryHeader &hdr, SFileTableEntry &fte);
+
 	size_t ComputeFileTableSize();
 	bool WriteFileTable();
 	void ClearFileTable();
@@ -127,35 +228,94 @@ protected:
 
 	IArchiveHandle *m_pah;
 	uint64_t m_InitialOffset;
+	uint64_t m_StreamOffset;
+	uint64_t m_Flags;
+	bool m_WriteFailed;				// something didn't make it into the archive; every file added from then on fails, and so does Finalize
 
 	uint64_t m_MaxSize;
 
+	typedef std::map<tstring, size_t> TReferenceIndex;
+
+	IArchiveHandle *m_pRefHandle;
+	IExtractor *m_pRefExtractor;
+	TReferenceIndex m_RefIndex;		// lower-cased destination path -> index into the reference archive's file table
+
+	CBlockCache *m_pCache;
+
+	IArchiveProgress *m_pProgress;
+	uint64_t m_FileProgress;		// how much of the current file has been reported
+
 };
 
 class CFastLZExtractor : public IExtractor
 {
 public:
-	CFastLZExtractor(IArchiveHandle *pah, UINT64 flags);
+	CFastLZExtractor(IArchiveHandle *pah, UINT64 flags, EXTRACT_MODE mode = EM_RANDOMACCESS);
 
 	virtual ~CFastLZExtractor();
 
 	virtual size_t GetFileCount();
 
-	virtual bool GetFileInfo(size_t file_idx, tstring *filename = NULL, tstring *filepath = NULL, uint64_t *csize = NULL, uint64_t *usize = NULL, FILETIME *ctime = NULL, FILETIME *mtime = NULL, tstring *snippet = NULL);
+	virtual bool GetFileInfo(size_t file_idx, tstring *filename = NULL, tstring *filepath = NULL, uint64_t *csize = NULL, uint64_t *usize = NULL, FILETIME *ctime = NULL, FILETIME *mtime = NULL, tstring *snippet = NULL, uint32_t *crc = NULL);
 
 	virtual EXTRACT_RESULT ExtractFile(size_t file_idx, tstring *output_filename = NULL, const TCHAR *override_filename = NULL, bool test_only = false);
 
 	virtual void SetBaseOutputPath(const TCHAR *path);
 
+	virtual void SetUpdateMode(UPDATE_MODE mode);
+
+	// gives the archiver direct access to a previous build's entries when updating from it
+	const SFileTableEntry *GetFileTableEntry(size_t file_idx) const;
+
 protected:
 
 	bool ReadFileTable();
 
+	// sequential mode only; reads the next file's local header and adds it to the file table
+	bool ReadLocalHeader();
+
+	// sequential mode only; discards the blocks of the file whose local header was last read
+	void SkipFileBlocks();
+
+	// brings the installed file at path up to date from an unchanged or delta entry
+	EXTRACT_RESULT ApplyPatch(SFileTableEntry &fte, const TCHAR *path, bool test_only);
+
+	// returns true if the file at path is already what fte would extract to, according to the update mode
+	bool IsUnchanged(const SFileTableEntry &fte, const TCHAR *path) const;
+
+	// creates dir and any of its parents that don't exist, remembering what's been done so that the next file going to
+	// the same place (or next to it) doesn't have to ask the file system again
+	bool EnsureDirectory(const TCHAR *dir);
+
+	// drops dir, its parents, and anything below it from what EnsureDirectory thinks exists
+	void ForgetDirectory(const TCHAR *dir);
+
+	// the form dir is kept in m_EnsuredDirs; Windows paths are case-insensitive, so it's lower-cased
+	static tstring DirectoryKey(const TCHAR *dir);
+
+	// expands the environment variables and registry keys in a file table name or path, remembering the result so that
+	// the same template doesn't have to be expanded again until a script changes what it could expand to
+	bool ExpandPath(const tstring &raw, tstring &expanded);
+
 	TFileTable m_FileTable;
 	uint64_t m_CachedFilePosition;
 
+	UINT64 m_Flags;
+	EXTRACT_MODE m_Mode;
+	UPDATE_MODE m_UpdateMode;
+	bool m_PendingBlocks;		// the last local header's data hasn't been consumed yet
+	bool m_EndOfStream;			// the trailing index has been reached
+
 	IArchiveHandle *m_pah;
 
 	TCHAR m_BasePath[MAX_PATH];
+
+	// directories known to exist, because this extractor made sure of it; see DirectoryKey
+	std::unordered_set<tstring> m_EnsuredDirs;
+
+	// expanded names and paths, keyed by their raw template; the flag is whether all the environment variables were found
+	typedef std::unordered_map<tstring, std::pair<tstring, bool>> TExpansionMap;
+	TExpansionMap m_Expansions;
+	LONG m_ExpansionGeneration;
 };
 
@@ -0,0 +1,528 @@
+/*
+	Copyright © 2013-2020, Keelan Stuart (hereafter referenced as AUTHOR). All Rights Reserved.
+	Permission to use, copy, modify, and distribute this software is hereby granted, without fee and without a signed licensing agreement,
+	provided that the above copyright notice appears in all copies, modifications, and distributions.
+	Furthermore, AUTHOR assumes no responsibility for any damages caused either directly or indirectly by the use of this software, nor vouches for
+	any fitness of purpose of this software.
+	All other copyrighted material contained herein is noted and rights attributed to individual copyright holders.
+	
+	For inquiries, contact: keelanstuart@gmail.com
+*/
+
+
+#include <Windows.h>
+#include "TarGzArchiver.h"
+#include "FastLZArchiver.h"
+#include "Deflate.h"
+#include <algorithm>
+
+
+#define TAR_BLOCK_SIZE		512
+
+// the seconds between the FILETIME epoch (1601) and the unix one (1970), in 100ns units
+#define FILETIME_UNIX_EPOCH	116444736000000000ULL
+
+
+struct sTarHeader
+{
+	char name[100];
+	char mode[8];
+	char uid[8];
+	char gid[8];
+	char size[12];
+	char mtime[12];
+	char chksum[8];
+	char typeflag;
+	char linkname[100];
+	char magic[6];
+	char version[2];
+	char uname[32];
+	char gname[32];
+	char devmajor[8];
+	char devminor[8];
+	char prefix[155];
+	char pad[12];
+};
+
+
+// Fills a numeric header field with zero-padded octal and a terminating NUL; values too big for that are stored in binary,
+// big-endian, with the high bit of the first byte set (as GNU tar and every modern reader understand)
+static void TarNumber(char *field, size_t width, uint64_t val)
+{
+	if (val < (1ULL << (3 * (width - 1))))
+	{
+		field[width - 1] = '\0';
+		for (size_t i = width - 1; i > 0; i--)
+		{
+			field[i - 1] = (char)('0' + (val & 7));
+			val >>= 3;
+		}
+	}
+	else
+	{
+		for (size_t i = width; i > 1; i--)
+		{
+			field[i - 1] = (char)(val & 0xFF);
+			val >>= 8;
+		}
+
+		field[0] = (char)0x80;
+	}
+}
+
+
+static void TarChecksum(sTarHeader &hdr)
+{
+	memset(hdr.chksum, ' ', sizeof(hdr.chksum));
+
+	uint32_t sum = 0;
+	const BYTE *p = (const BYTE *)&hdr;
+	for (size_t i = 0; i < sizeof(sTarHeader); i++)
+		sum += p[i];
+
+	TarNumber(hdr.chksum, 7, sum);
+	hdr.chksum[7] = ' ';
+}
+
+
+CTarGzArchiver::CTarGzArchiver(IArchiveHandle *pah)
+{
+	m_pah = pah;
+	m_pProgress = nullptr;
+
+	m_FileCount = 0;
+	m_Written = 0;
+	m_WriteFailed = false;
+
+	m_MaxSize = UINT64_MAX;
+	m_VolumeWritten = 0;
+
+	InitializeCriticalSection(&m_QueueLock);
+	m_hQueueSem = CreateSemaphore(NULL, 0, MAXLONG, NULL);
+	m_hQuitEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+	UINT threads = std::min<UINT>(std::max<UINT>(si.dwNumberOfProcessors, 1), 16);
+
+	// twice as many chunks as threads keeps every thread busy while finished members wait to be written in order
+	m_Chunks.resize(threads * 2);
+	for (auto &c : m_Chunks)
+	{
+		c.m_pIn = (BYTE *)malloc(CHUNK_SIZE);
+		c.m_InUsed = 0;
+		c.m_pOut = (BYTE *)malloc(FLZADeflateBound(CHUNK_SIZE) + 18);
+		c.m_OutUsed = 0;
+		c.m_hDone = CreateEvent(NULL, TRUE, FALSE, NULL);
+		c.m_Pending = false;
+	}
+
+	m_Cur = 0;
+
+	for (UINT i = 0; i < threads; i++)
+	{
+		HANDLE ht = CreateThread(NULL, 0, CompressThreadProc, this, 0, NULL);
+		if (ht)
+			m_Threads.push_back(ht);
+	}
+}
+
+
+CTarGzArchiver::~CTarGzArchiver()
+{
+	// anything not yet compressed is abandoned; that only happens if the build was cancelled before Finalize
+	SetEvent(m_hQuitEvent);
+
+	if (!m_Threads.empty())
+		WaitForMultipleObjects((DWORD)m_Threads.size(), m_Threads.data(), TRUE, INFINITE);
+
+	for (auto ht : m_Threads)
+		CloseHandle(ht);
+
+	for (auto &c : m_Chunks)
+	{
+		free(c.m_pIn);
+		free(c.m_pOut);
+		CloseHandle(c.m_hDone);
+	}
+
+	CloseHandle(m_hQuitEvent);
+	CloseHandle(m_hQueueSem);
+	DeleteCriticalSection(&m_QueueLock);
+}
+
+
+void CTarGzArchiver::SetMaximumSize(uint64_t maxsize)
+{
+	m_MaxSize = maxsize ? maxsize : UINT64_MAX;
+}
+
+
+size_t CTarGzArchiver::GetFileCount(INFO_MODE mode)
+{
+	return m_FileCount;
+}
+
+
+bool CTarGzArchiver::SetReferenceArchive(IArchiveHandle *pah)
+{
+	return false;
+}
+
+
+bool CTarGzArchiver::SetCache(const TCHAR *cache_path, uint64_t max_size)
+{
+	return false;
+}
+
+
+void CTarGzArchiver::GetCacheStats(size_t *hits, size_t *misses)
+{
+	if (hits)
+		*hits = 0;
+
+	if (misses)
+		*misses = 0;
+}
+
+
+void CTarGzArchiver::SetProgress(IArchiveProgress *pprog)
+{
+	m_pProgress = pprog;
+}
+
+
+DWORD WINAPI CTarGzArchiver::CompressThreadProc(LPVOID param)
+{
+	CTarGzArchiver *_this = (CTarGzArchiver *)param;
+
+	HANDLE h[2] = {_this->m_hQuitEvent, _this->m_hQueueSem};
+
+	while (WaitForMultipleObjects(2, h, FALSE, INFINITE) == (WAIT_OBJECT_0 + 1))
+	{
+		EnterCriticalSection(&_this->m_QueueLock);
+		SChunk *pc = _this->m_Queue.front();
+		_this->m_Queue.pop_front();
+		LeaveCriticalSection(&_this->m_QueueLock);
+
+		CompressChunk(*pc);
+	}
+
+	return 0;
+}
+
+
+void CTarGzArchiver::CompressChunk(SChunk &c)
+{
+	// a gzip member (RFC 1952) with no name, time, or extra fields; the OS is given as NTFS
+	static const BYTE header[10] = {0x1F, 0x8B, 8, 0, 0, 0, 0, 0, 0, 11};
+
+	BYTE *p = c.m_pOut;
+
+	memcpy(p, header, sizeof(header));
+	p += sizeof(header);
+
+	p += FLZADeflate(c.m_pIn, c.m_InUsed, p, FLZADeflateBound(CHUNK_SIZE));
+
+	uint32_t trailer[2] = {FLZACrc32(0, c.m_pIn, c.m_InUsed), (uint32_t)c.m_InUsed};
+	memcpy(p, trailer, sizeof(trailer));
+	p += sizeof(trailer);
+
+	c.m_OutUsed = p - c.m_pOut;
+
+	SetEvent(c.m_hDone);
+}
+
+
+BYTE *CTarGzArchiver::Reserve(size_t &sz)
+{
+	if (m_Chunks[m_Cur].m_InUsed == CHUNK_SIZE)
+		Submit();
+
+	SChunk &c = m_Chunks[m_Cur];
+	sz = std::min<size_t>(sz, CHUNK_SIZE - c.m_InUsed);
+
+	return c.m_pIn + c.m_InUsed;
+}
+
+
+void CTarGzArchiver::Commit(size_t sz)
+{
+	m_Chunks[m_Cur].m_InUsed += sz;
+}
+
+
+void CTarGzArchiver::Append(const void *buf, size_t sz)
+{
+	const BYTE *src = (const BYTE *)buf;
+
+	while (sz)
+	{
+		size_t n = sz;
+		BYTE *dst = Reserve(n);
+
+		if (src)
+		{
+			memcpy(dst, src, n);
+			src += n;
+		}
+		else
+		{
+			memset(dst, 0, n);
+		}
+
+		Commit(n);
+		sz -= n;
+	}
+}
+
+
+void CTarGzArchiver::Submit()
+{
+	SChunk &c = m_Chunks[m_Cur];
+	if (!c.m_InUsed)
+		return;
+
+	c.m_Pending = true;
+	ResetEvent(c.m_hDone);
+
+	// if no thread could be started, nothing would ever pick the chunk up, so it's done here instead
+	if (m_Threads.empty())
+	{
+		CompressChunk(c);
+	}
+	else
+	{
+		EnterCriticalSection(&m_QueueLock);
+		m_Queue.push_back(&c);
+		LeaveCriticalSection(&m_QueueLock);
+
+		ReleaseSemaphore(m_hQueueSem, 1, NULL);
+	}
+
+	m_Cur = (m_Cur + 1) % m_Chunks.size();
+
+	// this is what keeps the tar stream from getting ahead of the compression threads
+	Retire(m_Chunks[m_Cur]);
+}
+
+
+void CTarGzArchiver::Retire(SChunk &c)
+{
+	if (!c.m_Pending)
+		return;
+
+	WaitForSingleObject(c.m_hDone, INFINITE);
+
+	WriteOut(c.m_pOut, c.m_OutUsed);
+
+	m_Written += c.m_OutUsed;
+
+	if (m_pProgress)
+		m_pProgress->Progress(0, c.m_OutUsed);
+
+	c.m_Pending = false;
+	c.m_InUsed = 0;
+	c.m_OutUsed = 0;
+}
+
+
+void CTarGzArchiver::WriteOut(const BYTE *buf, size_t sz)
+{
+	while (sz && !m_WriteFailed)
+	{
+		if (m_VolumeWritten >= m_MaxSize)
+		{
+			// a volume boundary can fall anywhere, even in the middle of a member
+			if (!m_pah->Span())
+			{
+				m_WriteFailed = true;
+				break;
+			}
+
+			m_VolumeWritten = 0;
+		}
+
+		DWORD n = (DWORD)std::min<uint64_t>(sz, m_MaxSize - m_VolumeWritten);
+
+		DWORD bw = 0;
+		if (!WriteFile(m_pah->GetHandle(), buf, n, &bw, NULL) || (bw != n))
+			m_WriteFailed = true;
+
+		m_VolumeWritten += n;
+		buf += n;
+		sz -= n;
+	}
+}
+
+
+void CTarGzArchiver::WriteHeader(const TCHAR *dst_filename, uint64_t size, const FILETIME &mtime)
+{
+	tstring dst = dst_filename;
+	std::replace(dst.begin(), dst.end(), _T('\\'), _T('/'));
+
+	size_t skip = dst.find_first_not_of(_T('/'));
+	if (skip == tstring::npos)
+		skip = dst.length();
+
+	std::string path;
+	int len = WideCharToMultiByte(CP_UTF8, 0, dst.c_str() + skip, -1, NULL, 0, NULL, NULL);
+	if (len > 1)
+	{
+		path.resize(len - 1);
+		WideCharToMultiByte(CP_UTF8, 0, dst.c_str() + skip, -1, &path[0], len, NULL, NULL);
+	}
+
+	uint64_t t = ((((uint64_t)mtime.dwHighDateTime) << 32) | mtime.dwLowDateTime);
+	t = (t > FILETIME_UNIX_EPOCH) ? ((t - FILETIME_UNIX_EPOCH) / 10000000) : 0;
+
+	sTarHeader hdr;
+	memset(&hdr, 0, sizeof(sTarHeader));
+
+	TarNumber(hdr.mode, sizeof(hdr.mode), 0644);
+	TarNumber(hdr.uid, sizeof(hdr.uid), 0);
+	TarNumber(hdr.gid, sizeof(hdr.gid), 0);
+	TarNumber(hdr.mtime, sizeof(hdr.mtime), t);
+	memcpy(hdr.magic, "ustar", 6);
+	memcpy(hdr.version, "00", 2);
+
+	// a name of up to 100 bytes fits as it is; up to 256 may be split into a prefix and name at a '/'
+	size_t split = std::string::npos;
+	if (path.length() > sizeof(hdr.name))
+	{
+		for (size_t i = std::min<size_t>(path.length() - 1, sizeof(hdr.prefix)); i > 0; i--)
+		{
+			if (path[i] == '/')
+			{
+				if ((path.length() - i - 1) <= sizeof(hdr.name))
+					split = i;
+
+				break;
+			}
+		}
+
+		if (split == std::string::npos)
+		{
+			// otherwise, a pax extended header carries the whole thing; a record's length includes its own digits
+			size_t base = path.length() + 7;		// " path=" and "\n"
+			size_t reclen = base + 1;
+			while (reclen != (base + std::to_string(reclen).length()))
+				reclen = base + std::to_string(reclen).length();
+
+			std::string pax = std::to_string(reclen);
+			pax += " path=";
+			pax += path;
+			pax += "\n";
+
+			sTarHeader xhdr = hdr;
+			memcpy(xhdr.name, "PaxHeader", 9);
+			TarNumber(xhdr.size, sizeof(xhdr.size), pax.length());
+			xhdr.typeflag = 'x';
+			TarChecksum(xhdr);
+
+			Append(&xhdr, sizeof(sTarHeader));
+			Append(pax.data(), pax.length());
+			Append(NULL, (TAR_BLOCK_SIZE - (pax.length() % TAR_BLOCK_SIZE)) % TAR_BLOCK_SIZE);
+		}
+	}
+
+	if (split != std::string::npos)
+	{
+		memcpy(hdr.prefix, path.data(), split);
+		memcpy(hdr.name, path.data() + split + 1, path.length() - split - 1);
+	}
+	else
+	{
+		// when there's a pax header, this is only what readers that don't understand it will see
+		memcpy(hdr.name, path.data(), std::min<size_t>(path.length(), sizeof(hdr.name)));
+	}
+
+	TarNumber(hdr.size, sizeof(hdr.size), size);
+	hdr.typeflag = '0';
+	TarChecksum(hdr);
+
+	Append(&hdr, sizeof(sTarHeader));
+}
+
+
+IArchiver::ADD_RESULT CTarGzArchiver::AddFile(const TCHAR *src_filename, const TCHAR *dst_filename, uint64_t *sz_uncomp, uint64_t *sz_comp, const TCHAR *scriptsnippet)
+{
+	if (!src_filename || !dst_filename)
+		return AR_UNKNOWN_ERROR;
+
+	HANDLE hin = CreateFile(src_filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (hin == INVALID_HANDLE_VALUE)
+		return AR_UNKNOWN_ERROR;
+
+	LARGE_INTEGER fsz;
+	FILETIME mtime;
+	if (!GetFileSizeEx(hin, &fsz) || !GetFileTime(hin, NULL, NULL, &mtime))
+	{
+		CloseHandle(hin);
+		return AR_UNKNOWN_ERROR;
+	}
+
+	uint64_t size = fsz.QuadPart;
+	uint64_t written = m_Written;
+
+	WriteHeader(dst_filename, size, mtime);
+
+	// the file is read straight into the tar stream
+	uint64_t remaining = size;
+	while (remaining)
+	{
+		size_t n = (size_t)std::min<uint64_t>(remaining, CHUNK_SIZE);
+		BYTE *dst = Reserve(n);
+
+		DWORD br = 0;
+		if (!ReadFile(hin, dst, (DWORD)n, &br, NULL) || !br)
+			break;
+
+		Commit(br);
+		remaining -= br;
+
+		if (m_pProgress)
+			m_pProgress->Progress(br, 0);
+	}
+
+	CloseHandle(hin);
+
+	ADD_RESULT ret = m_WriteFailed ? AR_UNKNOWN_ERROR : AR_OK;
+
+	// a file that got shorter while it was being read is padded out to the size in its header, so what follows stays in place
+	if (remaining)
+	{
+		Append(NULL, (size_t)remaining);
+
+		if (m_pProgress)
+			m_pProgress->Progress(remaining, 0);
+
+		ret = AR_UNKNOWN_ERROR;
+	}
+
+	Append(NULL, (size_t)((TAR_BLOCK_SIZE - (size % TAR_BLOCK_SIZE)) % TAR_BLOCK_SIZE));
+
+	m_FileCount++;
+
+	if (sz_uncomp)
+		*sz_uncomp = size;
+
+	if (sz_comp)
+		*sz_comp = m_Written - written;
+
+	return ret;
+}
+
+
+IArchiver::FINALIZE_RESULT CTarGzArchiver::Finalize()
+{
+	// the end of the archive is marked by two empty records
+	Append(NULL, TAR_BLOCK_SIZE * 2);
+
+	Submit();
+
+	for (size_t i = 1, maxi = m_Chunks.size(); i <= maxi; i++)
+		Retire(m_Chunks[(m_Cur + i) % maxi]);
+
+	return m_WriteFailed ? FR_UNKNOWN_ERROR : FR_OK;
+}
@@ -0,0 +1,110 @@
+/*
+	Copyright © 2013-2020, Keelan Stuart (hereafter referenced as AUTHOR). All Rights Reserved.
+	Permission to use, copy, modify, and distribute this software is hereby granted, without fee and without a signed licensing agreement,
+	provided that the above copyright notice appears in all copies, modifications, and distributions.
+	Furthermore, AUTHOR assumes no responsibility for any damages caused either directly or indirectly by the use of this software, nor vouches for
+	any fitness of purpose of this software.
+	All other copyrighted material contained herein is noted and rights attributed to individual copyright holders.
+	
+	For inquiries, contact: keelanstuart@gmail.com
+*/
+
+
+#pragma once
+
+#include "..\Include\Archiver.h"
+
+#include <deque>
+#include <vector>
+
+
+// Writes a standard .tar.gz. Files are read straight into ustar records at the end of the tar stream, which is cut into fixed
+// size chunks that a pool of threads compresses at the same time, each one into a complete gzip member of its own. Members are
+// written out in order, and since a series of gzip members is itself a valid gzip file (the way pigz makes them), anything
+// that reads .tar.gz files can unpack the result. With a maximum size, the output is cut into volumes of exactly that size (the
+// last one excepted) through IArchiveHandle::Span, which have to be joined back together before unpacking, as 7-Zip's -v ones
+// do. There is no reference archive or cache
+class CTarGzArchiver : public IArchiver
+{
+public:
+	CTarGzArchiver(IArchiveHandle *pah);
+
+	virtual ~CTarGzArchiver();
+
+	virtual void SetMaximumSize(uint64_t maxsize);
+
+	virtual size_t GetFileCount(INFO_MODE mode);
+
+	// sz_comp is how much compressed data was written while the file was being added; chunks are compressed in the background,
+	// so that lags behind, but over the whole archive (with Finalize) it adds up
+	virtual ADD_RESULT AddFile(const TCHAR *src_filename, const TCHAR *dst_filename, uint64_t *sz_uncomp = nullptr, uint64_t *sz_comp = nullptr, const TCHAR *scriptsnippet = nullptr);
+
+	virtual bool SetReferenceArchive(IArchiveHandle *pah);
+
+	virtual bool SetCache(const TCHAR *cache_path, uint64_t max_size);
+
+	virtual void GetCacheStats(size_t *hits, size_t *misses);
+
+	virtual void SetProgress(IArchiveProgress *pprog);
+
+	virtual FINALIZE_RESULT Finalize();
+
+	enum { CHUNK_SIZE = (1 << 20) };
+
+protected:
+
+	struct SChunk
+	{
+		BYTE *m_pIn;			// CHUNK_SIZE bytes of the tar stream
+		size_t m_InUsed;
+		BYTE *m_pOut;			// the gzip member made from it
+		size_t m_OutUsed;
+		HANDLE m_hDone;			// set once m_pOut is filled in
+		bool m_Pending;			// submitted, but not yet written out
+	};
+
+	// Returns where up to sz bytes can be put at the end of the tar stream, reducing sz to what fits in the current chunk
+	BYTE *Reserve(size_t &sz);
+
+	// Adds sz bytes, previously reserved, to the tar stream
+	void Commit(size_t sz);
+
+	// Adds sz bytes to the tar stream; if buf is NULL, they're zeros
+	void Append(const void *buf, size_t sz);
+
+	// Hands the current chunk to the compression threads and makes the next one current, first writing out what it held
+	void Submit();
+
+	// Waits for a chunk to be compressed, if it was submitted, and writes its member out
+	void Retire(SChunk &c);
+
+	// Writes to the archive handle, spanning to a new volume whenever the current one reaches the maximum size
+	void WriteOut(const BYTE *buf, size_t sz);
+
+	// Adds the header record(s) for a regular file; names that don't fit a ustar header get a pax extended header first
+	void WriteHeader(const TCHAR *dst_filename, uint64_t size, const FILETIME &mtime);
+
+	static DWORD WINAPI CompressThreadProc(LPVOID param);
+
+	static void CompressChunk(SChunk &c);
+
+	IArchiveHandle *m_pah;
+	IArchiveProgress *m_pProgress;
+
+	size_t m_FileCount;
+	uint64_t m_Written;
+	bool m_WriteFailed;
+
+	uint64_t m_MaxSize;
+	uint64_t m_VolumeWritten;
+
+	// used round robin, so the oldest submitted chunk is always the one after the current one
+	std::vector<SChunk> m_Chunks;
+	size_t m_Cur;
+
+	std::deque<SChunk *> m_Queue;
+	CRITICAL_SECTION m_QueueLock;
+	HANDLE m_hQueueSem;
+	HANDLE m_hQuitEvent;
+	std::vector<HANDLE> m_Threads;
+};
@@ -0,0 +1,293 @@
+/*
+	Copyright © 2013-2020, Keelan Stuart (hereafter referenced as AUTHOR). All Rights Reserved.
+	Permission to use, copy, modify, and distribute this software is hereby granted, without fee and without a signed licensing agreement,
+	provided that the above copyright notice appears in all copies, modifications, and distributions.
+	Furthermore, AUTHOR assumes no responsibility for any damages caused either directly or indirectly by the use of this software, nor vouches for
+	any fitness of purpose of this software.
+	All other copyrighted material contained herein is noted and rights attributed to individual copyright holders.
+
+	For inquiries, contact: keelanstuart@gmail.com
+*/
+
+// Builds small archives in a temporary directory and checks what comes back out of them; returns the number of failed tests
+
+#include <Windows.h>
+#include <tchar.h>
+#include <stdio.h>
+#include <Shlwapi.h>
+#include <vector>
+
+#include "../Include/Archiver.h"
+#include "../Source/FastLZArchiver.h"
+
+#pragma comment(lib, "shlwapi.lib")
+
+
+// An archive that is a whole file on disk, never spanned
+class CTestArcHandle : public IArchiveHandle
+{
+protected:
+	HANDLE m_hFile;
+
+public:
+	CTestArcHandle(const TCHAR *filename, bool create)
+	{
+		m_hFile = CreateFile(filename, GENERIC_READ | (create ? GENERIC_WRITE : 0), FILE_SHARE_READ, NULL, create ? CREATE_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	}
+
+	virtual ~CTestArcHandle()
+	{
+		if (m_hFile != INVALID_HANDLE_VALUE)
+			CloseHandle(m_hFile);
+	}
+
+	virtual HANDLE GetHandle()
+	{
+		return m_hFile;
+	}
+
+	virtual bool Span()
+	{
+		return false;
+	}
+
+	virtual uint64_t GetLength()
+	{
+		LARGE_INTEGER p;
+		GetFileSizeEx(m_hFile, &p);
+		return p.QuadPart;
+	}
+
+	virtual uint64_t GetOffset()
+	{
+		LARGE_INTEGER p, z;
+		z.QuadPart = 0;
+		SetFilePointerEx(m_hFile, z, &p, FILE_CURRENT);
+		return p.QuadPart;
+	}
+
+	virtual void Release()
+	{
+		delete this;
+	}
+};
+
+
+static bool WriteWholeFile(const TCHAR *filename, const std::vector<BYTE> &data)
+{
+	HANDLE h = CreateFile(filename, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (h == INVALID_HANDLE_VALUE)
+		return false;
+
+	DWORD bw;
+	bool ret = WriteFile(h, data.data(), (DWORD)data.size(), &bw, NULL) && (bw == (DWORD)data.size());
+
+	CloseHandle(h);
+
+	return ret;
+}
+
+
+static bool ReadWholeFile(const TCHAR *filename, std::vector<BYTE> &data)
+{
+	HANDLE h = CreateFile(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (h == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER sz;
+	GetFileSizeEx(h, &sz);
+	data.resize((size_t)sz.QuadPart);
+
+	bool ret = data.empty() || FLZAReadFully(h, data.data(), (DWORD)data.size());
+
+	CloseHandle(h);
+
+	return ret;
+}
+
+
+// Builds an archive holding only src, using the cache in cachedir; returns what AddFile said
+static IArchiver::ADD_RESULT BuildArchive(const TCHAR *arcfile, const TCHAR *src, const TCHAR *cachedir)
+{
+	IArchiver::ADD_RESULT ret = IArchiver::AR_UNKNOWN_ERROR;
+
+	IArchiveHandle *pah = new CTestArcHandle(arcfile, true);
+
+	IArchiver *parc = nullptr;
+	if (IArchiver::CreateArchiver(&parc, pah, IArchiver::CT_FASTLZ) == IArchiver::CR_OK)
+	{
+		parc->SetCache(cachedir, UINT64_MAX);
+
+		ret = parc->AddFile(src, _T("data\\test.bin"));
+
+		if (parc->Finalize() != IArchiver::FR_OK)
+			ret = IArchiver::AR_UNKNOWN_ERROR;
+	}
+
+	IArchiver::DestroyArchiver(&parc);
+
+	pah->Release();
+
+	return ret;
+}
+
+
+// Extracts the only file in arcfile to outfile; returns false if that isn't what the archive holds
+static bool ExtractArchive(const TCHAR *arcfile, const TCHAR *outfile)
+{
+	bool ret = false;
+
+	IArchiveHandle *pah = new CTestArcHandle(arcfile, false);
+
+	IExtractor *pie = nullptr;
+	if (IExtractor::CreateExtractor(&pie, pah) == IExtractor::CR_OK)
+		ret = (pie->GetFileCount() == 1) && (pie->ExtractFile(0, nullptr, outfile) == IExtractor::ER_OK);
+
+	IExtractor::DestroyExtractor(&pie);
+
+	pah->Release();
+
+	return ret;
+}
+
+
+// Finds the one entry in the cache directory
+static bool FindCacheEntry(const TCHAR *cachedir, TCHAR *entry)
+{
+	TCHAR spec[MAX_PATH];
+	_tcscpy_s(spec, cachedir);
+	PathAppend(spec, _T("*.blk"));
+
+	WIN32_FIND_DATA fd;
+	HANDLE hfind = FindFirstFile(spec, &fd);
+	if (hfind == INVALID_HANDLE_VALUE)
+		return false;
+
+	FindClose(hfind);
+
+	_tcscpy_s(entry, MAX_PATH, cachedir);
+	PathAppend(entry, fd.cFileName);
+
+	return true;
+}
+
+
+enum ECacheDamage
+{
+	CD_DATA = 0,		// bytes in the middle of the first block's compressed data are changed
+	CD_BLOCKHEADER,		// the first block claims to be bigger than any block can be
+
+	CD_NUMTYPES
+};
+
+
+// A cache entry whose blocks have been damaged, without changing its size, must not keep the file out of the package or put
+// the damaged data into it; the file has to be compressed from its source instead
+static bool TestDamagedCacheEntry(const TCHAR *dir, ECacheDamage damage)
+{
+	TCHAR src[MAX_PATH], cachedir[MAX_PATH], arcfile[MAX_PATH], outfile[MAX_PATH], entry[MAX_PATH];
+
+	_tcscpy_s(src, dir);
+	PathAppend(src, _T("test.bin"));
+
+	_tcscpy_s(cachedir, dir);
+	PathAppend(cachedir, _T("cache\\"));
+	CreateDirectory(cachedir, NULL);
+
+	_tcscpy_s(arcfile, dir);
+	PathAppend(arcfile, _T("test.arc"));
+
+	_tcscpy_s(outfile, dir);
+	PathAppend(outfile, _T("test.out"));
+
+	// several blocks' worth of data that compresses, but not to nothing
+	std::vector<BYTE> data((sFileBlock::FB_UNCOMPRESSED_BUFSIZE * 5) / 2);
+	uint32_t seed = 12345;
+	for (size_t i = 0; i < data.size(); i++)
+	{
+		seed = (seed * 1103515245) + 12345;
+		data[i] = (BYTE)('a' + ((seed >> 16) % 8));
+	}
+
+	if (!WriteWholeFile(src, data))
+		return false;
+
+	// the first build fills the cache
+	if (BuildArchive(arcfile, src, cachedir) >= IArchiver::AR_SPANFAIL)
+		return false;
+
+	if (!FindCacheEntry(cachedir, entry))
+		return false;
+
+	std::vector<BYTE> cached;
+	if (!ReadWholeFile(entry, cached))
+		return false;
+
+	SBlockCacheEntryHeader hdr;
+	memcpy(&hdr, cached.data(), sizeof(SBlockCacheEntryHeader));
+
+	size_t blockofs = sizeof(SBlockCacheEntryHeader) + (hdr.m_PathLength * sizeof(TCHAR));
+	if ((blockofs + sizeof(sFileBlock::sFileBlockHeader) + 64) > cached.size())
+		return false;
+
+	switch (damage)
+	{
+		case CD_DATA:
+			for (size_t i = 0; i < 16; i++)
+				cached[blockofs + sizeof(sFileBlock::sFileBlockHeader) + 32 + i] ^= 0xFF;
+			break;
+
+		case CD_BLOCKHEADER:
+		{
+			sFileBlock::sFileBlockHeader bh;
+			memcpy(&bh, cached.data() + blockofs, sizeof(sFileBlock::sFileBlockHeader));
+			bh.m_SizeC = sFileBlock::FB_COMPRESSED_BUFSIZE * 4;
+			memcpy(cached.data() + blockofs, &bh, sizeof(sFileBlock::sFileBlockHeader));
+			break;
+		}
+	}
+
+	if (!WriteWholeFile(entry, cached))
+		return false;
+
+	// the second build finds the damaged entry; the file has to be compressed again, and has to come out whole
+	IArchiver::ADD_RESULT ar = BuildArchive(arcfile, src, cachedir);
+	if ((ar >= IArchiver::AR_SPANFAIL) || (ar == IArchiver::AR_OK_CACHED))
+		return false;
+
+	std::vector<BYTE> extracted;
+	bool ret = ExtractArchive(arcfile, outfile) && ReadWholeFile(outfile, extracted) && (extracted == data);
+
+	DeleteFile(entry);
+	RemoveDirectory(cachedir);
+	DeleteFile(src);
+	DeleteFile(arcfile);
+	DeleteFile(outfile);
+
+	return ret;
+}
+
+
+int _tmain(int argc, TCHAR **argv)
+{
+	TCHAR dir[MAX_PATH];
+	GetTempPath(MAX_PATH, dir);
+	PathAppend(dir, _T("ArchiverTest"));
+	CreateDirectory(dir, NULL);
+
+	int failed = 0;
+
+	const TCHAR *damage_name[CD_NUMTYPES] = {_T("data"), _T("block header")};
+	for (int i = 0; i < CD_NUMTYPES; i++)
+	{
+		bool ok = TestDamagedCacheEntry(dir, (ECacheDamage)i);
+		_tprintf(_T("%s: damaged cache entry (%s)\n"), ok ? _T("PASS") : _T("FAIL"), damage_name[i]);
+
+		if (!ok)
+			failed++;
+	}
+
+	RemoveDirectory(dir);
+
+	return failed;
+}
@@ -0,0 +1,2322 @@
+/*
+	Copyright © 2013-2020, Keelan Stuart (hereafter referenced as AUTHOR). All Rights Reserved.
+	Permission to use, copy, modify, and distribute this software is hereby granted, without fee and without a signed licensing agreement,
+	provided that the above copyright notice appears in all copies, modifications, and distributions.
+	Furthermore, AUTHOR assumes no responsibility for any damages caused either directly or indirectly by the use of this software, nor vouches for
+	any fitness of purpose of this software.
+	All other copyrighted material contained herein is noted and rights attributed to individual copyright holders.
+	
+	For inquiries, contact: keelanstuart@gmail.com
+*/
+
+
+// InstallEngine.cpp : the install itself, and the functions its scripts can call
+//
+
+#include "stdafx.h"
+#include "sfx.h"
+#include "InstallEngine.h"
+#include <vector>
+#include <set>
+#include <istream>
+#include <chrono>
+#include <ctime>
+#include "../sfxPackager/GenParser.h"
+#include "HttpDownload.h"
+#include "../sfxFlags.h"
+
+#include "../../Archiver/Include/Archiver.h"
+
+extern bool ReplaceEnvironmentVariables(const tstring &src, tstring &dst);
+extern bool ReplaceRegistryKeys(const tstring &src, tstring &dst);
+extern void FLZAInvalidatePathExpansions();
+extern bool FLZACreateDirectories(const TCHAR *dir);
+extern uint32_t FLZAHashFile(HANDLE hIn);
+
+
+class CUnpackArchiveHandle : public IArchiveHandle
+{
+protected:
+	HANDLE m_hFile;
+
+public:
+	CUnpackArchiveHandle(HANDLE hf)
+	{
+		m_hFile = hf;
+	}
+
+	virtual ~CUnpackArchiveHandle()
+	{
+
+	}
+
+	virtual HANDLE GetHandle()
+	{
+		return m_hFile;
+	}
+
+	virtual bool Span()
+	{
+		return false;
+	}
+
+	virtual uint64_t GetLength()
+	{
+		LARGE_INTEGER p;
+		GetFileSizeEx(m_hFile, &p);
+		return p.QuadPart;
+	}
+
+	virtual uint64_t GetOffset()
+	{
+		LARGE_INTEGER p, z;
+		z.QuadPart = 0;
+		SetFilePointerEx(m_hFile, z, &p, FILE_CURRENT);
+		return p.QuadPart;
+	}
+
+};
+
+class CSfxHandle : public CUnpackArchiveHandle
+{
+public:
+	CSfxHandle(HANDLE hf) : CUnpackArchiveHandle(hf)
+	{
+		m_hFile = hf;
+	}
+
+	virtual ~CSfxHandle() { }
+
+	virtual void Release()
+	{
+		delete this;
+	}
+
+};
+
+class CExtArcHandle : public CUnpackArchiveHandle
+{
+
+protected:
+	UINT m_spanIdx;
+	TCHAR m_BaseFilename[MAX_PATH];
+	TCHAR m_CurrentFilename[MAX_PATH];
+
+public:
+	CExtArcHandle(HANDLE hf, const TCHAR *base_filename) : CUnpackArchiveHandle(hf)
+	{
+		m_spanIdx = 0;
+		_tcscpy_s(m_BaseFilename, base_filename);
+		_tcscpy_s(m_CurrentFilename, base_filename);
+	}
+
+	~CExtArcHandle() { }
+
+	virtual void Release()
+	{
+		delete this;
+	}
+
+	virtual bool Span()
+	{
+		m_spanIdx++;
+
+		TCHAR local_filename[MAX_PATH];
+		_tcscpy_s(local_filename, MAX_PATH, m_BaseFilename);
+
+		TCHAR *plext = PathFindExtension(local_filename);
+		if (plext)
+			*plext = _T('\0');
+
+		_stprintf_s(m_CurrentFilename, MAX_PATH, _T("%s_part%d.data"), local_filename, m_spanIdx + 1);
+
+		// Finalize archive
+		CloseHandle(m_hFile);
+		m_hFile = INVALID_HANDLE_VALUE;
+
+		m_hFile = CreateFile(m_CurrentFilename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
+		return (m_hFile != INVALID_HANDLE_VALUE);
+	}
+
+};
+
+HRESULT CreateShortcut(const TCHAR *targetFile, const TCHAR *targetArgs, const TCHAR *linkFile, const TCHAR *description,
+					   int showMode, const TCHAR *curDir, const TCHAR *iconFile, int iconIndex)
+{
+	HRESULT hr = E_INVALIDARG;
+
+	if ((targetFile && *targetFile) && (linkFile && linkFile))
+	{
+		CoInitialize(NULL);
+
+		IShellLink *pl;
+		hr = CoCreateInstance(CLSID_ShellLink, NULL, CLSCTX_INPROC_SERVER, IID_IShellLink, (LPVOID*)&pl);
+
+		if (SUCCEEDED(hr))
+		{
+			hr = pl->SetPath(targetFile);
+			hr = pl->SetArguments(targetArgs ? targetArgs : _T(""));
+
+			if (description && *description)
+				hr = pl->SetDescription(description);
+
+			if (showMode > 0)
+				hr = pl->SetShowCmd(showMode);
+
+			if (curDir && curDir)
+				hr = pl->SetWorkingDirectory(curDir);
+
+			if (iconFile && *iconFile && (iconIndex >= 0))
+				hr = pl->SetIconLocation(iconFile, iconIndex);
+
+			IPersistFile* pf;
+			hr = pl->QueryInterface(IID_IPersistFile, (LPVOID*)&pf);
+			if (SUCCEEDED(hr))
+			{
+				wchar_t *fn;
+				LOCAL_TCS2WCS(linkFile, fn);
+
+				hr = pf->Save(fn, TRUE);
+				pf->Release();
+			}
+			pl->Release();
+		}
+
+		CoUninitialize();
+	}
+
+	return (hr);
+}
+
+
+// ******************************************************************************
+// ******************************************************************************
+
+void scSetGlobalInt(CScriptVar *c, void *userdata)
+{
+	tstring name = c->getParameter(_T("name"))->getString();
+	int64_t val = c->getParameter(_T("val"))->getInt();
+
+	IInstallProgress *_this = (IInstallProgress *)userdata;
+
+	std::pair<CSfxApp::TIntMap::iterator, bool> insret = theApp.m_jsGlobalIntMap.insert(CSfxApp::TIntMap::value_type(name, val));
+	if (!insret.second)
+		insret.first->second = val;
+}
+
+
+void scGetGlobalInt(CScriptVar *c, void *userdata)
+{
+	tstring name = c->getParameter(_T("name"))->getString();
+
+	IInstallProgress *_this = (IInstallProgress *)userdata;
+
+	CScriptVar *ret = c->getReturnVar();
+	if (ret)
+	{
+		CSfxApp::TIntMap::iterator it = theApp.m_jsGlobalIntMap.find(name);
+
+		ret->setInt((it != theApp.m_jsGlobalIntMap.end()) ? it->second : 0);
+	}
+}
+
+
+void scMessageBox(CScriptVar *c, void *userdata)
+{
+	tstring title = c->getParameter(_T("title"))->getString();
+	tstring msg = c->getParameter(_T("msg"))->getString();
+
+	IInstallProgress *_this = (IInstallProgress *)userdata;
+
+	_this->ShowMessage(title.c_str(), msg.c_str());
+}
+
+
+void scMessageBoxYesNo(CScriptVar *c, void *userdata)
+{
+	tstring title = c->getParameter(_T("title"))->getString();
+	tstring msg = c->getParameter(_T("msg"))->getString();
+
+	IInstallProgress *_this = (IInstallProgress *)userdata;
+
+	bool bret = _this->AskYesNo(title.c_str(), msg.c_str());
+	CScriptVar *ret = c->getReturnVar();
+	if (ret)
+		ret->setInt(bret);
+}
+
+
+void scEcho(CScriptVar *c, void *userdata)
+{
+	tstring msg = c->getParameter(_T("msg"))->getString(), _msg;
+	ReplaceEnvironmentVariables(msg, _msg);
+	ReplaceRegistryKeys(_msg, msg);
+
+	IInstallProgress *_this = (IInstallProgress *)userdata;
+	_this->Echo(msg.c_str());
+}
+
+
+void scCreateDirectoryTree(CScriptVar *c, void *userdata)
+{
+	tstring path = c->getParameter(_T("path"))->getString(), _path;
+	ReplaceEnvironmentVariables(path, _path);
+	ReplaceRegistryKeys(_path, path);
+
+	bool create_result = TRUE;
+	if (!theApp.m_TestOnlyMode)
+	{
+		create_result = FLZACreateDirectories(path.c_str());
+	}
+
+	CScriptVar *ret = c->getReturnVar();
+	if (ret)
+		ret->setInt(create_result ? 1 : 0);
+}
+
+
+void scCopyFile(CScriptVar *c, void *userdata)
+{
+	tstring src = c->getParameter(_T("src"))->getString(), _src;
+	ReplaceEnvironmentVariables(src, _src);
+	ReplaceRegistryKeys(_src, src);
+
+	tstring dst = c->getParameter(_T("dst"))->getString(), _dst;
+	ReplaceEnvironmentVariables(dst, _dst);
+	ReplaceRegistryKeys(_dst, dst);
+
+	BOOL copy_result;
+	if (!theApp.m_TestOnlyMode)
+	{
+		copy_result = CopyFile(src.c_str(), dst.c_str(), false);
+	}
+
+	CScriptVar *ret = c->getReturnVar();
+	if (ret)
+		ret->setInt(copy_result ? 1 : 0);
+}
+
+
+void scRenameFile(CScriptVar *c, void *userdata)
+{
+	tstring filename = c->getParameter(_T("filename"))->getString(), _filename;
+	ReplaceEnvironmentVariables(filename, _filename);
+	ReplaceRegistryKeys(_filename, filename);
+
+	tstring newname = c->getParameter(_T("newname"))->getString(), _newname;
+	ReplaceEnvironmentVariables(newname, _newname);
+	ReplaceRegistryKeys(_newname, newname);
+
+	int rename_result = TRUE;
+	if (!theApp.m_TestOnlyMode)
+	{
+		rename_result = _trename(filename.c_str(), newname.c_str());
+	}
+
+	CScriptVar *ret = c->getReturnVar();
+	if (ret)
+		ret->setInt((rename_result == 0) ? 1 : 0);
+}
+
+
+void scDeleteFile(CScriptVar *c, void *userdata)
+{
+	tstring path = c->getParameter(_T("path"))->getString(), _path;
+	ReplaceEnvironmentVariables(path, _path);
+	ReplaceRegistryKeys(_path, path);
+
+
+	BOOL delete_result = TRUE;
+	if (!theApp.m_TestOnlyMode)
+	{
+		delete_result = DeleteFile(path.c_str());
+	}
+
+	CScriptVar *ret = c->getReturnVar();
+	if (ret)
+		ret->setInt(delete_result ? 1 : 0);
+}
+
+
+void scFileExists(CScriptVar *c, void *userdata)
+{
+	tstring path = c->getParameter(_T("path"))->getString(), _path;
+	ReplaceEnvironmentVariables(path, _path);
+	ReplaceRegistryKeys(_path, path);
+
+	BOOL result = PathFileExists(path.c_str());
+	CScriptVar *ret = c->getReturnVar();
+	if (ret)
+		ret->setInt(result ? 1 : 0);
+}
+
+void scIsDirectory(CScriptVar *c, void *userdata)
+{
+	tstring path = c->getParameter(_T("path"))->getString(), _path;
+	ReplaceEnvironmentVariables(path, _path);
+	ReplaceRegistryKeys(_path, path);
+
+	BOOL result = PathIsDirectory(path.c_str());
+	CScriptVar *ret = c->getReturnVar();
+	if (ret)
+		ret->setInt(result ? 1 : 0);
+}
+
+
+void scIsDirectoryEmpty(CScriptVar *c, void *userdata)
+{
+	tstring path = c->getParameter(_T("path"))->getString(), _path;
+	ReplaceEnvironmentVariables(path, _path);
+	ReplaceRegistryKeys(_path, path);
+
+	BOOL result = PathIsDirectoryEmpty(path.c_str());
+	CScriptVar *ret = c->getReturnVar();
+	if (ret)
+		ret->setInt(result ? 1 : 0);
+}
+
+void scCreateSymbolicLink(CScriptVar *c, void *userdata)
+{
+	tstring targetname = c->getParameter(_T("targetname"))->getString(), _targetname;
+	ReplaceEnvironmentVariables(targetname, _targetname);
+	ReplaceRegistryKeys(_targetname, targetname);
+
+	tstring linkname = c->getParameter(_T("linkname"))->getString(), _linkname;
+	ReplaceEnvironmentVariables(linkname, _linkname);
+	ReplaceRegistryKeys(_linkname, linkname);
+
+	DWORD flags = 0;
+	if (PathIsDirectory(targetname.c_str()))
+		flags |= SYMBOLIC_LINK_FLAG_DIRECTORY;
+
+	BOOL result = CreateSymbolicLink(linkname.c_str(), targetname.c_str(), flags);
+	CScriptVar *ret = c->getReturnVar();
+	if (ret)
+		ret->setInt(result ? 1 : 0);
+}
+
+void scCreateShortcut(CScriptVar *c, void *userdata)
+{
+	tstring file = c->getParameter(_T("file"))->getString(), _file;
+	ReplaceEnvironmentVariables(file, _file);
+	ReplaceRegistryKeys(_file, file);
+
+	tstring targ = c->getParameter(_T("target"))->getString(), _targ;
+	ReplaceEnvironmentVariables(targ, _targ);
+	ReplaceRegistryKeys(_targ, targ);
+
+	tstring args = c->getParameter(_T("args"))->getString(), _args;
+	ReplaceEnvironmentVariables(args, _args);
+	ReplaceRegistryKeys(_args, args);
+
+	tstring rundir = c->getParameter(_T("rundir"))->getString(), _rundir;
+	ReplaceEnvironmentVariables(rundir, _rundir);
+	ReplaceRegistryKeys(_rundir, rundir);
+
+	tstring desc = c->getParameter(_T("desc"))->getString(), _desc;
+	ReplaceEnvironmentVariables(desc, _desc);
+	ReplaceRegistryKeys(_desc, desc);
+
+	int64_t showmode = c->getParameter(_T("showmode"))->getInt();
+
+	tstring icon = c->getParameter(_T("icon"))->getString(), _icon;
+	ReplaceEnvironmentVariables(icon, _icon);
+	ReplaceRegistryKeys(_icon, icon);
+
+	int64_t iconidx = c->getParameter(_T("iconidx"))->getInt();
+
+	if (!theApp.m_TestOnlyMode)
+	{
+		CreateShortcut(targ.c_str(), args.c_str(), file.c_str(), desc.c_str(),
+					   (int)showmode, rundir.c_str(), icon.c_str(), (int)iconidx);
+	}
+}
+
+
+void scGetGlobalEnvironmentVariable(CScriptVar *c, void *userdata)
+{
+	CScriptVar *ret = c->getReturnVar();
+	if (!ret)
+		return;
+
+	tstring var = c->getParameter(_T("varname"))->getString(), _var;
+	ReplaceEnvironmentVariables(var, _var);
+	ReplaceRegistryKeys(_var, var);
+
+	tstring rs;
+	DWORD sz = GetEnvironmentVariable(var.c_str(), nullptr, 0);
+	if (sz > 0)
+	{
+		rs.resize(sz, _T('#'));
+		GetEnvironmentVariable(var.c_str(), (TCHAR *)(rs.data()), sz);
+	}
+
+	ret->setString(rs);
+}
+
+
+void scSetGlobalEnvironmentVariable(CScriptVar *c, void *userdata)
+{
+	tstring var = c->getParameter(_T("varname"))->getString(), _var;
+	ReplaceEnvironmentVariables(var, _var);
+	ReplaceRegistryKeys(_var, var);
+
+	tstring val = c->getParameter(_T("val"))->getString(), _val;
+	ReplaceEnvironmentVariables(val, _val);
+	ReplaceRegistryKeys(_val, val);
+
+	if (!theApp.m_TestOnlyMode)
+	{
+		CRegKey cKey;
+		if (SUCCEEDED(cKey.Create(HKEY_LOCAL_MACHINE, _T("SYSTEM\\CurrentControlSet\\Control\\Session Manager\\Environment"))))
+		{
+			cKey.SetStringValue(var.c_str(), val.c_str());
+			FLZAInvalidatePathExpansions();
+		}
+	}
+}
+
+
+void scRegistryKeyValueExists(CScriptVar *c, void *userdata)
+{
+	CScriptVar *ret = c->getReturnVar();
+	if (!ret)
+		return;
+
+	ret->setInt(0);
+
+	tstring root = c->getParameter(_T("root"))->getString();
+	std::transform(root.begin(), root.end(), root.begin(), toupper);
+	HKEY hr = HKEY_LOCAL_MACHINE;
+	if (root == _T("HKEY_CURRENT_USER"))
+		hr = HKEY_CURRENT_USER;
+	else if (root == _T("HKEY_CURRENT_CONFIG"))
+		hr = HKEY_CURRENT_CONFIG;
+	else if (root != _T("HKEY_LOCAL_MACHINE"))
+		return;
+
+	tstring key = c->getParameter(_T("key"))->getString(), _key;
+	ReplaceEnvironmentVariables(key, _key);
+	ReplaceRegistryKeys(_key, key);
+	for (tstring::iterator it = key.begin(), last_it = key.end(); it != last_it; it++)
+	{
+		if (*it == _T('/'))
+			*it = _T('\\');
+	}
+
+	tstring name = c->getParameter(_T("name"))->getString(), _name;
+	ReplaceEnvironmentVariables(name, _name);
+	ReplaceRegistryKeys(_name, name);
+
+	CRegKey cKey;
+	if (SUCCEEDED(cKey.Open(hr, key.c_str())) && cKey.m_hKey)
+	{
+		if (!name.empty())
+		{
+			TCHAR tmp;
+			ULONG tmps = 1;
+			if (cKey.QueryStringValue(name.c_str(), &tmp, &tmps) != ERROR_FILE_NOT_FOUND)
+				ret->setInt(1);
+		}
+
+		cKey.Close();
+	}
+}
+
+
+void scGetRegistryKeyValue(CScriptVar *c, void *userdata)
+{
+	CScriptVar *ret = c->getReturnVar();
+	if (!ret)
+		return;
+
+	tstring root = c->getParameter(_T("root"))->getString();
+	std::transform(root.begin(), root.end(), root.begin(), toupper);
+	HKEY hr = HKEY_LOCAL_MACHINE;
+	if (root == _T("HKEY_CURRENT_USER"))
+		hr = HKEY_CURRENT_USER;
+	else if (root == _T("HKEY_CURRENT_CONFIG"))
+		hr = HKEY_CURRENT_CONFIG;
+	else if (root != _T("HKEY_LOCAL_MACHINE"))
+		return;
+
+	tstring key = c->getParameter(_T("key"))->getString(), _key;
+	ReplaceEnvironmentVariables(key, _key);
+	ReplaceRegistryKeys(_key, key);
+	for (tstring::iterator it = key.begin(), last_it = key.end(); it != last_it; it++)
+	{
+		if (*it == _T('/'))
+			*it = _T('\\');
+	}
+
+	tstring valname = c->getParameter(_T("name"))->getString(), _valname;
+	ReplaceEnvironmentVariables(valname, _valname);
+	ReplaceRegistryKeys(_valname, valname);
+
+	if (!theApp.m_TestOnlyMode)
+	{
+		HKEY hkey;
+		if (RegOpenKeyEx(hr, key.c_str(), 0, KEY_READ, &hkey) == ERROR_SUCCESS)
+		{
+			DWORD cb;
+			DWORD type;
+			BYTE val[(MAX_PATH + 1) * 2 * sizeof(TCHAR)];
+			if (RegGetValue(hkey, nullptr, valname.c_str(), RRF_RT_DWORD | RRF_RT_QWORD | RRF_RT_REG_SZ, &type, val, &cb) == ERROR_SUCCESS)
+			{
+				switch (type)
+				{
+					case REG_SZ:
+						ret->setString((const TCHAR *)val);
+						break;
+
+					case REG_DWORD:
+						ret->setInt((int64_t)(DWORD((*(const DWORD *)val))));
+						break;
+
+					case REG_QWORD:
+						ret->setInt((int64_t)(QWORD((*(const QWORD *)val))));
+						break;
+
+					default:
+						break;
+				}
+
+			}
+
+			RegCloseKey(hkey);
+		}
+	}
+}
+
+
+void scSetRegistryKeyValue(CScriptVar *c, void *userdata)
+{
+	tstring root = c->getParameter(_T("root"))->getString();
+	std::transform(root.begin(), root.end(), root.begin(), toupper);
+	HKEY hr = HKEY_LOCAL_MACHINE;
+	if (root == _T("HKEY_CURRENT_USER"))
+		hr = HKEY_CURRENT_USER;
+	else if (root == _T("HKEY_CURRENT_CONFIG"))
+		hr = HKEY_CURRENT_CONFIG;
+	else if (root != _T("HKEY_LOCAL_MACHINE"))
+		return;
+
+	tstring key = c->getParameter(_T("key"))->getString(), _key;
+	ReplaceEnvironmentVariables(key, _key);
+	ReplaceRegistryKeys(_key, key);
+	for (tstring::iterator it = key.begin(), last_it = key.end(); it != last_it; it++)
+	{
+		if (*it == _T('/'))
+			*it = _T('\\');
+	}
+
+	tstring name = c->getParameter(_T("name"))->getString(), _name;
+	ReplaceEnvironmentVariables(name, _name);
+	ReplaceRegistryKeys(_name, name);
+
+	tstring val = c->getParameter(_T("val"))->getString(), _val;
+	ReplaceEnvironmentVariables(val, _val);
+	ReplaceRegistryKeys(_val, val);
+
+	if (!theApp.m_TestOnlyMode)
+	{
+		CRegKey cKey;
+		if (SUCCEEDED(cKey.Create(hr, key.c_str())))
+		{
+			cKey.SetStringValue(name.c_str(), val.c_str());
+			FLZAInvalidatePathExpansions();
+		}
+	}
+}
+
+
+void scSpawnProcess(CScriptVar *c, void *userdata)
+{
+	tstring cmd = c->getParameter(_T("cmd"))->getString(), _cmd;
+	ReplaceEnvironmentVariables(cmd, _cmd);
+	ReplaceRegistryKeys(_cmd, cmd);
+
+	tstring params = c->getParameter(_T("params"))->getString(), _params;
+	ReplaceEnvironmentVariables(params, _params);
+	ReplaceRegistryKeys(_params, params);
+
+	tstring rundir = c->getParameter(_T("rundir"))->getString(), _rundir;
+	ReplaceEnvironmentVariables(rundir, _rundir);
+	ReplaceRegistryKeys(_rundir, rundir);
+
+	bool block = c->getParameter(_T("block"))->getBool();
+
+	tstring arg;
+	arg.reserve((cmd.length() + params.length()) * 2);
+
+	if (!params.empty())
+		arg += _T("\"");
+
+	arg += cmd;
+
+	if (!params.empty())
+	{
+		arg += _T("\" ");
+		arg += params;
+	}
+
+	STARTUPINFO si = { 0 };
+	si.cb = sizeof(si);
+	PROCESS_INFORMATION pi;
+
+	BOOL created = true;
+	if (!theApp.m_TestOnlyMode)
+	{
+		created = CreateProcess(nullptr, (TCHAR *)(arg.c_str()), NULL, NULL, FALSE, NULL, NULL, rundir.empty() ? NULL : rundir.c_str(), &si, &pi);
+		if (created)
+		{
+			if (block)
+				WaitForSingleObject(pi.hProcess, INFINITE);
+		}
+		else
+		{
+			LPVOID lpMsgBuf;
+			DWORD dw = GetLastError();
+			FormatMessage(FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS,
+						  NULL, dw, MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT), (LPTSTR)&lpMsgBuf, 0, NULL);
+
+			// Display the error
+			IInstallProgress *_this = (IInstallProgress *)userdata;
+			_this->Echo(_T("SpawnProcess Failed:\n\t"));
+			_this->Echo((const TCHAR *)lpMsgBuf);
+
+			// Free resources created by the system
+			LocalFree(lpMsgBuf);
+		}
+	}
+
+	CScriptVar *ret = c->getReturnVar();
+	if (ret)
+		ret->setInt(created ? 1 : 0);
+}
+
+void scGetExeVersion(CScriptVar* c, void* userdata)
+{
+	tstring fn = c->getParameter(_T("file"))->getString(), _fn;
+	ReplaceEnvironmentVariables(fn, _fn);
+	ReplaceRegistryKeys(_fn, fn);
+
+	TCHAR v[128];
+	_stprintf_s(v, 127, _T("%d.%d.%d.%d"), 0, 0, 0, 0);
+
+	if (PathFileExists(fn.c_str()))
+	{
+		DWORD  verHandle = 0;
+		UINT   size = 0;
+		LPBYTE lpBuffer = NULL;
+		DWORD  verSize = GetFileVersionInfoSize(fn.c_str(), &verHandle);
+
+		if (verSize != NULL)
+		{
+			LPSTR verData = new char[verSize];
+
+			if (GetFileVersionInfo(fn.c_str(), verHandle, verSize, verData))
+			{
+				if (VerQueryValue(verData, _T("\\"), (VOID FAR * FAR*) & lpBuffer, &size))
+				{
+					if (size)
+					{
+						VS_FIXEDFILEINFO* verInfo = (VS_FIXEDFILEINFO*)lpBuffer;
+						if (verInfo->dwSignature == 0xfeef04bd)
+						{
+							_stprintf_s(v, 127, _T("%d.%d.%d.%d"),
+								(verInfo->dwFileVersionMS >> 16) & 0xffff,
+								(verInfo->dwFileVersionMS >> 0) & 0xffff,
+								(verInfo->dwFileVersionLS >> 16) & 0xffff,
+								(verInfo->dwFileVersionLS >> 0) & 0xffff);
+						}
+					}
+				}
+			}
+
+			delete[] verData;
+		}
+	}
+
+	CScriptVar* ret = c->getReturnVar();
+	if (ret)
+		ret->setString(tstring(v));
+}
+
+
+void scCompareStrings(CScriptVar* c, void* userdata)
+{
+	tstring str1 = c->getParameter(_T("str1"))->getString();
+	tstring str2 = c->getParameter(_T("str2"))->getString();
+
+	int cmp = _tcscmp(str1.c_str(), str2.c_str());
+
+	CScriptVar* ret = c->getReturnVar();
+	if (ret)
+		ret->setInt(cmp);
+}
+
+
+void scAbortInstall(CScriptVar* c, void* userdata)
+{
+	exit(-1);
+}
+
+
+void scShowLicenseDlg(CScriptVar *c, void *userdata)
+{
+	IInstallProgress *_this = (IInstallProgress *)userdata;
+
+	if (!_this->ShowLicense())
+	{
+		exit(CInstallEngine::IR_NOTLICENSED);
+	}
+}
+
+
+void scGetLicenseKey(CScriptVar *c, void *userdata)
+{
+	IInstallProgress *_this = (IInstallProgress *)userdata;
+
+	tstring key, user, org;
+	_this->GetLicense(key, user, org);
+
+	CScriptVar *ret = c->getReturnVar();
+	if (ret)
+		ret->setString(key);
+}
+
+
+void scGetLicenseUser(CScriptVar *c, void *userdata)
+{
+	IInstallProgress *_this = (IInstallProgress *)userdata;
+
+	tstring key, user, org;
+	_this->GetLicense(key, user, org);
+
+	CScriptVar *ret = c->getReturnVar();
+	if (ret)
+		ret->setString(user);
+}
+
+
+void scGetLicenseOrg(CScriptVar *c, void *userdata)
+{
+	IInstallProgress *_this = (IInstallProgress *)userdata;
+
+	tstring key, user, org;
+	_this->GetLicense(key, user, org);
+
+	CScriptVar *ret = c->getReturnVar();
+	if (ret)
+		ret->setString(org);
+}
+
+
+void scDownloadFile(CScriptVar *c, void *userdata)
+{
+	CScriptVar *purl = c->getParameter(_T("url"));
+	CScriptVar *pfile = c->getParameter(_T("file"));
+
+	BOOL result = FALSE;
+
+	if (purl && pfile)
+	{
+		CHttpDownloader dl;
+		result = dl.DownloadHttpFile(purl->getString().c_str(), pfile->getString().c_str(), _T(""));
+	}
+
+	CScriptVar *ret = c->getReturnVar();
+	if (ret)
+		ret->setInt(result ? 1 : 0);
+}
+
+
+void scTextFileOpen(CScriptVar *c, void *userdata)
+{
+	CScriptVar *pfile = c->getParameter(_T("filename"));
+	CScriptVar *pmode = c->getParameter(_T("mode"));
+
+	FILE *f = nullptr;
+	if (pfile)
+		f = _tfopen(pfile->getString().c_str(), pmode ? pmode->getString().c_str() : _T("r, ccs=UTF-8"));
+
+	CScriptVar *ret = c->getReturnVar();
+	if (ret)
+		ret->setInt((int64_t)f);
+}
+
+
+void scTextFileClose(CScriptVar *c, void *userdata)
+{
+	CScriptVar *phandle = c->getParameter(_T("handle"));
+
+	if (phandle)
+	{
+		FILE *f = (FILE *)phandle->getInt();
+		if (f)
+			fclose(f);
+	}
+}
+
+
+void scTextFileReadLn(CScriptVar *c, void *userdata)
+{
+	CScriptVar *phandle = c->getParameter(_T("handle"));
+
+	tstring s;
+
+	if (phandle)
+	{
+		FILE *f = (FILE *)phandle->getInt();
+		if (f)
+		{
+			TCHAR _s[4096];
+			if (_fgetts(_s, 4096, f))
+			{
+				size_t n = _tcslen(_s);
+
+				if ((n > 0) && (n <= 4096))
+					_s[n - 1] = _T('\0');
+
+				s = _s;
+			}
+		}
+	}
+
+	CScriptVar *ret = c->getReturnVar();
+	if (ret)
+		ret->setString(s);
+}
+
+
+void scTextFileWrite(CScriptVar *c, void *userdata)
+{
+	CScriptVar *phandle = c->getParameter(_T("handle"));
+	CScriptVar *ptext = c->getParameter(_T("text"));
+
+	if (phandle && ptext)
+	{
+		FILE *f = (FILE *)phandle->getInt();
+		if (f)
+			_fputts(ptext->getString().c_str(), f);
+	}
+}
+
+
+void scTextFileReachedEOF(CScriptVar *c, void *userdata)
+{
+	CScriptVar *phandle = c->getParameter(_T("handle"));
+
+	int64_t b = 1;
+	if (phandle)
+	{
+		FILE *f = (FILE *)phandle->getInt();
+		if (f)
+			b = feof(f);
+	}
+
+	CScriptVar *ret = c->getReturnVar();
+	if (ret)
+		ret->setInt(b);
+}
+
+
+void scGetCurrentDateStr(CScriptVar *c, void *userdata)
+{
+	auto now = std::chrono::system_clock::now();
+	std::time_t now_c = std::chrono::system_clock::to_time_t(now);
+	struct tm *parts = std::localtime(&now_c);
+
+	TCHAR dates[MAX_PATH];
+	_stprintf(dates, _T("%04d/%02d/%02d"), 1900 + parts->tm_year, 1 + parts->tm_mon, parts->tm_mday);
+
+	CScriptVar *ret = c->getReturnVar();
+	if (ret)
+		ret->setString(tstring(dates));
+}
+
+
+void scGetFileNameFromPath(CScriptVar *c, void *userdata)
+{
+	CScriptVar *pfilename = c->getParameter(_T("filepath"));
+
+	tstring n;
+	if (pfilename)
+	{
+		tstring _n = pfilename->getString();
+		size_t o = _n.find_last_of(_T("\\/"));
+		tstring::const_iterator it = _n.cbegin();
+		if (o <= _n.length())
+		{
+			it += (o + 1);
+			while (it != _n.cend()) { n += *it; it++; }
+		}
+	}
+
+	CScriptVar *ret = c->getReturnVar();
+	if (ret)
+		ret->setString(n);
+}
+
+
+// ******************************************************************************
+// ******************************************************************************
+
+bool IsScriptEmpty(const tstring &scr)
+{
+	CGenParser gp;
+
+	gp.SetSourceData(scr.c_str(), scr.length());
+	while (gp.NextToken())
+	{
+		tstring_view t = gp.GetCurrentToken();
+		if ((t != _T("function")) && (t != _T("var")))
+			return false;
+
+		gp.NextLine();
+	}
+
+	return true;
+}
+
+// Tells whether a script calls (or names, which is enough to be careful) one of the natives that can change what the paths
+// in the archive expand to
+static bool ScriptAffectsPaths(const tstring &scr)
+{
+	CGenParser gp;
+
+	gp.SetSourceData(scr.c_str(), scr.length());
+	while (gp.NextToken())
+	{
+		tstring_view t = gp.GetCurrentToken();
+		if ((t == _T("SetGlobalEnvironmentVariable")) || (t == _T("SetRegistryKeyValue")))
+			return true;
+	}
+
+	return false;
+}
+
+// Keeps a record, in a small hidden file in the install directory, of the files an install has completely finished.
+// If the install is cancelled or the machine goes down partway through, running it again verifies those files and
+// skips them instead of decompressing everything from the start. The record is only ever appended to, and is written
+// out in batches; a finished install deletes it
+class CInstallJournal
+{
+public:
+	enum
+	{
+		JOURNAL_MAGIC = 0x4C4E4A53,		// 'SJNL'
+		JOURNAL_VERSION = 1,
+
+		FLUSH_BYTES = 16 << 10,			// write the pending entries once there are this many bytes of them...
+		FLUSH_INTERVAL_MS = 2000,		// ...or when this long has passed since the last time
+
+		MAX_JOURNAL_SIZE = 256 << 20
+	};
+
+	struct SEntry
+	{
+		uint64_t m_Size;
+		uint32_t m_Crc;
+		tstring m_Path;
+	};
+
+	CInstallJournal()
+	{
+		m_hFile = INVALID_HANDLE_VALUE;
+		m_Filename[0] = _T('\0');
+		m_ValidLength = 0;
+		m_LastFlush = GetTickCount();
+		ZeroMemory(&m_Header, sizeof(SHeader));
+	}
+
+	~CInstallJournal()
+	{
+		Close();
+	}
+
+	// Picks up the journal left in dir by a previous run of the same archive, if there is one; harc is the archive's file
+	void Load(const TCHAR *dir, HANDLE harc, size_t file_count)
+	{
+		_tcscpy_s(m_Filename, MAX_PATH, dir);
+		PathAppend(m_Filename, _T("~sfxinstall.jnl"));
+
+		// the header identifies the archive the journal goes with, so a rebuilt package doesn't skip files it shouldn't
+		m_Header.m_Magic = JOURNAL_MAGIC;
+		m_Header.m_Version = JOURNAL_VERSION;
+		m_Header.m_FileCount = file_count;
+
+		BY_HANDLE_FILE_INFORMATION fi;
+		if (GetFileInformationByHandle(harc, &fi))
+		{
+			m_Header.m_ArchiveSize = ((uint64_t)fi.nFileSizeHigh << 32) | fi.nFileSizeLow;
+			m_Header.m_ArchiveTime = fi.ftLastWriteTime;
+		}
+
+		HANDLE hf = CreateFile(m_Filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (hf == INVALID_HANDLE_VALUE)
+			return;
+
+		std::vector<BYTE> buf;
+
+		LARGE_INTEGER sz;
+		if (GetFileSizeEx(hf, &sz) && ((uint64_t)sz.QuadPart >= sizeof(SHeader)) && ((uint64_t)sz.QuadPart < MAX_JOURNAL_SIZE))
+		{
+			buf.resize((size_t)sz.QuadPart);
+
+			DWORD br;
+			if (ReadFile(hf, buf.data(), (DWORD)buf.size(), &br, NULL))
+				buf.resize(br);
+			else
+				buf.clear();
+		}
+
+		CloseHandle(hf);
+
+		if ((buf.size() < sizeof(SHeader)) || memcmp(buf.data(), &m_Header, sizeof(SHeader)))
+			return;
+
+		// a run that was cut off may have only written part of its last entry; everything before that is still good
+		size_t ofs = sizeof(SHeader);
+		while ((ofs + sizeof(SEntryHeader)) <= buf.size())
+		{
+			SEntryHeader eh;
+			memcpy(&eh, buf.data() + ofs, sizeof(SEntryHeader));
+
+			size_t pathbytes = eh.m_PathLen * sizeof(TCHAR);
+			if ((ofs + sizeof(SEntryHeader) + pathbytes) > buf.size())
+				break;
+
+			SEntry &e = m_Completed[eh.m_Index];
+			e.m_Size = eh.m_Size;
+			e.m_Crc = eh.m_Crc;
+			e.m_Path.assign((const TCHAR *)(buf.data() + ofs + sizeof(SEntryHeader)), eh.m_PathLen);
+
+			ofs += sizeof(SEntryHeader) + pathbytes;
+		}
+
+		m_ValidLength = ofs;
+	}
+
+	// Returns what a previous run recorded for file idx, or nullptr if it never finished it
+	const SEntry *Find(size_t idx) const
+	{
+		std::map<size_t, SEntry>::const_iterator it = m_Completed.find(idx);
+		return (it != m_Completed.cend()) ? &(it->second) : nullptr;
+	}
+
+	// Checks that the file a previous run recorded is still there, exactly as it was left
+	static bool Verify(const SEntry &e)
+	{
+		HANDLE hf = CreateFile(e.m_Path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (hf == INVALID_HANDLE_VALUE)
+			return false;
+
+		LARGE_INTEGER sz;
+		bool ret = (GetFileSizeEx(hf, &sz) && ((uint64_t)sz.QuadPart == e.m_Size) && (FLZAHashFile(hf) == e.m_Crc));
+
+		CloseHandle(hf);
+
+		return ret;
+	}
+
+	// Notes that file idx has been completely installed to path, with the given size and checksum; nothing is read here,
+	// so the checksum has to come from the archive (or from wherever the file was last written)
+	void Record(size_t idx, const tstring &path, uint64_t size, uint32_t crc)
+	{
+		if (!*m_Filename || (path.length() > USHRT_MAX))
+			return;
+
+		SEntryHeader eh;
+		eh.m_Index = (uint32_t)idx;
+		eh.m_Crc = crc;
+		eh.m_Size = size;
+		eh.m_PathLen = (uint16_t)path.length();
+
+		const BYTE *peh = (const BYTE *)&eh, *ppath = (const BYTE *)path.c_str();
+		m_Pending.insert(m_Pending.end(), peh, peh + sizeof(SEntryHeader));
+		m_Pending.insert(m_Pending.end(), ppath, ppath + (eh.m_PathLen * sizeof(TCHAR)));
+
+		if ((m_Pending.size() >= FLUSH_BYTES) || ((GetTickCount() - m_LastFlush) >= FLUSH_INTERVAL_MS))
+			Flush();
+	}
+
+	// Writes out any pending entries and makes sure they're on the disk
+	void Flush()
+	{
+		m_LastFlush = GetTickCount();
+
+		if (m_Pending.empty())
+			return;
+
+		if (m_hFile == INVALID_HANDLE_VALUE)
+		{
+			m_hFile = CreateFile(m_Filename, GENERIC_WRITE, 0, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_HIDDEN, NULL);
+			if (m_hFile == INVALID_HANDLE_VALUE)
+			{
+				// the journal is only ever a shortcut; an install that can't keep one still works
+				m_Pending.clear();
+				return;
+			}
+
+			// carry on from the previous run's entries, dropping any partial one at the end; otherwise, start over
+			LARGE_INTEGER p;
+			p.QuadPart = m_ValidLength;
+			SetFilePointerEx(m_hFile, p, NULL, FILE_BEGIN);
+			SetEndOfFile(m_hFile);
+
+			DWORD bw;
+			if (!m_ValidLength)
+				WriteFile(m_hFile, &m_Header, sizeof(SHeader), &bw, NULL);
+		}
+
+		DWORD bw;
+		WriteFile(m_hFile, m_Pending.data(), (DWORD)m_Pending.size(), &bw, NULL);
+		FlushFileBuffers(m_hFile);
+
+		m_Pending.clear();
+	}
+
+	// Writes out what's pending and leaves the journal for the next run
+	void Close()
+	{
+		Flush();
+
+		if (m_hFile != INVALID_HANDLE_VALUE)
+		{
+			CloseHandle(m_hFile);
+			m_hFile = INVALID_HANDLE_VALUE;
+		}
+	}
+
+	// Removes the journal, once the install it tracks has finished
+	void Discard()
+	{
+		m_Pending.clear();
+
+		if (m_hFile != INVALID_HANDLE_VALUE)
+		{
+			CloseHandle(m_hFile);
+			m_hFile = INVALID_HANDLE_VALUE;
+		}
+
+		if (*m_Filename)
+			DeleteFile(m_Filename);
+	}
+
+protected:
+#pragma pack(push, 1)
+	struct SHeader
+	{
+		uint32_t m_Magic;
+		uint32_t m_Version;
+		uint64_t m_FileCount;
+		uint64_t m_ArchiveSize;
+		FILETIME m_ArchiveTime;
+	};
+
+	// followed by m_PathLen TCHARs of the installed file's full path
+	struct SEntryHeader
+	{
+		uint32_t m_Index;
+		uint32_t m_Crc;
+		uint64_t m_Size;
+		uint16_t m_PathLen;
+	};
+#pragma pack(pop)
+
+	TCHAR m_Filename[MAX_PATH];
+	HANDLE m_hFile;
+	SHeader m_Header;
+	size_t m_ValidLength;		// how much of the existing journal can be kept
+	DWORD m_LastFlush;
+	std::vector<BYTE> m_Pending;
+	std::map<size_t, SEntry> m_Completed;
+};
+
+// The extraction stage of an install. A worker thread decompresses and writes the files (downloading the ones that
+// have to be) in archive order, up to MAX_AHEAD files ahead of the thread that reports on them and runs their per-file
+// scripts; that way the scripts' time overlaps the I/O instead of adding to it. A file is only handed over once it's
+// completely written, so a script always finds the file it's run for
+class CExtractPipeline
+{
+public:
+	enum { MAX_AHEAD = 32 };
+
+	struct SFile
+	{
+		size_t m_Index;
+		bool m_bExtracted;	// on disk and ready for the per-file script
+		bool m_bResumed;	// finished by a previous run of the install, so there's nothing more to do for it
+		bool m_bUnchanged;	// already on disk before the install started; nothing was written, so there's nothing to journal
+		bool m_bFailed;		// the install as a whole should report a failure
+		uint64_t m_Size;	// what the journal records for the file
+		uint32_t m_Crc;
+		tstring m_Name, m_Path, m_FullPath, m_Snippet;
+		CString m_Status;	// the line for the status window
+	};
+
+	CExtractPipeline(IExtractor *pie, HANDLE hcancel, const CInstallJournal *pjournal)
+	{
+		m_pExtractor = pie;
+		m_hCancel = hcancel;
+		m_pJournal = pjournal;
+		m_Count = pie->GetFileCount();
+		m_Next = 0;
+
+		m_hThread = NULL;
+		m_hSlots = CreateSemaphore(NULL, MAX_AHEAD, MAX_AHEAD, NULL);
+		m_hReady = CreateSemaphore(NULL, 0, MAX_AHEAD + 1, NULL);
+		m_hStop = CreateEvent(NULL, TRUE, FALSE, NULL);
+		InitializeCriticalSection(&m_Lock);
+	}
+
+	~CExtractPipeline()
+	{
+		Stop();
+
+		CloseHandle(m_hSlots);
+		CloseHandle(m_hReady);
+		CloseHandle(m_hStop);
+		DeleteCriticalSection(&m_Lock);
+	}
+
+	// If ahead is false, or there's no thread, Next does the work itself, one file at a time, the way it always used to be
+	// done; that's needed when a file's script can change where the files after it go
+	void Start(bool ahead)
+	{
+		if (ahead && m_hSlots && m_hReady && m_hStop)
+			m_hThread = CreateThread(NULL, 0, WorkerProc, this, 0, NULL);
+	}
+
+	// Waits for the next file, in order; returns false when there are no more
+	bool Next(SFile &f)
+	{
+		if (!m_hThread)
+		{
+			while (m_Next < m_Count)
+			{
+				if (WaitForSingleObject(m_hCancel, 0) != WAIT_TIMEOUT)
+					return false;
+
+				if (Extract(m_Next++, f))
+					return true;
+			}
+
+			return false;
+		}
+
+		WaitForSingleObject(m_hReady, INFINITE);
+
+		EnterCriticalSection(&m_Lock);
+
+		if (m_Queue.empty())
+		{
+			// the worker has finished; leave the count up so that asking again doesn't block
+			LeaveCriticalSection(&m_Lock);
+			ReleaseSemaphore(m_hReady, 1, NULL);
+			return false;
+		}
+
+		f = std::move(m_Queue.front());
+		m_Queue.pop_front();
+
+		LeaveCriticalSection(&m_Lock);
+
+		ReleaseSemaphore(m_hSlots, 1, NULL);
+
+		return true;
+	}
+
+	// Keeps the worker from starting on any more files and waits for it
+	void Stop()
+	{
+		if (m_hThread)
+		{
+			SetEvent(m_hStop);
+			WaitForSingleObject(m_hThread, INFINITE);
+			CloseHandle(m_hThread);
+			m_hThread = NULL;
+		}
+	}
+
+protected:
+	static DWORD WINAPI WorkerProc(LPVOID param)
+	{
+		CExtractPipeline *_this = (CExtractPipeline *)param;
+
+		HANDLE h[3] = {_this->m_hSlots, _this->m_hStop, _this->m_hCancel};
+
+		for (size_t i = 0; i < _this->m_Count; i++)
+		{
+			// wait for room in the queue, unless we're told to quit
+			if (WaitForMultipleObjects(3, h, FALSE, INFINITE) != WAIT_OBJECT_0)
+				break;
+
+			SFile f;
+			if (!_this->Extract(i, f))
+			{
+				ReleaseSemaphore(_this->m_hSlots, 1, NULL);
+				continue;
+			}
+
+			EnterCriticalSection(&_this->m_Lock);
+			_this->m_Queue.push_back(std::move(f));
+			LeaveCriticalSection(&_this->m_Lock);
+
+			ReleaseSemaphore(_this->m_hReady, 1, NULL);
+		}
+
+		// one more, with nothing in the queue behind it, to tell Next that it's over
+		ReleaseSemaphore(_this->m_hReady, 1, NULL);
+
+		return 0;
+	}
+
+	// Extracts (or downloads) file i; returns false if there's no such file
+	bool Extract(size_t i, SFile &f)
+	{
+		tstring fname, fpath, snippet, ffull;
+		uint64_t usize;
+		uint32_t crc;
+		FILETIME created_time, modified_time;
+		if (!m_pExtractor->GetFileInfo(i, &fname, &fpath, NULL, &usize, &created_time, &modified_time, &snippet, &crc))
+			return false;
+
+		// an archive without a checksum for the file means reading it back once it's written, if it's to be journaled
+		bool hashed = (crc || !usize);
+
+		// skipping a file that's already done means the next one extracted is found by seeking straight to it
+		const CInstallJournal::SEntry *pje = m_pJournal ? m_pJournal->Find(i) : nullptr;
+		bool resumed = (pje && CInstallJournal::Verify(*pje));
+
+		IExtractor::EXTRACT_RESULT er;
+		if (resumed)
+		{
+			ffull = pje->m_Path;
+			er = IExtractor::ER_OK;
+		}
+		else
+		{
+			er = m_pExtractor->ExtractFile(i, &ffull, nullptr, theApp.m_TestOnlyMode);
+		}
+
+		TCHAR relfull[MAX_PATH];
+		if (!PathRelativePathTo(relfull, theApp.m_InstallPath, FILE_ATTRIBUTE_DIRECTORY, ffull.c_str(), 0))
+			_tcscpy_s(relfull, MAX_PATH, ffull.c_str());
+		if (!_tcslen(relfull))
+			_tcscpy_s(relfull, MAX_PATH, fname.c_str());
+
+		f.m_Index = i;
+		f.m_bFailed = false;
+		f.m_Status.Empty();
+
+		CString msg;
+
+		if ((er == IExtractor::ER_OK) || (er == IExtractor::ER_UNCHANGED))
+			f.m_Status.Format(_T("    %s "), relfull);
+
+		switch (er)
+		{
+			case IExtractor::ER_MUSTDOWNLOAD:
+			{
+				_tcscat_s(relfull, PathFindFileName(ffull.c_str()));
+
+				TCHAR dir[MAX_PATH], *_dir = dir;
+				_tcscpy_s(dir, ffull.c_str());
+				while (_dir && *(_dir++)) { if (*_dir == _T('/')) *_dir = _T('\\'); }
+
+				f.m_Status.Format(_T("    Downloading %s from %s ... "), relfull, fname.c_str());
+
+				if (!theApp.m_TestOnlyMode)
+				{
+					PathRemoveFileSpec(dir);
+					FLZACreateDirectories(dir);
+
+					CHttpDownloader dl;
+					if (!dl.DownloadHttpFile(fname.c_str(), ffull.c_str(), _T("")))
+					{
+						msg.Format(_T("[download failed]\r\n"));
+						break;
+					}
+				}
+
+				HANDLE dlfh = CreateFile(ffull.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, 0, NULL);
+				if (dlfh == INVALID_HANDLE_VALUE)
+				{
+					msg.Format(_T("[file error]\r\n"));
+					break;
+				}
+
+				LARGE_INTEGER fsz;
+				GetFileSizeEx(dlfh, &fsz);
+				usize = fsz.QuadPart;
+				if (m_pJournal)
+				{
+					crc = FLZAHashFile(dlfh);
+					hashed = true;
+				}
+				CloseHandle(dlfh);
+
+				std::replace(ffull.begin(), ffull.end(), _T('\\'), _T('/'));
+
+				fname = PathFindFileName(ffull.c_str());
+				fpath = ffull;
+				size_t sp = fpath.find_last_of(_T('/'));
+				if (sp < fpath.length())
+				{
+					tstring::const_iterator pit = fpath.cbegin() + sp;
+					fpath.erase(pit, fpath.cend());
+				}
+				else
+					fpath = _T("./");
+
+				er = IExtractor::ER_OK;
+			}
+
+			case IExtractor::ER_UNCHANGED:
+			case IExtractor::ER_OK:
+			{
+				std::replace(ffull.begin(), ffull.end(), _T('\\'), _T('/'));
+				std::replace(fpath.begin(), fpath.end(), _T('\\'), _T('/'));
+
+				if (resumed)
+					msg.Format(_T("(%" PRId64 "KB) [already installed]\r\n"), std::max<uint64_t>(1, usize / 1024));
+				else if (er == IExtractor::ER_UNCHANGED)
+					msg.Format(_T("(%" PRId64 "KB) [unchanged]\r\n"), std::max<uint64_t>(1, usize / 1024));
+				else
+					msg.Format(_T("(%" PRId64 "KB) [ok]\r\n"), std::max<uint64_t>(1, usize / 1024));
+
+				break;
+			}
+
+			case IExtractor::ER_PATCHMISMATCH:
+				msg.Format(_T("    %s [not the version this update applies to]\r\n"), relfull);
+				f.m_bFailed = true;
+				break;
+
+			default:
+				msg.Format(_T("    %s [failed]\r\n"), relfull);
+				f.m_bFailed = true;
+				break;
+		}
+
+		f.m_Status += msg;
+
+		f.m_bExtracted = ((er == IExtractor::ER_OK) || (er == IExtractor::ER_UNCHANGED));
+		f.m_bResumed = resumed;
+		f.m_bUnchanged = (er == IExtractor::ER_UNCHANGED);
+
+		// this is the worker thread, when there is one, so any reading back is kept off of the thread running the scripts
+		if (m_pJournal && (er == IExtractor::ER_OK) && !resumed && !hashed)
+		{
+			HANDLE hf = CreateFile(ffull.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+			if (hf != INVALID_HANDLE_VALUE)
+			{
+				crc = FLZAHashFile(hf);
+				CloseHandle(hf);
+			}
+		}
+
+		f.m_Size = usize;
+		f.m_Crc = crc;
+		f.m_Name = std::move(fname);
+		f.m_Path = std::move(fpath);
+		f.m_FullPath = std::move(ffull);
+		f.m_Snippet = std::move(snippet);
+
+		return true;
+	}
+
+	IExtractor *m_pExtractor;
+	const CInstallJournal *m_pJournal;
+	HANDLE m_hCancel;
+	size_t m_Count;
+	size_t m_Next;
+
+	HANDLE m_hThread;
+	HANDLE m_hSlots;	// counts the room left in the queue
+	HANDLE m_hReady;	// counts the files in the queue, plus one once the worker is done
+	HANDLE m_hStop;
+	CRITICAL_SECTION m_Lock;
+	std::deque<SFile> m_Queue;
+};
+
+// Separates the named functions declared at the top level of a script from everything else in it, so that they can be
+// defined once, ahead of time, instead of every time the rest of the script runs. Top-level variables are declared there too
+// (without their initializers, which stay behind as plain assignments), so that they're still globals when the rest runs
+// inside a function: they keep their values from one run to the next, and the functions can see them. Returns false if the
+// script couldn't be taken apart, in which case it should be run as it is
+static bool SplitFunctionDeclarations(const tstring &scr, tstring &decls, tstring &rest)
+{
+	decls.clear();
+	rest.clear();
+
+	try
+	{
+		CScriptLex lex(scr);
+		int64_t copied = 0;
+		int depth = 0;
+
+		while (lex.tk != LEX_EOF)
+		{
+			if ((lex.tk == LEX_R_FUNCTION) && !depth)
+			{
+				int64_t start = lex.tokenStart;
+				lex.match(LEX_R_FUNCTION);
+
+				// only "function name(...) {...}"; a function expression stays where it is
+				if (lex.tk != LEX_ID)
+					continue;
+
+				int braces = 0;
+				while ((lex.tk != LEX_EOF) && !((lex.tk == _T('}')) && (braces == 1)))
+				{
+					if (lex.tk == _T('{'))
+						braces++;
+					else if (lex.tk == _T('}'))
+						braces--;
+
+					lex.match(lex.tk);
+				}
+
+				// if it never ends, leave it for the interpreter to complain about
+				if (lex.tk == LEX_EOF)
+					break;
+
+				int64_t end = lex.tokenEnd + 1;
+				rest.append(scr, (size_t)copied, (size_t)(start - copied));
+				decls.append(scr, (size_t)start, (size_t)(end - start));
+				decls += _T('\n');
+				copied = end;
+			}
+			else if ((lex.tk == LEX_R_VAR) && !depth)
+			{
+				// "var a = x, b;" becomes "var a; var b;" up front and "a = x;" here; a declaration without a value
+				// doesn't change one that's already there, so it needs nothing left behind
+				int64_t start = lex.tokenStart;
+				lex.match(LEX_R_VAR);
+
+				tstring assigns;
+				for (;;)
+				{
+					tstring name = lex.tkStr;
+					lex.match(LEX_ID);
+
+					decls += _T("var ");
+					decls += name;
+					decls += _T(";\n");
+
+					if (lex.tk == _T('='))
+					{
+						lex.match(_T('='));
+
+						// the value ends at the first ',' or ';' that isn't nested in anything
+						int64_t vstart = lex.tokenStart, vend = vstart;
+						int nest = 0;
+						while ((lex.tk != LEX_EOF) && (nest || ((lex.tk != _T(',')) && (lex.tk != _T(';')))))
+						{
+							if ((lex.tk == _T('(')) || (lex.tk == _T('[')) || (lex.tk == _T('{')))
+								nest++;
+							else if ((lex.tk == _T(')')) || (lex.tk == _T(']')) || (lex.tk == _T('}')))
+								nest--;
+
+							vend = lex.tokenEnd + 1;
+							lex.match(lex.tk);
+						}
+
+						assigns += name;
+						assigns += _T(" = ");
+						assigns.append(scr, (size_t)vstart, (size_t)(vend - vstart));
+						assigns += _T(";");
+					}
+
+					if (lex.tk != _T(','))
+						break;
+
+					lex.match(_T(','));
+				}
+
+				// the interpreter wants the ';', so a missing one is left for it to complain about
+				int64_t end = lex.tokenEnd + 1;
+				lex.match(_T(';'));
+
+				rest.append(scr, (size_t)copied, (size_t)(start - copied));
+				rest += assigns;
+				copied = end;
+
+				continue;
+			}
+			else if (lex.tk == _T('{'))
+			{
+				depth++;
+			}
+			else if (lex.tk == _T('}'))
+			{
+				depth--;
+			}
+
+			lex.match(lex.tk);
+		}
+
+		rest.append(scr, (size_t)copied, tstring::npos);
+	}
+	catch (CScriptException *e)
+	{
+		delete e;
+
+		decls.clear();
+		rest = scr;
+
+		return false;
+	}
+
+	return true;
+}
+
+
+// ******************************************************************************
+// ******************************************************************************
+
+static void GetArchiveFilename(TCHAR *path)
+{
+	_tcscpy_s(path, MAX_PATH, theApp.m_pszHelpFilePath);
+	// if this install uses an external archive file (i.e., not one built into the exe), then use that--
+	// same base filename, but with a .data extension
+	PathRenameExtension(path, ((theApp.m_Flags & SFX_FLAG_EXTERNALARCHIVE) ? _T(".data") : _T(".exe")));
+}
+
+
+// Opens the archive and reads its file table; when it succeeds, the caller owns hfile, pah and pie. If dataofs isn't
+// null, it gets the offset of the archive in the file
+static bool OpenArchive(const TCHAR *arcpath, HANDLE &hfile, CUnpackArchiveHandle *&pah, IExtractor *&pie, uint64_t *dataofs)
+{
+	hfile = CreateFile(arcpath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
+	if (hfile == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER arcofs = {0};
+	DWORD br;
+
+	if (!(theApp.m_Flags & SFX_FLAG_EXTERNALARCHIVE))
+	{
+		SetFilePointer(hfile, -(LONG)(sizeof(LONGLONG)), NULL, FILE_END);
+		ReadFile(hfile, &(arcofs.QuadPart), sizeof(LONGLONG), &br, NULL);
+
+		pah = new CSfxHandle(hfile);
+	}
+	else
+	{
+		pah = new CExtArcHandle(hfile, arcpath);
+	}
+
+	SetFilePointerEx(hfile, arcofs, NULL, FILE_BEGIN);
+
+	pie = NULL;
+	if (IExtractor::CreateExtractor(&pie, pah) != IExtractor::CR_OK)
+	{
+		IExtractor::DestroyExtractor(&pie);
+
+		pah->Release();
+		pah = nullptr;
+
+		CloseHandle(hfile);
+		hfile = INVALID_HANDLE_VALUE;
+
+		return false;
+	}
+
+	if (dataofs)
+		*dataofs = arcofs.QuadPart;
+
+	return true;
+}
+
+
+// Opens the archive and reads its file table on a thread of its own, as soon as the installer starts, so that it's done
+// by the time the user gets through the wizard and clicks Install. Then it reads through the start of the archive's data
+// at background priority, so that the first files are already in the OS cache when extraction gets to them
+class CArchivePreloader
+{
+public:
+	enum
+	{
+		WARM_BYTES = 64 MB,
+		WARM_CHUNK = 1 MB
+	};
+
+	CArchivePreloader()
+	{
+		m_ArchivePath[0] = _T('\0');
+		m_hThread = m_hReady = m_hStop = NULL;
+		m_hFile = INVALID_HANDLE_VALUE;
+		m_pHandle = nullptr;
+		m_pExtractor = nullptr;
+		m_DataOffset = 0;
+	}
+
+	~CArchivePreloader()
+	{
+		Stop();
+	}
+
+	void Start(const TCHAR *arcpath)
+	{
+		if (m_hThread)
+			return;
+
+		_tcscpy_s(m_ArchivePath, MAX_PATH, arcpath);
+
+		m_hReady = CreateEvent(NULL, TRUE, FALSE, NULL);
+		m_hStop = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+		if (m_hReady && m_hStop)
+			m_hThread = CreateThread(NULL, 0, ThreadProc, this, 0, NULL);
+
+		if (!m_hThread)
+			CloseEvents();
+	}
+
+	// Hands over the archive that was opened for arcpath, waiting for it if it isn't ready yet; returns false if there's
+	// nothing to hand over, in which case the caller has to open the archive itself
+	bool Take(const TCHAR *arcpath, HANDLE &hfile, CUnpackArchiveHandle *&pah, IExtractor *&pie)
+	{
+		if (!m_hThread || _tcsicmp(arcpath, m_ArchivePath))
+			return false;
+
+		WaitForSingleObject(m_hReady, INFINITE);
+
+		// from here on, extraction does its own reading
+		SetEvent(m_hStop);
+
+		if (!m_pExtractor)
+			return false;
+
+		hfile = m_hFile;
+		pah = m_pHandle;
+		pie = m_pExtractor;
+
+		m_hFile = INVALID_HANDLE_VALUE;
+		m_pHandle = nullptr;
+		m_pExtractor = nullptr;
+
+		return true;
+	}
+
+	// Waits for the thread and closes whatever wasn't taken
+	void Stop()
+	{
+		if (!m_hThread)
+			return;
+
+		SetEvent(m_hStop);
+		WaitForSingleObject(m_hThread, INFINITE);
+		CloseHandle(m_hThread);
+		m_hThread = NULL;
+
+		CloseEvents();
+
+		if (m_pExtractor)
+			IExtractor::DestroyExtractor(&m_pExtractor);
+
+		if (m_pHandle)
+		{
+			m_pHandle->Release();
+			m_pHandle = nullptr;
+		}
+
+		if (m_hFile != INVALID_HANDLE_VALUE)
+		{
+			CloseHandle(m_hFile);
+			m_hFile = INVALID_HANDLE_VALUE;
+		}
+	}
+
+protected:
+	static DWORD WINAPI ThreadProc(LPVOID param)
+	{
+		CArchivePreloader *_this = (CArchivePreloader *)param;
+
+		bool opened = OpenArchive(_this->m_ArchivePath, _this->m_hFile, _this->m_pHandle, _this->m_pExtractor, &(_this->m_DataOffset));
+
+		SetEvent(_this->m_hReady);
+
+		if (opened)
+		{
+			// the wizard should stay responsive while this goes on
+			SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN);
+			_this->WarmCache();
+			SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_END);
+		}
+
+		return 0;
+	}
+
+	void WarmCache()
+	{
+		// a handle of its own, so the extractor's file pointer is left alone
+		HANDLE hf = CreateFile(m_ArchivePath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (hf == INVALID_HANDLE_VALUE)
+			return;
+
+		LARGE_INTEGER p;
+		p.QuadPart = m_DataOffset;
+		SetFilePointerEx(hf, p, NULL, FILE_BEGIN);
+
+		std::vector<BYTE> buf(WARM_CHUNK);
+
+		DWORD br = 0;
+		for (uint64_t total = 0; total < WARM_BYTES; total += br)
+		{
+			if (WaitForSingleObject(m_hStop, 0) != WAIT_TIMEOUT)
+				break;
+
+			if (!ReadFile(hf, buf.data(), WARM_CHUNK, &br, NULL) || !br)
+				break;
+		}
+
+		CloseHandle(hf);
+	}
+
+	void CloseEvents()
+	{
+		if (m_hReady)
+			CloseHandle(m_hReady);
+
+		if (m_hStop)
+			CloseHandle(m_hStop);
+
+		m_hReady = m_hStop = NULL;
+	}
+
+	TCHAR m_ArchivePath[MAX_PATH];
+	HANDLE m_hThread;
+	HANDLE m_hReady;		// set once the archive is open (or failed to open)
+	HANDLE m_hStop;
+
+	HANDLE m_hFile;
+	CUnpackArchiveHandle *m_pHandle;
+	IExtractor *m_pExtractor;
+	uint64_t m_DataOffset;
+};
+
+static CArchivePreloader s_Preloader;
+
+
+CInstallEngine::CInstallEngine(IInstallProgress *pprog, HANDLE hcancel)
+{
+	m_pProgress = pprog;
+	m_hCancel = hcancel;
+
+	GetArchiveFilename(m_ArchivePath);
+}
+
+
+void CInstallEngine::Preload()
+{
+	TCHAR arcpath[MAX_PATH];
+	GetArchiveFilename(arcpath);
+
+	s_Preloader.Start(arcpath);
+}
+
+
+CInstallEngine::~CInstallEngine()
+{
+}
+
+
+void CInstallEngine::RegisterFunctions()
+{
+	theApp.m_js.addNative(_T("function AbortInstall()"), scAbortInstall, (void *)m_pProgress);
+	theApp.m_js.addNative(_T("function CompareStrings(str1, str2)"), scCompareStrings, (void *)m_pProgress);
+	theApp.m_js.addNative(_T("function CopyFile(src, dst)"), scCopyFile, (void *)m_pProgress);
+	theApp.m_js.addNative(_T("function CreateDirectoryTree(path)"), scCreateDirectoryTree, (void *)m_pProgress);
+	theApp.m_js.addNative(_T("function CreateShortcut(file, target, args, rundir, desc, showmode, icon, iconidx)"), scCreateShortcut, (void *)m_pProgress);
+	theApp.m_js.addNative(_T("function CreateSymbolicLink(linkname, targetname)"), scCreateSymbolicLink, (void *)m_pProgress);
+	theApp.m_js.addNative(_T("function DeleteFile(path)"), scDeleteFile, (void *)m_pProgress);
+	theApp.m_js.addNative(_T("function DownloadFile(url, file)"), scDownloadFile, (void *)m_pProgress);
+	theApp.m_js.addNative(_T("function Echo(msg)"), scEcho, (void *)m_pProgress);
+	theApp.m_js.addNative(_T("function FileExists(path)"), scFileExists, (void *)m_pProgress);
+	theApp.m_js.addNative(_T("function GetCurrentDateString()"), scGetCurrentDateStr, (void *)m_pProgress);
+	theApp.m_js.addNative(_T("function GetGlobalEnvironmentVariable(varname)"), scGetGlobalEnvironmentVariable, (void *)m_pProgress);
+	theApp.m_js.addNative(_T("function GetGlobalInt(name)"), scGetGlobalInt, (void *)m_pProgress);
+	theApp.m_js.addNative(_T("function GetExeVersion(file)"), scGetExeVersion, (void *)m_pProgress);
+	theApp.m_js.addNative(_T("function GetRegistryKeyValue(root, key, name)"), scGetRegistryKeyValue, (void *)m_pProgress);
+	theApp.m_js.addNative(_T("function GetFileNameFromPath(filepath)"), scGetFileNameFromPath, (void *)m_pProgress);
+	theApp.m_js.addNative(_T("function GetLicenseKey()"), scGetLicenseKey, (void *)m_pProgress);
+	theApp.m_js.addNative(_T("function GetLicenseOrg()"), scGetLicenseOrg, (void *)m_pProgress);
+	theApp.m_js.addNative(_T("function GetLicenseUser()"), scGetLicenseUser, (void *)m_pProgress);
+	theApp.m_js.addNative(_T("function IsDirectory(path)"), scIsDirectory, (void *)m_pProgress);
+	theApp.m_js.addNative(_T("function IsDirectoryEmpty(path)"), scIsDirectoryEmpty, (void *)m_pProgress);
+	theApp.m_js.addNative(_T("function MessageBox(title, msg)"), scMessageBox, (void *)m_pProgress);
+	theApp.m_js.addNative(_T("function MessageBoxYesNo(title, msg)"), scMessageBoxYesNo, (void *)m_pProgress);
+	theApp.m_js.addNative(_T("function RegistryKeyValueExists(root, key, name)"), scRegistryKeyValueExists, (void *)m_pProgress);
+	theApp.m_js.addNative(_T("function RenameFile(filename, newname)"), scRenameFile, (void *)m_pProgress);
+	theApp.m_js.addNative(_T("function SetGlobalEnvironmentVariable(varname, val)"), scSetGlobalEnvironmentVariable, (void *)m_pProgress);
+	theApp.m_js.addNative(_T("function SetGlobalInt(name, val)"), scSetGlobalInt, (void *)m_pProgress);
+	theApp.m_js.addNative(_T("function SetRegistryKeyValue(root, key, name, val)"), scSetRegistryKeyValue, (void *)m_pProgress);
+	theApp.m_js.addNative(_T("function ShowLicenseDlg()"), scShowLicenseDlg, (void *)m_pProgress);
+	theApp.m_js.addNative(_T("function SpawnProcess(cmd, params, rundir, block)"), scSpawnProcess, (void *)m_pProgress);
+	theApp.m_js.addNative(_T("function TextFileOpen(filename, mode)"), scTextFileOpen, (void *)m_pProgress);
+	theApp.m_js.addNative(_T("function TextFileClose(handle)"), scTextFileClose, (void *)m_pProgress);
+	theApp.m_js.addNative(_T("function TextFileReadLn(handle)"), scTextFileReadLn, (void *)m_pProgress);
+	theApp.m_js.addNative(_T("function TextFileWrite(handle, text)"), scTextFileWrite, (void *)m_pProgress);
+	theApp.m_js.addNative(_T("function TextFileReachedEOF(handle)"), scTextFileReachedEOF, (void *)m_pProgress);
+}
+
+
+CInstallEngine::INSTALL_RESULT CInstallEngine::Run()
+{
+	if ((theApp.m_Flags & SFX_FLAG_EXTERNALARCHIVE) && !PathFileExists(m_ArchivePath))
+		return IR_NOARCHIVE;
+
+	CString msg;
+
+	m_pProgress->SetFilesDone(0);
+
+	RegisterFunctions();
+
+	theApp.m_InstallPath.Replace(_T("\\"), _T("/"));
+
+	if (!theApp.m_Script[CSfxApp::EScriptType::INIT].empty())
+	{
+		tstring iscr;
+
+		iscr += _T("var BASEPATH = \"");
+		iscr += (LPCTSTR)(theApp.m_InstallPath);
+		iscr += _T("\";  /* the base install path */\n\n");
+
+		iscr += theApp.m_Script[CSfxApp::EScriptType::INIT];
+
+		if (!IsScriptEmpty(iscr))
+			theApp.m_js.execute(iscr);
+	}
+
+	// The per-file script is compiled, once for each different snippet that goes with it, into a function; the helper functions
+	// and variables it declares are defined at the top level just the once. Each file then only costs a call. The file's paths
+	// are globals, as they always were, and are set before each call
+	const tstring &pfsrc = theApp.m_Script[CSfxApp::EScriptType::PERFILE];
+	tstring pfdecls, pfbody;
+	bool pfsplit = SplitFunctionDeclarations(pfsrc, pfdecls, pfbody);
+	bool pfdecls_defined = false;
+
+	// what runs for each snippet: a function to call, or failing that (if the scripts couldn't be taken apart) a script to run
+	// at the top level; both are empty if there's nothing that needs running
+	struct SPerFileScript
+	{
+		tstring m_Func;
+		tstring m_Script;
+	};
+	std::map<tstring, SPerFileScript> pffuncs;
+
+	// looked up every time, since assigning to a variable in a script replaces what it holds
+	static const TCHAR *pfglobals[4] = {_T("BASEPATH"), _T("FILENAME"), _T("PATH"), _T("FILEPATH")};
+	tstring pfvalues[4];
+	pfvalues[0] = (LPCTSTR)(theApp.m_InstallPath);
+
+	bool cancelled = false;
+	bool extract_ok = true;
+
+	HANDLE hfile = INVALID_HANDLE_VALUE;
+	CUnpackArchiveHandle *pah = nullptr;
+	IExtractor *pie = NULL;
+
+	// usually, the archive was opened and its file table read while the wizard was up
+	if (s_Preloader.Take(m_ArchivePath, hfile, pah, pie) || OpenArchive(m_ArchivePath, hfile, pah, pie, nullptr))
+	{
+		size_t maxi = pie->GetFileCount();
+
+		msg.Format(_T("Installing %d files to %s  ...\r\n"), int(maxi), (LPCTSTR)(theApp.m_InstallPath));
+		m_pProgress->Echo(msg);
+
+		m_pProgress->SetFileCount(maxi);
+
+		pie->SetBaseOutputPath((LPCTSTR)(theApp.m_InstallPath));
+
+		// re-running a build over an existing install only has to write the files that are different
+		if (theApp.m_SkipUnchanged)
+			pie->SetUpdateMode(theApp.m_VerifyUnchanged ? IExtractor::UM_SKIPVERIFIED : IExtractor::UM_SKIPUNCHANGED);
+
+		// a test run doesn't write anything, so there's nothing to resume and nothing worth recording
+		CInstallJournal journal;
+		bool journaling = !theApp.m_TestOnlyMode;
+		if (journaling)
+			journal.Load((LPCTSTR)(theApp.m_InstallPath), hfile, maxi);
+
+		// files are decompressed and written on a worker thread that runs ahead of this one, so the per-file scripts
+		// run while the next files are being extracted; a file only comes out of the pipeline once it's on disk
+		// unless a file's script can set something that the paths of the files after it are expanded from; then each one
+		// has to wait for the script before it. Functions the init script declares can be called from the per-file script
+		bool ahead = !ScriptAffectsPaths(pfsrc);
+		if (ahead)
+		{
+			tstring initdecls, initrest;
+			SplitFunctionDeclarations(theApp.m_Script[CSfxApp::EScriptType::INIT], initdecls, initrest);
+			ahead = !ScriptAffectsPaths(initdecls);
+
+			std::set<tstring> snippets;
+			tstring snippet;
+			for (size_t i = 0; ahead && (i < maxi); i++)
+			{
+				if (pie->GetFileInfo(i, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, &snippet) && snippets.insert(snippet).second)
+					ahead = !ScriptAffectsPaths(snippet);
+			}
+		}
+
+		CExtractPipeline pipeline(pie, m_hCancel, journaling ? &journal : nullptr);
+		pipeline.Start(ahead);
+
+		CExtractPipeline::SFile f;
+		while (pipeline.Next(f))
+		{
+			if (WaitForSingleObject(m_hCancel, 0) != WAIT_TIMEOUT)
+			{
+				msg.Format(_T("Operation cancelled.\r\n"));
+				cancelled = true;
+				break;
+			}
+
+			m_pProgress->SetFilesDone(f.m_Index + 1);
+
+			m_pProgress->Echo(f.m_Status);
+
+			if (f.m_bFailed)
+				extract_ok = false;
+
+			if (f.m_bExtracted && !f.m_bResumed && !(pfsrc.empty() && f.m_Snippet.empty()))
+			{
+				std::map<tstring, SPerFileScript>::const_iterator pfit = pffuncs.find(f.m_Snippet);
+				if (pfit == pffuncs.cend())
+				{
+					SPerFileScript pf;
+
+					tstring pfscr = pfsrc;
+					pfscr += _T("\n\n");
+					pfscr += f.m_Snippet;
+
+					if (!IsScriptEmpty(pfscr))
+					{
+						// the snippet's own declarations go to the top level too
+						tstring sndecls, snbody;
+						if (pfsplit && SplitFunctionDeclarations(f.m_Snippet, sndecls, snbody))
+						{
+							if (!pfdecls_defined)
+							{
+								if (!pfdecls.empty())
+									theApp.m_js.execute(pfdecls);
+
+								pfdecls_defined = true;
+							}
+
+							if (!sndecls.empty())
+								theApp.m_js.execute(sndecls);
+
+							TCHAR fnbuf[32];
+							_stprintf_s(fnbuf, _T("__sfxPerFile%d"), (int)pffuncs.size());
+							pf.m_Func = fnbuf;
+
+							tstring fndef = _T("function ");
+							fndef += pf.m_Func;
+							fndef += _T("()\n{\n");
+							fndef += pfbody;
+							fndef += _T("\n\n");
+							fndef += snbody;
+							fndef += _T("\n}\n");
+
+							theApp.m_js.execute(fndef);
+						}
+						else
+						{
+							pf.m_Script.swap(pfscr);
+						}
+					}
+
+					pfit = pffuncs.insert(std::make_pair(f.m_Snippet, pf)).first;
+				}
+
+				if (!pfit->second.m_Func.empty() || !pfit->second.m_Script.empty())
+				{
+					pfvalues[1] = f.m_Name;
+					pfvalues[2] = f.m_Path;
+					pfvalues[3] = f.m_FullPath;
+
+					for (size_t g = 0; g < 4; g++)
+						theApp.m_js.root->findChildOrCreate(pfglobals[g])->var->setString(pfvalues[g]);
+
+					if (!pfit->second.m_Func.empty())
+						theApp.m_js.callFunction(pfit->second.m_Func, std::vector<tstring>());
+					else
+						theApp.m_js.execute(pfit->second.m_Script);
+				}
+			}
+
+			// only once its script has run is a file really done
+			if (journaling && f.m_bExtracted && !f.m_bResumed && !f.m_bUnchanged)
+				journal.Record(f.m_Index, f.m_FullPath, f.m_Size, f.m_Crc);
+		}
+
+		// stops the worker, if it's still going, before the extractor goes away
+		pipeline.Stop();
+
+		// a complete install has no more use for its journal; anything else leaves it for the next attempt
+		if (journaling)
+		{
+			if (!cancelled && extract_ok && (WaitForSingleObject(m_hCancel, 0) == WAIT_TIMEOUT))
+				journal.Discard();
+			else
+				journal.Close();
+		}
+
+		IExtractor::DestroyExtractor(&pie);
+
+		pah->Release();
+
+		CloseHandle(hfile);
+	}
+
+	s_Preloader.Stop();
+
+	if (!theApp.m_Script[CSfxApp::EScriptType::FINISH].empty())
+	{
+		tstring fscr;
+
+		fscr += _T("var BASEPATH = \"");
+		fscr += (LPCTSTR)(theApp.m_InstallPath);
+		fscr += _T("\";  /* the base install path */\n\n");
+
+		fscr += theApp.m_Script[CSfxApp::EScriptType::FINISH];
+
+		if (!IsScriptEmpty(fscr))
+			theApp.m_js.execute(fscr);
+	}
+
+	msg.Format(_T("Done.\r\n"));
+	m_pProgress->Echo(msg);
+
+	if (cancelled || (WaitForSingleObject(m_hCancel, 0) != WAIT_TIMEOUT))
+		return IR_CANCELLED;
+
+	return extract_ok ? IR_OK : IR_FAILED;
+}
+
+
+// ******************************************************************************
+// ******************************************************************************
+
+HANDLE CConsoleInstallProgress::s_hCancel = NULL;
+
+CConsoleInstallProgress::CConsoleInstallProgress()
+{
+	// the installer is a windowed app with no console of its own, so borrow the one it was started from, if any
+	AttachConsole(ATTACH_PARENT_PROCESS);
+
+	m_hOut = GetStdHandle(STD_OUTPUT_HANDLE);
+
+	DWORD mode;
+	m_IsConsole = (m_hOut && (m_hOut != INVALID_HANDLE_VALUE) && GetConsoleMode(m_hOut, &mode));
+
+	s_hCancel = CreateEvent(NULL, TRUE, FALSE, NULL);
+	SetConsoleCtrlHandler(CtrlHandler, TRUE);
+}
+
+
+CConsoleInstallProgress::~CConsoleInstallProgress()
+{
+	SetConsoleCtrlHandler(CtrlHandler, FALSE);
+
+	CloseHandle(s_hCancel);
+	s_hCancel = NULL;
+}
+
+
+BOOL WINAPI CConsoleInstallProgress::CtrlHandler(DWORD type)
+{
+	if ((type != CTRL_C_EVENT) && (type != CTRL_BREAK_EVENT))
+		return FALSE;
+
+	// the install stops after the file it's on, and still runs its finish script
+	SetEvent(s_hCancel);
+
+	return TRUE;
+}
+
+
+void CConsoleInstallProgress::SetFileCount(size_t count)
+{
+	// every file gets its own line, so there's no separate progress to show
+}
+
+
+void CConsoleInstallProgress::SetFilesDone(size_t count)
+{
+}
+
+
+void CConsoleInstallProgress::Echo(const TCHAR *msg)
+{
+	if (!msg || !*msg || !m_hOut || (m_hOut == INVALID_HANDLE_VALUE))
+		return;
+
+	DWORD len = (DWORD)_tcslen(msg), w;
+
+	if (m_IsConsole)
+	{
+		WriteConsole(m_hOut, msg, len, &w, NULL);
+		return;
+	}
+
+#if defined(_UNICODE)
+	int sz = WideCharToMultiByte(CP_UTF8, 0, msg, (int)len, NULL, 0, NULL, NULL);
+	if (sz <= 0)
+		return;
+
+	std::vector<char> buf(sz);
+	WideCharToMultiByte(CP_UTF8, 0, msg, (int)len, buf.data(), sz, NULL, NULL);
+
+	WriteFile(m_hOut, buf.data(), (DWORD)sz, &w, NULL);
+#else
+	WriteFile(m_hOut, msg, len, &w, NULL);
+#endif
+}
+
+
+void CConsoleInstallProgress::ShowMessage(const TCHAR *title, const TCHAR *msg)
+{
+	CString s;
+	s.Format(_T("%s: %s\r\n"), title, msg);
+	Echo(s);
+}
+
+
+bool CConsoleInstallProgress::AskYesNo(const TCHAR *title, const TCHAR *msg)
+{
+	// nobody's there to ask, so the script gets the answer that lets the install carry on
+	CString s;
+	s.Format(_T("%s: %s [yes]\r\n"), title, msg);
+	Echo(s);
+
+	return true;
+}
+
+
+bool CConsoleInstallProgress::ShowLicense()
+{
+	// nobody's there to read it, so agreeing to it has to have been done up front
+	if (theApp.m_LicenseKey.IsEmpty())
+	{
+		Echo(_T("This installation requires a license; use -license= (and -licenseuser= and -licenseorg=, if needed) to provide one.\r\n"));
+		return false;
+	}
+
+	return true;
+}
+
+
+void CConsoleInstallProgress::GetLicense(tstring &key, tstring &user, tstring &org)
+{
+	key = (LPCTSTR)theApp.m_LicenseKey;
+	user = (LPCTSTR)theApp.m_LicenseUser;
+	org = (LPCTSTR)theApp.m_LicenseOrg;
+}
@@ -0,0 +1,118 @@
+/*
+	Copyright © 2013-2020, Keelan Stuart (hereafter referenced as AUTHOR). All Rights Reserved.
+	Permission to use, copy, modify, and distribute this software is hereby granted, without fee and without a signed licensing agreement,
+	provided that the above copyright notice appears in all copies, modifications, and distributions.
+	Furthermore, AUTHOR assumes no responsibility for any damages caused either directly or indirectly by the use of this software, nor vouches for
+	any fitness of purpose of this software.
+	All other copyrighted material contained herein is noted and rights attributed to individual copyright holders.
+	
+	For inquiries, contact: keelanstuart@gmail.com
+*/
+
+
+// InstallEngine.h : the install itself, independent of whatever is showing it to the user
+//
+
+#pragma once
+
+
+// Receives everything an install has to say or ask while it runs; the progress dialog is one of these, and so is the
+// console that a silent install reports to. Calls come from the thread that runs the install
+class IInstallProgress
+{
+public:
+	// The number of files the install will go through
+	virtual void SetFileCount(size_t count) = NULL;
+
+	// How many of those have been dealt with so far
+	virtual void SetFilesDone(size_t count) = NULL;
+
+	// Adds msg to the install's status output
+	virtual void Echo(const TCHAR *msg) = NULL;
+
+	// Shows a script's message; a host with nobody to show it to may just log it
+	virtual void ShowMessage(const TCHAR *title, const TCHAR *msg) = NULL;
+
+	// Asks a script's yes / no question; a host with nobody to ask has to answer it itself
+	virtual bool AskYesNo(const TCHAR *title, const TCHAR *msg) = NULL;
+
+	// Asks for license information; returns false if the user declined, in which case the install goes no further
+	virtual bool ShowLicense() = NULL;
+
+	// Returns whatever license information was entered
+	virtual void GetLicense(tstring &key, tstring &user, tstring &org) = NULL;
+};
+
+
+// Runs an install: the init script, then every file in the archive (with its per-file script), then the finish script.
+// Settings come from the application; everything the user would see goes through the IInstallProgress
+class CInstallEngine
+{
+public:
+	enum INSTALL_RESULT
+	{
+		IR_OK = 0,
+
+		IR_NOARCHIVE,			// the archive data couldn't be found
+
+		IR_CANCELLED,
+
+		IR_FAILED,				// one or more files couldn't be extracted
+
+		IR_NOTELEVATED,			// the package needs administrative privileges, and a silent install can't ask for them
+
+		IR_NOTLICENSED			// the license wasn't accepted; a silent install needs -license= for that
+	};
+
+	// hcancel is an event that stops the install when it's set
+	CInstallEngine(IInstallProgress *pprog, HANDLE hcancel);
+
+	~CInstallEngine();
+
+	// The file that the archive is read from; the exe itself, unless the package keeps its data on the side
+	const TCHAR *GetArchivePath() const { return m_ArchivePath; }
+
+	INSTALL_RESULT Run();
+
+	// Starts opening the archive and reading its file table in the background, for the next Run to pick up; call it as
+	// soon as the application's flags are known
+	static void Preload();
+
+protected:
+	void RegisterFunctions();
+
+	IInstallProgress *m_pProgress;
+	HANDLE m_hCancel;
+	TCHAR m_ArchivePath[MAX_PATH];
+};
+
+
+// Reports a silent install on the console of the process that started it (or wherever its output was redirected) and
+// answers yes to any of the scripts' questions, since nobody is there to ask; Ctrl+C cancels. The license is only
+// accepted if it was on the command line (-license=, with -licenseuser= and -licenseorg=)
+class CConsoleInstallProgress : public IInstallProgress
+{
+public:
+	CConsoleInstallProgress();
+
+	virtual ~CConsoleInstallProgress();
+
+	// The event that's set when the user asks to stop
+	HANDLE GetCancelEvent() const { return s_hCancel; }
+
+	virtual void SetFileCount(size_t count);
+	virtual void SetFilesDone(size_t count);
+	virtual void Echo(const TCHAR *msg);
+	virtual void ShowMessage(const TCHAR *title, const TCHAR *msg);
+	virtual bool AskYesNo(const TCHAR *title, const TCHAR *msg);
+	virtual bool ShowLicense();
+	virtual void GetLicense(tstring &key, tstring &user, tstring &org);
+
+protected:
+	static BOOL WINAPI CtrlHandler(DWORD type);
+
+	static HANDLE s_hCancel;
+
+	HANDLE m_hOut;
+	bool m_IsConsole;		// otherwise, the output's been redirected and gets written as UTF-8
+};
@@ -11,10 +11,11 @@
 
 #pragma once
 
+#include "InstallEngine.h"
 
 // CProgressDlg dialog
 
-class CProgressDlg : public CDialogEx
+class CProgressDlg : public CDialogEx, public IInstallProgress
 {
 	DECLARE_DYNAMIC(CProgressDlg)
 
@@ -22,7 +23,14 @@ public:
 	CProgressDlg(CWnd* pParent = NULL);   // standard constructor
 	virtual ~CProgressDlg();
 
-	void Echo(const TCHAR *msg);
+	// IInstallProgress; the install thread reports to the dialog's controls and asks its questions over the dialog
+	virtual void SetFileCount(size_t count);
+	virtual void SetFilesDone(size_t count);
+	virtual void Echo(const TCHAR *msg);
+	virtual void ShowMessage(const TCHAR *title, const TCHAR *msg);
+	virtual bool AskYesNo(const TCHAR *title, const TCHAR *msg);
+	virtual bool ShowLicense();
+	virtual void GetLicense(tstring &key, tstring &user, tstring &org);
 
 // Dialog Data
 	enum { IDD = IDD_PROGRESS_DIALOG };
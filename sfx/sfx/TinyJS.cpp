@@ -1801,6 +1801,75 @@ void CTinyJS::execute(const tstring &code)
 	scopes = oldScopes;
 }
 
+bool CTinyJS::callFunction(const tstring &funcName, const vector<tstring> &args)
+{
+	CScriptVarLink *function = root->findChild(funcName);
+	if (!function || !function->var->isFunction())
+		return false;
+
+	CScriptLex *oldLex = l;
+	vector<CScriptVar *> oldScopes = scopes;
+
+#ifdef TINYJS_CALL_STACK
+	call_stack.clear();
+	call_stack.push_back(funcName);
+#endif
+
+	scopes.clear();
+	scopes.push_back(root);
+
+	// set up the arguments the way functionCall does, but from the strings we were given instead of parsed expressions
+	CScriptVar *functionRoot = new CScriptVar(TINYJS_BLANK_DATA, SCRIPTVAR_FUNCTION);
+	size_t argi = 0;
+	for (CScriptVarLink *v = function->var->firstChild; v; v = v->nextSibling, argi++)
+		functionRoot->addChild(v->name, (argi < args.size()) ? new CScriptVar(args[argi]) : new CScriptVar());
+
+	functionRoot->addChild(TINYJS_RETURN_VAR);
+	scopes.push_back(functionRoot);
+
+	bool ret = true;
+
+	if (function->var->isNative())
+	{
+		ASSERT(function->var->jsCallback);
+		function->var->jsCallback(functionRoot, function->var->jsCallbackUserData);
+	}
+	else
+	{
+		l = new CScriptLex(function->var->getString());
+
+		try
+		{
+			bool execute = true;
+			block(execute);
+		}
+		catch (CScriptException *e)
+		{
+			tstringstream msg;
+			msg << _T("Error ") << e->text;
+
+#ifdef TINYJS_CALL_STACK
+			for (int64_t i = (int64_t)call_stack.size() - 1; i >= 0; i--)
+				msg << _T("\n") << i << _T(": ") << call_stack.at(i);
+#endif
+			msg << _T(" at ") << l->getPosition();
+			last_error = msg.str();
+
+			delete e;
+			ret = false;
+		}
+
+		delete l;
+	}
+
+	l = oldLex;
+	scopes = oldScopes;
+
+	delete functionRoot;
+
+	return ret;
+}
+
 CScriptVarLink CTinyJS::evaluateComplex(const tstring &code)
 {
 	CScriptLex *oldLex = l;
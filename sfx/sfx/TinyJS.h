@@ -300,6 +300,11 @@ public:
     /** Evaluate the given code and return a string. If nothing to return, will return
      * 'undefined' */
     tstring evaluate(const tstring &code);
+    /** Call a function defined at the root scope, passing the given strings as its
+     * arguments (missing ones are undefined). Nothing has to be lexed to make the call
+     * itself, only the function's own body. Returns false if there's no such function
+     * or it raised an error */
+    bool callFunction(const tstring &funcName, const std::vector<tstring> &args);
 
     /// add a native function to be called from TinyJS
     /** example:
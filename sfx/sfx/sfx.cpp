@@ -20,6 +20,7 @@
 #include "WelcomeDlg.h"
 #include "ProgressDlg.h"
 #include "FinishDlg.h"
+#include "InstallEngine.h"
 
 #include "../sfxFlags.h"
 
@@ -92,6 +93,31 @@ CDialog *CreateSfxDialog(ESfxDlgType dt)
 	return NULL;
 }
 
+// Finds name (e.g., "-dest=") on the command line and gets the value that follows it, which is quoted if it has spaces
+static bool GetCommandLineValue(const TCHAR *cmdline, const TCHAR *name, CString &val)
+{
+	const TCHAR *p = _tcsstr(cmdline, name);
+	if (!p)
+		return false;
+
+	p += _tcslen(name);
+
+	TCHAR term = _T(' ');
+	if (*p == _T('"'))
+	{
+		term = _T('"');
+		p++;
+	}
+
+	const TCHAR *e = p;
+	while (*e && (*e != term))
+		e++;
+
+	val = CString(p, (int)(e - p));
+
+	return !val.IsEmpty();
+}
+
 void RemoveQuitMessage(HWND hwnd)
 {
 	MSG tmp;
@@ -128,6 +154,9 @@ BOOL CSfxApp::InitInstance()
 #endif
 
 	m_TestOnlyMode = false;
+	m_SkipUnchanged = false;
+	m_VerifyUnchanged = false;
+	m_SilentMode = false;
 
 	registerFunctions(&m_js);
 	registerMathFunctions(&m_js);
@@ -183,8 +212,27 @@ BOOL CSfxApp::InitInstance()
 		m_Caption += _T(" (TEST ONLY)");
 	}
 
+	if (_tcsstr(m_lpCmdLine, _T("-update")) != nullptr)
+	{
+		m_SkipUnchanged = true;
+		m_VerifyUnchanged = (_tcsstr(m_lpCmdLine, _T("-update:verify")) != nullptr);
+	}
+
+	// a silent install goes to -dest=, if it's given, or the default path if it isn't
+	m_SilentMode = (_tcsstr(m_lpCmdLine, _T("-silent")) != nullptr);
+
+	GetCommandLineValue(m_lpCmdLine, _T("-license="), m_LicenseKey);
+	GetCommandLineValue(m_lpCmdLine, _T("-licenseuser="), m_LicenseUser);
+	GetCommandLineValue(m_lpCmdLine, _T("-licenseorg="), m_LicenseOrg);
+
 	bool runnow = false;
-	if (!m_TestOnlyMode && PathIsDirectory(m_lpCmdLine))
+	CString dest;
+	if (GetCommandLineValue(m_lpCmdLine, _T("-dest="), dest))
+	{
+		m_InstallPath = dest;
+		runnow = true;
+	}
+	else if (!m_TestOnlyMode && PathIsDirectory(m_lpCmdLine))
 	{
 		m_InstallPath = m_lpCmdLine;
 		runnow = true;
@@ -229,6 +277,14 @@ BOOL CSfxApp::InitInstance()
 			CloseHandle(htoken);
 		}
 
+		if (!has_privs && m_SilentMode)
+		{
+			// there's nobody to ask, so whatever started the install has to have started it elevated
+			CConsoleInstallProgress prog;
+			prog.Echo(_T("This installation requires administrative privileges.\r\n"));
+			ExitProcess((UINT)CInstallEngine::IR_NOTELEVATED);
+		}
+
 		if (!has_privs)
 		{
 			if (MessageBox(NULL, _T("This installation requires administrative privileges.\r\nWould you like to elevate permissions?"), _T("UAC Override Required"), MB_YESNO) == IDYES)
@@ -255,6 +311,29 @@ BOOL CSfxApp::InitInstance()
 	m_SpaceRequired.QuadPart = furd ? furd->m_SpaceRequired.QuadPart : 0;
 	m_CompressedFileCount = furd ? furd->m_CompressedFileCount : 0;
 
+	if (m_SilentMode)
+	{
+		CConsoleInstallProgress prog;
+		CInstallEngine engine(&prog, prog.GetCancelEvent());
+
+		CInstallEngine::INSTALL_RESULT ir = engine.Run();
+		if (ir == CInstallEngine::IR_NOARCHIVE)
+		{
+			CString m;
+			m.Format(_T("The installation could not continue because the file \"%s\" could not be found.\r\n"), engine.GetArchivePath());
+			prog.Echo(m);
+		}
+
+		if (pShellManager != NULL)
+			delete pShellManager;
+
+		// the exit code is all a deployment script has to go on
+		ExitProcess((UINT)ir);
+	}
+
+	// the archive's file table is read while the user goes through the wizard, instead of after they click Install
+	CInstallEngine::Preload();
+
 	UINT dt = runnow ? DT_PROGRESS : DT_FIRST;
 
 	while (dt != DT_QUIT)
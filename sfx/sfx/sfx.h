@@ -42,6 +42,12 @@ public:
 	UINT32 m_ZipParts;
 
 	bool m_TestOnlyMode;
+	bool m_SkipUnchanged;		// -update: files already installed from this build aren't written again
+	bool m_VerifyUnchanged;		// -update:verify: ...and they're hashed to be sure
+	bool m_SilentMode;			// -silent: no windows; reports to the console and exits with a CInstallEngine::INSTALL_RESULT
+
+	// -license=, -licenseuser=, -licenseorg=: what a silent install gives the scripts in place of the license dialog
+	CString m_LicenseKey, m_LicenseUser, m_LicenseOrg;
 
 	CTinyJS m_js;
 
@@ -52,6 +52,7 @@
 #include <inttypes.h>
 
 #include <string>
+#include <string_view>
 #include <deque>
 #include <map>
 #include <vector>
@@ -103,6 +104,7 @@
 
 
 typedef std::basic_string<TCHAR> tstring;
+typedef std::basic_string_view<TCHAR> tstring_view;
 typedef std::basic_ios<TCHAR, std::char_traits<TCHAR>> tios;
 typedef std::basic_streambuf<TCHAR, std::char_traits<TCHAR>> tstreambuf;
 typedef std::basic_istream<TCHAR, std::char_traits<TCHAR>> tistream;
@@ -0,0 +1,420 @@
+/*
+	Copyright © 2013-2020, Keelan Stuart (hereafter referenced as AUTHOR). All Rights Reserved.
+	Permission to use, copy, modify, and distribute this software is hereby granted, without fee and without a signed licensing agreement,
+	provided that the above copyright notice appears in all copies, modifications, and distributions.
+	Furthermore, AUTHOR assumes no responsibility for any damages caused either directly or indirectly by the use of this software, nor vouches for
+	any fitness of purpose of this software.
+	All other copyrighted material contained herein is noted and rights attributed to individual copyright holders.
+	
+	For inquiries, contact: keelanstuart@gmail.com
+*/
+
+
+#include "stdafx.h"
+
+#include "BuildManifest.h"
+
+
+CBuildManifest::CBuildManifest(const TCHAR *basepath, HANDLE hcancel, CSourceWatcher *pwatcher)
+{
+	_tcscpy_s(m_BasePath, MAX_PATH, basepath ? basepath : _T(""));
+
+	InitializeCriticalSection(&m_QueueLock);
+	m_hQueueSem = CreateSemaphore(NULL, 0, LONG_MAX, NULL);
+	m_hDoneEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	m_hCancelEvent = hcancel;
+	m_Outstanding = 0;
+
+	m_pWatcher = pwatcher;
+	m_DirCount = 0;
+	m_WatchedDirCount = 0;
+
+	m_TotalSize = 0;
+}
+
+
+CBuildManifest::~CBuildManifest()
+{
+	for (auto pnode : m_Roots)
+		FreeNode(pnode);
+
+	CloseHandle(m_hDoneEvent);
+	CloseHandle(m_hQueueSem);
+	DeleteCriticalSection(&m_QueueLock);
+}
+
+
+void CBuildManifest::FreeNode(SScanNode *pnode)
+{
+	for (auto &item : pnode->m_Items)
+	{
+		if (item.m_pChild)
+			FreeNode(item.m_pChild);
+	}
+
+	delete pnode;
+}
+
+
+// Returns where the filename part of a source spec begins: after the last separator that comes before any wildcard or ';'. The
+// filename part may itself be a list with directories in it (e.g. "*.exe;bin\*.dll"), which is matched relative to what precedes it
+static const TCHAR *FindFileSpec(const TCHAR *srcspec)
+{
+	const TCHAR *c = srcspec;
+
+	// the '?' of a "\\?\" prefix isn't a wildcard
+	if (!_tcsncmp(c, _T("\\\\?\\"), 4))
+		c += 4;
+
+	const TCHAR *end = c + _tcscspn(c, _T("*?;"));
+
+	const TCHAR *ret = srcspec;
+	for (; c < end; c++)
+	{
+		if ((*c == _T('\\')) || (*c == _T('/')))
+			ret = c + 1;
+	}
+
+	return ret;
+}
+
+
+void CBuildManifest::AddSource(const TCHAR *srcspec, const TCHAR *excludespec, const TCHAR *snippet, const TCHAR *dstpath, const TCHAR *dstfilename)
+{
+	if (!srcspec)
+		return;
+
+	m_Strings.push_back(snippet ? snippet : _T(""));
+	const tstring *psnippet = &m_Strings.back();
+
+	m_Matchers.emplace_back(excludespec);
+	const CFileSpecMatcher *pexclude = &m_Matchers.back();
+
+	SScanNode *pnode = new SScanNode;
+	pnode->m_pInclude = nullptr;
+	pnode->m_pExclude = pexclude;
+	pnode->m_pSnippet = psnippet;
+	pnode->m_Missing = false;
+	pnode->m_Wildcard = false;
+
+	m_Roots.push_back(pnode);
+
+	const TCHAR *pss = srcspec;
+	if (!_tcsnicmp(pss, _T("http"), 4))
+	{
+		pss += 4;
+		if (!_tcsnicmp(pss, _T("s"), 1))
+			pss++;
+
+		// download references don't need scanning; they go straight in
+		if (!_tcsnicmp(pss, _T("://"), 3))
+		{
+			TCHAR local_dstpath[MAX_PATH], *dp = local_dstpath;
+			_tcscpy_s(local_dstpath, dstpath ? dstpath : _T(""));
+			if (_tcslen(local_dstpath) > 0)
+				PathAddBackslash(local_dstpath);
+			_tcscat_s(local_dstpath, dstfilename ? dstfilename : _T(""));
+
+			while (dp && *(dp++)) { if (*dp == _T('/')) *dp = _T('\\'); }
+
+			SScanItem item;
+			item.m_pChild = nullptr;
+			item.m_Entry.m_Src = srcspec;
+			item.m_Entry.m_Dst = local_dstpath;
+			item.m_Entry.m_Snippet = *psnippet;
+			item.m_Entry.m_Size = 0;
+			item.m_Entry.m_Modified.dwLowDateTime = item.m_Entry.m_Modified.dwHighDateTime = 0;
+			item.m_Entry.m_Attributes = 0;
+			item.m_Entry.m_Download = true;
+
+			pnode->m_Items.push_back(item);
+
+			return;
+		}
+	}
+
+	const TCHAR *pfilespec = FindFileSpec(srcspec);
+	tstring srcdir(srcspec, pfilespec - srcspec);
+
+	pnode->m_FileSpec = pfilespec;
+	pnode->m_Wildcard = (pnode->m_FileSpec.find_first_of(_T("*?;\\/")) != tstring::npos);
+
+	m_Matchers.emplace_back(pnode->m_FileSpec.c_str());
+	pnode->m_pInclude = &m_Matchers.back();
+
+	// anything with wildcards, a list, or a path of its own in it is matched by the include spec against a full listing
+	TCHAR fullfilename[MAX_PATH];
+	if (PathIsRelative(srcspec))
+		PathCombine(fullfilename, m_BasePath, srcdir.c_str());
+	else
+		_tcscpy_s(fullfilename, srcdir.c_str());
+	PathAppend(fullfilename, pnode->m_Wildcard ? _T("*") : pfilespec);
+
+	if (!pnode->m_Wildcard && dstfilename)
+	{
+		pnode->m_DstFilename = dstfilename;
+	}
+
+	pnode->m_Pattern = fullfilename;
+
+	if (dstpath)
+	{
+		if (!PathIsNetworkPath(dstpath) && (*dstpath == _T('\\')))
+			dstpath++;
+
+		pnode->m_DstPath = dstpath;
+	}
+}
+
+
+void CBuildManifest::QueueNode(SScanNode *pnode)
+{
+	InterlockedIncrement(&m_Outstanding);
+
+	EnterCriticalSection(&m_QueueLock);
+	m_Queue.push_back(pnode);
+	LeaveCriticalSection(&m_QueueLock);
+
+	ReleaseSemaphore(m_hQueueSem, 1, NULL);
+}
+
+
+bool CBuildManifest::ListNode(SScanNode *pnode, const TCHAR *dir, CSourceWatcher::TListing &listing)
+{
+	InterlockedIncrement(&m_DirCount);
+
+	// only a whole directory's listing is worth keeping (a pattern that names a single file is matched as it's listed)
+	bool watched = m_pWatcher && pnode->m_Wildcard;
+	if (watched && m_pWatcher->GetListing(dir, listing))
+	{
+		InterlockedIncrement(&m_WatchedDirCount);
+		return true;
+	}
+
+	ULONGLONG token = watched ? m_pWatcher->BeginListing(dir) : 0;
+
+	WIN32_FIND_DATA fd;
+	HANDLE hfind = FindFirstFileEx(pnode->m_Pattern.c_str(), FindExInfoBasic, &fd, FindExSearchNameMatch, NULL, FIND_FIRST_EX_LARGE_FETCH);
+	if (hfind == INVALID_HANDLE_VALUE)
+		return false;
+
+	bool cancelled = false;
+
+	do
+	{
+		if (WaitForSingleObject(m_hCancelEvent, 0) != WAIT_TIMEOUT)
+		{
+			cancelled = true;
+			break;
+		}
+
+		if (!_tcscmp(fd.cFileName, _T(".")) || !_tcscmp(fd.cFileName, _T("..")))
+			continue;
+
+		CSourceWatcher::SItem item;
+		item.m_Name = fd.cFileName;
+		item.m_Size = (((uint64_t)fd.nFileSizeHigh) << 32) | fd.nFileSizeLow;
+		item.m_Modified = fd.ftLastWriteTime;
+		item.m_Attributes = fd.dwFileAttributes;
+
+		listing.push_back(item);
+	}
+	while (FindNextFile(hfind, &fd));
+
+	FindClose(hfind);
+
+	// a partial listing is no good to anyone later
+	if (token && !cancelled)
+		m_pWatcher->StoreListing(dir, token, listing);
+
+	return true;
+}
+
+
+void CBuildManifest::ScanNode(SScanNode *pnode)
+{
+	// the directory the pattern is in, which everything found is relative to
+	TCHAR dir[MAX_PATH];
+	_tcscpy_s(dir, MAX_PATH, pnode->m_Pattern.c_str());
+	PathRemoveFileSpec(dir);
+
+	CSourceWatcher::TListing listing;
+	if (!ListNode(pnode, dir, listing))
+	{
+		pnode->m_Missing = !pnode->m_Wildcard;
+		return;
+	}
+
+	for (const auto &li : listing)
+	{
+		if (WaitForSingleObject(m_hCancelEvent, 0) != WAIT_TIMEOUT)
+			break;
+
+		TCHAR fullfilename[MAX_PATH];
+		PathCombine(fullfilename, dir, li.m_Name.c_str());
+
+		SScanItem item;
+		item.m_pChild = nullptr;
+
+		if (li.m_Attributes & FILE_ATTRIBUTE_DIRECTORY)
+		{
+			// an empty directory produces nothing, so it doesn't need checking for first; subdirectories are listed in full, since
+			// their names don't have to match the spec that the files do
+			SScanNode *pchild = new SScanNode;
+
+			PathAppend(fullfilename, pnode->m_Wildcard ? _T("*") : pnode->m_FileSpec.c_str());
+			pchild->m_Pattern = fullfilename;
+			pchild->m_FileSpec = pnode->m_FileSpec;
+
+			pchild->m_DstPath = pnode->m_DstPath;
+			if (!pchild->m_DstPath.empty())
+				pchild->m_DstPath += _T('\\');
+			pchild->m_DstPath += li.m_Name;
+
+			pchild->m_RelDir = pnode->m_RelDir;
+			pchild->m_RelDir += li.m_Name;
+			pchild->m_RelDir += _T('\\');
+
+			pchild->m_pInclude = pnode->m_pInclude;
+			pchild->m_pExclude = pnode->m_pExclude;
+			pchild->m_pSnippet = pnode->m_pSnippet;
+			pchild->m_Wildcard = pnode->m_Wildcard;
+			pchild->m_Missing = false;
+
+			item.m_pChild = pchild;
+			pnode->m_Items.push_back(item);
+
+			QueueNode(pchild);
+		}
+		else if (pnode->m_pInclude->Matches(li.m_Name.c_str(), pnode->m_RelDir.c_str()) && !pnode->m_pExclude->Matches(li.m_Name.c_str(), pnode->m_RelDir.c_str()))
+		{
+			item.m_Entry.m_Src = fullfilename;
+
+			item.m_Entry.m_Dst = pnode->m_DstPath;
+			if (!item.m_Entry.m_Dst.empty())
+				item.m_Entry.m_Dst += _T('\\');
+			item.m_Entry.m_Dst += (!pnode->m_Wildcard && !pnode->m_DstFilename.empty()) ? pnode->m_DstFilename.c_str() : li.m_Name.c_str();
+
+			item.m_Entry.m_Snippet = *(pnode->m_pSnippet);
+			item.m_Entry.m_Size = li.m_Size;
+			item.m_Entry.m_Modified = li.m_Modified;
+			item.m_Entry.m_Attributes = li.m_Attributes;
+			item.m_Entry.m_Download = false;
+
+			pnode->m_Items.push_back(item);
+		}
+	}
+}
+
+
+DWORD WINAPI CBuildManifest::ScanThreadProc(LPVOID param)
+{
+	CBuildManifest *_this = (CBuildManifest *)param;
+
+	HANDLE h[3] = {_this->m_hDoneEvent, _this->m_hCancelEvent, _this->m_hQueueSem};
+
+	while (WaitForMultipleObjects(3, h, FALSE, INFINITE) == (WAIT_OBJECT_0 + 2))
+	{
+		EnterCriticalSection(&_this->m_QueueLock);
+		SScanNode *pnode = _this->m_Queue.front();
+		_this->m_Queue.pop_front();
+		LeaveCriticalSection(&_this->m_QueueLock);
+
+		_this->ScanNode(pnode);
+
+		// the last node to finish, with nothing more queued by it, means the whole scan is done
+		if (!InterlockedDecrement(&_this->m_Outstanding))
+			SetEvent(_this->m_hDoneEvent);
+	}
+
+	return 0;
+}
+
+
+void CBuildManifest::Collect(SScanNode *pnode)
+{
+	if (pnode->m_Missing)
+		m_Missing.push_back(pnode->m_Pattern);
+
+	for (auto &item : pnode->m_Items)
+	{
+		if (item.m_pChild)
+		{
+			Collect(item.m_pChild);
+		}
+		else
+		{
+			m_Entries.push_back(item.m_Entry);
+			m_TotalSize += item.m_Entry.m_Size;
+		}
+	}
+}
+
+
+bool CBuildManifest::Scan(UINT maxthreads)
+{
+	m_Entries.clear();
+	m_Missing.clear();
+	m_TotalSize = 0;
+	m_DirCount = 0;
+	m_WatchedDirCount = 0;
+
+	// listing directories is mostly waiting, so there can be more threads than processors
+	if (!maxthreads)
+	{
+		SYSTEM_INFO si;
+		GetSystemInfo(&si);
+		maxthreads = std::min<UINT>(std::max<UINT>(si.dwNumberOfProcessors * 2, 2), 16);
+	}
+
+	ResetEvent(m_hDoneEvent);
+
+	for (auto pnode : m_Roots)
+	{
+		// download references were filled in when they were added
+		if (pnode->m_Pattern.empty())
+			continue;
+
+		// the watch has to be in place before anything under it is listed, or a change made in between would go unnoticed
+		if (m_pWatcher && pnode->m_Wildcard)
+		{
+			TCHAR dir[MAX_PATH];
+			_tcscpy_s(dir, MAX_PATH, pnode->m_Pattern.c_str());
+			PathRemoveFileSpec(dir);
+
+			m_pWatcher->Watch(dir);
+		}
+
+		QueueNode(pnode);
+	}
+
+	if (m_Outstanding)
+	{
+		std::vector<HANDLE> threads;
+		threads.reserve(maxthreads);
+
+		for (UINT i = 0; i < maxthreads; i++)
+		{
+			HANDLE ht = CreateThread(NULL, 0, ScanThreadProc, this, 0, NULL);
+			if (ht)
+				threads.push_back(ht);
+		}
+
+		// there's no way to finish without anything to do the work
+		if (threads.empty())
+			return false;
+
+		WaitForMultipleObjects((DWORD)threads.size(), threads.data(), TRUE, INFINITE);
+
+		for (auto ht : threads)
+			CloseHandle(ht);
+	}
+
+	if (WaitForSingleObject(m_hCancelEvent, 0) != WAIT_TIMEOUT)
+		return false;
+
+	for (auto pnode : m_Roots)
+		Collect(pnode);
+
+	return true;
+}
@@ -0,0 +1,125 @@
+/*
+	Copyright © 2013-2020, Keelan Stuart (hereafter referenced as AUTHOR). All Rights Reserved.
+	Permission to use, copy, modify, and distribute this software is hereby granted, without fee and without a signed licensing agreement,
+	provided that the above copyright notice appears in all copies, modifications, and distributions.
+	Furthermore, AUTHOR assumes no responsibility for any damages caused either directly or indirectly by the use of this software, nor vouches for
+	any fitness of purpose of this software.
+	All other copyrighted material contained herein is noted and rights attributed to individual copyright holders.
+	
+	For inquiries, contact: keelanstuart@gmail.com
+*/
+
+
+#pragma once
+
+#include "FileSpecMatcher.h"
+#include "SourceWatcher.h"
+
+
+// The list of everything that goes into a package, gathered before any of it is compressed. Sources are enumerated by a pool
+// of threads, since on network shares most of the time goes to waiting on directory listings, but entries come out in the
+// same order as a single-threaded walk would produce them, so the archive layout doesn't depend on timing
+class CBuildManifest
+{
+public:
+
+	struct SEntry
+	{
+		tstring m_Src;			// the full source filename, or the URL of a download reference
+		tstring m_Dst;			// the destination path and filename in the archive
+		tstring m_Snippet;		// script snippet appended to the per-file script
+		uint64_t m_Size;
+		FILETIME m_Modified;
+		DWORD m_Attributes;
+		bool m_Download;
+	};
+
+	// If a watcher is given, directories it has an unchanged listing of aren't listed again, and the ones that are listed are
+	// kept by it for next time
+	CBuildManifest(const TCHAR *basepath, HANDLE hcancel, CSourceWatcher *pwatcher = nullptr);
+
+	~CBuildManifest();
+
+	// Adds one of the project's file entries; srcspec may contain a wildcard in its filename (in which case dstfilename is ignored
+	// and subdirectories are included) or be a URL, and is taken relative to the base path given at construction. The filename
+	// part of srcspec and excludespec may each be a semicolon-separated list of specs
+	void AddSource(const TCHAR *srcspec, const TCHAR *excludespec, const TCHAR *snippet, const TCHAR *dstpath, const TCHAR *dstfilename);
+
+	// Enumerates everything that was added, using up to maxthreads threads; returns false if cancelled
+	bool Scan(UINT maxthreads = 0);
+
+	size_t GetCount() const { return m_Entries.size(); }
+
+	const SEntry &GetEntry(size_t idx) const { return m_Entries[idx]; }
+
+	uint64_t GetTotalSize() const { return m_TotalSize; }
+
+	// sources that were named explicitly (not by wildcard) but couldn't be found
+	const std::vector<tstring> &GetMissing() const { return m_Missing; }
+
+	// how many directories the last Scan looked at, and how many of those the watcher already had listings of
+	UINT GetDirectoryCount() const { return (UINT)m_DirCount; }
+	UINT GetWatchedDirectoryCount() const { return (UINT)m_WatchedDirCount; }
+
+protected:
+
+	struct SScanNode;
+
+	struct SScanItem
+	{
+		SEntry m_Entry;
+		SScanNode *m_pChild;		// if set, this item is a subdirectory and m_Entry is unused
+	};
+
+	struct SScanNode
+	{
+		tstring m_Pattern;			// what's handed to FindFirstFile
+		tstring m_FileSpec;			// the filename part of the source spec, which files (but not directories) must match
+		tstring m_DstPath;
+		tstring m_DstFilename;		// only for a source that isn't a wildcard
+		tstring m_RelDir;			// relative to the source's own directory, with a trailing backslash, for path specs
+		const CFileSpecMatcher *m_pInclude;
+		const CFileSpecMatcher *m_pExclude;
+		const tstring *m_pSnippet;
+		bool m_Wildcard;
+		bool m_Missing;
+
+		std::vector<SScanItem> m_Items;
+	};
+
+	static DWORD WINAPI ScanThreadProc(LPVOID param);
+
+	void ScanNode(SScanNode *pnode);
+
+	// Gets the contents of dir (from the watcher, if it can); returns false if pnode's pattern didn't match anything at all
+	bool ListNode(SScanNode *pnode, const TCHAR *dir, CSourceWatcher::TListing &listing);
+
+	void QueueNode(SScanNode *pnode);
+
+	void Collect(SScanNode *pnode);
+
+	void FreeNode(SScanNode *pnode);
+
+	TCHAR m_BasePath[MAX_PATH];
+
+	// the snippets and compiled include / exclude specs of each source, shared by all of its nodes
+	std::deque<tstring> m_Strings;
+	std::deque<CFileSpecMatcher> m_Matchers;
+
+	std::vector<SScanNode *> m_Roots;
+
+	std::deque<SScanNode *> m_Queue;
+	CRITICAL_SECTION m_QueueLock;
+	HANDLE m_hQueueSem;
+	HANDLE m_hDoneEvent;
+	HANDLE m_hCancelEvent;
+	volatile LONG m_Outstanding;
+
+	CSourceWatcher *m_pWatcher;
+	volatile LONG m_DirCount;
+	volatile LONG m_WatchedDirCount;
+
+	std::vector<SEntry> m_Entries;
+	uint64_t m_TotalSize;
+	std::vector<tstring> m_Missing;
+};
@@ -0,0 +1,57 @@
+/*
+	Copyright © 2013-2020, Keelan Stuart (hereafter referenced as AUTHOR). All Rights Reserved.
+	Permission to use, copy, modify, and distribute this software is hereby granted, without fee and without a signed licensing agreement,
+	provided that the above copyright notice appears in all copies, modifications, and distributions.
+	Furthermore, AUTHOR assumes no responsibility for any damages caused either directly or indirectly by the use of this software, nor vouches for
+	any fitness of purpose of this software.
+	All other copyrighted material contained herein is noted and rights attributed to individual copyright holders.
+	
+	For inquiries, contact: keelanstuart@gmail.com
+*/
+
+
+
+#pragma once
+
+
+// Everything a build has to say goes through one of these, so that the same build can be run by the GUI (which shows it in
+// the output window and status bar) or from the command line (which prints it). Methods may be called from any thread
+class IBuildReporter
+{
+public:
+
+	struct SBuildResult
+	{
+		enum EOutcome
+		{
+			BO_SUCCEEDED = 0,
+			BO_FAILED,			// the package was built, but something that should have gone into it didn't
+			BO_CANCELLED,
+
+			BO_NUMOUTCOMES
+		};
+
+		EOutcome m_Outcome;
+		const TCHAR *m_Filename;	// the package that was built (the first one, if it spans)
+		size_t m_FileCount;
+		size_t m_SpanCount;
+		uint64_t m_UncompressedSize;
+		uint64_t m_CompressedSize;
+		int m_Seconds;
+	};
+
+	// Adds a message, which may be several lines long, to the build log
+	virtual void LogMessage(const TCHAR *msg) = NULL;
+
+	// Indicates that the build is busy doing something it can't measure the progress of (or has stopped doing so)
+	virtual void SetBusy(bool busy) = NULL;
+
+	// Sets how far along the build is, from 0 - 100
+	virtual void SetProgress(UINT pct) = NULL;
+
+	// Describes how the build is going right now, in a single line
+	virtual void ShowStatus(const TCHAR *text) = NULL;
+
+	// Called once, when a build that was started is over
+	virtual void BuildFinished(const SBuildResult &result) = NULL;
+};
@@ -0,0 +1,190 @@
+/*
+	Copyright © 2013-2020, Keelan Stuart (hereafter referenced as AUTHOR). All Rights Reserved.
+	Permission to use, copy, modify, and distribute this software is hereby granted, without fee and without a signed licensing agreement,
+	provided that the above copyright notice appears in all copies, modifications, and distributions.
+	Furthermore, AUTHOR assumes no responsibility for any damages caused either directly or indirectly by the use of this software, nor vouches for
+	any fitness of purpose of this software.
+	All other copyrighted material contained herein is noted and rights attributed to individual copyright holders.
+	
+	For inquiries, contact: keelanstuart@gmail.com
+*/
+
+
+#include "stdafx.h"
+
+#include "FileSpecMatcher.h"
+
+
+CFileSpecMatcher::CFileSpecMatcher()
+{
+	m_MatchAll = false;
+}
+
+
+CFileSpecMatcher::CFileSpecMatcher(const TCHAR *specs)
+{
+	m_MatchAll = false;
+
+	Compile(specs);
+}
+
+
+void CFileSpecMatcher::Compile(const TCHAR *specs)
+{
+	m_Extensions.clear();
+	m_NameGlobs.clear();
+	m_PathGlobs.clear();
+	m_MatchAll = false;
+
+	if (!specs)
+		return;
+
+	const TCHAR *c = specs;
+	while (*c)
+	{
+		const TCHAR *d = _tcschr(c, _T(';'));
+		if (!d)
+			d = c + _tcslen(c);
+
+		// leading and trailing whitespace is ignored, as it is by PathMatchSpecEx
+		const TCHAR *b = c, *e = d;
+		while ((b < e) && _istspace(*b))
+			b++;
+		while ((e > b) && _istspace(*(e - 1)))
+			e--;
+
+		if (b < e)
+		{
+			tstring spec(b, e - b);
+			CharLowerBuff(&spec[0], (DWORD)spec.length());
+			std::replace(spec.begin(), spec.end(), _T('/'), _T('\\'));
+
+			// a trailing '.' stands for the end of a name that has no extension, not for a '.' in it
+			bool noext = ((spec.length() > 1) && (spec.back() == _T('.')) && (spec[spec.length() - 2] != _T('.')));
+			if (noext)
+				spec.pop_back();
+
+			size_t wc = spec.find_first_of(_T("*?"));
+
+			if (!noext && (!_tcscmp(spec.c_str(), _T("*")) || !_tcscmp(spec.c_str(), _T("*.*"))))
+			{
+				m_MatchAll = true;
+			}
+			else if (!noext && (spec.length() > 2) && !_tcsncmp(spec.c_str(), _T("*."), 2) && (spec.find_first_of(_T("*?.\\"), 2) == tstring::npos))
+			{
+				m_Extensions.insert(spec.substr(2));
+			}
+			else
+			{
+				SGlob glob;
+				glob.m_NoExtension = noext;
+				glob.m_HasWildcard = (wc != tstring::npos);
+				glob.m_PrefixLen = glob.m_HasWildcard ? wc : spec.length();
+				glob.m_SuffixLen = glob.m_HasWildcard ? (spec.length() - spec.find_last_of(_T("*?")) - 1) : spec.length();
+				glob.m_Pattern.swap(spec);
+
+				if (glob.m_Pattern.find(_T('\\')) != tstring::npos)
+					m_PathGlobs.push_back(glob);
+				else
+					m_NameGlobs.push_back(glob);
+			}
+		}
+
+		c = *d ? (d + 1) : d;
+	}
+}
+
+
+bool CFileSpecMatcher::MatchGlob(const SGlob &glob, const TCHAR *s, size_t len)
+{
+	const TCHAR *p = glob.m_Pattern.c_str();
+
+	if (!glob.m_HasWildcard)
+		return (len == glob.m_Pattern.length()) && !_tcsncmp(p, s, len);
+
+	// reject on the literal ends first; most candidates fail here without ever reaching a wildcard
+	if (len < (glob.m_PrefixLen + glob.m_SuffixLen))
+		return false;
+
+	if (glob.m_PrefixLen && _tcsncmp(p, s, glob.m_PrefixLen))
+		return false;
+
+	if (glob.m_SuffixLen && _tcsncmp(p + glob.m_Pattern.length() - glob.m_SuffixLen, s + len - glob.m_SuffixLen, glob.m_SuffixLen))
+		return false;
+
+	// only the most recent '*' ever needs to be revisited, so this never takes more than one pass per star
+	const TCHAR *star = NULL, *resume = NULL, *end = s + len;
+	while (s < end)
+	{
+		if (*p == _T('*'))
+		{
+			star = p++;
+			resume = s;
+		}
+		else if ((*p == _T('?')) || (*p == *s))
+		{
+			p++;
+			s++;
+		}
+		else if (star)
+		{
+			p = star + 1;
+			s = ++resume;
+		}
+		else
+		{
+			return false;
+		}
+	}
+
+	while (*p == _T('*'))
+		p++;
+
+	return !*p;
+}
+
+
+bool CFileSpecMatcher::Matches(const TCHAR *name, const TCHAR *reldir) const
+{
+	if (m_MatchAll)
+		return true;
+
+	if (!name)
+		return false;
+
+	// the relative directory goes in front of the name in the same buffer, so path specs see both without another copy
+	TCHAR lpath[MAX_PATH * 2];
+	size_t dirlen = 0;
+	if (!m_PathGlobs.empty() && reldir)
+	{
+		_tcsncpy_s(lpath, MAX_PATH, reldir, _TRUNCATE);
+		dirlen = _tcslen(lpath);
+	}
+
+	TCHAR *lname = lpath + dirlen;
+	_tcsncpy_s(lname, MAX_PATH, name, _TRUNCATE);
+	size_t len = _tcslen(lname);
+	CharLowerBuff(lpath, (DWORD)(dirlen + len));
+
+	const TCHAR *ext = _tcsrchr(lname, _T('.'));
+
+	if (!m_Extensions.empty())
+	{
+		if (ext && *(ext + 1) && (m_Extensions.find(ext + 1) != m_Extensions.end()))
+			return true;
+	}
+
+	for (const auto &glob : m_NameGlobs)
+	{
+		if ((!glob.m_NoExtension || !ext) && MatchGlob(glob, lname, len))
+			return true;
+	}
+
+	for (const auto &glob : m_PathGlobs)
+	{
+		if ((!glob.m_NoExtension || !ext) && MatchGlob(glob, lpath, dirlen + len))
+			return true;
+	}
+
+	return false;
+}
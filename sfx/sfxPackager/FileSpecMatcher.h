@@ -0,0 +1,57 @@
+/*
+	Copyright © 2013-2020, Keelan Stuart (hereafter referenced as AUTHOR). All Rights Reserved.
+	Permission to use, copy, modify, and distribute this software is hereby granted, without fee and without a signed licensing agreement,
+	provided that the above copyright notice appears in all copies, modifications, and distributions.
+	Furthermore, AUTHOR assumes no responsibility for any damages caused either directly or indirectly by the use of this software, nor vouches for
+	any fitness of purpose of this software.
+	All other copyrighted material contained herein is noted and rights attributed to individual copyright holders.
+	
+	For inquiries, contact: keelanstuart@gmail.com
+*/
+
+
+#pragma once
+
+#include <unordered_set>
+
+
+// Matches filenames against a semicolon-separated list of wildcard specs, case-insensitively, the way PathMatchSpec would. The list
+// is compiled once up front: plain "*.ext" specs go into a hashed set of extensions, so any number of them costs a single lookup,
+// and everything else becomes a lower-cased glob with its literal ends pulled out for a quick reject. A spec that contains a
+// backslash is matched against the file's path relative to where enumeration started instead of just its name (e.g. "obj\*").
+// As with PathMatchSpec, a spec that ends in '.' only matches names without an extension (e.g. "*." or "readme.")
+class CFileSpecMatcher
+{
+public:
+
+	CFileSpecMatcher();
+
+	CFileSpecMatcher(const TCHAR *specs);
+
+	void Compile(const TCHAR *specs);
+
+	bool IsEmpty() const { return !m_MatchAll && m_Extensions.empty() && m_NameGlobs.empty() && m_PathGlobs.empty(); }
+
+	// reldir is the directory name is in, relative to where enumeration started, with a trailing backslash; it may be NULL or
+	// empty for the top level. Safe to call from multiple threads at once
+	bool Matches(const TCHAR *name, const TCHAR *reldir = NULL) const;
+
+protected:
+
+	struct SGlob
+	{
+		tstring m_Pattern;		// lower-cased, with '/' turned into '\'
+		size_t m_PrefixLen;		// the number of literal characters before the first wildcard
+		size_t m_SuffixLen;		// the number of literal characters after the last wildcard
+		bool m_HasWildcard;
+		bool m_NoExtension;		// the spec ended in '.', which was removed; the name must not have an extension
+	};
+
+	// s doesn't need to be terminated; only len characters are looked at
+	static bool MatchGlob(const SGlob &glob, const TCHAR *s, size_t len);
+
+	std::unordered_set<tstring> m_Extensions;		// lower-cased, without the '.'
+	std::vector<SGlob> m_NameGlobs;
+	std::vector<SGlob> m_PathGlobs;
+	bool m_MatchAll;
+};
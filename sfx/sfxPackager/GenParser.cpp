@@ -16,6 +16,54 @@
 #include "GenParser.h"
 
 
+// Classifies a character the way the tokenizer cares about; NUL is treated as whitespace
+enum ECharClass
+{
+	CC_OTHER = 0,
+	CC_SPACE,
+	CC_ALPHA,
+	CC_DIGIT,
+	CC_SYMBOL,
+	CC_QUOTE
+};
+
+static inline ECharClass ClassifyChar(TCHAR c)
+{
+	if (((c >= _T('a')) && (c <= _T('z'))) || ((c >= _T('A')) && (c <= _T('Z'))) || (c == _T('_')))
+		return CC_ALPHA;
+
+	if ((c >= _T('0')) && (c <= _T('9')))
+		return CC_DIGIT;
+
+	switch (c)
+	{
+		case _T('\0'):
+		case _T('\n'):
+		case _T('\r'):
+		case _T('\t'):
+		case _T(' '):
+			return CC_SPACE;
+
+		case _T('\"'):
+		case _T('\''):
+			return CC_QUOTE;
+
+		case _T('`'): case _T('~'): case _T('!'): case _T('@'): case _T('#'): case _T('$'): case _T('%'): case _T('^'):
+		case _T('&'): case _T('*'): case _T('('): case _T(')'): case _T('-'): case _T('='): case _T('+'): case _T('['):
+		case _T(']'): case _T('{'): case _T('}'): case _T('\\'): case _T('|'): case _T(';'): case _T(':'): case _T(','):
+		case _T('.'): case _T('<'): case _T('>'): case _T('/'): case _T('?'):
+			return CC_SYMBOL;
+	}
+
+	return CC_OTHER;
+}
+
+static inline bool IsHexLetter(TCHAR c)
+{
+	return ((c >= _T('a')) && (c <= _T('f'))) || ((c >= _T('A')) && (c <= _T('F')));
+}
+
+
 CGenParser::CGenParser()
 {
 	m_data = NULL;
@@ -23,6 +71,8 @@ CGenParser::CGenParser()
 	m_pos = 0;
 
 	m_curType = TT_NONE;
+	m_tokStart = 0;
+	m_tokLen = 0;
 }
 
 
@@ -33,217 +83,156 @@ CGenParser::~CGenParser()
 
 void CGenParser::SetSourceData(const TCHAR *data, size_t datalen)
 {
-	m_data = (TCHAR *)data;
+	m_data = data;
 	m_datalen = datalen;
 	m_pos = 0;
 
 	m_curType = TT_NONE;
-	m_curStr.clear();
+	m_tokStart = 0;
+	m_tokLen = 0;
 }
 
 
 bool CGenParser::NextToken()
 {
+	m_curType = TT_NONE;
+	m_tokStart = m_pos;
+	m_tokLen = 0;
+
 	if (!m_data || !m_datalen)
 		return false;
 
-	m_curType = TT_NONE;
-	m_curStr.clear();
 	TCHAR strdelim = _T('\0');
+	bool decimal = false;
 
 	while (m_pos < m_datalen)
 	{
-		// skip whitespace
-		if (_tcschr(_T("\n\r\t "), m_data[m_pos]))
+		TCHAR c = m_data[m_pos];
+
+		if (m_curType == TT_STRING)
 		{
-			if (m_curType == TT_NONE)
-			{
-				// skip whitespace
-				m_pos++;
-			}
-			else if (m_curType == TT_STRING)
+			// everything up to the matching delimiter belongs to the string, whitespace and all
+			if (c == strdelim)
 			{
-				m_curStr += m_data[m_pos];
+				m_tokLen = m_pos - m_tokStart;
 				m_pos++;
-			}
-			else
-			{
-				break;
+
+				return (m_tokLen > 0);
 			}
 
+			m_pos++;
 			continue;
 		}
 
-		if (_tcschr(_T("abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_"), m_data[m_pos]))
-		{
-			if (m_curType == TT_NONE)
-			{
-				// nothing yet?  this is an identifier
-				m_curType = TT_IDENT;
+		ECharClass cc = ClassifyChar(c);
 
-				m_curStr += m_data[m_pos];
-				m_pos++;
-			}
-			else if (m_curType == TT_HEXNUMBER)
-			{
-				if (_tcschr(_T("abcdefABCDEF"), m_data[m_pos]))
-				{
-					m_curStr += m_data[m_pos];
-					m_pos++;
-				}
-				else
-					break;
-			}
-			else if ((m_curType == TT_STRING) || (m_curType == TT_IDENT))
-			{
-				// already an identifier or string? just add and move on
-				m_curStr += m_data[m_pos];
-				m_pos++;
-			}
-			else
-			{
-				// if we're a number or a symbol and hit one of these characters, get out
+		if ((cc == CC_SPACE) || (cc == CC_OTHER))
+		{
+			// skip whitespace (and anything else we don't understand) between tokens; it ends the one we're in
+			if (m_curType != TT_NONE)
 				break;
-			}
 
+			m_pos++;
 			continue;
 		}
 
-		if (_tcschr(_T("0123456789"), m_data[m_pos]))
+		if (m_curType == TT_NONE)
 		{
-			if (m_curType == TT_NONE)
+			m_tokStart = m_pos;
+
+			switch (cc)
 			{
-				// nothing yet?  this is a number
-				m_curType = TT_NUMBER;
-
-				if ((m_data[m_pos + 1] == _T('x')) || (m_data[m_pos + 1] == _T('X')))
-				{
-					m_curType = TT_HEXNUMBER;
-					m_pos += 2;
-				}
-				else
-				{
-					m_curStr += m_data[m_pos];
+				case CC_ALPHA:
+					m_curType = TT_IDENT;
 					m_pos++;
-				}
-			}
-			else if ((m_curType == TT_NUMBER) || (m_curType == TT_STRING) || (m_curType == TT_IDENT) || (m_curType == TT_HEXNUMBER))
-			{
-				// already an identifier or string? just add and move on
-				m_curStr += m_data[m_pos];
-				m_pos++;
-			}
-			else
-			{
-				// if we're a number or a symbol and hit one of these characters, get out
-				break;
-			}
-
-			continue;
-		}
+					break;
 
-		// symbols of every kind
-		if (_tcschr(_T("`~!@#$%^&*()-=+[]{}\\|;:,.<>/?"), m_data[m_pos]))
-		{
-			if (m_curType == TT_NONE)
-			{
-				if (m_data[m_pos] == _T('-'))
-				{
-					if (((m_pos + 1) < m_datalen) && _tcschr(_T("0123456789"), m_data[m_pos + 1]))
+				case CC_DIGIT:
+					if (((m_pos + 1) < m_datalen) && ((m_data[m_pos + 1] == _T('x')) || (m_data[m_pos + 1] == _T('X'))))
+					{
+						// the 0x prefix isn't part of the token
+						m_curType = TT_HEXNUMBER;
+						m_pos += 2;
+						m_tokStart = m_pos;
+					}
+					else
 					{
-						// nothing yet?  this is a number
 						m_curType = TT_NUMBER;
-
-						m_curStr += m_data[m_pos];
 						m_pos++;
-
-						continue;
 					}
-				}
-
-				// nothing yet?  this is a number
-				m_curType = TT_SYMBOL;
+					break;
 
-				m_curStr += m_data[m_pos];
-				m_pos++;
-			}
-			else if (m_curType == TT_NUMBER)
-			{
-				// a decimal point can only be inserted if it's already a number and there's no pre-existing decimal point
-				if (m_data[m_pos] == _T('.') && !_tcschr(m_curStr.c_str(), _T('.')))
-				{
-					m_curStr += m_data[m_pos];
+				case CC_SYMBOL:
 					m_pos++;
 
-					continue;
-				}
-			}
-			else if (m_curType == TT_STRING)
-			{
-				m_curStr += m_data[m_pos];
-				m_pos++;
-
-				continue;
-			}
+					// a minus sign followed by a digit is a negative number; any other symbol is a token all by itself
+					if ((c == _T('-')) && (m_pos < m_datalen) && (ClassifyChar(m_data[m_pos]) == CC_DIGIT))
+					{
+						m_curType = TT_NUMBER;
+						break;
+					}
 
-			break;
-		}
+					m_curType = TT_SYMBOL;
+					m_tokLen = 1;
+					return true;
 
-		if (_tcschr(_T("\"'"), m_data[m_pos]) != NULL)
-		{
-			if (m_curType == TT_NONE)
-			{
-				m_curType = TT_STRING;
-				strdelim = m_data[m_pos];
-				m_pos++;
-			}
-			else if (m_curType == TT_STRING)
-			{
-				if (strdelim != m_data[m_pos])
-				{
-					m_curStr += m_data[m_pos];
+				case CC_QUOTE:
+					// the delimiters aren't part of the token
+					m_curType = TT_STRING;
+					strdelim = c;
 					m_pos++;
-				}
-				else
-				{
-					m_pos++;
-					strdelim = _T('\0');
+					m_tokStart = m_pos;
 					break;
-				}
 			}
 
 			continue;
 		}
 
-		if (m_curType == TT_STRING)
+		// we're in an identifier or a number; see if this character continues it
+		bool more = false;
+		switch (cc)
 		{
-			m_curStr += m_data[m_pos];
+			case CC_ALPHA:
+				more = (m_curType == TT_IDENT) || ((m_curType == TT_HEXNUMBER) && IsHexLetter(c));
+				break;
+
+			case CC_DIGIT:
+				more = true;
+				break;
+
+			case CC_SYMBOL:
+				// a decimal point can only be inserted if it's already a number and there's no pre-existing decimal point
+				more = (m_curType == TT_NUMBER) && (c == _T('.')) && !decimal;
+				decimal |= more;
+				break;
 		}
 
+		if (!more)
+			break;
+
 		m_pos++;
 	}
 
-	if (m_curStr.empty())
-	{
-		return false;
-	}
+	// also covers a string that runs off the end of the data without being closed
+	m_tokLen = m_pos - m_tokStart;
 
-	return true;
+	return (m_tokLen > 0);
 }
 
 
 bool CGenParser::NextLine()
 {
+	m_curType = TT_NONE;
+	m_tokStart = m_pos;
+	m_tokLen = 0;
+
 	if (!m_data || !m_datalen)
 		return false;
 
-	m_curType = TT_NONE;
-	m_curStr.clear();
-
 	while (m_pos < m_datalen)
 	{
-		// skip whitespace
-		if (_tcschr(_T("\n\r"), m_data[m_pos]))
+		// skip to the end of the line
+		if ((m_data[m_pos] == _T('\n')) || (m_data[m_pos] == _T('\r')))
 		{
 			break;
 		}
@@ -254,7 +243,7 @@ bool CGenParser::NextLine()
 	while (m_pos < m_datalen)
 	{
 		// find non-whitespace
-		if (!_tcschr(_T("\n\r"), m_data[m_pos]))
+		if ((m_data[m_pos] != _T('\n')) && (m_data[m_pos] != _T('\r')))
 		{
 			return true;
 		}
@@ -274,38 +263,45 @@ CGenParser::TOKEN_TYPE CGenParser::GetCurrentTokenType()
 
 TCHAR *CGenParser::GetCurrentTokenString()
 {
+	// re-uses the buffer, so once it's grown to fit the longest token, this doesn't allocate
+	m_curStr.assign(m_data ? (m_data + m_tokStart) : _T(""), m_tokLen);
+
 	return (TCHAR *)m_curStr.c_str();
 }
 
-bool CGenParser::IsToken(TCHAR *s, bool case_sensitive)
+bool CGenParser::IsToken(const TCHAR *s, bool case_sensitive) const
 {
+	size_t len = _tcslen(s);
+	if (len != m_tokLen)
+		return false;
+
+	if (!len)
+		return true;
+
 	if (case_sensitive)
-		return !_tcscmp(m_curStr.c_str(), s);
+		return !_tcsncmp(m_data + m_tokStart, s, len);
 
-	return !_tcsicmp(m_curStr.c_str(), s);
+	return !_tcsnicmp(m_data + m_tokStart, s, len);
 }
 
 bool CGenParser::FindBoundedRawString(TCHAR s)
 {
+	m_curType = TT_STRING;
+	m_tokStart = m_pos;
+	m_tokLen = 0;
+
 	if (!m_data || !m_datalen)
 		return false;
 
-	m_curType = TT_STRING;
-	m_curStr.clear();
-
 	while (m_pos < m_datalen)
 	{
 		if (m_data[m_pos] == s)
 			break;
 
-		m_curStr += m_data[m_pos];
-
 		m_pos++;
 	}
 
-	if (m_pos < m_datalen)
-		return true;
-
-	return true;
+	m_tokLen = m_pos - m_tokStart;
 
+	return (m_pos < m_datalen);
 }
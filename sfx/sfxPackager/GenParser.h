@@ -11,6 +11,8 @@
 
 #pragma once
 
+// Tokens are returned as views into the source data; nothing is copied unless the caller asks for a string.
+// The source data must outlive any view taken from it.
 class CGenParser
 {
 public:
@@ -37,17 +39,25 @@ public:
 	bool NextLine();
 
 	TOKEN_TYPE GetCurrentTokenType();
+
+	// The current token, in place; strings don't include their delimiters and escape sequences are left as they are
+	tstring_view GetCurrentToken() const { return tstring_view(m_data + m_tokStart, m_tokLen); }
+
+	// Copies the current token into a NUL-terminated buffer owned by the parser; prefer GetCurrentToken
 	TCHAR *GetCurrentTokenString();
 
-	bool IsToken(TCHAR *s, bool case_sensitive = false);
+	bool IsToken(const TCHAR *s, bool case_sensitive = false) const;
 	bool FindBoundedRawString(TCHAR s);
 
 protected:
-	TCHAR *m_data;
+	const TCHAR *m_data;
 	size_t m_datalen;
 	size_t m_pos;
 
 	TOKEN_TYPE m_curType;
+	size_t m_tokStart;
+	size_t m_tokLen;
+
 	tstring m_curStr;
 };
 
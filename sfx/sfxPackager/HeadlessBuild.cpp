@@ -0,0 +1,313 @@
+/*
+	Copyright © 2013-2020, Keelan Stuart (hereafter referenced as AUTHOR). All Rights Reserved.
+	Permission to use, copy, modify, and distribute this software is hereby granted, without fee and without a signed licensing agreement,
+	provided that the above copyright notice appears in all copies, modifications, and distributions.
+	Furthermore, AUTHOR assumes no responsibility for any damages caused either directly or indirectly by the use of this software, nor vouches for
+	any fitness of purpose of this software.
+	All other copyrighted material contained herein is noted and rights attributed to individual copyright holders.
+	
+	For inquiries, contact: keelanstuart@gmail.com
+*/
+
+
+
+// HeadlessBuild.cpp : builds a project from the command line, without the GUI
+//
+
+#include "stdafx.h"
+#include "sfxPackager.h"
+#include "sfxPackagerDoc.h"
+#include "HeadlessBuild.h"
+
+#ifdef _DEBUG
+#define new DEBUG_NEW
+#endif
+
+
+// Prints everything a build reports, one line at a time, in a form that's easy for a script to pick apart
+class CConsoleReporter : public IBuildReporter
+{
+protected:
+	HANDLE m_hOut;
+	bool m_bOwnHandle;
+	bool m_bConsole;	// WriteConsole for a console; everything else (files, pipes) gets UTF-8
+
+	CRITICAL_SECTION m_Lock;
+
+	bool m_bFinished;
+	SBuildResult::EOutcome m_Outcome;
+
+	void WriteLine(const TCHAR *keyword, const TCHAR *text, size_t len)
+	{
+		CString line(keyword);
+		line += _T(' ');
+		line.Append(text, (int)len);
+		line += _T("\r\n");
+
+		if (m_hOut == INVALID_HANDLE_VALUE)
+			return;
+
+		DWORD wb;
+		if (m_bConsole)
+		{
+			WriteConsole(m_hOut, (LPCTSTR)line, line.GetLength(), &wb, NULL);
+		}
+		else
+		{
+			CT2CA utf8(line, CP_UTF8);
+			WriteFile(m_hOut, (LPCSTR)utf8, (DWORD)strlen(utf8), &wb, NULL);
+		}
+	}
+
+public:
+	CConsoleReporter()
+	{
+		InitializeCriticalSection(&m_Lock);
+
+		m_bFinished = false;
+		m_Outcome = SBuildResult::BO_FAILED;
+
+		// a redirected stdout is inherited even though this isn't a console application, but otherwise output has to go to
+		// the console that started us, if there is one
+		m_bOwnHandle = false;
+		m_hOut = GetStdHandle(STD_OUTPUT_HANDLE);
+		if (!m_hOut || (m_hOut == INVALID_HANDLE_VALUE))
+		{
+			m_hOut = INVALID_HANDLE_VALUE;
+			if (AttachConsole(ATTACH_PARENT_PROCESS))
+			{
+				m_hOut = CreateFile(_T("CONOUT$"), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
+				m_bOwnHandle = (m_hOut != INVALID_HANDLE_VALUE);
+			}
+		}
+
+		DWORD mode;
+		m_bConsole = (m_hOut != INVALID_HANDLE_VALUE) && GetConsoleMode(m_hOut, &mode);
+	}
+
+	virtual ~CConsoleReporter()
+	{
+		if (m_bOwnHandle)
+			CloseHandle(m_hOut);
+
+		DeleteCriticalSection(&m_Lock);
+	}
+
+	bool IsFinished() const { return m_bFinished; }
+
+	SBuildResult::EOutcome GetOutcome() const { return m_Outcome; }
+
+	virtual void LogMessage(const TCHAR *msg)
+	{
+		EnterCriticalSection(&m_Lock);
+
+		// messages are formatted for the output window, so they're split back up into lines, and the blank ones dropped
+		const TCHAR *s = msg;
+		while (*s)
+		{
+			size_t len = _tcscspn(s, _T("\r\n"));
+			if (len)
+				WriteLine(_T("LOG"), s, len);
+
+			s += len;
+			s += _tcsspn(s, _T("\r\n"));
+		}
+
+		LeaveCriticalSection(&m_Lock);
+	}
+
+	virtual void SetBusy(bool busy)
+	{
+		EnterCriticalSection(&m_Lock);
+		WriteLine(_T("BUSY"), busy ? _T("1") : _T("0"), 1);
+		LeaveCriticalSection(&m_Lock);
+	}
+
+	virtual void SetProgress(UINT pct)
+	{
+		TCHAR s[16];
+		_stprintf_s(s, _T("%u"), pct);
+
+		EnterCriticalSection(&m_Lock);
+		WriteLine(_T("PROGRESS"), s, _tcslen(s));
+		LeaveCriticalSection(&m_Lock);
+	}
+
+	virtual void ShowStatus(const TCHAR *text)
+	{
+		EnterCriticalSection(&m_Lock);
+		WriteLine(_T("STATUS"), text, _tcscspn(text, _T("\r\n")));
+		LeaveCriticalSection(&m_Lock);
+	}
+
+	virtual void BuildFinished(const SBuildResult &result)
+	{
+		static const TCHAR *outcome[SBuildResult::BO_NUMOUTCOMES] = {_T("succeeded"), _T("failed"), _T("cancelled")};
+
+		CString s;
+		s.Format(_T("outcome=%s files=%u spans=%u uncompressed=%I64u compressed=%I64u seconds=%d output=%s"),
+			outcome[result.m_Outcome], (UINT)result.m_FileCount, (UINT)result.m_SpanCount, result.m_UncompressedSize, result.m_CompressedSize,
+			result.m_Seconds, result.m_Filename ? result.m_Filename : _T(""));
+
+		EnterCriticalSection(&m_Lock);
+		WriteLine(_T("RESULT"), s, s.GetLength());
+		m_Outcome = result.m_Outcome;
+		m_bFinished = true;
+		LeaveCriticalSection(&m_Lock);
+	}
+};
+
+
+static HANDLE s_hCancelEvent = NULL;
+
+// Ctrl+C, Ctrl+Break, or the console closing cancel the build the same way the GUI's cancel button does
+static BOOL WINAPI HeadlessCtrlHandler(DWORD ctrltype)
+{
+	if (s_hCancelEvent)
+		SetEvent(s_hCancelEvent);
+
+	return TRUE;
+}
+
+
+bool RunHeadlessBuild(int argc, TCHAR **argv, int &exitcode)
+{
+	const TCHAR *projectfile = NULL;
+	const TCHAR *outputfile = NULL;
+	bool build = false;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (!_tcsicmp(argv[i], _T("/build")) || !_tcsicmp(argv[i], _T("-build")))
+		{
+			build = true;
+			if ((i + 1) < argc)
+				projectfile = argv[++i];
+		}
+		else if (!_tcsicmp(argv[i], _T("/out")) || !_tcsicmp(argv[i], _T("-out")))
+		{
+			if ((i + 1) < argc)
+				outputfile = argv[++i];
+		}
+	}
+
+	if (!build)
+		return false;
+
+	CConsoleReporter reporter;
+
+	if (!projectfile)
+	{
+		reporter.LogMessage(_T("usage: sfxPackager /build <project.sfxpp> [/out <package.exe | package.tar.gz>]\r\n")
+			_T("sfxPackager is a windowed program: from cmd.exe, run it with \"start /wait\" to wait for the build and get its exit code;\r\n")
+			_T("without that, output still goes to the console it was started from, but the prompt comes back right away.\r\n"));
+		exitcode = HBR_USAGE;
+		return true;
+	}
+
+	TCHAR projectpath[MAX_PATH];
+	GetFullPathName(projectfile, MAX_PATH, projectpath, NULL);
+
+	CFile f;
+	if (!f.Open(projectpath, CFile::modeRead | CFile::shareDenyWrite))
+	{
+		CString msg;
+		msg.Format(_T("Unable to open project \"%s\".\r\n"), projectpath);
+		reporter.LogMessage(msg);
+
+		exitcode = HBR_BADPROJECT;
+		return true;
+	}
+
+	// the document is loaded exactly as it would be when opened in the GUI, it just never gets a view
+	CSfxPackagerDoc *pdoc = (CSfxPackagerDoc *)(RUNTIME_CLASS(CSfxPackagerDoc)->CreateObject());
+	pdoc->SetPathName(projectpath, FALSE);
+
+	// a truncated or corrupt project throws from deep inside serialization
+	bool loaded = true;
+	try
+	{
+		CArchive ar(&f, CArchive::load);
+		ar.m_pDocument = pdoc;
+		pdoc->Serialize(ar);
+		ar.Close();
+	}
+	catch (CArchiveException *e)
+	{
+		e->Delete();
+		loaded = false;
+	}
+	catch (CFileException *e)
+	{
+		e->Delete();
+		loaded = false;
+	}
+
+	f.Close();
+
+	if (!loaded)
+	{
+		CString msg;
+		msg.Format(_T("Project \"%s\" could not be read; it may be damaged or from a newer version.\r\n"), projectpath);
+		reporter.LogMessage(msg);
+
+		delete pdoc;
+
+		exitcode = HBR_BADPROJECT;
+		return true;
+	}
+
+	if (!pdoc->GetNumFiles())
+	{
+		CString msg;
+		msg.Format(_T("Project \"%s\" has no files in it.\r\n"), projectpath);
+		reporter.LogMessage(msg);
+
+		delete pdoc;
+
+		exitcode = HBR_BADPROJECT;
+		return true;
+	}
+
+	// an output given on the command line is relative to where we were run from, not to the project
+	TCHAR outputpath[MAX_PATH];
+	if (outputfile)
+	{
+		GetFullPathName(outputfile, MAX_PATH, outputpath, NULL);
+		pdoc->m_SfxOutputFile = outputpath;
+	}
+
+	s_hCancelEvent = pdoc->m_hCancelEvent;
+	SetConsoleCtrlHandler(HeadlessCtrlHandler, TRUE);
+
+	pdoc->CreatePackage(NULL, &reporter);
+
+	SetConsoleCtrlHandler(HeadlessCtrlHandler, FALSE);
+	s_hCancelEvent = NULL;
+
+	// a build that never got started has already said why, but whoever is reading still expects a result
+	if (!reporter.IsFinished())
+	{
+		IBuildReporter::SBuildResult result = {IBuildReporter::SBuildResult::BO_FAILED, pdoc->m_SfxOutputFile, 0, 0, 0, 0, 0};
+		reporter.BuildFinished(result);
+	}
+
+	switch (reporter.GetOutcome())
+	{
+		case IBuildReporter::SBuildResult::BO_SUCCEEDED:
+			exitcode = HBR_SUCCEEDED;
+			break;
+
+		case IBuildReporter::SBuildResult::BO_CANCELLED:
+			exitcode = HBR_CANCELLED;
+			break;
+
+		default:
+			exitcode = HBR_FAILED;
+			break;
+	}
+
+	delete pdoc;
+
+	return true;
+}
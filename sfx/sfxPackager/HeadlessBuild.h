@@ -0,0 +1,39 @@
+/*
+	Copyright © 2013-2020, Keelan Stuart (hereafter referenced as AUTHOR). All Rights Reserved.
+	Permission to use, copy, modify, and distribute this software is hereby granted, without fee and without a signed licensing agreement,
+	provided that the above copyright notice appears in all copies, modifications, and distributions.
+	Furthermore, AUTHOR assumes no responsibility for any damages caused either directly or indirectly by the use of this software, nor vouches for
+	any fitness of purpose of this software.
+	All other copyrighted material contained herein is noted and rights attributed to individual copyright holders.
+	
+	For inquiries, contact: keelanstuart@gmail.com
+*/
+
+
+
+#pragma once
+
+
+// Process exit codes for a build that was run from the command line
+enum EHeadlessBuildResult
+{
+	HBR_SUCCEEDED = 0,
+	HBR_FAILED,			// the package is missing something, or couldn't be written at all
+	HBR_CANCELLED,		// the console was closed or Ctrl+C'd
+	HBR_BADPROJECT,		// the project couldn't be loaded, or has nothing in it
+	HBR_USAGE,			// the command line was wrong
+
+	HBR_NUMRESULTS
+};
+
+// If the command line is "/build <project.sfxpp> [/out <package>]", loads the project and builds it without creating any
+// windows, then returns true with exitcode set to one of EHeadlessBuildResult. Returns false for any other command line.
+// Everything the build reports is printed to stdout (or the console the packager was started from), one line per item, as a
+// keyword followed by its data:
+//   LOG <text>
+//   BUSY <0|1>
+//   PROGRESS <0-100>
+//   STATUS <text>
+//   RESULT outcome=<succeeded|failed|cancelled> files=<n> spans=<n> uncompressed=<bytes> compressed=<bytes> seconds=<n> output=<filename>
+// The packager is a windowed application, so cmd.exe only waits for it (and sets ERRORLEVEL) when run with "start /wait"
+bool RunHeadlessBuild(int argc, TCHAR **argv, int &exitcode);
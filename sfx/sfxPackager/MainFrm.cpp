@@ -533,4 +533,30 @@ void CMainFrame::OnTestSfx()
 		pView->TestSfx();
 }
 
+void CMainFrame::LogMessage(const TCHAR *msg)
+{
+	m_wndOutput.AppendMessage(COutputWnd::OT_BUILD, msg);
+}
 
+void CMainFrame::SetBusy(bool busy)
+{
+	m_wndStatusBar.PostMessage(CProgressStatusBar::WM_UPDATE_STATUS, 0xff, busy ? 1 : 0);
+	Sleep(0);
+}
+
+void CMainFrame::SetProgress(UINT pct)
+{
+	m_wndStatusBar.PostMessage(CProgressStatusBar::WM_UPDATE_STATUS, pct, 0);
+}
+
+void CMainFrame::ShowStatus(const TCHAR *text)
+{
+	m_wndStatusBar.PostStatusText(text);
+}
+
+void CMainFrame::BuildFinished(const SBuildResult &result)
+{
+	// the log already has the details
+	m_wndStatusBar.PostMessage(CProgressStatusBar::WM_UPDATE_STATUS, -1, 0);
+	Sleep(0);
+}
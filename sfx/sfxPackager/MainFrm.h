@@ -17,8 +17,9 @@
 #include "OutputWnd.h"
 #include "PropertiesWnd.h"
 #include "ProgressStatusBar.h"
+#include "BuildReporter.h"
 
-class CMainFrame : public CMDIFrameWndEx
+class CMainFrame : public CMDIFrameWndEx, public IBuildReporter
 {
 	DECLARE_DYNAMIC(CMainFrame)
 public:
@@ -47,6 +48,13 @@ public:
 	CPropertiesWnd &GetPropertiesWnd() { return m_wndProperties; }
 	CProgressStatusBar &GetStatusBarWnd() { return m_wndStatusBar; }
 
+	// IBuildReporter; builds show up in the output window and the status bar
+	virtual void LogMessage(const TCHAR *msg);
+	virtual void SetBusy(bool busy);
+	virtual void SetProgress(UINT pct);
+	virtual void ShowStatus(const TCHAR *text);
+	virtual void BuildFinished(const SBuildResult &result);
+
 protected:  // control bar embedded members
 	CMFCMenuBar         m_wndMenuBar;
 	CMFCToolBar		    m_wndToolBar;
@@ -22,15 +22,46 @@
 static char THIS_FILE[] = __FILE__;
 #endif
 
+// the pending message type used to open or close the log file
+#define MT_SETLOGFILE		COutputWnd::OT_NUMTYPES
+
+#define DRAIN_TIMER_ID		1
+#define DRAIN_INTERVAL_MS	100
+
+// the most text kept in each output window; older lines are discarded (the log file has everything)
+#define MAX_WINDOW_CHARS	(512 * 1024)
+
+// the most text allowed to wait to be shown; a build that logs faster than that only gets the excess into the log file
+#define MAX_PENDING_CHARS	(4 * 1024 * 1024)
+
 /////////////////////////////////////////////////////////////////////////////
 // COutputBar
 
 COutputWnd::COutputWnd()
 {
+	m_pPending = (PSLIST_HEADER)_aligned_malloc(sizeof(SLIST_HEADER), MEMORY_ALLOCATION_ALIGNMENT);
+	InitializeSListHead(m_pPending);
+
+	m_PendingChars = 0;
+	m_HiddenMessages = 0;
+
+	m_hLogFile = INVALID_HANDLE_VALUE;
 }
 
 COutputWnd::~COutputWnd()
 {
+	PSLIST_ENTRY pe = InterlockedFlushSList(m_pPending);
+	while (pe)
+	{
+		PSLIST_ENTRY next = pe->Next;
+		_aligned_free(CONTAINING_RECORD(pe, SPendingMessage, m_Link));
+		pe = next;
+	}
+
+	_aligned_free(m_pPending);
+
+	if (m_hLogFile != INVALID_HANDLE_VALUE)
+		CloseHandle(m_hLogFile);
 }
 
 void COutputWnd::AppendMessage(EOutputType t, const TCHAR *msg)
@@ -48,16 +79,187 @@ void COutputWnd::AppendMessage(EOutputType t, const TCHAR *msg)
 			break;
 	}
 
-	if (pol)
+	if (pol && msg)
+		PushMessage(t, msg);
+}
+
+void COutputWnd::SetLogFile(const TCHAR *filename)
+{
+	PushMessage(MT_SETLOGFILE, filename ? filename : _T(""));
+}
+
+void COutputWnd::PushMessage(UINT type, const TCHAR *text)
+{
+	size_t len = _tcslen(text);
+
+	// changing the log file doesn't count against the limit; only what's waiting to be shown does, since the log file has
+	// to get every line however far behind the window is
+	bool logonly = false;
+	if (type != MT_SETLOGFILE)
 	{
-		pol->SetSel(0x7FFFFFFE, 0x7FFFFFFE, 0);
-		pol->ReplaceSel(msg);
+		if ((InterlockedExchangeAdd(&m_PendingChars, (LONG)len) + (LONG)len) > MAX_PENDING_CHARS)
+		{
+			InterlockedExchangeAdd(&m_PendingChars, -(LONG)len);
+			InterlockedIncrement(&m_HiddenMessages);
+
+			// debug output isn't logged, so there's nowhere else for it to go
+			if (type != OT_BUILD)
+				return;
+
+			logonly = true;
+		}
 	}
+
+	SPendingMessage *pm = (SPendingMessage *)_aligned_malloc(sizeof(SPendingMessage) + (len * sizeof(TCHAR)), MEMORY_ALLOCATION_ALIGNMENT);
+	if (!pm)
+	{
+		if ((type != MT_SETLOGFILE) && !logonly)
+			InterlockedExchangeAdd(&m_PendingChars, -(LONG)len);
+
+		return;
+	}
+
+	pm->m_Type = type;
+	pm->m_LogOnly = logonly;
+	memcpy(pm->m_Text, text, (len + 1) * sizeof(TCHAR));
+
+	InterlockedPushEntrySList(m_pPending, &pm->m_Link);
+}
+
+void COutputWnd::DrainMessages()
+{
+	PSLIST_ENTRY pe = InterlockedFlushSList(m_pPending);
+	if (!pe)
+		return;
+
+	// the list comes back newest first; reverse it so messages are shown in the order they were appended
+	PSLIST_ENTRY ordered = NULL;
+	while (pe)
+	{
+		PSLIST_ENTRY next = pe->Next;
+		pe->Next = ordered;
+		ordered = pe;
+		pe = next;
+	}
+
+	CString text[OT_NUMTYPES];
+	CString logtext;
+	LONG drained = 0;
+
+	for (pe = ordered; pe; )
+	{
+		SPendingMessage *pm = CONTAINING_RECORD(pe, SPendingMessage, m_Link);
+		pe = pe->Next;
+
+		if (pm->m_Type == MT_SETLOGFILE)
+		{
+			// whatever was logged before the change belongs to the previous file
+			WriteLog(logtext);
+
+			if (m_hLogFile != INVALID_HANDLE_VALUE)
+			{
+				CloseHandle(m_hLogFile);
+				m_hLogFile = INVALID_HANDLE_VALUE;
+			}
+
+			if (*pm->m_Text)
+				m_hLogFile = CreateFile(pm->m_Text, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		}
+		else
+		{
+			if (!pm->m_LogOnly)
+			{
+				drained += (LONG)_tcslen(pm->m_Text);
+
+				text[pm->m_Type] += pm->m_Text;
+			}
+
+			if ((pm->m_Type == OT_BUILD) && (m_hLogFile != INVALID_HANDLE_VALUE))
+				logtext += pm->m_Text;
+		}
+
+		_aligned_free(pm);
+	}
+
+	InterlockedExchangeAdd(&m_PendingChars, -drained);
+
+	LONG hidden = InterlockedExchange(&m_HiddenMessages, 0);
+	if (hidden)
+	{
+		CString note;
+		note.Format(_T("[%d message(s) not shown; output was arriving faster than it could be shown%s]\r\n"), hidden,
+			(m_hLogFile != INVALID_HANDLE_VALUE) ? _T(", but the log file has them") : _T(""));
+
+		text[OT_BUILD] += note;
+	}
+
+	WriteLog(logtext);
+
+	if (!text[OT_BUILD].IsEmpty())
+		AppendToWindow(&m_wndOutputBuild, text[OT_BUILD]);
+
+	if (!text[OT_DEBUG].IsEmpty())
+		AppendToWindow(&m_wndOutputDebug, text[OT_DEBUG]);
+}
+
+void COutputWnd::AppendToWindow(COutputList *pol, const CString &text)
+{
+	if (!pol->GetSafeHwnd())
+		return;
+
+	LPCTSTR ptext = text;
+	int textlen = text.GetLength();
+
+	// if the batch alone is more than the window may hold, only the end of it is shown
+	if (textlen > MAX_WINDOW_CHARS)
+	{
+		ptext += textlen - MAX_WINDOW_CHARS;
+		textlen = MAX_WINDOW_CHARS;
+	}
+
+	pol->SetRedraw(FALSE);
+
+	int len = pol->GetWindowTextLength();
+	int excess = len + textlen - MAX_WINDOW_CHARS;
+	if (excess > 0)
+	{
+		// discard whole lines from the top to make room
+		int cut = pol->LineIndex(pol->LineFromChar(min(excess, len)) + 1);
+		if ((cut < 0) || (cut > len))
+			cut = len;
+
+		pol->SetSel(0, cut, TRUE);
+		pol->ReplaceSel(_T(""));
+	}
+
+	pol->SetSel(0x7FFFFFFE, 0x7FFFFFFE, 0);
+	pol->ReplaceSel(ptext);
+
+	pol->SetRedraw(TRUE);
+	pol->Invalidate();
+}
+
+void COutputWnd::WriteLog(CString &text)
+{
+	if (text.IsEmpty())
+		return;
+
+	if (m_hLogFile != INVALID_HANDLE_VALUE)
+	{
+		CT2CA s(text, CP_UTF8);
+
+		DWORD cb;
+		WriteFile(m_hLogFile, (LPCSTR)s, (DWORD)strlen(s), &cb, NULL);
+	}
+
+	text.Empty();
 }
 
 BEGIN_MESSAGE_MAP(COutputWnd, CDockablePane)
 	ON_WM_CREATE()
 	ON_WM_SIZE()
+	ON_WM_TIMER()
+	ON_WM_DESTROY()
 END_MESSAGE_MAP()
 
 int COutputWnd::OnCreate(LPCREATESTRUCT lpCreateStruct)
@@ -104,9 +306,32 @@ int COutputWnd::OnCreate(LPCREATESTRUCT lpCreateStruct)
 	// Fill output tabs with some dummy text (nothing magic here)
 	AppendMessage(OT_DEBUG, _T("sfxPackager v2.6 - contact Keelan Stuart (keelanstuart@gmail.com) with comments, bug reports, or suggestions.\r\n"));
 
+	SetTimer(DRAIN_TIMER_ID, DRAIN_INTERVAL_MS, NULL);
+
 	return 0;
 }
 
+void COutputWnd::OnTimer(UINT_PTR nIDEvent)
+{
+	if (nIDEvent == DRAIN_TIMER_ID)
+	{
+		DrainMessages();
+		return;
+	}
+
+	CDockablePane::OnTimer(nIDEvent);
+}
+
+void COutputWnd::OnDestroy()
+{
+	KillTimer(DRAIN_TIMER_ID);
+
+	// make sure the log file gets everything that was queued
+	DrainMessages();
+
+	CDockablePane::OnDestroy();
+}
+
 void COutputWnd::OnSize(UINT nType, int cx, int cy)
 {
 	CDockablePane::OnSize(nType, cx, cy);
@@ -50,8 +50,12 @@ public:
 		OT_NUMTYPES
 	};
 
+	// Safe to call from any thread; the message is queued without blocking and shown when the window next drains its queue
 	void AppendMessage(EOutputType t, const TCHAR *msg);
 
+	// Everything subsequently appended to the build output is also streamed to the given file; NULL closes it
+	void SetLogFile(const TCHAR *filename);
+
 // Attributes
 protected:
 	CMFCTabCtrl	m_wndTabs;
@@ -59,9 +63,32 @@ protected:
 	COutputList m_wndOutputBuild;
 	COutputList m_wndOutputDebug;
 
+	// a pending message, allocated to fit its text
+	struct SPendingMessage
+	{
+		SLIST_ENTRY m_Link;
+		UINT m_Type;
+		bool m_LogOnly;		// it came in over the limit, so it only goes to the log file
+		TCHAR m_Text[1];
+	};
+
+	// messages are pushed here by any thread and drained on the UI thread by a timer; once the text waiting to be shown
+	// reaches MAX_PENDING_CHARS, further build messages are still queued for the log file, but not for the window, and the
+	// next drain notes in the window how many weren't shown
+	PSLIST_HEADER m_pPending;
+	volatile LONG m_PendingChars;
+	volatile LONG m_HiddenMessages;
+
+	HANDLE m_hLogFile;
+
 protected:
 	void ClearWindow(EOutputType t);
 
+	void PushMessage(UINT type, const TCHAR *text);
+	void DrainMessages();
+	void AppendToWindow(COutputList *pol, const CString &text);
+	void WriteLog(CString &text);
+
 	void AdjustHorzScroll(CListBox& wndListBox);
 
 // Implementation
@@ -71,6 +98,8 @@ public:
 protected:
 	afx_msg int OnCreate(LPCREATESTRUCT lpCreateStruct);
 	afx_msg void OnSize(UINT nType, int cx, int cy);
+	afx_msg void OnTimer(UINT_PTR nIDEvent);
+	afx_msg void OnDestroy();
 
 	DECLARE_MESSAGE_MAP()
 };
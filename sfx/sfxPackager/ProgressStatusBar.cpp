@@ -21,13 +21,17 @@
 
 IMPLEMENT_DYNAMIC(CProgressStatusBar, CMFCStatusBar)
 
+// the progress bar takes up the right side of the first pane, leaving the rest for the build statistics
+#define PROGRESSBAR_WIDTH		240
+
 CProgressStatusBar::CProgressStatusBar()
 {
-
+	InitializeCriticalSection(&m_StatusTextLock);
 }
 
 CProgressStatusBar::~CProgressStatusBar()
 {
+	DeleteCriticalSection(&m_StatusTextLock);
 }
 
 
@@ -35,6 +39,7 @@ BEGIN_MESSAGE_MAP(CProgressStatusBar, CMFCStatusBar)
 	ON_WM_SIZE()
 	ON_WM_CREATE()
 	ON_MESSAGE(WM_UPDATE_STATUS, OnUpdateStatus)
+	ON_MESSAGE(WM_UPDATE_STATUSTEXT, OnUpdateStatusText)
 END_MESSAGE_MAP()
 
 
@@ -56,6 +61,7 @@ void CProgressStatusBar::OnSize(UINT nType, int cx, int cy)
 
 	CRect rc;
 	GetItemRect(0, &rc);
+	rc.left = max(rc.left, rc.right - PROGRESSBAR_WIDTH);
 
 	m_ProgressBar.MoveWindow(&rc, FALSE);
 }
@@ -81,8 +87,6 @@ void CProgressStatusBar::SetProgress(UINT pct)
 	DWORD oldstyle = m_ProgressBar.GetStyle();
 	DWORD newstyle = oldstyle;
 
-	UINT oldpct = m_ProgressBar.GetPos();
-
 	if ((pct >= 0) && (pct <= 100))
 	{
 		newstyle |= WS_VISIBLE;
@@ -93,12 +97,12 @@ void CProgressStatusBar::SetProgress(UINT pct)
 		newstyle &= ~WS_VISIBLE;
 	}
 
-	if ((oldstyle != newstyle) || (oldpct != pct))
+	// the text beside the bar belongs to whatever the bar is showing the progress of
+	if (oldstyle != newstyle)
 	{
-		SetWindowText(NULL);
+		SetPaneText(0, _T(""));
 
-		if (oldstyle != newstyle)
-			SetWindowLong(m_ProgressBar.GetSafeHwnd(), GWL_STYLE, newstyle);
+		SetWindowLong(m_ProgressBar.GetSafeHwnd(), GWL_STYLE, newstyle);
 	}
 }
 
@@ -127,3 +131,24 @@ LRESULT CProgressStatusBar::OnUpdateStatus(WPARAM pct, LPARAM marquee)
 
 	return 0;
 }
+
+void CProgressStatusBar::PostStatusText(const TCHAR *text)
+{
+	// only the latest text matters, so it's stored rather than sent along with the message
+	EnterCriticalSection(&m_StatusTextLock);
+	m_StatusText = text;
+	LeaveCriticalSection(&m_StatusTextLock);
+
+	PostMessage(WM_UPDATE_STATUSTEXT);
+}
+
+LRESULT CProgressStatusBar::OnUpdateStatusText(WPARAM wparam, LPARAM lparam)
+{
+	EnterCriticalSection(&m_StatusTextLock);
+	CString text = m_StatusText;
+	LeaveCriticalSection(&m_StatusTextLock);
+
+	SetPaneText(0, text);
+
+	return 0;
+}
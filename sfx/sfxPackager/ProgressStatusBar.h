@@ -19,21 +19,28 @@ class CProgressStatusBar : public CMFCStatusBar
 	DECLARE_DYNAMIC(CProgressStatusBar)
 
 public:
-	enum { WM_UPDATE_STATUS = WM_USER + 1 };
+	enum { WM_UPDATE_STATUS = WM_USER + 1, WM_UPDATE_STATUSTEXT };
 	CProgressStatusBar();
 	virtual ~CProgressStatusBar();
 
 	void SetProgress(UINT pct);
 	void SetMarquee(bool on);
 
+	// Shows text next to the progress bar; may be called from any thread
+	void PostStatusText(const TCHAR *text);
+
 protected:
 	CProgressCtrl m_ProgressBar;
 
+	CString m_StatusText;
+	CRITICAL_SECTION m_StatusTextLock;
+
 	DECLARE_MESSAGE_MAP()
 public:
 	afx_msg void OnSize(UINT nType, int cx, int cy);
 	afx_msg int OnCreate(LPCREATESTRUCT lpCreateStruct);
 	afx_msg LRESULT OnUpdateStatus(WPARAM pct, LPARAM marquee);
+	afx_msg LRESULT OnUpdateStatusText(WPARAM wparam, LPARAM lparam);
 };
 
 
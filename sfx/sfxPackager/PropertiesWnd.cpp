@@ -191,6 +191,7 @@ void CPropertiesWnd::FillPropertyList(CSfxPackagerDoc *pd, EPropertySet s)
 	static const TCHAR szIcoFilter[] = _T("Icon Files(*.ico)|*.ico|All Files(*.*)|*.*||");
 	static const TCHAR szBmpFilter[] = _T("Bitmap Files(*.bmp)|*.bmp|All Files(*.*)|*.*||");
 	static const TCHAR szExeFilter[] = _T("Executable Files(*.exe)|*.exe|All Files(*.*)|*.*||");
+	static const TCHAR szPackageFilter[] = _T("Packages(*.exe;*.data)|*.exe;*.data|All Files(*.*)|*.*||");
 
 	switch (s)
 	{
@@ -203,12 +204,24 @@ void CPropertiesWnd::FillPropertyList(CSfxPackagerDoc *pd, EPropertySet s)
 			CMFCPropertyGridProperty *pAppendBuildDateProp = new CMFCPropertyGridProperty(_T("Append Current Date"), (_variant_t)((bool)pd->m_bAppendBuildDate), _T("If set, appends the current date to the output file name, immediately before the extension (YYYYMMDD format)."));
 			CMFCPropertyGridProperty *pMaxSizeProp = new CMFCPropertyGridProperty(_T("Maximum Size (MB)"), pd->m_MaxSize, _T("The maximum size (in MB) constraint for generated sfx archives, beyond which, files will be split (-1 is no constraint)."));
 			CMFCPropertyGridProperty *pExternalArchiveProp = new CMFCPropertyGridProperty(_T("External Archive"), (_variant_t)((bool)pd->m_bExternalArchive), _T("If set, the archived file data will be stored in an external file, not the exe itself; use this if your archive exceeds 4GB."));
+			CMFCPropertyGridProperty *pStreamingLayoutProp = new CMFCPropertyGridProperty(_T("Streaming Layout"), (_variant_t)((bool)pd->m_bStreamingLayout), _T("If set, each file's data is preceded by its own header, so the archive can be extracted sequentially as it is downloaded or piped, without seeking to the file table first."));
+			CMFCPropertyGridProperty *pIncrementalBuildProp = new CMFCPropertyGridProperty(_T("Incremental Build"), (_variant_t)((bool)pd->m_bIncrementalBuild), _T("If set, the previous output is used as a reference; files that haven't changed since (same size, modification time, and content) have their compressed data copied from it instead of being compressed again."));
+			CMFCPropertyGridProperty *pCachePathProp = new CMFCPropertyGridFileProperty(_T("Build Cache Path"), pd->m_CachePath, 0, _T("OPTIONAL: A folder where the compressed data of each file is kept between builds (and may be shared by other projects); files that haven't changed since are copied from there instead of being compressed again."));
+			CMFCPropertyGridProperty *pCacheSizeProp = new CMFCPropertyGridProperty(_T("Build Cache Size (MB)"), pd->m_CacheSize, _T("The size (in MB) the build cache is allowed to grow to; beyond that, the least recently used files are removed from it after a build."));
+			CMFCPropertyGridProperty *pPatchBaseProp = new CMFCPropertyGridFileProperty(_T("Patch Against"), TRUE, pd->m_PatchBase, _T("exe"), 0, szPackageFilter, _T("OPTIONAL: A previously built package (its exe, or its .data file if External Archive was set); if given, an update package is built that only holds what has changed since then, and can only be installed over that version."));
+			CMFCPropertyGridProperty *pOutputCmdProp = new CMFCPropertyGridProperty(_T("Output Command"), pd->m_OutputCmd, _T("OPTIONAL: A command that the package will be streamed into (on its standard input) instead of being written to disk, e.g. an upload tool. With External Archive set, only the archive data is streamed and the exe is still written. Spanning is not supported."));
 
 			pSettingsGroup->AddSubItem(pSfxNameProp);
 			pSettingsGroup->AddSubItem(pAppendVersionProp);
 			pSettingsGroup->AddSubItem(pAppendBuildDateProp);
 			pSettingsGroup->AddSubItem(pMaxSizeProp);
 			pSettingsGroup->AddSubItem(pExternalArchiveProp);
+			pSettingsGroup->AddSubItem(pStreamingLayoutProp);
+			pSettingsGroup->AddSubItem(pIncrementalBuildProp);
+			pSettingsGroup->AddSubItem(pCachePathProp);
+			pSettingsGroup->AddSubItem(pCacheSizeProp);
+			pSettingsGroup->AddSubItem(pPatchBaseProp);
+			pSettingsGroup->AddSubItem(pOutputCmdProp);
 
 			m_wndPropList.AddProperty(pSettingsGroup);
 
@@ -289,7 +302,7 @@ void CPropertiesWnd::FillPropertyList(CSfxPackagerDoc *pd, EPropertySet s)
 				selcount++;
 
 				int i = list.GetNextSelectedItem(pos);
-				DWORD_PTR hi = list.GetItemData(i);
+				DWORD_PTR hi = pv->GetFileHandle(i);
 
 				if (!got_name)
 				{
@@ -366,10 +379,8 @@ void CPropertiesWnd::FillPropertyList(CSfxPackagerDoc *pd, EPropertySet s)
 		case PS_SETTINGS:
 		{
 			CMFCPropertyGridFileProperty *pTempPathProp = new CMFCPropertyGridFileProperty(_T("Temporary Directory"), theApp.m_sTempPath, NULL, _T("The location where temporary working files will be stored - this should be an isolated location and contain no other files than those copied there by sfxPackager, since they will be deleted"));
-			CMFCPropertyGridFileProperty *p7ZipPathProp = new CMFCPropertyGridFileProperty(_T("7-Zip Executable"), TRUE, theApp.m_s7ZipPath, _T("exe"), 0, szExeFilter, _T("The location of 7z.exe"));
 
 			m_wndPropList.AddProperty(pTempPathProp);
-			m_wndPropList.AddProperty(p7ZipPathProp);
 			break;
 		}
 	}
@@ -90,6 +90,30 @@ void CPropertyGrid::OnPropertyChanged(CMFCPropertyGridProperty* pProp) const
 	{
 		pd->m_bExternalArchive = pProp->GetValue().boolVal ? true : false;
 	}
+	else if (!_tcsicmp(pProp->GetName(), _T("Streaming Layout")))
+	{
+		pd->m_bStreamingLayout = pProp->GetValue().boolVal ? true : false;
+	}
+	else if (!_tcsicmp(pProp->GetName(), _T("Incremental Build")))
+	{
+		pd->m_bIncrementalBuild = pProp->GetValue().boolVal ? true : false;
+	}
+	else if (!_tcsicmp(pProp->GetName(), _T("Build Cache Path")))
+	{
+		pd->m_CachePath = pProp->GetValue();
+	}
+	else if (!_tcsicmp(pProp->GetName(), _T("Build Cache Size (MB)")))
+	{
+		pd->m_CacheSize = pProp->GetValue().intVal;
+	}
+	else if (!_tcsicmp(pProp->GetName(), _T("Patch Against")))
+	{
+		pd->m_PatchBase = pProp->GetValue();
+	}
+	else if (!_tcsicmp(pProp->GetName(), _T("Output Command")))
+	{
+		pd->m_OutputCmd = pProp->GetValue();
+	}
 	else if (!_tcsicmp(pProp->GetName(), _T("Allow Destination Change")))
 	{
 		pd->m_bAllowDestChg = pProp->GetValue().boolVal ? true : false;
@@ -172,12 +196,6 @@ void CPropertyGrid::OnPropertyChanged(CMFCPropertyGridProperty* pProp) const
 
 		theApp.m_sTempPath = tempdir;
 	}
-	else if (!_tcsicmp(pProp->GetName(), _T("7-Zip Executable")))
-	{
-		CString exepath = pProp->GetValue();
-
-		theApp.m_s7ZipPath = exepath;
-	}
 	else
 		CMFCPropertyGridCtrl::OnPropertyChanged(pProp);
 }
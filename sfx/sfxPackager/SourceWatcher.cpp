@@ -0,0 +1,509 @@
+/*
+	Copyright © 2013-2020, Keelan Stuart (hereafter referenced as AUTHOR). All Rights Reserved.
+	Permission to use, copy, modify, and distribute this software is hereby granted, without fee and without a signed licensing agreement,
+	provided that the above copyright notice appears in all copies, modifications, and distributions.
+	Furthermore, AUTHOR assumes no responsibility for any damages caused either directly or indirectly by the use of this software, nor vouches for
+	any fitness of purpose of this software.
+	All other copyrighted material contained herein is noted and rights attributed to individual copyright holders.
+	
+	For inquiries, contact: keelanstuart@gmail.com
+*/
+
+
+
+#include "stdafx.h"
+
+#include "SourceWatcher.h"
+
+
+#define WATCH_FILTER	(FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME | FILE_NOTIFY_CHANGE_ATTRIBUTES | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE)
+
+
+CSourceWatcher::CSourceWatcher()
+{
+	m_hThread = NULL;
+	m_bStopping = false;
+	m_Seq = 1;
+
+	InitializeCriticalSection(&m_Lock);
+}
+
+
+CSourceWatcher::~CSourceWatcher()
+{
+	if (m_hThread)
+	{
+		QueueUserAPC(StopProc, m_hThread, (ULONG_PTR)this);
+		WaitForSingleObject(m_hThread, INFINITE);
+		CloseHandle(m_hThread);
+	}
+
+	DeleteCriticalSection(&m_Lock);
+}
+
+
+void CSourceWatcher::MakeKey(const TCHAR *dir, tstring &key)
+{
+	key = dir;
+	if (key.empty() || (key.back() != _T('\\')))
+		key += _T('\\');
+
+	CharLowerBuff(&key[0], (DWORD)key.length());
+}
+
+
+bool CSourceWatcher::MakeLongPath(tstring &path)
+{
+	TCHAR buf[MAX_PATH];
+	DWORD len = GetLongPathName(path.c_str(), buf, MAX_PATH);
+	if (!len || (len >= MAX_PATH))
+		return false;
+
+	path.assign(buf, len);
+	return true;
+}
+
+
+bool CSourceWatcher::GetDirectoryId(HANDLE hdir, DWORD &volser, ULONGLONG &fileid)
+{
+	BY_HANDLE_FILE_INFORMATION bhfi;
+	if (!GetFileInformationByHandle(hdir, &bhfi))
+		return false;
+
+	volser = bhfi.dwVolumeSerialNumber;
+	fileid = (((ULONGLONG)bhfi.nFileIndexHigh) << 32) | bhfi.nFileIndexLow;
+	return true;
+}
+
+
+DWORD WINAPI CSourceWatcher::WatchThreadProc(LPVOID param)
+{
+	CSourceWatcher *_this = (CSourceWatcher *)param;
+
+	// everything happens in APCs and completion routines, which only run while the thread waits alertably
+	while (!_this->m_bStopping)
+		SleepEx(INFINITE, TRUE);
+
+	EnterCriticalSection(&_this->m_Lock);
+	std::vector<SRoot *> roots;
+	roots.swap(_this->m_Roots);
+	LeaveCriticalSection(&_this->m_Lock);
+
+	for (auto proot : roots)
+		CancelIo(proot->m_hDir);
+
+	// a cancelled read still completes, and its routine has to run before the root can go
+	for (auto proot : roots)
+	{
+		while (proot->m_Pending)
+			SleepEx(100, TRUE);
+
+		CloseHandle(proot->m_hDir);
+		delete proot;
+	}
+
+	return 0;
+}
+
+
+VOID CALLBACK CSourceWatcher::AddRootProc(ULONG_PTR param)
+{
+	SRoot *proot = (SRoot *)param;
+
+	proot->m_Watching = proot->m_pWatcher->Arm(proot);
+
+	SetEvent(proot->m_hReady);
+}
+
+
+VOID CALLBACK CSourceWatcher::RemoveRootProc(ULONG_PTR param)
+{
+	SRoot *proot = (SRoot *)param;
+
+	// the read can only be cancelled by the thread that issued it, and its routine has to run before the root can go
+	proot->m_Removing = true;
+	CancelIo(proot->m_hDir);
+
+	while (proot->m_Pending)
+		SleepEx(100, TRUE);
+
+	CloseHandle(proot->m_hDir);
+	delete proot;
+}
+
+
+VOID CALLBACK CSourceWatcher::StopProc(ULONG_PTR param)
+{
+	CSourceWatcher *_this = (CSourceWatcher *)param;
+
+	_this->m_bStopping = true;
+}
+
+
+bool CSourceWatcher::Arm(SRoot *proot)
+{
+	ZeroMemory(&proot->m_Overlapped, sizeof(OVERLAPPED));
+
+	proot->m_Pending = (ReadDirectoryChangesW(proot->m_hDir, proot->m_Buffer, sizeof(proot->m_Buffer), TRUE, WATCH_FILTER, NULL, &proot->m_Overlapped, ChangeProc) != FALSE);
+
+	return proot->m_Pending;
+}
+
+
+VOID CALLBACK CSourceWatcher::ChangeProc(DWORD err, DWORD bytes, LPOVERLAPPED pov)
+{
+	SRoot *proot = CONTAINING_RECORD(pov, SRoot, m_Overlapped);
+	CSourceWatcher *_this = proot->m_pWatcher;
+
+	proot->m_Pending = false;
+
+	if (err == ERROR_OPERATION_ABORTED)
+		return;
+
+	if (err || !bytes)
+	{
+		// more changed than would fit in the buffer (ERROR_NOTIFY_ENUM_DIR, or no bytes at all), so there's no telling what;
+		// none of the listings can be trusted
+		EnterCriticalSection(&_this->m_Lock);
+		_this->ChangedUnder(proot->m_Dir);
+		LeaveCriticalSection(&_this->m_Lock);
+	}
+	else
+	{
+		const BYTE *p = (const BYTE *)proot->m_Buffer;
+
+		for (;;)
+		{
+			const FILE_NOTIFY_INFORMATION *pfni = (const FILE_NOTIFY_INFORMATION *)p;
+
+			std::wstring name(pfni->FileName, pfni->FileNameLength / sizeof(WCHAR));
+
+			tstring path = proot->m_Dir;
+			path += (LPCTSTR)CW2T(name.c_str());
+
+			// names can be reported in their short (8.3) form, but listings are kept by the long ones
+			bool known = MakeLongPath(path);
+			if (!known)
+			{
+				// whatever it was is gone; its directory is still there to be looked up, and the name itself only matters if it
+				// could be a short one
+				size_t sep = path.find_last_of(_T('\\'));
+				tstring parent = path.substr(0, sep);
+				tstring leaf = path.substr(sep + 1);
+
+				if (MakeLongPath(parent))
+				{
+					path = parent + _T('\\') + leaf;
+					known = (leaf.find(_T('~')) == tstring::npos);
+				}
+			}
+
+			CharLowerBuff(&path[0], (DWORD)path.length());
+
+			if (known)
+			{
+				_this->Changed(path);
+			}
+			else
+			{
+				// there's no telling which listing that was in, or whether it was a directory that had its own
+				size_t sep = path.find_last_of(_T('\\'));
+				tstring parent = path.substr(0, sep + 1);
+				if (parent.compare(0, proot->m_Dir.length(), proot->m_Dir))
+					parent = proot->m_Dir;
+
+				EnterCriticalSection(&_this->m_Lock);
+				_this->ChangedUnder(parent);
+				LeaveCriticalSection(&_this->m_Lock);
+			}
+
+			if (!pfni->NextEntryOffset)
+				break;
+
+			p += pfni->NextEntryOffset;
+		}
+	}
+
+	if (_this->m_bStopping || proot->m_Removing)
+		return;
+
+	// changes that happen before this are held by the system until it's asked for them
+	if (!_this->Arm(proot))
+	{
+		EnterCriticalSection(&_this->m_Lock);
+		_this->ChangedUnder(proot->m_Dir);
+		proot->m_Watching = false;
+		LeaveCriticalSection(&_this->m_Lock);
+	}
+}
+
+
+void CSourceWatcher::Changed(const tstring &path)
+{
+	EnterCriticalSection(&m_Lock);
+
+	m_Seq++;
+
+	// whatever changed is part of its parent directory's listing
+	size_t sep = path.find_last_of(_T('\\'));
+	if (sep != tstring::npos)
+	{
+		auto it = m_Listings.find(path.substr(0, sep + 1));
+		if (it != m_Listings.end())
+		{
+			it->second.m_Valid = false;
+			it->second.m_Items.clear();
+			it->second.m_ChangedSeq = m_Seq;
+		}
+	}
+
+	// and if it was a directory that had been listed, it (and everything under it) may have been moved or deleted
+	tstring dir = path + _T('\\');
+	if (m_Listings.find(dir) != m_Listings.end())
+		ChangedUnder(dir);
+
+	LeaveCriticalSection(&m_Lock);
+}
+
+
+void CSourceWatcher::ChangedUnder(const tstring &dir)
+{
+	m_Seq++;
+
+	for (auto &it : m_Listings)
+	{
+		if (!it.first.compare(0, dir.length(), dir))
+		{
+			it.second.m_Valid = false;
+			it.second.m_Items.clear();
+			it.second.m_ChangedSeq = m_Seq;
+		}
+	}
+}
+
+
+bool CSourceWatcher::CheckRoot(const tstring &key)
+{
+	tstring dir;
+	DWORD volser = 0;
+	ULONGLONG fileid = 0;
+
+	EnterCriticalSection(&m_Lock);
+	for (auto proot : m_Roots)
+	{
+		if (proot->m_Watching && !key.compare(0, proot->m_Dir.length(), proot->m_Dir))
+		{
+			dir = proot->m_Dir;
+			volser = proot->m_VolumeSerial;
+			fileid = proot->m_FileId;
+			break;
+		}
+	}
+	LeaveCriticalSection(&m_Lock);
+
+	if (dir.empty())
+		return false;
+
+	HANDLE h = CreateFile(dir.c_str(), FILE_READ_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+
+	DWORD cur_volser;
+	ULONGLONG cur_fileid;
+	bool same = (h != INVALID_HANDLE_VALUE) && GetDirectoryId(h, cur_volser, cur_fileid) && (cur_volser == volser) && (cur_fileid == fileid);
+
+	if (h != INVALID_HANDLE_VALUE)
+		CloseHandle(h);
+
+	if (!same)
+	{
+		EnterCriticalSection(&m_Lock);
+
+		ChangedUnder(dir);
+
+		for (auto proot : m_Roots)
+		{
+			if (proot->m_Dir == dir)
+				proot->m_Watching = false;
+		}
+
+		LeaveCriticalSection(&m_Lock);
+	}
+
+	return same;
+}
+
+
+bool CSourceWatcher::Watch(const TCHAR *dir)
+{
+	// the root is kept by its long name, since that's what the names of changes under it are turned into
+	tstring longdir = dir;
+	MakeLongPath(longdir);
+
+	tstring key;
+	MakeKey(longdir.c_str(), key);
+
+	// a root that's no longer watched (its path leads somewhere else now, or its read couldn't be issued again) is let go
+	// here, so that watching the same place again replaces it instead of adding another
+	std::vector<SRoot *> stale;
+
+	EnterCriticalSection(&m_Lock);
+	for (auto proot : m_Roots)
+	{
+		if (!key.compare(0, proot->m_Dir.length(), proot->m_Dir) && proot->m_Watching)
+		{
+			LeaveCriticalSection(&m_Lock);
+			return true;
+		}
+	}
+
+	for (auto it = m_Roots.begin(); it != m_Roots.end(); )
+	{
+		if (!(*it)->m_Watching)
+		{
+			stale.push_back(*it);
+			it = m_Roots.erase(it);
+		}
+		else
+			it++;
+	}
+	LeaveCriticalSection(&m_Lock);
+
+	for (auto proot : stale)
+	{
+		// if it can't be handed to the thread, it's left for the thread to clean up when it stops
+		if (!QueueUserAPC(RemoveRootProc, m_hThread, (ULONG_PTR)proot))
+		{
+			EnterCriticalSection(&m_Lock);
+			m_Roots.push_back(proot);
+			LeaveCriticalSection(&m_Lock);
+		}
+	}
+
+	HANDLE hdir = CreateFile(dir, FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL);
+	if (hdir == INVALID_HANDLE_VALUE)
+		return false;
+
+	DWORD volser;
+	ULONGLONG fileid;
+	if (!GetDirectoryId(hdir, volser, fileid))
+	{
+		CloseHandle(hdir);
+		return false;
+	}
+
+	if (!m_hThread)
+	{
+		m_hThread = CreateThread(NULL, 0, WatchThreadProc, this, 0, NULL);
+		if (!m_hThread)
+		{
+			CloseHandle(hdir);
+			return false;
+		}
+	}
+
+	SRoot *proot = new SRoot;
+	proot->m_pWatcher = this;
+	proot->m_Dir = key;
+	proot->m_hDir = hdir;
+	proot->m_VolumeSerial = volser;
+	proot->m_FileId = fileid;
+	proot->m_hReady = CreateEvent(NULL, FALSE, FALSE, NULL);
+	proot->m_Watching = false;
+	proot->m_Pending = false;
+	proot->m_Removing = false;
+
+	// the read has to be issued by the thread that will wait for it to complete; it's done before returning, so nothing that
+	// the caller lists after this can change unnoticed
+	if (QueueUserAPC(AddRootProc, m_hThread, (ULONG_PTR)proot))
+		WaitForSingleObject(proot->m_hReady, INFINITE);
+
+	CloseHandle(proot->m_hReady);
+	proot->m_hReady = NULL;
+
+	if (!proot->m_Watching)
+	{
+		CloseHandle(proot->m_hDir);
+		delete proot;
+
+		return false;
+	}
+
+	EnterCriticalSection(&m_Lock);
+	m_Roots.push_back(proot);
+	LeaveCriticalSection(&m_Lock);
+
+	return true;
+}
+
+
+bool CSourceWatcher::GetListing(const TCHAR *dir, TListing &listing)
+{
+	tstring key;
+	MakeKey(dir, key);
+
+	// a kept listing can only be trusted while its root's path still leads to the directory that's being watched
+	if (!CheckRoot(key))
+		return false;
+
+	bool ret = false;
+
+	EnterCriticalSection(&m_Lock);
+
+	auto it = m_Listings.find(key);
+	if ((it != m_Listings.end()) && it->second.m_Valid)
+	{
+		listing = it->second.m_Items;
+		ret = true;
+	}
+
+	LeaveCriticalSection(&m_Lock);
+
+	return ret;
+}
+
+
+ULONGLONG CSourceWatcher::BeginListing(const TCHAR *dir)
+{
+	tstring key;
+	MakeKey(dir, key);
+
+	ULONGLONG ret = 0;
+
+	EnterCriticalSection(&m_Lock);
+
+	for (auto proot : m_Roots)
+	{
+		if (proot->m_Watching && !key.compare(0, proot->m_Dir.length(), proot->m_Dir))
+		{
+			// the entry has to exist before the listing starts, so that any change made during it is recorded there
+			m_Listings[key];
+
+			ret = m_Seq;
+			break;
+		}
+	}
+
+	LeaveCriticalSection(&m_Lock);
+
+	return ret;
+}
+
+
+void CSourceWatcher::StoreListing(const TCHAR *dir, ULONGLONG token, const TListing &listing)
+{
+	if (!token)
+		return;
+
+	tstring key;
+	MakeKey(dir, key);
+
+	EnterCriticalSection(&m_Lock);
+
+	auto it = m_Listings.find(key);
+	if ((it != m_Listings.end()) && (it->second.m_ChangedSeq <= token))
+	{
+		it->second.m_Items = listing;
+		it->second.m_Valid = true;
+	}
+
+	LeaveCriticalSection(&m_Lock);
+}
@@ -0,0 +1,109 @@
+/*
+	Copyright © 2013-2020, Keelan Stuart (hereafter referenced as AUTHOR). All Rights Reserved.
+	Permission to use, copy, modify, and distribute this software is hereby granted, without fee and without a signed licensing agreement,
+	provided that the above copyright notice appears in all copies, modifications, and distributions.
+	Furthermore, AUTHOR assumes no responsibility for any damages caused either directly or indirectly by the use of this software, nor vouches for
+	any fitness of purpose of this software.
+	All other copyrighted material contained herein is noted and rights attributed to individual copyright holders.
+	
+	For inquiries, contact: keelanstuart@gmail.com
+*/
+
+
+
+#pragma once
+
+#include <unordered_map>
+
+
+// Watches the directory trees that a project's files come from and keeps the listings of their directories for as long as
+// nothing in them changes, so that a build can skip listing them again. Changes are noticed with ReadDirectoryChangesW, on a
+// thread of its own; anything that isn't watched (some network shares can't be) simply never has a listing kept
+class CSourceWatcher
+{
+public:
+
+	struct SItem
+	{
+		tstring m_Name;
+		uint64_t m_Size;
+		FILETIME m_Modified;
+		DWORD m_Attributes;
+	};
+
+	typedef std::vector<SItem> TListing;
+
+	CSourceWatcher();
+
+	~CSourceWatcher();
+
+	// Starts watching dir and everything under it, if that isn't being done already; returns false if it can't be watched
+	bool Watch(const TCHAR *dir);
+
+	// Gets the listing of dir that was kept, if there is one and nothing in dir has changed since
+	bool GetListing(const TCHAR *dir, TListing &listing);
+
+	// Call before listing dir yourself; returns the token to give StoreListing, or 0 if dir isn't being watched
+	ULONGLONG BeginListing(const TCHAR *dir);
+
+	// Keeps a listing of dir, unless something in it changed after the BeginListing that returned token
+	void StoreListing(const TCHAR *dir, ULONGLONG token, const TListing &listing);
+
+protected:
+
+	struct SRoot
+	{
+		OVERLAPPED m_Overlapped;
+		CSourceWatcher *m_pWatcher;
+		tstring m_Dir;				// the long name, lower-case, with a trailing backslash
+		HANDLE m_hDir;
+		DWORD m_VolumeSerial;		// what m_hDir was opened on; if the path stops leading there, nothing under it is watched
+		ULONGLONG m_FileId;
+		HANDLE m_hReady;
+		bool m_Watching;
+		bool m_Pending;
+		bool m_Removing;			// it's being let go, so its read isn't issued again
+		DWORD m_Buffer[16 * 1024];	// 64KB is as much as a network share will take
+	};
+
+	struct SListing
+	{
+		TListing m_Items;
+		bool m_Valid;
+		ULONGLONG m_ChangedSeq;
+	};
+
+	static DWORD WINAPI WatchThreadProc(LPVOID param);
+	static VOID CALLBACK AddRootProc(ULONG_PTR param);
+	static VOID CALLBACK RemoveRootProc(ULONG_PTR param);
+	static VOID CALLBACK StopProc(ULONG_PTR param);
+	static VOID CALLBACK ChangeProc(DWORD err, DWORD bytes, LPOVERLAPPED pov);
+
+	// Asks for the next batch of changes under proot
+	bool Arm(SRoot *proot);
+
+	// Forgets the listings affected by a change to path (the lower-case full path of whatever changed)
+	void Changed(const tstring &path);
+
+	// Forgets the listing of every directory under dir, including dir itself; m_Lock must be held
+	void ChangedUnder(const tstring &dir);
+
+	// Makes sure the root that key is under still has the path it was watched by (it may have been deleted and made again, or
+	// the path remapped to another volume); if not, its listings are forgotten and it's no longer considered watched
+	bool CheckRoot(const tstring &key);
+
+	static void MakeKey(const TCHAR *dir, tstring &key);
+
+	// Replaces any short (8.3) names in path with long ones; fails if path doesn't exist
+	static bool MakeLongPath(tstring &path);
+
+	static bool GetDirectoryId(HANDLE hdir, DWORD &volser, ULONGLONG &fileid);
+
+	HANDLE m_hThread;
+	bool m_bStopping;
+
+	CRITICAL_SECTION m_Lock;
+	std::vector<SRoot *> m_Roots;
+	std::unordered_map<tstring, SListing> m_Listings;
+	ULONGLONG m_Seq;
+};
@@ -0,0 +1,133 @@
+/*
+	Copyright © 2013-2020, Keelan Stuart (hereafter referenced as AUTHOR). All Rights Reserved.
+	Permission to use, copy, modify, and distribute this software is hereby granted, without fee and without a signed licensing agreement,
+	provided that the above copyright notice appears in all copies, modifications, and distributions.
+	Furthermore, AUTHOR assumes no responsibility for any damages caused either directly or indirectly by the use of this software, nor vouches for
+	any fitness of purpose of this software.
+	All other copyrighted material contained herein is noted and rights attributed to individual copyright holders.
+	
+	For inquiries, contact: keelanstuart@gmail.com
+*/
+
+
+#include "stdafx.h"
+#include "Utf8ArchiveWriter.h"
+
+
+CUtf8ArchiveWriter::CUtf8ArchiveWriter(CArchive &ar, size_t bufsize) : m_Archive(ar)
+{
+	// room for at least one fully-encoded character
+	m_Buf.resize(max(bufsize, (size_t)16));
+	m_Used = 0;
+}
+
+
+CUtf8ArchiveWriter::~CUtf8ArchiveWriter()
+{
+}
+
+
+void CUtf8ArchiveWriter::Write(const TCHAR *s)
+{
+	if (s)
+		Write(s, _tcslen(s));
+}
+
+
+void CUtf8ArchiveWriter::Write(const TCHAR *s, size_t len)
+{
+	char *buf = m_Buf.data();
+	size_t cap = m_Buf.size();
+
+#if defined(UNICODE)
+	for (size_t i = 0; i < len; i++)
+	{
+		// the longest a single character can become is four bytes (a surrogate pair)
+		if ((m_Used + 4) > cap)
+			Flush();
+
+		UINT c = (UINT)s[i];
+
+		if (c < 0x80)
+		{
+			buf[m_Used++] = (char)c;
+		}
+		else if (c < 0x800)
+		{
+			buf[m_Used++] = (char)(0xC0 | (c >> 6));
+			buf[m_Used++] = (char)(0x80 | (c & 0x3F));
+		}
+		else if ((c >= 0xD800) && (c < 0xDC00) && ((i + 1) < len) && ((UINT)s[i + 1] >= 0xDC00) && ((UINT)s[i + 1] < 0xE000))
+		{
+			c = 0x10000 + ((c - 0xD800) << 10) + ((UINT)s[++i] - 0xDC00);
+
+			buf[m_Used++] = (char)(0xF0 | (c >> 18));
+			buf[m_Used++] = (char)(0x80 | ((c >> 12) & 0x3F));
+			buf[m_Used++] = (char)(0x80 | ((c >> 6) & 0x3F));
+			buf[m_Used++] = (char)(0x80 | (c & 0x3F));
+		}
+		else
+		{
+			// a surrogate without its other half becomes U+FFFD, as WideCharToMultiByte does
+			if ((c >= 0xD800) && (c < 0xE000))
+				c = 0xFFFD;
+
+			buf[m_Used++] = (char)(0xE0 | (c >> 12));
+			buf[m_Used++] = (char)(0x80 | ((c >> 6) & 0x3F));
+			buf[m_Used++] = (char)(0x80 | (c & 0x3F));
+		}
+	}
+#else
+	while (len)
+	{
+		if (m_Used == cap)
+			Flush();
+
+		size_t n = min(len, cap - m_Used);
+		memcpy(buf + m_Used, s, n);
+		m_Used += n;
+		s += n;
+		len -= n;
+	}
+#endif
+}
+
+
+void CUtf8ArchiveWriter::WriteEscaped(const TCHAR *s)
+{
+	if (!s)
+		return;
+
+	const TCHAR *run = s;
+	for (const TCHAR *c = s; *c; c++)
+	{
+		const TCHAR *ent;
+		size_t entlen;
+
+		switch (*c)
+		{
+			case _T('<'): ent = _T("&lt;"); entlen = 4; break;
+			case _T('>'): ent = _T("&gt;"); entlen = 4; break;
+			case _T('&'): ent = _T("&amp;"); entlen = 5; break;
+			case _T('\"'): ent = _T("&quot;"); entlen = 6; break;
+			default: continue;
+		}
+
+		// everything since the last entity goes out in one piece
+		Write(run, c - run);
+		Write(ent, entlen);
+		run = c + 1;
+	}
+
+	Write(run, _tcslen(run));
+}
+
+
+void CUtf8ArchiveWriter::Flush()
+{
+	if (m_Used)
+	{
+		m_Archive.Write(m_Buf.data(), (UINT)m_Used);
+		m_Used = 0;
+	}
+}
@@ -0,0 +1,41 @@
+/*
+	Copyright © 2013-2020, Keelan Stuart (hereafter referenced as AUTHOR). All Rights Reserved.
+	Permission to use, copy, modify, and distribute this software is hereby granted, without fee and without a signed licensing agreement,
+	provided that the above copyright notice appears in all copies, modifications, and distributions.
+	Furthermore, AUTHOR assumes no responsibility for any damages caused either directly or indirectly by the use of this software, nor vouches for
+	any fitness of purpose of this software.
+	All other copyrighted material contained herein is noted and rights attributed to individual copyright holders.
+	
+	For inquiries, contact: keelanstuart@gmail.com
+*/
+
+
+
+
+#pragma once
+
+
+// Writes text to an archive as UTF-8, converting (and, if asked, XML-escaping) straight into a buffer that is only handed
+// to the archive when it fills up; a save is a handful of large writes instead of a conversion and a write per line
+class CUtf8ArchiveWriter
+{
+public:
+	CUtf8ArchiveWriter(CArchive &ar, size_t bufsize = (256 << 10));
+
+	~CUtf8ArchiveWriter();
+
+	void Write(const TCHAR *s);
+	void Write(const TCHAR *s, size_t len);
+
+	// Replaces <, >, & and " with their entities as it writes
+	void WriteEscaped(const TCHAR *s);
+
+	// Must be called when done; anything still buffered is lost otherwise. Errors are thrown by the archive
+	void Flush();
+
+protected:
+	CArchive &m_Archive;
+
+	std::vector<char> m_Buf;
+	size_t m_Used;
+};
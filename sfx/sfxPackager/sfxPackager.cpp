@@ -22,6 +22,7 @@
 #include "ChildFrm.h"
 #include "sfxPackagerDoc.h"
 #include "sfxPackagerView.h"
+#include "HeadlessBuild.h"
 
 #ifdef _DEBUG
 #define new DEBUG_NEW
@@ -46,6 +47,8 @@ CSfxPackagerApp::CSfxPackagerApp()
 
 	// recommended format for string is CompanyName.ProductName.SubProduct.VersionInformation
 	SetAppID(_T("sfxPackager.sfxPackager.1.1.0.1"));
+
+	m_HeadlessExitCode = -1;
 }
 
 // The one and only CSfxPackagerApp object
@@ -92,22 +95,6 @@ BOOL CSfxPackagerApp::InitInstance()
 	SetRegistryKey(_T("sfxPackager"));
 	LoadStdProfileSettings(4);  // Load standard INI file options (including MRU)
 
-	{
-		TCHAR path7z[MAX_PATH] = {0};
-		HKEY key;
-		if (RegOpenKeyEx(HKEY_LOCAL_MACHINE, _T("SOFTWARE\\7-Zip"), 0, KEY_READ, &key) == ERROR_SUCCESS)
-		{
-			DWORD rkt, rksz;
-			rksz = sizeof(path7z);
-			RegQueryValueEx(key, _T("Path"), 0, &rkt, (BYTE *)path7z, &rksz);
-
-			RegCloseKey(key);
-		}
-		_tcscat_s(path7z, MAX_PATH, _T("7z.exe"));
-
-		m_s7ZipPath = GetProfileString(_T("sfxPackager"), _T("7ZipPath"), path7z);
-	}
-
 	{
 		TCHAR workpath[MAX_PATH] = {0};
 		TCHAR *rootpath;
@@ -137,6 +124,10 @@ BOOL CSfxPackagerApp::InitInstance()
 		m_sTempPath = GetProfileString(_T("sfxPackager"), _T("TempPath"), workpath);
 	}
 
+	// a build from the command line never creates any windows; returning FALSE ends the process with its exit code
+	if (RunHeadlessBuild(__argc, __targv, m_HeadlessExitCode))
+		return FALSE;
+
 	InitContextMenuManager();
 
 	InitKeyboardManager();
@@ -195,10 +186,11 @@ int CSfxPackagerApp::ExitInstance()
 	//TODO: handle additional resources you may have added
 	AfxOleTerm(FALSE);
 
-	WriteProfileString(_T("sfxPackager"), _T("7ZipPath"), m_s7ZipPath);
 	WriteProfileString(_T("sfxPackager"), _T("TempPath"), m_sTempPath);
 
-	return CWinAppEx::ExitInstance();
+	int ret = CWinAppEx::ExitInstance();
+
+	return (m_HeadlessExitCode >= 0) ? m_HeadlessExitCode : ret;
 }
 
 // CSfxPackagerApp message handlers
@@ -40,9 +40,11 @@ public:
 	UINT  m_nAppLook;
 	BOOL  m_bHiColorIcons;
 
-	CString m_s7ZipPath;
 	CString m_sTempPath;
 
+	// set when a build was run from the command line (see HeadlessBuild.h), and then used as the process exit code
+	int m_HeadlessExitCode;
+
 	virtual void PreLoadState();
 	virtual void LoadCustomState();
 	virtual void SaveCustomState();
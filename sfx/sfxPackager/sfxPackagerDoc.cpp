@@ -31,6 +31,8 @@
 #include <propkey.h>
 
 #include "../sfxFlags.h"
+#include "BuildManifest.h"
+#include "Utf8ArchiveWriter.h"
 
 #include <vector>
 #include <chrono>
@@ -42,6 +44,12 @@
 
 #define SFXRESID_ICON		130
 
+// room left after the caption in the stub's resources for the " (part N)" that each span's copy has added
+#define SFX_CAPTION_SPANROOM	24
+
+// how many customized stubs are kept around in the temporary directory for later builds to reuse
+#define SFX_STUB_TEMPLATES_KEPT	8
+
 bool CreateDirectories(const TCHAR *dir)
 {
 	if (!dir || !*dir)
@@ -132,10 +140,54 @@ typedef struct
 } ICONDATA_FILE;
 #pragma pack(pop)
 
-bool SetupSfxExecutable(const TCHAR *filename, CSfxPackagerDoc *pDoc, HANDLE &hFile, size_t spanIdx)
+// Finds the file offset of one of the SFX resources in a stub by way of its resource section, so that it can be patched in place
+// later without reading the whole package back in or going through the resource API again; returns -1 if it can't be found
+LONGLONG LocateSfxResource(const TCHAR *filename, const TCHAR *resname)
+{
+	LONGLONG ret = -1;
+
+	HMODULE hmod = LoadLibraryEx(filename, NULL, LOAD_LIBRARY_AS_DATAFILE | LOAD_LIBRARY_AS_IMAGE_RESOURCE);
+	if (hmod)
+	{
+		// the low bits of a resource-only module's handle are flags; the rest is where the image is mapped
+		BYTE *base = (BYTE *)((ULONG_PTR)hmod & ~(ULONG_PTR)3);
+
+		HRSRC hfr = FindResource(hmod, resname, _T("SFX"));
+		HGLOBAL hfg = hfr ? LoadResource(hmod, hfr) : NULL;
+		BYTE *pfr = hfg ? (BYTE *)LockResource(hfg) : nullptr;
+
+		if (pfr)
+		{
+			// the image is laid out by section, so the resource's RVA has to be mapped back to where its section is in the file
+			DWORD rva = (DWORD)(pfr - base);
+
+			IMAGE_NT_HEADERS *nthdr = (IMAGE_NT_HEADERS *)(base + ((IMAGE_DOS_HEADER *)base)->e_lfanew);
+			IMAGE_SECTION_HEADER *sec = IMAGE_FIRST_SECTION(nthdr);
+
+			for (WORD i = 0; i < nthdr->FileHeader.NumberOfSections; i++, sec++)
+			{
+				if ((rva >= sec->VirtualAddress) && (rva < (sec->VirtualAddress + sec->SizeOfRawData)))
+				{
+					ret = (LONGLONG)(rva - sec->VirtualAddress) + sec->PointerToRawData;
+					break;
+				}
+			}
+		}
+
+		FreeLibrary(hmod);
+	}
+
+	return ret;
+}
+
+// Writes the sfx exe with all of the project's resources (icon, image, html, scripts) put in; the caption has room left after it
+// for a span suffix, and the fixup record is left blank, so that only those need to be patched in each copy
+bool BuildSfxStub(const TCHAR *filename, CSfxPackagerDoc *pDoc)
 {
 	bool ret = false;
 
+	HANDLE hFile;
+
 	TCHAR docpath[MAX_PATH];
 	_tcscpy_s(docpath, pDoc->GetPathName());
 	PathRemoveFileSpec(docpath);
@@ -299,8 +351,7 @@ bool SetupSfxExecutable(const TCHAR *filename, CSfxPackagerDoc *pDoc, HANDLE &hF
 							}
 							else
 							{
-								CMainFrame *pmf = (CMainFrame *)(AfxGetApp()->m_pMainWnd);
-								pmf->GetOutputWnd().AppendMessage(COutputWnd::OT_BUILD, _T("WARNING: Image file may not be more than 24bpp!\r\n"));
+								pDoc->m_pReporter->LogMessage(_T("WARNING: Image file may not be more than 24bpp!\r\n"));
 							}
 
 							free(pbin);
@@ -311,12 +362,12 @@ bool SetupSfxExecutable(const TCHAR *filename, CSfxPackagerDoc *pDoc, HANDLE &hF
 				}
 			}
 
-			CString spanstr;
-			spanstr.Format(_T(" (part %d)"), spanIdx + 1);
-			CString caption;
-			caption.Format(_T("%s%s"), pDoc->m_Caption, spanIdx ? spanstr : _T(""));
+			{
+				std::vector<TCHAR> caption(pDoc->m_Caption.GetLength() + SFX_CAPTION_SPANROOM + 1, _T('\0'));
+				memcpy(caption.data(), (LPCTSTR)pDoc->m_Caption, pDoc->m_Caption.GetLength() * sizeof(TCHAR));
 
-			bresult = UpdateResource(hbur, _T("SFX"), _T("SFX_CAPTION"), MAKELANGID(LANG_ENGLISH, SUBLANG_DEFAULT), (void *)((LPCTSTR)caption), (caption.GetLength() + 1) * sizeof(TCHAR));
+				bresult = UpdateResource(hbur, _T("SFX"), _T("SFX_CAPTION"), MAKELANGID(LANG_ENGLISH, SUBLANG_DEFAULT), caption.data(), DWORD(caption.size() * sizeof(TCHAR)));
+			}
 			bresult = UpdateResource(hbur, _T("SFX"), _T("SFX_DEFAULTPATH"), MAKELANGID(LANG_ENGLISH, SUBLANG_DEFAULT), (void *)((LPCTSTR)pDoc->m_DefaultPath), (pDoc->m_DefaultPath.GetLength() + 1) * sizeof(TCHAR));
 
 			{
@@ -432,69 +483,241 @@ bool SetupSfxExecutable(const TCHAR *filename, CSfxPackagerDoc *pDoc, HANDLE &hF
 
 			bresult = EndUpdateResource(hbur, FALSE);
 		}
+
+		ret = ret && bresult;
+	}
+	else
+	{
+		ret = false;
 	}
 
-	hFile = CreateFile(filename, GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
-	LARGE_INTEGER p = {0}, z = {0};
-	SetFilePointerEx(hFile, z, &p, FILE_END);
+	return ret;
+}
 
-	return (hFile != INVALID_HANDLE_VALUE);
+static void HashStubInput(uint64_t &h, const void *data, size_t len)
+{
+	const BYTE *p = (const BYTE *)data;
+	for (size_t i = 0; i < len; i++)
+	{
+		h ^= p[i];
+		h *= 0x100000001B3ULL;
+	}
 }
 
-bool FixupSfxExecutable(CSfxPackagerDoc *pDoc, const TCHAR *filename, const TCHAR *launchcmd, bool span, UINT32 filecount)
+// a file that a project setting names is identified by its path, size, and modification time rather than read in full;
+// a setting that isn't a file is taken as it is
+static void HashStubSetting(uint64_t &h, const TCHAR *docpath, const CString &setting)
 {
-	bool bresult = true;
+	HashStubInput(h, (LPCTSTR)setting, setting.GetLength() * sizeof(TCHAR));
 
-	HANDLE hf = CreateFile(filename, GENERIC_WRITE | GENERIC_READ, 0, NULL, OPEN_EXISTING, 0, NULL);
-	if (hf == INVALID_HANDLE_VALUE)
+	if (setting.IsEmpty())
+		return;
+
+	TCHAR path[MAX_PATH];
+	if (PathIsRelative(setting))
+		PathCombine(path, docpath, setting);
+	else
+		_tcscpy_s(path, setting);
+
+	WIN32_FILE_ATTRIBUTE_DATA fad;
+	if (GetFileAttributesEx(path, GetFileExInfoStandard, &fad))
+	{
+		HashStubInput(h, &fad.nFileSizeHigh, sizeof(DWORD));
+		HashStubInput(h, &fad.nFileSizeLow, sizeof(DWORD));
+		HashStubInput(h, &fad.ftLastWriteTime, sizeof(FILETIME));
+	}
+}
+
+// Deletes all but the most recently used customized stubs from the temporary directory; every change to a project's settings
+// or scripts makes a new one, and nothing else would ever clean them up
+void EvictSfxStubTemplates(const TCHAR *tempdir, const TCHAR *keep)
+{
+	TCHAR spec[MAX_PATH];
+	PathCombine(spec, tempdir, _T("sfxstub_*.exe"));
+
+	typedef std::pair<ULONGLONG, tstring> TStubAge;
+	std::vector<TStubAge> stubs;
+
+	WIN32_FIND_DATA fd;
+	HANDLE hfind = FindFirstFile(spec, &fd);
+	if (hfind == INVALID_HANDLE_VALUE)
+		return;
+
+	do
+	{
+		// only what PrepareSfxStubTemplate names (not a temporary one still being built), and not the one about to be used
+		if ((fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) || (_tcslen(fd.cFileName) != (8 + 16 + 4)) || !_tcsicmp(fd.cFileName, PathFindFileName(keep)))
+			continue;
+
+		ULARGE_INTEGER t;
+		t.LowPart = fd.ftLastWriteTime.dwLowDateTime;
+		t.HighPart = fd.ftLastWriteTime.dwHighDateTime;
+		stubs.push_back(TStubAge(t.QuadPart, fd.cFileName));
+	}
+	while (FindNextFile(hfind, &fd));
+
+	FindClose(hfind);
+
+	if (stubs.size() < SFX_STUB_TEMPLATES_KEPT)
+		return;
+
+	// newest first; the one being kept counts against the limit too
+	std::sort(stubs.begin(), stubs.end(), [](const TStubAge &a, const TStubAge &b) { return a.first > b.first; });
+
+	for (size_t i = SFX_STUB_TEMPLATES_KEPT - 1; i < stubs.size(); i++)
+	{
+		TCHAR stale[MAX_PATH];
+		PathCombine(stale, tempdir, stubs[i].second.c_str());
+
+		// one that another build is copying from right now can't be deleted, which is fine
+		DeleteFile(stale);
+	}
+}
+
+// Produces the customized stub once per build; it's kept in the temporary directory under a name derived from everything that
+// goes into it, so a later build whose stub would come out the same uses it as it is
+bool PrepareSfxStubTemplate(CSfxPackagerDoc *pDoc)
+{
+	if (!pDoc->m_StubTemplate.IsEmpty())
+		return true;
+
+	TCHAR docpath[MAX_PATH];
+	_tcscpy_s(docpath, pDoc->GetPathName());
+	PathRemoveFileSpec(docpath);
+
+	// FNV-1a
+	uint64_t h = 0xCBF29CE484222325ULL;
+
+	// the sfx itself changes along with the packager
+	HRSRC hsfxres = FindResource(NULL, MAKEINTRESOURCE(IDR_EXE_SFX), _T("EXE"));
+	HGLOBAL hsfxload = hsfxres ? LoadResource(NULL, hsfxres) : NULL;
+	BYTE *pbuf = hsfxload ? (BYTE *)LockResource(hsfxload) : nullptr;
+	if (!pbuf)
 		return false;
 
-	LARGE_INTEGER ofs;
-	DWORD cb;
-	if (!pDoc->m_bExternalArchive)
+	HashStubInput(h, pbuf, SizeofResource(NULL, hsfxres));
+
+	HashStubSetting(h, docpath, pDoc->m_IconFile);
+	HashStubSetting(h, docpath, pDoc->m_ImageFile);
+	HashStubSetting(h, docpath, pDoc->m_Description);
+	HashStubSetting(h, docpath, pDoc->m_LicenseMessage);
+	HashStubInput(h, (LPCTSTR)pDoc->m_Caption, pDoc->m_Caption.GetLength() * sizeof(TCHAR));
+	HashStubInput(h, (LPCTSTR)pDoc->m_DefaultPath, pDoc->m_DefaultPath.GetLength() * sizeof(TCHAR));
+
+	for (UINT i = 0; i < CSfxPackagerDoc::EScriptType::NUMTYPES; i++)
+	{
+		HashStubInput(h, (LPCTSTR)pDoc->m_Script[i], (pDoc->m_Script[i].GetLength() + 1) * sizeof(TCHAR));
+	}
+
+	TCHAR stubname[MAX_PATH];
+	_tcscpy_s(stubname, MAX_PATH, theApp.m_sTempPath);
+	CreateDirectories(stubname);
+	PathAddBackslash(stubname);
+	_stprintf_s(stubname + _tcslen(stubname), MAX_PATH - _tcslen(stubname), _T("sfxstub_%016llx.exe"), h);
+
+	if (!PathFileExists(stubname))
 	{
-		SetFilePointer(hf, -(int)(sizeof(LONGLONG)), NULL, FILE_END);
-		ReadFile(hf, &(ofs.QuadPart), sizeof(LONGLONG), &cb, NULL);
+		// built under a name of its own first, so an interrupted build never leaves a bad stub to be picked up later
+		TCHAR tmpname[MAX_PATH];
+		_stprintf_s(tmpname, MAX_PATH, _T("%s.%u.tmp"), stubname, GetCurrentProcessId());
+
+		if (!BuildSfxStub(tmpname, pDoc) || !MoveFileEx(tmpname, stubname, MOVEFILE_REPLACE_EXISTING))
+		{
+			DeleteFile(tmpname);
+			return false;
+		}
 	}
 	else
 	{
-		ofs.LowPart = GetFileSize(hf, (LPDWORD)&ofs.HighPart);
+		// reusing it makes it the most recently used, as far as eviction is concerned
+		HANDLE hstub = CreateFile(stubname, FILE_WRITE_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (hstub != INVALID_HANDLE_VALUE)
+		{
+			FILETIME now;
+			GetSystemTimeAsFileTime(&now);
+			SetFileTime(hstub, NULL, NULL, &now);
+
+			CloseHandle(hstub);
+		}
 	}
 
-	BYTE *pdata = (BYTE *)malloc(ofs.QuadPart);
-	if (pdata)
+	EvictSfxStubTemplates(theApp.m_sTempPath, stubname);
+
+	pDoc->m_StubFixupOfs = LocateSfxResource(stubname, _T("SFX_FIXUPDATA"));
+	pDoc->m_StubCaptionOfs = LocateSfxResource(stubname, _T("SFX_CAPTION"));
+	pDoc->m_StubTemplate = stubname;
+
+	return true;
+}
+
+bool SetupSfxExecutable(const TCHAR *filename, CSfxPackagerDoc *pDoc, HANDLE &hFile, size_t spanIdx, LONGLONG &fixupOfs)
+{
+	hFile = INVALID_HANDLE_VALUE;
+	fixupOfs = -1;
+
+	if (!PrepareSfxStubTemplate(pDoc))
+		return false;
+
+	TCHAR dir[MAX_PATH];
+	_tcscpy_s(dir, MAX_PATH, filename);
+	PathRemoveFileSpec(dir);
+	CreateDirectories(dir);
+
+	// every exe in the build starts out as the same stub; only the caption and fixup data differ
+	if (!CopyFile(pDoc->m_StubTemplate, filename, FALSE))
+		return false;
+
+	hFile = CreateFile(filename, GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return false;
+
+	fixupOfs = pDoc->m_StubFixupOfs;
+
+	if (spanIdx && (pDoc->m_StubCaptionOfs >= 0))
 	{
-		SetFilePointer(hf, 0, NULL, FILE_BEGIN);
-		ReadFile(hf, pdata, (DWORD)ofs.QuadPart, &cb, NULL);
+		CString spanstr;
+		spanstr.Format(_T(" (part %d)"), spanIdx + 1);
 
-		char ss[16];
-		strcpy(ss, SFX_FIXUP_SEARCH_STRING);
+		LARGE_INTEGER p;
+		p.QuadPart = pDoc->m_StubCaptionOfs + (pDoc->m_Caption.GetLength() * sizeof(TCHAR));
+		SetFilePointerEx(hFile, p, NULL, FILE_BEGIN);
 
-		// search for our identifier string in the exe file... when we find it, then replace the data ourselves instead of using the resource API
-		BYTE *p = pdata;
-		bool found = false;
-		while (p && ((uint64_t)(p - pdata) < (uint64_t)(ofs.QuadPart - sizeof(SFixupResourceData))))
-		{
-			p = (BYTE *)memchr((char *)p, ss[0], ofs.QuadPart - (p - pdata));
+		DWORD cw;
+		WriteFile(hFile, (LPCTSTR)spanstr, (DWORD)(std::min<int>(spanstr.GetLength(), SFX_CAPTION_SPANROOM) * sizeof(TCHAR)), &cw, NULL);
+	}
 
-			if (!p)
-			{
-				break;
-			}
-			else if (!strcmp((const char *)p, SFX_FIXUP_SEARCH_STRING))
-			{
-				found = true;
-				break;
-			}
+	LARGE_INTEGER p = {0}, z = {0};
+	SetFilePointerEx(hFile, z, &p, FILE_END);
 
-			p++;
-		}
+	return true;
+}
+
+// fixupOfs is where SetupSfxExecutable found the fixup record in the stub; the data is replaced there directly instead of using the
+// resource API, which would have to rewrite the whole file (archive included)
+bool FixupSfxExecutable(CSfxPackagerDoc *pDoc, const TCHAR *filename, LONGLONG fixupOfs, const TCHAR *launchcmd, bool span, UINT32 filecount)
+{
+	bool bresult = false;
+
+	if (fixupOfs < 0)
+		return false;
+
+	HANDLE hf = CreateFile(filename, GENERIC_WRITE | GENERIC_READ, 0, NULL, OPEN_EXISTING, 0, NULL);
+	if (hf == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER ofs;
+	ofs.QuadPart = fixupOfs;
 
-		if (found)
+	SFixupResourceData fd;
+	DWORD cb;
+	if (SetFilePointerEx(hf, ofs, NULL, FILE_BEGIN) && ReadFile(hf, &fd, sizeof(SFixupResourceData), &cb, NULL) && (cb == sizeof(SFixupResourceData)))
+	{
+		// make sure the record is still where it was when the stub was set up
+		if (!strncmp(fd.m_Ident, SFX_FIXUP_SEARCH_STRING, sizeof(fd.m_Ident)))
 		{
-			SetFilePointer(hf, (LONG)(p - pdata), NULL, FILE_BEGIN);
+			SetFilePointerEx(hf, ofs, NULL, FILE_BEGIN);
 
-			SFixupResourceData *furd = (SFixupResourceData *)p;
+			SFixupResourceData *furd = &fd;
 			_tcscpy_s(furd->m_LaunchCmd, MAX_PATH, launchcmd);
 
 			CString vers = pDoc->m_VersionID;
@@ -534,10 +757,8 @@ bool FixupSfxExecutable(CSfxPackagerDoc *pDoc, const TCHAR *filename, const TCHA
 
 			furd->m_CompressedFileCount = filecount;
 
-			WriteFile(hf, furd, sizeof(SFixupResourceData), &cb, NULL);
+			bresult = WriteFile(hf, furd, sizeof(SFixupResourceData), &cb, NULL) && (cb == sizeof(SFixupResourceData));
 		}
-
-		free(pdata);
 	}
 
 	CloseHandle(hf);
@@ -555,6 +776,10 @@ protected:
 	TCHAR m_CurrentFilename[MAX_PATH];
 	HANDLE m_hFile;
 
+	// where the fixup record is in the base exe and in the current span's exe, respectively
+	LONGLONG m_BaseFixupOfs;
+	LONGLONG m_FixupOfs;
+
 	UINT m_spanIdx;
 	LARGE_INTEGER m_spanTotalSize;
 
@@ -566,6 +791,8 @@ public:
 		m_spanIdx = 0;
 		m_pDoc = pdoc;
 		m_spanTotalSize.QuadPart = 0;
+		m_BaseFixupOfs = -1;
+		m_FixupOfs = -1;
 	}
 
 	virtual ~CPackagerArchiveHandle()
@@ -581,7 +808,7 @@ public:
 			m_hFile = INVALID_HANDLE_VALUE;
 
 			// the last file is never spanned
-			FixupSfxExecutable(m_pDoc, m_BaseFilename, m_pDoc->m_LaunchCmd, false, (UINT32)fc);
+			FixupSfxExecutable(m_pDoc, m_BaseFilename, m_BaseFixupOfs, m_pDoc->m_LaunchCmd, false, (UINT32)fc);
 		}
 	}
 
@@ -634,10 +861,9 @@ public:
 		PathRenameExtension(m_CurrentFilename, _T(".data"));
 
 		m_hFile = INVALID_HANDLE_VALUE;
-		if (!SetupSfxExecutable(m_BaseFilename, m_pDoc, m_hFile, 0))
+		if (!SetupSfxExecutable(m_BaseFilename, m_pDoc, m_hFile, 0, m_BaseFixupOfs))
 		{
-			CMainFrame *pmf = (CMainFrame *)(AfxGetApp()->m_pMainWnd);
-			pmf->GetOutputWnd().AppendMessage(COutputWnd::OT_BUILD, _T("SFX setup failed; your output exe may be locked or the directory set to read-only.\r\n"));
+			m_pDoc->m_pReporter->LogMessage(_T("SFX setup failed; your output exe may be locked or the directory set to read-only.\r\n"));
 		}
 
 		ASSERT(m_hFile != INVALID_HANDLE_VALUE);
@@ -671,7 +897,7 @@ public:
 		size_t fc = m_pArc->GetFileCount(IArchiver::IM_SPAN);
 
 		// we finalize by storing the file table and writing the starting offset of the archive in the stream
-		m_pArc->Finalize();
+		bool finalized = (m_pArc->Finalize() == IArchiver::FR_OK);
 
 		LARGE_INTEGER sz;
 		sz.LowPart = GetFileSize(m_hFile, (LPDWORD)&sz.HighPart);
@@ -682,450 +908,687 @@ public:
 		m_hFile = INVALID_HANDLE_VALUE;
 
 		m_hFile = CreateFile(m_CurrentFilename, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
-		return (m_hFile != INVALID_HANDLE_VALUE);
+		return finalized && (m_hFile != INVALID_HANDLE_VALUE);
 	}
 
 };
 
-class CSfxHandle : public CPackagerArchiveHandle
+// Streams the archive into the standard input of another process (an uploader, a compressor, etc.) instead of to a file.
+// The archiver must be created with AF_TRAILER, since nothing written to a pipe can be patched later, and spanning isn't supported.
+class CPipeArcHandle : public CPackagerArchiveHandle
 {
+protected:
+	PROCESS_INFORMATION m_pi;
+	uint64_t m_StubSize;
+	uint64_t m_Advanced;
 
 public:
-	CSfxHandle(const TCHAR *base_filename, CSfxPackagerDoc *pdoc) : CPackagerArchiveHandle(pdoc)
+
+	CPipeArcHandle(const TCHAR *base_filename, CSfxPackagerDoc *pdoc, const TCHAR *cmd) : CPackagerArchiveHandle(pdoc)
 	{
-		_tcscpy_s(m_BaseFilename, MAX_PATH, base_filename);
-		_tcscpy_s(m_CurrentFilename, MAX_PATH, base_filename);
+		ZeroMemory(&m_pi, sizeof(PROCESS_INFORMATION));
+		m_StubSize = 0;
+		m_Advanced = 0;
 
-		m_hFile = INVALID_HANDLE_VALUE;
-		if (!SetupSfxExecutable(m_BaseFilename, m_pDoc, m_hFile, 0))
+		if (m_pDoc->m_bExternalArchive)
 		{
-			CMainFrame *pmf = (CMainFrame *)(AfxGetApp()->m_pMainWnd);
-			pmf->GetOutputWnd().AppendMessage(COutputWnd::OT_BUILD, _T("SFX setup failed; your output exe may be locked or the directory set to read-only.\r\n"));
+			// the exe stays on disk and can be fixed up normally once the archive has gone through the pipe
+			_tcscpy_s(m_BaseFilename, MAX_PATH, base_filename);
 		}
-		ASSERT(m_hFile != INVALID_HANDLE_VALUE);
-	}
-
-	virtual ~CSfxHandle() { }
-
-	virtual void Release()
-	{
-		delete this;
-	}
+		else
+		{
+			// the stub is only a temporary here; the whole package goes through the pipe
+			_tcscpy_s(m_BaseFilename, MAX_PATH, theApp.m_sTempPath);
+			PathAddBackslash(m_BaseFilename);
+			_tcscat_s(m_BaseFilename, MAX_PATH, PathFindFileName(base_filename));
+		}
+		_tcscpy_s(m_CurrentFilename, MAX_PATH, m_BaseFilename);
 
-	virtual bool Span()
-	{
-		m_spanIdx++;
+		HANDLE hstub = INVALID_HANDLE_VALUE;
+		if (!SetupSfxExecutable(m_BaseFilename, m_pDoc, hstub, 0, m_BaseFixupOfs))
+		{
+			m_pDoc->m_pReporter->LogMessage(_T("SFX setup failed; your output exe may be locked or the directory set to read-only.\r\n"));
+		}
 
-		TCHAR local_filename[MAX_PATH];
-		_tcscpy_s(local_filename, MAX_PATH, m_BaseFilename);
+		if (hstub != INVALID_HANDLE_VALUE)
+			CloseHandle(hstub);
 
-		TCHAR *pext = PathFindExtension(m_BaseFilename);
-		TCHAR *plext = PathFindExtension(local_filename);
-		_stprintf_s(plext, MAX_PATH, _T("_part%d"), m_spanIdx + 1);
-		_tcscat_s(local_filename, MAX_PATH, pext);
-		TCHAR *lcmd = PathFindFileName(local_filename);
+		SECURITY_ATTRIBUTES sa;
+		sa.nLength = sizeof(SECURITY_ATTRIBUTES);
+		sa.lpSecurityDescriptor = NULL;
+		sa.bInheritHandle = TRUE;
 
-		size_t fc = m_pArc->GetFileCount(IArchiver::IM_SPAN);
+		HANDLE hread = NULL;
+		m_hFile = INVALID_HANDLE_VALUE;
+		if (CreatePipe(&hread, &m_hFile, &sa, 1 MB))
+		{
+			// only the read end belongs to the child
+			SetHandleInformation(m_hFile, HANDLE_FLAG_INHERIT, 0);
+
+			STARTUPINFO si;
+			ZeroMemory(&si, sizeof(STARTUPINFO));
+			si.cb = sizeof(STARTUPINFO);
+			si.dwFlags = STARTF_USESTDHANDLES;
+			si.hStdInput = hread;
+			si.hStdOutput = GetStdHandle(STD_OUTPUT_HANDLE);
+			si.hStdError = GetStdHandle(STD_ERROR_HANDLE);
+
+			CString cmdline = cmd;
+			if (!CreateProcess(NULL, cmdline.GetBuffer(), NULL, NULL, TRUE, CREATE_NO_WINDOW, NULL, NULL, &si, &m_pi))
+			{
+				CString msg;
+				msg.Format(_T("Unable to start output command \"%s\".\r\n"), cmd);
+				m_pDoc->m_pReporter->LogMessage(msg);
 
-		// we finalize by storing the file table and writing the starting offset of the archive in the stream
-		m_pArc->Finalize();
+				CloseHandle(m_hFile);
+				m_hFile = INVALID_HANDLE_VALUE;
+			}
 
-		LARGE_INTEGER sz;
-		sz.LowPart = GetFileSize(m_hFile, (LPDWORD)&sz.HighPart);
-		m_spanTotalSize.QuadPart += sz.QuadPart;
+			cmdline.ReleaseBuffer();
 
-		// Finalize archive
-		CloseHandle(m_hFile);
-		m_hFile = INVALID_HANDLE_VALUE;
+			CloseHandle(hread);
+		}
 
-		FixupSfxExecutable(m_pDoc, m_CurrentFilename, lcmd, m_spanIdx, (UINT32)fc);
+		if ((m_hFile != INVALID_HANDLE_VALUE) && !m_pDoc->m_bExternalArchive)
+		{
+			// there is no coming back to the stub once it's in the pipe, so it gets fixed up first; the file count and
+			// required space aren't known yet and are left as zero, which the installer treats as unknown
+			FixupSfxExecutable(m_pDoc, m_BaseFilename, m_BaseFixupOfs, m_pDoc->m_LaunchCmd, false, 0);
 
-		_tcscpy_s(m_CurrentFilename, MAX_PATH, local_filename);
+			HANDLE hs = CreateFile(m_BaseFilename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+			if (hs != INVALID_HANDLE_VALUE)
+			{
+				BYTE buf[64 KB];
+				DWORD rb, wb;
+				while (ReadFile(hs, buf, sizeof(buf), &rb, NULL) && rb)
+				{
+					WriteFile(m_hFile, buf, rb, &wb, NULL);
+					m_StubSize += rb;
+				}
 
-		return SetupSfxExecutable(m_CurrentFilename, m_pDoc, m_hFile, m_spanIdx);
+				CloseHandle(hs);
+			}
+		}
 	}
 
-};
-
-
-// CSfxPackagerDoc
+	virtual ~CPipeArcHandle()
+	{
+		if (m_hFile != INVALID_HANDLE_VALUE)
+		{
+			size_t fc = m_pArc->GetFileCount(IArchiver::IM_WHOLE);
 
-IMPLEMENT_DYNCREATE(CSfxPackagerDoc, CDocument)
+			m_pArc->Finalize();
 
-BEGIN_MESSAGE_MAP(CSfxPackagerDoc, CDocument)
-END_MESSAGE_MAP()
+			// closing our end is what tells the other process that the stream is complete
+			CloseHandle(m_hFile);
+			m_hFile = INVALID_HANDLE_VALUE;
 
+			if (m_pDoc->m_bExternalArchive)
+				FixupSfxExecutable(m_pDoc, m_BaseFilename, m_BaseFixupOfs, m_pDoc->m_LaunchCmd, false, (UINT32)fc);
+		}
 
-// CSfxPackagerDoc construction/destruction
+		if (m_pi.hProcess)
+		{
+			WaitForSingleObject(m_pi.hProcess, INFINITE);
 
-CSfxPackagerDoc::CSfxPackagerDoc()
-{
-	m_Key = 0;
+			DWORD ec = 0;
+			if (GetExitCodeProcess(m_pi.hProcess, &ec) && ec)
+			{
+				CString msg;
+				msg.Format(_T("WARNING: the output command exited with code %d.\r\n"), ec);
+				m_pDoc->m_pReporter->LogMessage(msg);
+			}
 
-	m_SfxOutputFile = _T("mySfx.exe");
-	m_MaxSize = -1;
-	m_Caption = _T("SFX Installer");
-	m_VersionID = _T("");
-	m_Description = _T("Provide a description for the files being installed");
-	m_LicenseMessage = _T("");
-	m_IconFile = _T("");
-	m_ImageFile = _T("");
-	m_bExploreOnComplete = false;
-	m_LaunchCmd = _T("");
-	m_DefaultPath = _T("");
-	m_bAllowDestChg = true;
-	m_bRequireAdmin = false;
-	m_bRequireReboot = false;
-	m_bAppendBuildDate = false;
-	m_bAppendVersion = false;
-	m_bExternalArchive = false;
+			CloseHandle(m_pi.hProcess);
+			CloseHandle(m_pi.hThread);
+		}
 
-	m_hCancelEvent = CreateEvent(NULL, true, false, NULL);
-	m_hThread = NULL;
-}
+		if (!m_pDoc->m_bExternalArchive)
+			DeleteFile(m_BaseFilename);
+	}
 
-CSfxPackagerDoc::~CSfxPackagerDoc()
-{
-	if (m_hThread)
+	virtual void Release()
 	{
-		SignalObjectAndWait(m_hCancelEvent, m_hThread, INFINITE, FALSE);
+		delete this;
 	}
 
-	CloseHandle(m_hCancelEvent);
-
-	EndWaitCursor();
-}
+	virtual uint64_t GetLength()
+	{
+		return m_StubSize;
+	}
 
-CSfxPackagerDoc *CSfxPackagerDoc::GetDoc()
-{
-	CMDIFrameWnd *pframe = (CMDIFrameWnd *)(AfxGetApp()->m_pMainWnd);
-	CMDIChildWnd *pchild = pframe ? pframe->MDIGetActive() : NULL;
-	if (pchild)
+	// a pipe can't be asked for its position, so it's the stub plus the header CreateArchiver wrote ahead of the archiver;
+	// the archiver only asks where it starts and counts everything after that itself
+	virtual uint64_t GetOffset()
 	{
-		CDocument *pdoc = pchild->GetActiveDocument();
+		return m_StubSize + m_Advanced;
+	}
 
-		if (pdoc && pdoc->IsKindOf(RUNTIME_CLASS(CSfxPackagerDoc)))
-			return (CSfxPackagerDoc *)pdoc;
+	virtual void Advance(uint64_t bytes)
+	{
+		m_Advanced += bytes;
 	}
 
-	return NULL;
-}
+	virtual bool Span()
+	{
+		return false;
+	}
 
-BOOL CSfxPackagerDoc::OnNewDocument()
-{
-	if (!CDocument::OnNewDocument())
-		return FALSE;
+};
 
-	return TRUE;
-}
+// A read-only handle to the output of a previous build, which an incremental build copies unchanged files' data from
+class CReferenceArcHandle : public IArchiveHandle
+{
+protected:
+	HANDLE m_hFile;
 
+public:
+	CReferenceArcHandle(const TCHAR *filename)
+	{
+		m_hFile = CreateFile(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+	}
 
-BOOL CSfxPackagerDoc::EnumTypesFunc(HMODULE hModule, LPTSTR lpType, LONG_PTR lParam)
-{
-	CSfxPackagerDoc *_this = (CSfxPackagerDoc *)lParam;
+	virtual ~CReferenceArcHandle()
+	{
+		if (m_hFile != INVALID_HANDLE_VALUE)
+			CloseHandle(m_hFile);
+	}
 
-	EnumResourceNames(hModule, lpType, (ENUMRESNAMEPROC)EnumNamesFunc, lParam);
+	virtual void Release()
+	{
+		delete this;
+	}
 
-	return TRUE;
-}
+	virtual HANDLE GetHandle()
+	{
+		return m_hFile;
+	}
 
-BOOL CSfxPackagerDoc::EnumNamesFunc(HMODULE hModule, LPCTSTR lpType, LPTSTR lpName, LONG_PTR lParam)
-{
-	CSfxPackagerDoc *_this = (CSfxPackagerDoc *)lParam;
+	virtual bool Span()
+	{
+		return false;
+	}
 
-	if ((ULONGLONG)lpName & 0xFFFF0000)
+	virtual uint64_t GetLength()
 	{
+		LARGE_INTEGER p;
+		GetFileSizeEx(m_hFile, &p);
+		return p.QuadPart;
 	}
 
-	if (lpType == RT_ICON)
+	virtual uint64_t GetOffset()
 	{
-		_this->m_IconName = lpName;
+		LARGE_INTEGER p, z;
+		z.QuadPart = 0;
+		SetFilePointerEx(m_hFile, z, &p, FILE_CURRENT);
+		return p.QuadPart;
 	}
 
-	return TRUE;
-}
+};
 
-BOOL CSfxPackagerDoc::EnumLangsFunc(HMODULE hModule, LPCTSTR lpType, LPCTSTR lpName, WORD wLang, LONG_PTR lParam)
+// The output file of a tarball, which is written from start to finish; with a maximum size, it's spanned over volumes
+class CTarballHandle : public IArchiveHandle
 {
-	CSfxPackagerDoc *_this = (CSfxPackagerDoc *)lParam;
+protected:
+	HANDLE m_hFile;
 
-	HANDLE hResInfo = FindResourceEx(hModule, lpType, lpName, wLang); 
-	
-	return TRUE; 
-}
+	// when split into volumes, they're named like 7-Zip's: the tarball's name followed by .001, .002, etc.
+	tstring m_Filename;
+	bool m_Volumes;
+	UINT m_VolumeCount;
+	uint64_t m_PrevVolumesSize;
 
-DWORD CSfxPackagerDoc::RunCreateSFXPackage(LPVOID param)
-{
-	CSfxPackagerView *pv = (CSfxPackagerView *)param;
+	void GetVolumeFilename(UINT idx, TCHAR *filename)
+	{
+		if (m_Volumes)
+			_stprintf_s(filename, MAX_PATH, _T("%s.%03u"), m_Filename.c_str(), idx + 1);
+		else
+			_tcscpy_s(filename, MAX_PATH, m_Filename.c_str());
+	}
 
-	CSfxPackagerDoc *pd = pv->GetDocument(); // should be this
+	void OpenVolume()
+	{
+		TCHAR filename[MAX_PATH];
+		GetVolumeFilename(m_VolumeCount, filename);
 
-	pd->m_hThread = GetCurrentThread();
+		m_hFile = CreateFile(filename, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (m_hFile != INVALID_HANDLE_VALUE)
+			m_VolumeCount++;
+	}
+
+public:
+	CTarballHandle(const TCHAR *filename, bool volumes)
+	{
+		m_Filename = filename;
+		m_Volumes = volumes;
+		m_VolumeCount = 0;
+		m_PrevVolumesSize = 0;
+
+		OpenVolume();
+	}
+
+	virtual ~CTarballHandle()
+	{
+		if (m_hFile != INVALID_HANDLE_VALUE)
+			CloseHandle(m_hFile);
+	}
 
-	TCHAR *ext = PathFindExtension(pd->m_SfxOutputFile);
-	if (ext)
+	UINT GetVolumeCount() const
 	{
-		if (!_tcsicmp(ext, _T(".exe")))
+		return m_VolumeCount;
+	}
+
+	// closes and deletes everything written so far; a partial tarball is no use to anybody
+	void Discard()
+	{
+		if (m_hFile != INVALID_HANDLE_VALUE)
 		{
-			pd->CreateSFXPackage(NULL, pv);
+			CloseHandle(m_hFile);
+			m_hFile = INVALID_HANDLE_VALUE;
 		}
-		else if (!_tcsicmp(ext, _T(".gz")) || !_tcsicmp(ext, _T(".gzip")))
+
+		for (UINT i = 0; i < m_VolumeCount; i++)
 		{
-			pd->CreateTarGzipPackage(NULL, pv);
+			TCHAR filename[MAX_PATH];
+			GetVolumeFilename(i, filename);
+			DeleteFile(filename);
 		}
 	}
 
-	pv->DonePackaging();
+	virtual void Release()
+	{
+		delete this;
+	}
 
-	pd->m_hThread = NULL;
+	virtual HANDLE GetHandle()
+	{
+		return m_hFile;
+	}
 
-	ResetEvent(pd->m_hCancelEvent);
+	virtual bool Span()
+	{
+		if (!m_Volumes || (m_hFile == INVALID_HANDLE_VALUE))
+			return false;
 
-	return 0;
-}
+		LARGE_INTEGER p;
+		GetFileSizeEx(m_hFile, &p);
+		m_PrevVolumesSize += p.QuadPart;
+
+		CloseHandle(m_hFile);
 
+		OpenVolume();
 
-DWORD GetFileSizeByName(const TCHAR *filename)
-{
-	HANDLE h = CreateFile(filename, FILE_READ_ATTRIBUTES, FILE_SHARE_DELETE | FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
-	if (!h)
-		return 0;
+		return (m_hFile != INVALID_HANDLE_VALUE);
+	}
 
-	DWORD ret = GetFileSize(h, NULL);
+	// the length of all of the volumes together
+	virtual uint64_t GetLength()
+	{
+		LARGE_INTEGER p = {0};
+		if (m_hFile != INVALID_HANDLE_VALUE)
+			GetFileSizeEx(m_hFile, &p);
 
-	CloseHandle(h);
+		return m_PrevVolumesSize + p.QuadPart;
+	}
 
-	return ret;
-}
+	virtual uint64_t GetOffset()
+	{
+		LARGE_INTEGER p, z;
+		z.QuadPart = 0;
+		SetFilePointerEx(m_hFile, z, &p, FILE_CURRENT);
+		return p.QuadPart;
+	}
+
+};
 
-bool ShouldExclude(const TCHAR *filename, const TCHAR *excludespec)
+// Keeps the build's status (and, every so often, the build log) up to date with how much of the package's data has been
+// dealt with, how fast, and how long the rest should take
+class CBuildProgress : public IArchiveProgress
 {
-	// this SHOULD never happen...?
-	if (!filename)
-		return false;
+protected:
+	IBuildReporter *m_pReporter;
 
-	if (!excludespec || !*excludespec)
-		return false;
+	uint64_t m_Total;
+	uint64_t m_DoneU;
+	uint64_t m_DoneC;
 
-	TCHAR *buf = (TCHAR *)_malloca((_tcslen(excludespec) + 1) * sizeof(TCHAR));
-	if (!buf)
-		return false;
+	ULONGLONG m_StartTime;
+	ULONGLONG m_LastStatusTime;
+	ULONGLONG m_LastLogTime;
+	UINT m_LastPct;
+
+	void FormatStatus(CString &s, ULONGLONG now)
+	{
+		double mb_done = (double)m_DoneU / 1024.0 / 1024.0;
+		double mb_total = (double)m_Total / 1024.0 / 1024.0;
 
-	_tcscpy(buf, excludespec);
+		double secs = (double)(now - m_StartTime) / 1000.0;
+		double mbps = (secs > 0.0) ? (mb_done / secs) : 0.0;
 
-	bool ret = false;
+		double ratio = m_DoneC ? ((double)m_DoneU / (double)m_DoneC) : 1.0;
+
+		int eta = (mbps > 0.0) ? (int)((mb_total - mb_done) / mbps) : 0;
+
+		s.Format(_T("%1.02f of %1.02fMB (%d%%), %1.02fMB/s, ratio %1.02f:1, %02d:%02d:%02d remaining"),
+			mb_done, mb_total, m_LastPct, mbps, ratio, eta / 3600, (eta % 3600) / 60, eta % 60);
+	}
 
-	TCHAR *c = buf, *d;
-	while (c && *c)
+public:
+	CBuildProgress(IBuildReporter *preporter, uint64_t total)
 	{
-		d = _tcschr(c, _T(';'));
-		if (d)
-			*d = _T('\0');
+		m_pReporter = preporter;
+
+		m_Total = total;
+		m_DoneU = 0;
+		m_DoneC = 0;
+
+		m_StartTime = GetTickCount64();
+		m_LastStatusTime = m_StartTime;
+		m_LastLogTime = m_StartTime;
+		m_LastPct = 0;
+	}
+
+	virtual void Progress(uint64_t sz_uncomp, uint64_t sz_comp)
+	{
+		m_DoneU += sz_uncomp;
+		m_DoneC += sz_comp;
+
+		// blocks go by far faster than anyone can read, so the display is only refreshed a few times a second
+		ULONGLONG now = GetTickCount64();
+		if (((now - m_LastStatusTime) < 250) && (m_DoneU < m_Total))
+			return;
 
-		if (PathMatchSpec(filename, c))
+		m_LastStatusTime = now;
+
+		UINT pct = m_Total ? (UINT)((m_DoneU * 100) / m_Total) : 100;
+		if (pct != m_LastPct)
 		{
-			ret = true;
-			break;
+			m_LastPct = pct;
+			m_pReporter->SetProgress(pct);
 		}
 
-		c = d;
-		if (d)
-			c++;
-	}
+		CString s;
+		FormatStatus(s, now);
+		m_pReporter->ShowStatus(s);
 
-	_freea(buf);
+		if ((now - m_LastLogTime) >= 5000)
+		{
+			m_LastLogTime = now;
 
-	return ret;
-}
+			CString msg;
+			msg.Format(_T("    [%s]\r\n"), (LPCTSTR)s);
+			m_pReporter->LogMessage(msg);
+		}
+	}
+};
 
-bool CSfxPackagerDoc::AddFileToArchive(CSfxPackagerView *pview, IArchiver *parc, TStringArray &created_archives, TSizeArray &created_archive_filecounts, const TCHAR *srcspec, const TCHAR *excludespec, const TCHAR *scriptsnippet, const TCHAR *dstpath, const TCHAR *dstfilename, uint64_t *sz_uncomp, uint64_t *sz_comp, UINT recursion)
+class CSfxHandle : public CPackagerArchiveHandle
 {
-	DWORD wr = WaitForSingleObject(m_hCancelEvent, 0);
-	if ((wr == WAIT_OBJECT_0) || (wr == WAIT_ABANDONED))
+
+public:
+	CSfxHandle(const TCHAR *base_filename, CSfxPackagerDoc *pdoc) : CPackagerArchiveHandle(pdoc)
 	{
-		return false;
-	}
+		_tcscpy_s(m_BaseFilename, MAX_PATH, base_filename);
+		_tcscpy_s(m_CurrentFilename, MAX_PATH, base_filename);
 
-	if (!srcspec)
-		return false;
+		m_hFile = INVALID_HANDLE_VALUE;
+		if (!SetupSfxExecutable(m_BaseFilename, m_pDoc, m_hFile, 0, m_BaseFixupOfs))
+		{
+			m_pDoc->m_pReporter->LogMessage(_T("SFX setup failed; your output exe may be locked or the directory set to read-only.\r\n"));
+		}
+		ASSERT(m_hFile != INVALID_HANDLE_VALUE);
 
-	CString msg;
+		m_FixupOfs = m_BaseFixupOfs;
+	}
 
-	CMainFrame *pmf = (CMainFrame *)(AfxGetApp()->m_pMainWnd);
+	virtual ~CSfxHandle() { }
+
+	virtual void Release()
+	{
+		delete this;
+	}
 
-	const TCHAR *pss = srcspec;
-	if (!_tcsnicmp(pss, _T("http"), 4))
+	virtual bool Span()
 	{
-		pss += 4;
-		if (!_tcsnicmp(pss, _T("s"), 1))
-			pss++;
+		m_spanIdx++;
 
-		if (!_tcsnicmp(pss, _T("://"), 3))
-		{
-			TCHAR local_dstpath[MAX_PATH], *dp = local_dstpath;
-			_tcscpy_s(local_dstpath, dstpath);
-			if (_tcslen(local_dstpath) > 0)
-				PathAddBackslash(local_dstpath);
-			_tcscat(local_dstpath, dstfilename);
+		TCHAR local_filename[MAX_PATH];
+		_tcscpy_s(local_filename, MAX_PATH, m_BaseFilename);
+
+		TCHAR *pext = PathFindExtension(m_BaseFilename);
+		TCHAR *plext = PathFindExtension(local_filename);
+		_stprintf_s(plext, MAX_PATH, _T("_part%d"), m_spanIdx + 1);
+		_tcscat_s(local_filename, MAX_PATH, pext);
+		TCHAR *lcmd = PathFindFileName(local_filename);
 
-			while (dp && *(dp++)) { if (*dp == _T('/')) *dp = _T('\\'); }
+		size_t fc = m_pArc->GetFileCount(IArchiver::IM_SPAN);
 
-			parc->AddFile(srcspec, local_dstpath, nullptr, nullptr, scriptsnippet);
+		// we finalize by storing the file table and writing the starting offset of the archive in the stream
+		bool finalized = (m_pArc->Finalize() == IArchiver::FR_OK);
 
-			msg.Format(_T("    Adding download reference to \"%s\" from (%s) ...\r\n"), local_dstpath, srcspec);
-			pmf->GetOutputWnd().AppendMessage(COutputWnd::OT_BUILD, msg);
+		LARGE_INTEGER sz;
+		sz.LowPart = GetFileSize(m_hFile, (LPDWORD)&sz.HighPart);
+		m_spanTotalSize.QuadPart += sz.QuadPart;
 
-			return true;
-		}
+		// Finalize archive
+		CloseHandle(m_hFile);
+		m_hFile = INVALID_HANDLE_VALUE;
+
+		FixupSfxExecutable(m_pDoc, m_CurrentFilename, m_FixupOfs, lcmd, m_spanIdx, (UINT32)fc);
+
+		_tcscpy_s(m_CurrentFilename, MAX_PATH, local_filename);
+
+		return SetupSfxExecutable(m_CurrentFilename, m_pDoc, m_hFile, m_spanIdx, m_FixupOfs) && finalized;
 	}
 
-	TCHAR docpath[MAX_PATH];
-	_tcscpy_s(docpath, GetPathName());
-	PathRemoveFileSpec(docpath);
+};
 
-	TCHAR fullfilename[MAX_PATH];
-	if (PathIsRelative(srcspec))
+
+// CSfxPackagerDoc
+
+IMPLEMENT_DYNCREATE(CSfxPackagerDoc, CDocument)
+
+BEGIN_MESSAGE_MAP(CSfxPackagerDoc, CDocument)
+END_MESSAGE_MAP()
+
+
+// CSfxPackagerDoc construction/destruction
+
+CSfxPackagerDoc::CSfxPackagerDoc()
+{
+	m_Key = 0;
+
+	m_SfxOutputFile = _T("mySfx.exe");
+	m_MaxSize = -1;
+	m_Caption = _T("SFX Installer");
+	m_VersionID = _T("");
+	m_Description = _T("Provide a description for the files being installed");
+	m_LicenseMessage = _T("");
+	m_IconFile = _T("");
+	m_ImageFile = _T("");
+	m_bExploreOnComplete = false;
+	m_LaunchCmd = _T("");
+	m_DefaultPath = _T("");
+	m_bAllowDestChg = true;
+	m_bRequireAdmin = false;
+	m_bRequireReboot = false;
+	m_bAppendBuildDate = false;
+	m_bAppendVersion = false;
+	m_bExternalArchive = false;
+	m_bStreamingLayout = false;
+	m_bIncrementalBuild = false;
+	m_CachePath = _T("");
+	m_CacheSize = 1024;
+	m_PatchBase = _T("");
+	m_StubFixupOfs = -1;
+	m_StubCaptionOfs = -1;
+	m_OutputCmd = _T("");
+
+	m_hCancelEvent = CreateEvent(NULL, true, false, NULL);
+	m_hThread = NULL;
+	m_pReporter = NULL;
+}
+
+CSfxPackagerDoc::~CSfxPackagerDoc()
+{
+	if (m_hThread)
 	{
-		PathCombine(fullfilename, docpath, srcspec);
+		SignalObjectAndWait(m_hCancelEvent, m_hThread, INFINITE, FALSE);
 	}
-	else
+
+	CloseHandle(m_hCancelEvent);
+
+	EndWaitCursor();
+}
+
+CSfxPackagerDoc *CSfxPackagerDoc::GetDoc()
+{
+	CMDIFrameWnd *pframe = (CMDIFrameWnd *)(AfxGetApp()->m_pMainWnd);
+	CMDIChildWnd *pchild = pframe ? pframe->MDIGetActive() : NULL;
+	if (pchild)
 	{
-		_tcscpy_s(fullfilename, srcspec);
+		CDocument *pdoc = pchild->GetActiveDocument();
+
+		if (pdoc && pdoc->IsKindOf(RUNTIME_CLASS(CSfxPackagerDoc)))
+			return (CSfxPackagerDoc *)pdoc;
 	}
 
-	TCHAR *filespec = PathFindFileName(srcspec);
-	TCHAR *filename = PathFindFileName(fullfilename);
+	return NULL;
+}
+
+BOOL CSfxPackagerDoc::OnNewDocument()
+{
+	if (!CDocument::OnNewDocument())
+		return FALSE;
 
-	bool wildcard = (_tcschr(filespec, _T('*')) != NULL);
+	return TRUE;
+}
 
-	if (wildcard)
+
+BOOL CSfxPackagerDoc::EnumTypesFunc(HMODULE hModule, LPTSTR lpType, LONG_PTR lParam)
+{
+	CSfxPackagerDoc *_this = (CSfxPackagerDoc *)lParam;
+
+	EnumResourceNames(hModule, lpType, (ENUMRESNAMEPROC)EnumNamesFunc, lParam);
+
+	return TRUE;
+}
+
+BOOL CSfxPackagerDoc::EnumNamesFunc(HMODULE hModule, LPCTSTR lpType, LPTSTR lpName, LONG_PTR lParam)
+{
+	CSfxPackagerDoc *_this = (CSfxPackagerDoc *)lParam;
+
+	if ((ULONGLONG)lpName & 0xFFFF0000)
 	{
-		_tcscpy(filename, _T("*"));
-		dstfilename = NULL;
 	}
 
-	// set marquee mode on the progress bar while in recursion
-	if (!recursion && wildcard)
+	if (lpType == RT_ICON)
 	{
-		pmf->GetStatusBarWnd().PostMessage(CProgressStatusBar::WM_UPDATE_STATUS, 0xff, 1);
-		Sleep(0);
+		_this->m_IconName = lpName;
 	}
 
-	bool ret = false;
+	return TRUE;
+}
 
-	WIN32_FIND_DATA fd;
-	HANDLE hfind = FindFirstFile(fullfilename, &fd);
-	if (hfind != INVALID_HANDLE_VALUE)
+BOOL CSfxPackagerDoc::EnumLangsFunc(HMODULE hModule, LPCTSTR lpType, LPCTSTR lpName, WORD wLang, LONG_PTR lParam)
+{
+	CSfxPackagerDoc *_this = (CSfxPackagerDoc *)lParam;
+
+	HANDLE hResInfo = FindResourceEx(hModule, lpType, lpName, wLang); 
+	
+	return TRUE; 
+}
+
+DWORD CSfxPackagerDoc::RunCreateSFXPackage(LPVOID param)
+{
+	CSfxPackagerView *pv = (CSfxPackagerView *)param;
+
+	CSfxPackagerDoc *pd = pv->GetDocument(); // should be this
+
+	pd->m_hThread = GetCurrentThread();
+
+	CMainFrame *pmf = (CMainFrame *)(AfxGetApp()->m_pMainWnd);
+
+	// the output window only keeps the most recent part of the build log, so the whole thing goes next to the package
+	TCHAR logfilename[MAX_PATH];
+	if (PathIsRelative(pd->m_SfxOutputFile))
+	{
+		TCHAR docpath[MAX_PATH];
+		_tcscpy_s(docpath, pd->GetPathName());
+		PathRemoveFileSpec(docpath);
+		PathCombine(logfilename, docpath, pd->m_SfxOutputFile);
+	}
+	else
 	{
-		ret = true;
+		_tcscpy_s(logfilename, pd->m_SfxOutputFile);
+	}
+	PathRenameExtension(logfilename, _T(".log"));
 
-		do
-		{
-			wr = WaitForSingleObject(m_hCancelEvent, 0);
-			if ((wr == WAIT_OBJECT_0) || (wr == WAIT_ABANDONED))
-			{
-				return false;
-			}
+	pmf->GetOutputWnd().SetLogFile(logfilename);
 
-			if (_tcscmp(fd.cFileName, _T(".")) && _tcscmp(fd.cFileName, _T("..")))
-			{
-				_tcscpy(filename, fd.cFileName);
+	pd->CreatePackage(NULL, pmf);
 
-				uint64_t comp = 0, uncomp = 0;
+	pmf->GetOutputWnd().SetLogFile(NULL);
 
-				if (PathIsDirectory(fullfilename))
-				{
-					if (!PathIsDirectoryEmpty(fullfilename))
-					{
-						PathAddBackslash(filename);
-						_tcscat(filename, filespec);
-
-						TCHAR local_dstpath[MAX_PATH];
-						_tcscpy_s(local_dstpath, dstpath);
-						if (_tcslen(local_dstpath) > 0)
-							PathAddBackslash(local_dstpath);
-						_tcscat(local_dstpath, fd.cFileName);
-
-						uint64_t rcomp = 0, runcomp = 0;
-						ret &= AddFileToArchive(pview, parc, created_archives, created_archive_filecounts, fullfilename, excludespec, scriptsnippet, local_dstpath, NULL, &runcomp, &rcomp, recursion + 1);
-						if (ret)
-						{
-							uncomp = runcomp;
-							comp = rcomp;
-						}
-					}
-				}
-				else if (PathMatchSpec(fd.cFileName, filespec))
-				{
-					if (!ShouldExclude(fd.cFileName, excludespec))
-					{
-						if (!PathIsNetworkPath(dstpath) && *dstpath == _T('\\'))
-							dstpath++;
+	pv->DonePackaging();
 
-						TCHAR dst[MAX_PATH];
-						_tcscpy_s(dst, dstpath ? dstpath : _T(""));
+	pd->m_hThread = NULL;
 
-						if (dst[0] != _T('\0'))
-							PathAddBackslash(dst);
+	ResetEvent(pd->m_hCancelEvent);
 
-						_tcscat(dst, (dstfilename && !wildcard) ? dstfilename : fd.cFileName);
+	return 0;
+}
 
-						if (PathFileExists(fullfilename))
-						{
-							msg.Format(_T("    Adding \"%s\" from \"%s\" ...\r\n"), dst, fullfilename);
-							pmf->GetOutputWnd().AppendMessage(COutputWnd::OT_BUILD, msg);
+bool CSfxPackagerDoc::CreatePackage(const TCHAR *filename, IBuildReporter *preporter)
+{
+	if (!filename)
+		filename = m_SfxOutputFile;
 
-							parc->AddFile(fullfilename, dst, &uncomp, &comp, scriptsnippet);
-						}
-						else
-						{
-							msg.Format(_T("    WARNING: \"%s\" NOT FOUND!\r\n"), fullfilename);
-							pmf->GetOutputWnd().AppendMessage(COutputWnd::OT_BUILD, msg);
+	const TCHAR *ext = PathFindExtension(filename);
 
-							return false;
-						}
-					}
-				}
+	if (!_tcsicmp(ext, _T(".exe")))
+		return CreateSFXPackage(filename, preporter);
 
-				if (sz_uncomp)
-					*sz_uncomp += uncomp;
+	if (!_tcsicmp(ext, _T(".gz")) || !_tcsicmp(ext, _T(".gzip")))
+		return CreateTarGzipPackage(filename, preporter);
 
-				if (sz_comp)
-					*sz_comp += comp;
-			}
-		}
-		while (FindNextFile(hfind, &fd));
+	CString msg;
+	msg.Format(_T("Unable to build \"%s\"; the output must be an .exe or a .gz.\r\n"), filename);
+	preporter->LogMessage(msg);
 
-		FindClose(hfind);
-	}
+	return false;
+}
 
-	// set marquee mode on the progress bar while in recursion
-	if (!recursion && wildcard)
-	{
-		pmf->GetStatusBarWnd().PostMessage(CProgressStatusBar::WM_UPDATE_STATUS, 0xff, 0);
-		Sleep(0);
-	}
+
+DWORD GetFileSizeByName(const TCHAR *filename)
+{
+	HANDLE h = CreateFile(filename, FILE_READ_ATTRIBUTES, FILE_SHARE_DELETE | FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
+	if (!h)
+		return 0;
+
+	DWORD ret = GetFileSize(h, NULL);
+
+	CloseHandle(h);
 
 	return ret;
 }
 
-
-bool CSfxPackagerDoc::CreateSFXPackage(const TCHAR *filename, CSfxPackagerView *pview)
+bool CSfxPackagerDoc::CreateSFXPackage(const TCHAR *filename, IBuildReporter *preporter)
 {
 	time_t start_op, finish_op;
 	time(&start_op);
 
-	UINT c = 0, maxc = (UINT)m_FileData.size();
+	UINT maxc = (UINT)m_FileData.size();
 	if (!maxc)
 		return true;
 
+	m_pReporter = preporter;
+
 	CString msg;
 
 	if (!filename)
 		filename = m_SfxOutputFile;
 
-	CMainFrame *pmf = (CMainFrame *)(AfxGetApp()->m_pMainWnd);
-
 	TCHAR docpath[MAX_PATH];
 	_tcscpy_s(docpath, GetPathName());
 	PathRemoveFileSpec(docpath);
@@ -1193,7 +1656,7 @@ bool CSfxPackagerDoc::CreateSFXPackage(const TCHAR *filename, CSfxPackagerView *
 	}
 
 	msg.Format(_T("Beginning build of \"%s\" (%s) ...\r\n"), m_Caption, fullfilename);
-	pmf->GetOutputWnd().AppendMessage(COutputWnd::OT_BUILD, msg);
+	m_pReporter->LogMessage(msg);
 
 	TStringArray created_archives;
 	TSizeArray created_archive_filecounts;
@@ -1203,6 +1666,10 @@ bool CSfxPackagerDoc::CreateSFXPackage(const TCHAR *filename, CSfxPackagerView *
 	HANDLE hf = NULL;
 
 	IArchiver *parc = NULL;
+	IArchiveHandle *pref = nullptr;
+	TCHAR lastfilename[MAX_PATH] = {0};
+	TCHAR prevfilename[MAX_PATH] = {0};
+	TCHAR patchfilename[MAX_PATH] = {0};
 	UINT spanct;
 	uint64_t sz_uncomp = 0, sz_totalcomp = 0, sz_comp = 0;
 
@@ -1210,28 +1677,156 @@ bool CSfxPackagerDoc::CreateSFXPackage(const TCHAR *filename, CSfxPackagerView *
 	{
 		CPackagerArchiveHandle *pah = nullptr;
 
-		if (!m_bExternalArchive)
+		// the stub is customized at most once per build (the first time one is needed)
+		m_StubTemplate.Empty();
+
+		uint64_t arcflags = m_bStreamingLayout ? IArchiver::AF_STREAMING : 0;
+
+		// an update package is built against the one it updates, which is only ever read
+		if (!m_PatchBase.IsEmpty())
+		{
+			if (PathIsRelative(m_PatchBase))
+				PathCombine(patchfilename, docpath, m_PatchBase);
+			else
+				_tcscpy_s(patchfilename, m_PatchBase);
+
+			if (PathFileExists(patchfilename))
+			{
+				msg.Format(_T("Building an update package against \"%s\" ...\r\n"), patchfilename);
+				m_pReporter->LogMessage(msg);
+
+				if (m_bIncrementalBuild)
+					m_pReporter->LogMessage(_T("WARNING: Incremental Build is ignored when building an update package.\r\n"));
+
+				if (m_MaxSize > 0)
+					m_pReporter->LogMessage(_T("WARNING: the maximum size is ignored when building an update package; it will not be split.\r\n"));
+
+				arcflags |= IArchiver::AF_PATCH;
+				pref = new CReferenceArcHandle(patchfilename);
+			}
+			else
+			{
+				msg.Format(_T("WARNING: the package to patch against (%s) was not found; a full package will be built.\r\n"), patchfilename);
+				m_pReporter->LogMessage(msg);
+			}
+		}
+
+		bool piped = !m_OutputCmd.IsEmpty();
+		if (piped)
 		{
-			pah = new CSfxHandle(fullfilename, this);
+			msg.Format(_T("Streaming archive data to \"%s\" ...\r\n"), m_OutputCmd);
+			m_pReporter->LogMessage(msg);
+
+			if (m_MaxSize > 0)
+				m_pReporter->LogMessage(_T("WARNING: the maximum size is ignored when streaming to an output command; the archive will not be split.\r\n"));
+
+			pah = new CPipeArcHandle(fullfilename, this, m_OutputCmd);
+
+			// a pipe can't be seeked back into, so everything that would have been patched goes at the end
+			arcflags |= IArchiver::AF_TRAILER;
 		}
 		else
 		{
-			pah = new CExtArcHandle(fullfilename, this);
+			// the last output has to be moved out of the way before it's overwritten; only the first span is used
+			if (m_bIncrementalBuild && !pref)
+			{
+				_tcscpy_s(lastfilename, fullfilename);
+				if (m_bExternalArchive)
+					PathRenameExtension(lastfilename, _T(".data"));
+
+				_stprintf_s(prevfilename, MAX_PATH, _T("%s.prev"), lastfilename);
+
+				if (PathFileExists(lastfilename) && MoveFileEx(lastfilename, prevfilename, MOVEFILE_REPLACE_EXISTING))
+				{
+					pref = new CReferenceArcHandle(prevfilename);
+				}
+				else
+				{
+					m_pReporter->LogMessage(_T("No previous build was found; all files will be compressed.\r\n"));
+					prevfilename[0] = _T('\0');
+				}
+			}
+
+			if (!m_bExternalArchive)
+				pah = new CSfxHandle(fullfilename, this);
+			else
+				pah = new CExtArcHandle(fullfilename, this);
 		}
 
-		ret = (IArchiver::CreateArchiver(&parc, pah, IArchiver::CT_FASTLZ) == IArchiver::CR_OK);
+		ret = (IArchiver::CreateArchiver(&parc, pah, IArchiver::CT_FASTLZ, arcflags) == IArchiver::CR_OK);
 
 		if (pah)
 			pah->SetArchiver(parc);
 
-		parc->SetMaximumSize((m_MaxSize > 0) ? (m_MaxSize MB) : UINT64_MAX);
+		if (pref && !parc->SetReferenceArchive(pref))
+		{
+			if (arcflags & IArchiver::AF_PATCH)
+				msg.Format(_T("WARNING: the package to patch against (%s) could not be read; all files will be compressed.\r\n"), patchfilename);
+			else
+				msg.Format(_T("WARNING: the previous build (%s) could not be read; all files will be compressed.\r\n"), prevfilename);
+			m_pReporter->LogMessage(msg);
+		}
+
+		if (!m_CachePath.IsEmpty())
+		{
+			TCHAR cachepath[MAX_PATH];
+			if (PathIsRelative(m_CachePath))
+				PathCombine(cachepath, docpath, m_CachePath);
+			else
+				_tcscpy_s(cachepath, m_CachePath);
+
+			if (!parc->SetCache(cachepath, ((uint64_t)m_CacheSize) MB))
+			{
+				msg.Format(_T("WARNING: the build cache (%s) could not be created; all files will be compressed.\r\n"), cachepath);
+				m_pReporter->LogMessage(msg);
+			}
+		}
+
+		parc->SetMaximumSize(((m_MaxSize > 0) && !piped) ? (m_MaxSize MB) : UINT64_MAX);
 
 		m_UncompressedSize.QuadPart = 0;
+		m_ReusedFileCount = 0;
+		m_UnchangedFileCount = 0;
+		m_DeltaFileCount = 0;
+
+		// everything that goes into the package is found up front, by several threads, so that compression never waits on a
+		// directory listing (which can take a long time on a network share)
+		m_pReporter->LogMessage(_T("Scanning sources ...\r\n"));
+
+		m_pReporter->SetBusy(true);
+
+		CBuildManifest manifest(docpath, m_hCancelEvent, &m_SourceWatcher);
+		PopulateManifest(manifest);
 
-		TFileDataMap::iterator it = m_FileData.begin();
-		TFileDataMap::iterator last_it = m_FileData.end();
+		bool scanned = manifest.Scan();
 
-		while (it != last_it)
+		m_pReporter->SetBusy(false);
+
+		for (const auto &missing : manifest.GetMissing())
+		{
+			msg.Format(_T("    WARNING: \"%s\" NOT FOUND!\r\n"), missing.c_str());
+			m_pReporter->LogMessage(msg);
+
+			ret = false;
+		}
+
+		if (scanned)
+		{
+			msg.Format(_T("Found %d file(s) to add (%1.02fMB).\r\n"), (int)manifest.GetCount(), (double)manifest.GetTotalSize() / 1024.0 / 1024.0);
+			m_pReporter->LogMessage(msg);
+
+			if (manifest.GetWatchedDirectoryCount())
+			{
+				msg.Format(_T("%d of %d directories were unchanged since they were last listed.\r\n"), manifest.GetWatchedDirectoryCount(), manifest.GetDirectoryCount());
+				m_pReporter->LogMessage(msg);
+			}
+		}
+
+		// progress goes by the bytes compressed, out of everything the scan found
+		CBuildProgress progress(m_pReporter, manifest.GetTotalSize());
+		parc->SetProgress(&progress);
+
+		for (size_t i = 0, maxi = manifest.GetCount(); i < maxi; i++)
 		{
 			wr = WaitForSingleObject(m_hCancelEvent, 0);
 			if ((wr == WAIT_OBJECT_0) || (wr == WAIT_ABANDONED))
@@ -1239,43 +1834,81 @@ bool CSfxPackagerDoc::CreateSFXPackage(const TCHAR *filename, CSfxPackagerView *
 				break;
 			}
 
-			bool wildcard = ((_tcschr(it->second.name.c_str(), _T('*')) != NULL) || PathIsDirectory(it->second.srcpath.c_str()));
-
-			c++;
-			UINT pct = (c * 100) / maxc;
-			pmf->GetStatusBarWnd().PostMessage(CProgressStatusBar::WM_UPDATE_STATUS, pct, 0);
-			Sleep(0);
+			const CBuildManifest::SEntry &e = manifest.GetEntry(i);
 
-			if (wildcard)
+			if (e.m_Download)
 			{
-				// TODO: add include / exclude lists
-				TCHAR srcpath[MAX_PATH];
-				_tcscpy_s(srcpath, it->second.srcpath.c_str());
-				PathAddBackslash(srcpath);
-				_tcscat(srcpath, it->second.name.c_str());
+				parc->AddFile(e.m_Src.c_str(), e.m_Dst.c_str(), nullptr, nullptr, e.m_Snippet.c_str());
+
+				msg.Format(_T("    Adding download reference to \"%s\" from (%s) ...\r\n"), e.m_Dst.c_str(), e.m_Src.c_str());
+				m_pReporter->LogMessage(msg);
 
-				ret &= AddFileToArchive(pview, parc, created_archives, created_archive_filecounts, srcpath, it->second.exclude.c_str(), it->second.snippet.c_str(), it->second.dstpath.c_str(), nullptr, &sz_uncomp, &sz_comp);
+				continue;
 			}
-			else
+
+			msg.Format(_T("    Adding \"%s\" from \"%s\" ...\r\n"), e.m_Dst.c_str(), e.m_Src.c_str());
+			m_pReporter->LogMessage(msg);
+
+			uint64_t uncomp = 0, comp = 0;
+			switch (parc->AddFile(e.m_Src.c_str(), e.m_Dst.c_str(), &uncomp, &comp, e.m_Snippet.c_str()))
 			{
-				ret &= AddFileToArchive(pview, parc, created_archives, created_archive_filecounts, it->second.srcpath.c_str(), nullptr, it->second.snippet.c_str(), it->second.dstpath.c_str(), it->second.name.c_str(), &sz_uncomp, &sz_comp);
+				case IArchiver::AR_OK_REUSED:
+					m_ReusedFileCount++;
+					break;
+
+				case IArchiver::AR_OK_UNCHANGED:
+					m_UnchangedFileCount++;
+					break;
+
+				case IArchiver::AR_OK_DELTA:
+					m_DeltaFileCount++;
+					break;
+
+				case IArchiver::AR_OK_NODELTA:
+					msg.Format(_T("WARNING: \"%s\" is too large to be stored as a delta; it was compressed whole.\r\n"), e.m_Dst.c_str());
+					m_pReporter->LogMessage(msg);
+					break;
+
+				// the file isn't in the package, so the package is no good
+				case IArchiver::AR_SPANFAIL:
+				case IArchiver::AR_UNKNOWN_ERROR:
+					msg.Format(_T("    ERROR: \"%s\" could not be added to the package!\r\n"), e.m_Src.c_str());
+					m_pReporter->LogMessage(msg);
+
+					ret = false;
+					break;
 			}
 
+			sz_uncomp += uncomp;
+			sz_comp += comp;
+
 			sz_totalcomp = sz_comp;
 			m_UncompressedSize.QuadPart = sz_uncomp;
-
-			it++;
 		}
 
+		// a scan that was cancelled leaves nothing to add, but the build still has to be reported as cancelled
+		if (!scanned)
+			wr = WaitForSingleObject(m_hCancelEvent, 0);
+
+		parc->SetProgress(nullptr);
+
 		if (pah)
 		{
 			spanct = pah->GetSpanCount();
 			sz_totalcomp = pah->GetSpanTotalSize();
 		}
 
-		LARGE_INTEGER tsz = {0};
-		tsz.LowPart = GetFileSize(pah->GetHandle(), (LPDWORD)&tsz.HighPart);
-		sz_totalcomp += tsz.QuadPart;
+		// there's no file to measure when the data went through a pipe, so go by the compressed data that was written
+		if (piped)
+		{
+			sz_totalcomp += sz_comp;
+		}
+		else
+		{
+			LARGE_INTEGER tsz = {0};
+			tsz.LowPart = GetFileSize(pah->GetHandle(), (LPDWORD)&tsz.HighPart);
+			sz_totalcomp += tsz.QuadPart;
+		}
 
 		if (pah)
 		{
@@ -1286,6 +1919,7 @@ bool CSfxPackagerDoc::CreateSFXPackage(const TCHAR *filename, CSfxPackagerView *
 
 	time(&finish_op);
 	int elapsed = (int)difftime(finish_op, start_op);
+	double build_secs = std::max<double>(1.0, (double)elapsed);
 
 	int hours = elapsed / 3600;
 	elapsed %= 3600;
@@ -1293,14 +1927,35 @@ bool CSfxPackagerDoc::CreateSFXPackage(const TCHAR *filename, CSfxPackagerView *
 	int minutes = elapsed / 60;
 	int seconds = elapsed % 60;
 
-	if ((wr == WAIT_OBJECT_0) || (wr == WAIT_ABANDONED))
+	bool cancelled = ((wr == WAIT_OBJECT_0) || (wr == WAIT_ABANDONED));
+	if (cancelled)
 	{
 		msg.Format(_T("Cancelled. (after: %02d:%02d:%02d)\r\n"), hours, minutes, seconds);
 	}
 	else
 	{
 		msg.Format(_T("Done.\r\n\r\nAdded %d files, spanning %d archive(s).\r\n"), parc->GetFileCount(IArchiver::IM_WHOLE), spanct);
-		pmf->GetOutputWnd().AppendMessage(COutputWnd::OT_BUILD, msg);
+		m_pReporter->LogMessage(msg);
+
+		if (m_ReusedFileCount)
+		{
+			msg.Format(_T("Reused %d unchanged file(s) from the previous build.\r\n"), m_ReusedFileCount);
+			m_pReporter->LogMessage(msg);
+		}
+
+		if (m_UnchangedFileCount || m_DeltaFileCount)
+		{
+			msg.Format(_T("Patch: %d unchanged file(s) referenced, %d changed file(s) stored as deltas.\r\n"), m_UnchangedFileCount, m_DeltaFileCount);
+			m_pReporter->LogMessage(msg);
+		}
+
+		size_t cache_hits, cache_misses;
+		parc->GetCacheStats(&cache_hits, &cache_misses);
+		if (cache_hits || cache_misses)
+		{
+			msg.Format(_T("Build cache: %d hit(s), %d miss(es).\r\n"), (int)cache_hits, (int)cache_misses);
+			m_pReporter->LogMessage(msg);
+		}
 
 		double comp_pct = 0.0;
 		double uncomp_sz = (double)m_UncompressedSize.QuadPart;
@@ -1310,167 +1965,103 @@ bool CSfxPackagerDoc::CreateSFXPackage(const TCHAR *filename, CSfxPackagerView *
 			comp_pct = 100.0 * std::max<double>(0.0, ((uncomp_sz / comp_sz) - 1.0));
 		}
 		msg.Format(_T("Uncompressed Size: %1.02fMB\r\nCompressed Size: %1.02fMB\r\nCompression: %1.02f%%\r\n\r\n"), uncomp_sz / 1024.0f / 1024.0f, comp_sz / 1024.0f / 1024.0f, comp_pct);
-		pmf->GetOutputWnd().AppendMessage(COutputWnd::OT_BUILD, msg);
+		m_pReporter->LogMessage(msg);
 
-		msg.Format(_T("Completed in: %02d:%02d:%02d\r\n\r\n\r\n"), hours, minutes, seconds);
+		msg.Format(_T("Completed in: %02d:%02d:%02d (%1.02fMB/s)\r\n\r\n\r\n"), hours, minutes, seconds, uncomp_sz / 1024.0 / 1024.0 / build_secs);
 	}
 
-	pmf->GetOutputWnd().AppendMessage(COutputWnd::OT_BUILD, msg);
+	m_pReporter->LogMessage(msg);
 
-	pmf->GetStatusBarWnd().PostMessage(CProgressStatusBar::WM_UPDATE_STATUS, -1, 0);
-	Sleep(0);
+	IBuildReporter::SBuildResult result;
+	result.m_Outcome = cancelled ? IBuildReporter::SBuildResult::BO_CANCELLED : (ret ? IBuildReporter::SBuildResult::BO_SUCCEEDED : IBuildReporter::SBuildResult::BO_FAILED);
+	result.m_Filename = fullfilename;
+	result.m_FileCount = parc->GetFileCount(IArchiver::IM_WHOLE);
+	result.m_SpanCount = spanct;
+	result.m_UncompressedSize = m_UncompressedSize.QuadPart;
+	result.m_CompressedSize = sz_totalcomp;
+	result.m_Seconds = (int)difftime(finish_op, start_op);
 
 	IArchiver::DestroyArchiver(&parc);
 
-	return ret;
-}
-
-bool CSfxPackagerDoc::CopyFileToTemp(CSfxPackagerView *pview, const TCHAR *srcspec, const TCHAR *dstpath, const TCHAR *dstfilename, const TCHAR *excludespec, UINT recursion)
-{
-	DWORD wr = WaitForSingleObject(m_hCancelEvent, 0);
-	if ((wr == WAIT_OBJECT_0) || (wr == WAIT_ABANDONED))
-	{
-		return false;
-	}
-
-	if (!srcspec)
-		return false;
-
-	CMainFrame *pmf = (CMainFrame *)(AfxGetApp()->m_pMainWnd);
-
-	TCHAR docpath[MAX_PATH];
-	_tcscpy_s(docpath, GetPathName());
-	PathRemoveFileSpec(docpath);
-
-	TCHAR fullfilename[MAX_PATH];
-	if (PathIsRelative(srcspec))
-	{
-		PathCombine(fullfilename, docpath, srcspec);
-	}
-	else
-	{
-		_tcscpy(fullfilename, srcspec);
-	}
-
-	TCHAR *filespec = PathFindFileName(srcspec);
-	TCHAR *filename = PathFindFileName(fullfilename);
-
-	bool wildcard = (_tcschr(filespec, _T('*')) != NULL);
-
-	if (wildcard)
-	{
-		_tcscpy(filename, _T("*"));
-		dstfilename = NULL;
-	}
-
-	// set marquee mode on the progress bar while in recursion
-	if (!recursion && wildcard)
-	{
-		pmf->GetStatusBarWnd().PostMessage(CProgressStatusBar::WM_UPDATE_STATUS, 0xff, 1);
-		Sleep(0);
-	}
-
-	bool ret = false;
-
-	WIN32_FIND_DATA fd;
-	HANDLE hfind = FindFirstFile(fullfilename, &fd);
-	if (hfind != INVALID_HANDLE_VALUE)
+	// the archiver is done reading from the previous build, so it can go now (but a package that was patched against stays);
+	// if this build didn't make it, the partial output is replaced with the previous one so there is still something to build from
+	if (pref)
 	{
-		ret = true;
+		pref->Release();
 
-		CString msg;
-
-		do
+		if (prevfilename[0])
 		{
-			wr = WaitForSingleObject(m_hCancelEvent, 0);
-			if ((wr == WAIT_OBJECT_0) || (wr == WAIT_ABANDONED))
+			if (ret && !cancelled)
 			{
-				return false;
+				DeleteFile(prevfilename);
 			}
-
-			if (_tcscmp(fd.cFileName, _T(".")) && _tcscmp(fd.cFileName, _T("..")))
+			else if (MoveFileEx(prevfilename, lastfilename, MOVEFILE_REPLACE_EXISTING))
 			{
-				_tcscpy(filename, fd.cFileName);
-
-				if (PathIsDirectory(fullfilename))
-				{
-					if (!PathIsDirectoryEmpty(fullfilename))
-					{
-						PathAddBackslash(filename);
-						_tcscat(filename, filespec);
-
-						TCHAR local_dstpath[MAX_PATH];
-						_tcscpy_s(local_dstpath, dstpath);
-						if (_tcslen(local_dstpath) > 0)
-							PathAddBackslash(local_dstpath);
-						_tcscat(local_dstpath, fd.cFileName);
-
-						ret &= CopyFileToTemp(pview, fullfilename, local_dstpath, NULL, excludespec, recursion + 1);
-					}
-				}
-				else if (PathMatchSpec(fd.cFileName, filespec) && !ShouldExclude(fd.cFileName, excludespec))
-				{
-					if (*dstpath == _T('\\'))
-						dstpath++;
-
-					TCHAR dst[MAX_PATH];
-					_tcscpy_s(dst, dstpath ? dstpath : _T(""));
+				msg.Format(_T("The previous build (%s) was restored.\r\n"), lastfilename);
+				m_pReporter->LogMessage(msg);
+			}
+			else
+			{
+				msg.Format(_T("WARNING: the previous build could not be restored; it was left at \"%s\".\r\n"), prevfilename);
+				m_pReporter->LogMessage(msg);
+			}
+		}
+	}
 
-					CreateDirectories(dst);
+	m_pReporter->BuildFinished(result);
 
-					if (dst[0] != _T('\0'))
-						PathAddBackslash(dst);
+	return ret;
+}
 
-					_tcscat(dst, (dstfilename && !wildcard) ? dstfilename : fd.cFileName);
+void CSfxPackagerDoc::PopulateManifest(CBuildManifest &manifest)
+{
+	for (TFileDataMap::const_iterator it = m_FileData.cbegin(), last_it = m_FileData.cend(); it != last_it; it++)
+	{
+		bool wildcard = ((_tcschr(it->second.name.c_str(), _T('*')) != NULL) || PathIsDirectory(it->second.srcpath.c_str()));
 
-					msg.Format(_T("    Copying temp file \"%s\" from \"%s\"...\r\n"), dst, fullfilename);
-					pmf->GetOutputWnd().AppendMessage(COutputWnd::OT_BUILD, msg);
+		if (wildcard)
+		{
+			TCHAR srcpath[MAX_PATH];
+			_tcscpy_s(srcpath, it->second.srcpath.c_str());
+			PathAddBackslash(srcpath);
+			_tcscat(srcpath, it->second.name.c_str());
 
-					CopyFile(fullfilename, dst, FALSE);
-				}
-			}
+			manifest.AddSource(srcpath, it->second.exclude.c_str(), it->second.snippet.c_str(), it->second.dstpath.c_str(), nullptr);
+		}
+		else
+		{
+			manifest.AddSource(it->second.srcpath.c_str(), nullptr, it->second.snippet.c_str(), it->second.dstpath.c_str(), it->second.name.c_str());
 		}
-		while (FindNextFile(hfind, &fd));
-
-		FindClose(hfind);
-	}
-
-	// set marquee mode on the progress bar while in recursion
-	if (!recursion && wildcard)
-	{
-		pmf->GetStatusBarWnd().PostMessage(CProgressStatusBar::WM_UPDATE_STATUS, 0xff, 0);
-		Sleep(0);
 	}
-
-	return ret;
 }
 
-bool CSfxPackagerDoc::CreateTarGzipPackage(const TCHAR *filename, CSfxPackagerView *pview)
+bool CSfxPackagerDoc::CreateTarGzipPackage(const TCHAR *filename, IBuildReporter *preporter)
 {
 	time_t start_op, finish_op;
 	time(&start_op);
 
-	UINT c = 0, maxc = (UINT)m_FileData.size();
+	UINT maxc = (UINT)m_FileData.size();
 	if (!maxc)
 		return true;
 
+	m_pReporter = preporter;
+
 	CString msg;
 
 	if (!filename)
 		filename = m_SfxOutputFile;
 
-	CMainFrame *pmf = (CMainFrame *)(AfxGetApp()->m_pMainWnd);
-
 	msg.Format(_T("Beginning build of \"%s\" (%s)...\r\n"), m_Caption, filename);
-	pmf->GetOutputWnd().AppendMessage(COutputWnd::OT_BUILD, msg);
+	m_pReporter->LogMessage(msg);
+
+	TCHAR docpath[MAX_PATH];
+	_tcscpy_s(docpath, GetPathName());
+	PathRemoveFileSpec(docpath);
 
 	TCHAR fullfilename[MAX_PATH];
 
 	if (PathIsRelative(filename))
 	{
-		TCHAR docpath[MAX_PATH];
-		_tcscpy_s(docpath, GetPathName());
-		PathRemoveFileSpec(docpath);
 		PathCombine(fullfilename, docpath, filename);
 	}
 	else
@@ -1478,147 +2069,137 @@ bool CSfxPackagerDoc::CreateTarGzipPackage(const TCHAR *filename, CSfxPackagerVi
 		_tcscpy_s(fullfilename, filename);
 	}
 
-	TCHAR filename_sans_ext[MAX_PATH];
-	_tcscpy_s(filename_sans_ext, MAX_PATH, fullfilename);
-	TCHAR *pext = PathFindExtension(filename_sans_ext);
-	do
-	{
-		if (pext && *pext)
-			*pext = _T('\0');
+	bool ret = true;
+
+	DWORD wr = 0;
 
-		pext = PathFindExtension(filename_sans_ext);
+	// like 7-Zip's volumes, which tarballs used to be split into; they get joined back together before unpacking
+	bool volumes = (m_MaxSize > 0);
+	if (volumes)
+	{
+		msg.Format(_T("The tarball will be split into volumes of %dMB (%s.001, %s.002, ...).\r\n"), m_MaxSize, fullfilename, fullfilename);
+		m_pReporter->LogMessage(msg);
 	}
-	while (pext && *pext);
 
-	bool ret = true;
+	CTarballHandle *pah = new CTarballHandle(fullfilename, volumes);
+	if (pah->GetHandle() == INVALID_HANDLE_VALUE)
+	{
+		msg.Format(_T("Unable to create \"%s\"; it may be locked or the directory set to read-only.\r\n"), fullfilename);
+		m_pReporter->LogMessage(msg);
 
-	HANDLE hf = NULL;
+		pah->Release();
 
-	CString limitstr = _T("");
-	if (m_MaxSize > 0)
-		limitstr.Format(_T(" -v%dm"), m_MaxSize);
+		return false;
+	}
 
-	DWORD wr = 0;
+	IArchiver *parc = NULL;
+	IArchiver::CreateArchiver(&parc, pah, IArchiver::CT_TARGZIP);
 
-	TFileDataMap::iterator it = m_FileData.begin();
-	TFileDataMap::iterator last_it = m_FileData.end();
+	parc->SetMaximumSize(volumes ? (m_MaxSize MB) : UINT64_MAX);
 
-	msg.Format(_T("Pre-processing...\r\n"));
-	pmf->GetOutputWnd().AppendMessage(COutputWnd::OT_BUILD, msg);
+	m_pReporter->LogMessage(_T("Scanning sources ...\r\n"));
 
-	TCHAR tempdir_base[MAX_PATH];
-	_tcscpy_s(tempdir_base, MAX_PATH, theApp.m_sTempPath);
-	PathAddBackslash(tempdir_base);
-	PathAppend(tempdir_base, m_strTitle);
+	m_pReporter->SetBusy(true);
 
-	while (it != last_it)
-	{
-		wr = WaitForSingleObject(m_hCancelEvent, 0);
-		if ((wr == WAIT_OBJECT_0) || (wr == WAIT_ABANDONED))
-		{
-			break;
-		}
+	CBuildManifest manifest(docpath, m_hCancelEvent, &m_SourceWatcher);
+	PopulateManifest(manifest);
 
-		c++;
-		UINT pct = (c * 100) / maxc;
-		pmf->GetStatusBarWnd().PostMessage(CProgressStatusBar::WM_UPDATE_STATUS, pct, 0);
+	bool scanned = manifest.Scan();
 
-		bool wildcard = ((_tcschr(it->second.name.c_str(), _T('*')) != NULL) || PathIsDirectory(it->second.srcpath.c_str()));
+	m_pReporter->SetBusy(false);
 
-		TCHAR tempdir[MAX_PATH];
-		_tcscpy_s(tempdir, MAX_PATH, tempdir_base);
-		PathAppend(tempdir, it->second.dstpath.c_str());
+	for (const auto &missing : manifest.GetMissing())
+	{
+		msg.Format(_T("    WARNING: \"%s\" NOT FOUND!\r\n"), missing.c_str());
+		m_pReporter->LogMessage(msg);
 
-		if (wildcard)
-		{
-			TCHAR srcpath[MAX_PATH];
-			_tcscpy(srcpath, it->second.srcpath.c_str());
-			PathAddBackslash(srcpath);
-			_tcscat(srcpath, it->second.name.c_str());
+		ret = false;
+	}
 
-			ret &= CopyFileToTemp(pview, srcpath, tempdir, it->second.dstpath.c_str(), it->second.exclude.c_str());
-		}
-		else
+	if (scanned)
+	{
+		msg.Format(_T("Found %d file(s) to add (%1.02fMB).\r\n"), (int)manifest.GetCount(), (double)manifest.GetTotalSize() / 1024.0 / 1024.0);
+		m_pReporter->LogMessage(msg);
+
+		if (manifest.GetWatchedDirectoryCount())
 		{
-			ret &= CopyFileToTemp(pview, it->second.srcpath.c_str(), it->second.dstpath.c_str(), it->second.name.c_str(), it->second.exclude.c_str());
+			msg.Format(_T("%d of %d directories were unchanged since they were last listed.\r\n"), manifest.GetWatchedDirectoryCount(), manifest.GetDirectoryCount());
+			m_pReporter->LogMessage(msg);
 		}
-
-		it++;
 	}
 
-	CString cmd, param;
-	STARTUPINFO si;
-	PROCESS_INFORMATION pi;
-
-	if (!((wr == WAIT_OBJECT_0) || (wr == WAIT_ABANDONED)))
-	{
-		param.Format(_T("%s.tar"), filename_sans_ext);
-		DeleteFile(param);
-		param.Format(_T("%s.tar.gzip"), filename_sans_ext);
-		DeleteFile(param);
+	CBuildProgress progress(m_pReporter, manifest.GetTotalSize());
+	parc->SetProgress(&progress);
 
-		cmd = theApp.m_s7ZipPath;
-		TCHAR wd[MAX_PATH];
-		_tcscpy_s(wd, MAX_PATH, (LPTSTR)((LPCTSTR)theApp.m_s7ZipPath));
-		PathRemoveFileSpec(wd);
-		PathRemoveBackslash(wd);
+	uint64_t sz_uncomp = 0;
 
-		msg.Format(_T("Creating tarball(s)...\r\n"));
-		pmf->GetOutputWnd().AppendMessage(COutputWnd::OT_BUILD, msg);
+	for (size_t i = 0, maxi = manifest.GetCount(); i < maxi; i++)
+	{
+		wr = WaitForSingleObject(m_hCancelEvent, 0);
+		if ((wr == WAIT_OBJECT_0) || (wr == WAIT_ABANDONED))
+		{
+			break;
+		}
 
-		ZeroMemory(&pi, sizeof(PROCESS_INFORMATION));
-		ZeroMemory(&si, sizeof(STARTUPINFO));
-		si.cb = sizeof(STARTUPINFO);
+		const CBuildManifest::SEntry &e = manifest.GetEntry(i);
 
-		param.Format(_T("\"%s\" -ttar -r a \"%s.tar\" \"%s\\*\"%s"), cmd, filename_sans_ext, tempdir_base, limitstr);
-		if (CreateProcess(NULL, (LPTSTR)((LPCTSTR)param), NULL, NULL, false, CREATE_NO_WINDOW, NULL, wd, &si, &pi))
+		// there's nowhere to put a download reference in a tarball
+		if (e.m_Download)
 		{
-			WaitForSingleObject(pi.hProcess, INFINITE);
+			msg.Format(_T("    WARNING: download reference \"%s\" (%s) can't be included in a tarball; skipping it.\r\n"), e.m_Dst.c_str(), e.m_Src.c_str());
+			m_pReporter->LogMessage(msg);
 
-			CloseHandle(pi.hProcess);
-			CloseHandle(pi.hThread);
+			continue;
 		}
 
-		msg.Format(_T("Performing final gzip operation...\r\n"));
-		pmf->GetOutputWnd().AppendMessage(COutputWnd::OT_BUILD, msg);
+		msg.Format(_T("    Adding \"%s\" from \"%s\" ...\r\n"), e.m_Dst.c_str(), e.m_Src.c_str());
+		m_pReporter->LogMessage(msg);
 
-		ZeroMemory(&pi, sizeof(PROCESS_INFORMATION));
-		ZeroMemory(&si, sizeof(STARTUPINFO));
-		si.cb = sizeof(STARTUPINFO);
-
-		param.Format(_T("\"%s\" -tgzip a \"%s.tar.gzip\" \"%s.tar\""), cmd, filename_sans_ext, filename_sans_ext);
-		if (CreateProcess(NULL, (LPTSTR)((LPCTSTR)param), NULL, NULL, false, CREATE_NO_WINDOW, NULL, wd, &si, &pi))
+		uint64_t uncomp = 0;
+		if (parc->AddFile(e.m_Src.c_str(), e.m_Dst.c_str(), &uncomp) != IArchiver::AR_OK)
 		{
-			WaitForSingleObject(pi.hProcess, INFINITE);
+			msg.Format(_T("    WARNING: \"%s\" could not be read completely!\r\n"), e.m_Src.c_str());
+			m_pReporter->LogMessage(msg);
 
-			CloseHandle(pi.hProcess);
-			CloseHandle(pi.hThread);
+			ret = false;
 		}
 
-		param.Format(_T("%s.tar"), filename_sans_ext);
-		DeleteFile(param);
+		sz_uncomp += uncomp;
 	}
 
-	{
-		msg.Format(_T("Removing temporary files...\r\n"));
-		pmf->GetOutputWnd().AppendMessage(COutputWnd::OT_BUILD, msg);
+	if (!scanned)
+		wr = WaitForSingleObject(m_hCancelEvent, 0);
 
-		ZeroMemory(&pi, sizeof(PROCESS_INFORMATION));
-		ZeroMemory(&si, sizeof(STARTUPINFO));
-		si.cb = sizeof(STARTUPINFO);
+	bool cancelled = ((wr == WAIT_OBJECT_0) || (wr == WAIT_ABANDONED));
 
-		param.Format(_T("del /s /q %s\\*"), tempdir_base);
-		if (CreateProcess(_T("cmd.exe"), (LPTSTR)((LPCTSTR)param), NULL, NULL, false, CREATE_NO_WINDOW, NULL, NULL, &si, &pi))
+	if (!cancelled)
+	{
+		if (parc->Finalize() != IArchiver::FR_OK)
 		{
-			WaitForSingleObject(pi.hProcess, INFINITE);
-
-			CloseHandle(pi.hProcess);
-			CloseHandle(pi.hThread);
+			m_pReporter->LogMessage(_T("WARNING: writing the tarball failed; the disk may be full.\r\n"));
+			ret = false;
 		}
 	}
 
+	parc->SetProgress(nullptr);
+
+	size_t filecount = parc->GetFileCount(IArchiver::IM_WHOLE);
+
+	IArchiver::DestroyArchiver(&parc);
+
+	LARGE_INTEGER tsz = {0};
+	tsz.QuadPart = pah->GetLength();
+
+	UINT volct = pah->GetVolumeCount();
+
+	if (cancelled)
+		pah->Discard();
+
+	pah->Release();
+
 	time(&finish_op);
 	int elapsed = (int)difftime(finish_op, start_op);
+	double build_secs = std::max<double>(1.0, (double)elapsed);
 
 	int hours = elapsed / 3600;
 	elapsed %= 3600;
@@ -1626,19 +2207,42 @@ bool CSfxPackagerDoc::CreateTarGzipPackage(const TCHAR *filename, CSfxPackagerVi
 	int minutes = elapsed / 60;
 	int seconds = elapsed % 60;
 
-	if ((wr == WAIT_OBJECT_0) || (wr == WAIT_ABANDONED))
+	if (cancelled)
 	{
 		msg.Format(_T("Cancelled. (after: %02d:%02d:%02d)\r\n"), hours, minutes, seconds);
 	}
 	else
 	{
-		msg.Format(_T("Done. (completed in: %02d:%02d:%02d)\r\n"), hours, minutes, seconds);
+		if (volumes)
+			msg.Format(_T("Done.\r\n\r\nAdded %d files, spanning %d volume(s).\r\n"), (int)filecount, volct);
+		else
+			msg.Format(_T("Done.\r\n\r\nAdded %d files.\r\n"), (int)filecount);
+		m_pReporter->LogMessage(msg);
+
+		double comp_pct = 0.0;
+		double uncomp_sz = (double)sz_uncomp;
+		double comp_sz = (double)tsz.QuadPart;
+		if (comp_sz > 0)
+		{
+			comp_pct = 100.0 * std::max<double>(0.0, ((uncomp_sz / comp_sz) - 1.0));
+		}
+		msg.Format(_T("Uncompressed Size: %1.02fMB\r\nCompressed Size: %1.02fMB\r\nCompression: %1.02f%%\r\n\r\n"), uncomp_sz / 1024.0f / 1024.0f, comp_sz / 1024.0f / 1024.0f, comp_pct);
+		m_pReporter->LogMessage(msg);
+
+		msg.Format(_T("Completed in: %02d:%02d:%02d (%1.02fMB/s)\r\n\r\n\r\n"), hours, minutes, seconds, uncomp_sz / 1024.0 / 1024.0 / build_secs);
 	}
 
-	pmf->GetOutputWnd().AppendMessage(COutputWnd::OT_BUILD, msg);
+	m_pReporter->LogMessage(msg);
 
-	pmf->GetStatusBarWnd().PostMessage(CProgressStatusBar::WM_UPDATE_STATUS, -1, 0);
-	Sleep(0);
+	IBuildReporter::SBuildResult result;
+	result.m_Outcome = cancelled ? IBuildReporter::SBuildResult::BO_CANCELLED : (ret ? IBuildReporter::SBuildResult::BO_SUCCEEDED : IBuildReporter::SBuildResult::BO_FAILED);
+	result.m_Filename = fullfilename;
+	result.m_FileCount = filecount;
+	result.m_SpanCount = volct;
+	result.m_UncompressedSize = sz_uncomp;
+	result.m_CompressedSize = tsz.QuadPart;
+	result.m_Seconds = (int)difftime(finish_op, start_op);
+	m_pReporter->BuildFinished(result);
 
 	return ret;
 }
@@ -1720,6 +2324,15 @@ UINT CSfxPackagerDoc::GetNumFiles()
 	return (UINT)m_FileData.size();
 }
 
+void CSfxPackagerDoc::GetFileHandles(std::vector<UINT> &handles)
+{
+	handles.clear();
+	handles.reserve(m_FileData.size());
+
+	for (TFileDataMap::const_iterator it = m_FileData.cbegin(), last_it = m_FileData.cend(); it != last_it; it++)
+		handles.push_back(it->first);
+}
+
 const TCHAR *CSfxPackagerDoc::GetFileData(UINT handle, EFileDataType fdt)
 {
 	TFileDataMap::iterator it = m_FileData.find(handle);
@@ -1784,83 +2397,55 @@ void CSfxPackagerDoc::SetFileData(UINT handle, EFileDataType fdt, const TCHAR *d
 
 // CSfxPackagerDoc serialization
 
-void UnescapeString(const TCHAR *in, tstring &out)
+void UnescapeString(tstring_view in, tstring &out)
 {
-	out.reserve(_tcslen(in));
-	const TCHAR *c = in;
-	while (c && *c)
+	// most values have nothing escaped in them, so they're just copied
+	size_t amp = in.find(_T('&'));
+	if (amp == tstring_view::npos)
 	{
-		if (*c == _T('&'))
+		out.assign(in.data(), in.length());
+		return;
+	}
+
+	out.assign(in.data(), amp);
+	out.reserve(in.length());
+	in.remove_prefix(amp);
+
+	while (!in.empty())
+	{
+		if (in[0] == _T('&'))
 		{
-			if (!memcmp(c, _T("&lt;"), sizeof(TCHAR) * 4))
+			if (!in.compare(0, 4, _T("&lt;")))
 			{
 				out += _T('<');
-				c += 3;
+				in.remove_prefix(4);
+				continue;
 			}
-			else if (!memcmp(c, _T("&gt;"), sizeof(TCHAR) * 4))
+			else if (!in.compare(0, 4, _T("&gt;")))
 			{
 				out += _T('>');
-				c += 3;
+				in.remove_prefix(4);
+				continue;
 			}
-			else if (!memcmp(c, _T("&amp;"), sizeof(TCHAR) * 5))
+			else if (!in.compare(0, 5, _T("&amp;")))
 			{
 				out += _T('&');
-				c += 4;
+				in.remove_prefix(5);
+				continue;
 			}
-			else if (!memcmp(c, _T("&quot;"), sizeof(TCHAR) * 6))
+			else if (!in.compare(0, 6, _T("&quot;")))
 			{
 				out += _T('\"');
-				c += 5;
+				in.remove_prefix(6);
+				continue;
 			}
 		}
-		else
-			out += *c;
-
-		c++;
-	}
-}
-
-void EscapeString(const TCHAR *in, tstring &out)
-{
-	out.clear();
-	out.reserve(_tcslen(in) * 2);
-	const TCHAR *c = in;
-	while (c && *c)
-	{
-		switch (*c)
-		{
-			case _T('<'):
-			{
-				out += _T("&lt;");
-				break;
-			}
-			case _T('>'):
-			{
-				out += _T("&gt;");
-				break;
-			}
-			case _T('&'):
-			{
-				out += _T("&amp;");
-				break;
-			}
-			case _T('\"'):
-			{
-				out += _T("&quot;");
-				break;
-			}
-			default:
-			{
-				out += *c;
-				break;
-			}
-		};
 
-		c++;
+		out += in[0];
+		in.remove_prefix(1);
 	}
 }
 
-
 void CSfxPackagerDoc::ReadSettings(CGenParser &gp)
 {
 	tstring name, value;
@@ -1873,7 +2458,8 @@ void CSfxPackagerDoc::ReadSettings(CGenParser &gp)
 
 			if (!gp.IsToken(_T("/")))
 			{
-				name = gp.GetCurrentTokenString();
+				tstring_view t = gp.GetCurrentToken();
+				name.assign(t.data(), t.length());
 			}
 			else
 			{
@@ -1890,10 +2476,7 @@ void CSfxPackagerDoc::ReadSettings(CGenParser &gp)
 			gp.NextToken(); // skip '='
 
 			gp.NextToken();
-			value = gp.GetCurrentTokenString();
-			tstring tmp;
-			UnescapeString(value.c_str(), tmp);
-			value = tmp;
+			UnescapeString(gp.GetCurrentToken(), value);
 		}
 		else if (gp.IsToken(_T(">")))
 		{
@@ -1931,6 +2514,18 @@ void CSfxPackagerDoc::ReadSettings(CGenParser &gp)
 				m_bAppendVersion = (!_tcsicmp(value.c_str(), _T("true")) ? true : false);
 			else if (!_tcsicmp(name.c_str(), _T("externalarchive")))
 				m_bExternalArchive = (!_tcsicmp(value.c_str(), _T("true")) ? true : false);
+			else if (!_tcsicmp(name.c_str(), _T("streaminglayout")))
+				m_bStreamingLayout = (!_tcsicmp(value.c_str(), _T("true")) ? true : false);
+			else if (!_tcsicmp(name.c_str(), _T("incrementalbuild")))
+				m_bIncrementalBuild = (!_tcsicmp(value.c_str(), _T("true")) ? true : false);
+			else if (!_tcsicmp(name.c_str(), _T("cachepath")))
+				m_CachePath = value.c_str();
+			else if (!_tcsicmp(name.c_str(), _T("cachesize")))
+				m_CacheSize = _tstoi(value.c_str());
+			else if (!_tcsicmp(name.c_str(), _T("patchbase")))
+				m_PatchBase = value.c_str();
+			else if (!_tcsicmp(name.c_str(), _T("outputcmd")))
+				m_OutputCmd = value.c_str();
 		}
 	}
 }
@@ -1956,26 +2551,23 @@ void CSfxPackagerDoc::ReadScripts(CGenParser &gp)
 						gp.NextToken(); // skip '='
 
 						gp.NextToken();
-						tstring t = gp.GetCurrentTokenString();
+						EScriptType st = EScriptType::NUMTYPES;
+						if (gp.IsToken(_T("init")))
+							st = EScriptType::INIT;
+						else if (gp.IsToken(_T("perfile")))
+							st = EScriptType::PERFILE;
+						else if (gp.IsToken(_T("finish")))
+							st = EScriptType::FINISH;
 
 						gp.NextToken(); // skip '>'
 
 						gp.FindBoundedRawString(_T('<'));
-						tstring s = gp.GetCurrentTokenString();
-						tstring ues;
-						UnescapeString(s.c_str(), ues);
 
-						if (!_tcsicmp(t.c_str(), _T("init")))
-						{
-							m_Script[EScriptType::INIT] = ues.c_str();
-						}
-						else if (!_tcsicmp(t.c_str(), _T("perfile")))
+						if (st != EScriptType::NUMTYPES)
 						{
-							m_Script[EScriptType::PERFILE] = ues.c_str();
-						}
-						else if (!_tcsicmp(t.c_str(), _T("finish")))
-						{
-							m_Script[EScriptType::FINISH] = ues.c_str();
+							tstring ues;
+							UnescapeString(gp.GetCurrentToken(), ues);
+							m_Script[st] = ues.c_str();
 						}
 					}
 				}
@@ -1995,7 +2587,9 @@ void CSfxPackagerDoc::ReadScripts(CGenParser &gp)
 
 void CSfxPackagerDoc::ReadFiles(CGenParser &gp)
 {
+	// these are re-used for every <file>, so once they've grown to fit, reading a file entry doesn't allocate until AddFile keeps a copy
 	tstring name, src, dst, exclude, scriptsnippet;
+	tstring_view t;
 
 	while (gp.NextToken())
 	{
@@ -2025,35 +2619,39 @@ void CSfxPackagerDoc::ReadFiles(CGenParser &gp)
 			gp.NextToken(); // skip '='
 
 			gp.NextToken();
-			name = gp.GetCurrentTokenString();
+			t = gp.GetCurrentToken();
+			name.assign(t.data(), t.length());
 		}
 		else if (gp.IsToken(_T("src")))
 		{
 			gp.NextToken(); // skip '='
 
 			gp.NextToken();
-			src = gp.GetCurrentTokenString();
+			t = gp.GetCurrentToken();
+			src.assign(t.data(), t.length());
 		}
 		else if (gp.IsToken(_T("dst")))
 		{
 			gp.NextToken(); // skip '='
 
 			gp.NextToken();
-			dst = gp.GetCurrentTokenString();
+			t = gp.GetCurrentToken();
+			dst.assign(t.data(), t.length());
 		}
 		else if (gp.IsToken(_T("exclude")))
 		{
 			gp.NextToken(); // skip '='
 
 			gp.NextToken();
-			exclude = gp.GetCurrentTokenString();
+			t = gp.GetCurrentToken();
+			exclude.assign(t.data(), t.length());
 		}
 		else if (gp.IsToken(_T("snippet")))
 		{
 			gp.NextToken(); // skip '='
 
 			gp.NextToken();
-			UnescapeString(gp.GetCurrentTokenString(), scriptsnippet);
+			UnescapeString(gp.GetCurrentToken(), scriptsnippet);
 		}
 	}
 }
@@ -2094,54 +2692,56 @@ void CSfxPackagerDoc::Serialize(CArchive& ar)
 {
 	if (ar.IsStoring())
 	{
-		CString s;
-		s += _T("<sfxpackager>\n");
-		s += _T("\t<settings>");
-
-		tstring tmp;
-
-		s += _T("\n\t\t<output value=\""); s += m_SfxOutputFile; s += _T("\"/>");
-
-		EscapeString(m_Caption, tmp);
-		s += _T("\n\t\t<caption value=\""); s += tmp.c_str(); s += _T("\"/>");
-
-		EscapeString(m_Description, tmp);
-		s += _T("\n\t\t<description value=\""); s += tmp.c_str(); s += _T("\"/>");
-
-		EscapeString(m_LicenseMessage, tmp);
-		s += _T("\n\t\t<licensemsg value=\""); s += tmp.c_str(); s += _T("\"/>");
+		// everything is converted to UTF-8 straight into one buffer that goes to the file in large pieces
+		CUtf8ArchiveWriter w(ar);
 
-		s += _T("\n\t\t<icon value=\""); s += m_IconFile; s += _T("\"/>");
-
-		s += _T("\n\t\t<image value=\""); s += m_ImageFile; s += _T("\"/>");
-
-		s += _T("\n\t\t<launchcmd value=\""); s += m_LaunchCmd; s += _T("\"/>");
-
-		s += _T("\n\t\t<explore value=\""); s += m_bExploreOnComplete ? _T("true") : _T("false"); s += _T("\"/>");
-
-		s += _T("\n\t\t<defaultpath value=\""); s += m_DefaultPath; s += _T("\"/>");
-
-		EscapeString(m_VersionID, tmp);
-		s += _T("\n\t\t<versionid value=\""); s += tmp.c_str(); s += _T("\"/>");
-
-		s += _T("\n\t\t<requireadmin value=\""); s += m_bRequireAdmin ? _T("true") : _T("false"); s += _T("\"/>");
-
-		s += _T("\n\t\t<requirereboot value=\""); s += m_bRequireReboot ? _T("true") : _T("false"); s += _T("\"/>");
-
-		s += _T("\n\t\t<allowdestchg value=\""); s += m_bAllowDestChg ? _T("true") : _T("false"); s += _T("\"/>");
-
-		s += _T("\n\t\t<appendbuilddate value=\""); s += m_bAppendBuildDate ? _T("true") : _T("false"); s += _T("\"/>");
-
-		s += _T("\n\t\t<appendversion value=\""); s += m_bAppendVersion ? _T("true") : _T("false"); s += _T("\"/>");
+		auto WriteSetting = [&w](const TCHAR *name, const TCHAR *value, bool escape)
+		{
+			w.Write(_T("\n\t\t<")); w.Write(name); w.Write(_T(" value=\""));
+			if (escape)
+				w.WriteEscaped(value);
+			else
+				w.Write(value);
+			w.Write(_T("\"/>"));
+		};
 
-		s += _T("\n\t\t<externalarchive value=\""); s += m_bExternalArchive ? _T("true") : _T("false"); s += _T("\"/>");
+		w.Write(_T("<sfxpackager>\n"));
+		w.Write(_T("\t<settings>"));
+
+		WriteSetting(_T("output"), m_SfxOutputFile, false);
+		WriteSetting(_T("caption"), m_Caption, true);
+		WriteSetting(_T("description"), m_Description, true);
+		WriteSetting(_T("licensemsg"), m_LicenseMessage, true);
+		WriteSetting(_T("icon"), m_IconFile, false);
+		WriteSetting(_T("image"), m_ImageFile, false);
+		WriteSetting(_T("launchcmd"), m_LaunchCmd, false);
+		WriteSetting(_T("explore"), m_bExploreOnComplete ? _T("true") : _T("false"), false);
+		WriteSetting(_T("defaultpath"), m_DefaultPath, false);
+		WriteSetting(_T("versionid"), m_VersionID, true);
+		WriteSetting(_T("requireadmin"), m_bRequireAdmin ? _T("true") : _T("false"), false);
+		WriteSetting(_T("requirereboot"), m_bRequireReboot ? _T("true") : _T("false"), false);
+		WriteSetting(_T("allowdestchg"), m_bAllowDestChg ? _T("true") : _T("false"), false);
+		WriteSetting(_T("appendbuilddate"), m_bAppendBuildDate ? _T("true") : _T("false"), false);
+		WriteSetting(_T("appendversion"), m_bAppendVersion ? _T("true") : _T("false"), false);
+		WriteSetting(_T("externalarchive"), m_bExternalArchive ? _T("true") : _T("false"), false);
+		WriteSetting(_T("streaminglayout"), m_bStreamingLayout ? _T("true") : _T("false"), false);
+		WriteSetting(_T("incrementalbuild"), m_bIncrementalBuild ? _T("true") : _T("false"), false);
+		WriteSetting(_T("cachepath"), m_CachePath, true);
+
+		TCHAR csb[32];
+		_itot_s(m_CacheSize, csb, 32, 10);
+		WriteSetting(_T("cachesize"), csb, false);
+
+		WriteSetting(_T("patchbase"), m_PatchBase, true);
+		WriteSetting(_T("outputcmd"), m_OutputCmd, true);
 
 		TCHAR msb[32];
-		s += _T("\n\t\t<maxsize value=\""); _itot_s(m_MaxSize, msb, 32, 10); s += msb; s += _T("\"/>");
+		_itot_s(m_MaxSize, msb, 32, 10);
+		WriteSetting(_T("maxsize"), msb, false);
 
-		s += _T("\n\t</settings>\n");
+		w.Write(_T("\n\t</settings>\n"));
 
-		s += _T("\n\t<scripts>");
+		w.Write(_T("\n\t<scripts>"));
 
 		POSITION vp = GetFirstViewPosition();
 		CView *pv = nullptr;
@@ -2160,88 +2760,36 @@ void CSfxPackagerDoc::Serialize(CArchive& ar)
 				pe->UpdateDocWithActiveScript();
 		}
 
-		tstring scr;
-
-		if (!m_Script[EScriptType::INIT].IsEmpty())
-		{
-			EscapeString(m_Script[EScriptType::INIT], scr);
-			if (!scr.empty())
-				s += _T("\n\t\t<script type=\"init\">"); s += scr.c_str(); s += _T("</script>");
-		}
-
-		if (!m_Script[EScriptType::PERFILE].IsEmpty())
+		static const TCHAR *scripttype[EScriptType::NUMTYPES] = {_T("init"), _T("perfile"), _T("finish")};
+		for (int i = 0; i < EScriptType::NUMTYPES; i++)
 		{
-			EscapeString(m_Script[EScriptType::PERFILE], scr);
-			if (!scr.empty())
-				s += _T("\n\t\t<script type=\"perfile\">"); s += scr.c_str(); s += _T("</script>");
-		}
+			if (m_Script[i].IsEmpty())
+				continue;
 
-		if (!m_Script[EScriptType::FINISH].IsEmpty())
-		{
-			EscapeString(m_Script[EScriptType::FINISH], scr);
-			if (!scr.empty())
-				s += _T("\n\t\t<script type=\"finish\">"); s += scr.c_str(); s += _T("</script>");
+			w.Write(_T("\n\t\t<script type=\"")); w.Write(scripttype[i]); w.Write(_T("\">"));
+			w.WriteEscaped(m_Script[i]);
+			w.Write(_T("</script>"));
 		}
 
-		s += _T("\n\t</scripts>\n");
-
-		s += _T("\n\t<files>\n");
-
-#if defined(UNICODE)
-		int nLen;
-		char *pbuf;
-
-		nLen = WideCharToMultiByte(CP_UTF8, 0, (LPCTSTR)s, -1, NULL, NULL, NULL, NULL);
-		pbuf = (char *)malloc(nLen);
-		if (pbuf)
-			WideCharToMultiByte(CP_UTF8, 0, (LPCTSTR)s, -1, pbuf, nLen, NULL, NULL);
-#else
-		pbuf = (LPCTSTR)s;
-#endif
+		w.Write(_T("\n\t</scripts>\n"));
 
-		if (pbuf)
-			ar.Write(pbuf, nLen - 1);
+		w.Write(_T("\n\t<files>\n"));
 
-		for (TFileDataMap::iterator it = m_FileData.begin(), last_it = m_FileData.end(); it != last_it; it++)
+		for (TFileDataMap::const_iterator it = m_FileData.cbegin(), last_it = m_FileData.cend(); it != last_it; it++)
 		{
-			tstring esc_snip;
-			EscapeString(it->second.snippet.c_str(), esc_snip);
-
-			s.Format(_T("\t\t<file name=\"%s\" src=\"%s\" dst=\"%s\" exclude=\"%s\" snippet=\"%s\" />\n"), it->second.name.c_str(), it->second.srcpath.c_str(), it->second.dstpath.c_str(), it->second.exclude.c_str(), esc_snip.c_str());
-
-#if defined(UNICODE)
-			nLen = WideCharToMultiByte(CP_UTF8, 0, (LPCTSTR)s, -1, NULL, NULL, NULL, NULL);
-			pbuf = (char *)realloc(pbuf, nLen);
-			if (pbuf)
-				WideCharToMultiByte(CP_UTF8, 0, (LPCTSTR)s, -1, pbuf, nLen, NULL, NULL);
-#else
-		pbuf = (LPCTSTR)s;
-#endif
-
-			if (pbuf)
-				ar.Write(pbuf, nLen - 1);
+			// only the snippet is escaped; the reader takes the rest as-is
+			w.Write(_T("\t\t<file name=\"")); w.Write(it->second.name.c_str(), it->second.name.length());
+			w.Write(_T("\" src=\"")); w.Write(it->second.srcpath.c_str(), it->second.srcpath.length());
+			w.Write(_T("\" dst=\"")); w.Write(it->second.dstpath.c_str(), it->second.dstpath.length());
+			w.Write(_T("\" exclude=\"")); w.Write(it->second.exclude.c_str(), it->second.exclude.length());
+			w.Write(_T("\" snippet=\"")); w.WriteEscaped(it->second.snippet.c_str());
+			w.Write(_T("\" />\n"));
 		}
 
-		s = _T("\t</files>\n");
-		s += _T("</sfxpackager>\n");
-
-#if defined(UNICODE)
-		nLen = WideCharToMultiByte(CP_UTF8, 0, (LPCTSTR)s, -1, NULL, NULL, NULL, NULL);
-		pbuf = (char *)realloc(pbuf, nLen);
-		if (pbuf)
-			WideCharToMultiByte(CP_UTF8, 0, (LPCTSTR)s, -1, pbuf, nLen, NULL, NULL);
-#else
-		pbuf = (LPCTSTR)s;
-#endif
-
-		if (pbuf)
-		{
-			ar.Write(pbuf, nLen - 1);
+		w.Write(_T("\t</files>\n"));
+		w.Write(_T("</sfxpackager>\n"));
 
-#if defined(UNICODE)
-			free(pbuf);
-#endif
-		}
+		w.Flush();
 	}
 	else
 	{
@@ -2254,18 +2802,23 @@ void CSfxPackagerDoc::Serialize(CArchive& ar)
 			if (sz == ar.Read(pbuf, (UINT)sz))
 			{
 				TCHAR *ptbuf;
+				size_t tlen;
 
 #if defined(UNICODE)
-				int nLen = MultiByteToWideChar(CP_UTF8, 0, pbuf, -1, NULL, NULL);
+				// the file isn't NUL-terminated, so convert exactly what was read; the parser works in place on the result
+				int nLen = MultiByteToWideChar(CP_UTF8, 0, pbuf, (int)sz, NULL, NULL);
 				ptbuf = (TCHAR *)malloc((nLen + 1) * sizeof(TCHAR));
-				MultiByteToWideChar(CP_UTF8, 0, pbuf, -1, ptbuf, nLen);
+				if (ptbuf)
+					ptbuf[MultiByteToWideChar(CP_UTF8, 0, pbuf, (int)sz, ptbuf, nLen)] = _T('\0');
+				tlen = (size_t)nLen;
 #else
 				ptbuf = pbuf;
+				tlen = (size_t)sz;
 #endif
 				if (ptbuf)
 				{
 					CGenParser gp;
-					gp.SetSourceData(ptbuf, (UINT)sz);
+					gp.SetSourceData(ptbuf, tlen);
 					ReadProject(gp);
 
 #if defined(UNICODE)
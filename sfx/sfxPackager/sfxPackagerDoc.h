@@ -21,12 +21,15 @@
 #include <vector>
 
 #include "../../Archiver/Include/Archiver.h"
+#include "BuildReporter.h"
+#include "SourceWatcher.h"
 
 typedef std::vector<tstring> TStringArray;
 typedef std::vector<UINT64> TSizeArray;
 typedef std::vector<TSizeArray> TZipOffsetArray;
 
 class CSfxPackagerView;
+class CBuildManifest;
 
 class CSfxHandle;
 
@@ -78,6 +81,9 @@ public:
 
 	UINT GetNumFiles();
 
+	// Gets the handles of all the files, in the order they're in the project
+	void GetFileHandles(std::vector<UINT> &handles);
+
 	static CSfxPackagerDoc *GetDoc();
 
 protected:
@@ -97,11 +103,11 @@ protected:
 	UINT m_Key;
 
 	bool InitializeArchive(CSfxPackagerView *pview, TStringArray &created_archives, TSizeArray &created_archive_filecounts, const TCHAR *basename, UINT span = 0);
-	bool AddFileToArchive(CSfxPackagerView *pview, IArchiver *parc, TStringArray &created_archives, TSizeArray &created_archive_filecounts, const TCHAR *srcspec, const TCHAR *excludespec, const TCHAR *scriptsnippet, const TCHAR *dstpath, const TCHAR *dstfilename = NULL, uint64_t *sz_uncomp = NULL, uint64_t *sz_comp = NULL, UINT recursion = 0);
 	bool FixupPackage(const TCHAR *filename, const TCHAR *launchcmd, bool span, UINT32 filecount);
 	bool SetupSfxExecutable(const TCHAR *filename, UINT span = 0);
 
-	bool CopyFileToTemp(CSfxPackagerView *pview, const TCHAR *srcspec, const TCHAR *dstpath, const TCHAR *dstfilename, const TCHAR *excludespec, UINT recursion = 0);
+	// Adds every file entry in the project to the manifest, to be scanned
+	void PopulateManifest(CBuildManifest &manifest);
 
 public:
 	CString m_SfxOutputFile;
@@ -119,9 +125,23 @@ public:
 	bool m_bRequireReboot;
 	bool m_bAllowDestChg;
 	bool m_bExternalArchive;
+	bool m_bStreamingLayout;
+	bool m_bIncrementalBuild;
+	CString m_CachePath;
+	long m_CacheSize;
+	CString m_PatchBase;
+	CString m_OutputCmd;
 	CString m_LaunchCmd;
 	long m_MaxSize;
 	LARGE_INTEGER m_UncompressedSize;
+	UINT m_ReusedFileCount;
+	UINT m_UnchangedFileCount;
+	UINT m_DeltaFileCount;
+
+	// the customized stub that every exe in a build is copied from, and where its per-span data is
+	CString m_StubTemplate;
+	LONGLONG m_StubFixupOfs;
+	LONGLONG m_StubCaptionOfs;
 
 	CString m_Script[EScriptType::NUMTYPES];
 
@@ -130,10 +150,19 @@ public:
 	HANDLE m_hThread;
 	HANDLE m_hCancelEvent;
 
+	// where the build currently running says what it's doing
+	IBuildReporter *m_pReporter;
+
+	// keeps track of what's changed in the source directories since each build listed them, so the next one needn't
+	CSourceWatcher m_SourceWatcher;
+
 // Operations
 public:
-	bool CreateSFXPackage(const TCHAR *filename = NULL, CSfxPackagerView *pview = NULL);
-	bool CreateTarGzipPackage(const TCHAR *filename = NULL, CSfxPackagerView *pview = NULL);
+	// Builds whichever kind of package the output filename calls for (m_SfxOutputFile if filename is NULL)
+	bool CreatePackage(const TCHAR *filename, IBuildReporter *preporter);
+
+	bool CreateSFXPackage(const TCHAR *filename, IBuildReporter *preporter);
+	bool CreateTarGzipPackage(const TCHAR *filename, IBuildReporter *preporter);
 
 	static DWORD WINAPI RunCreateSFXPackage(LPVOID param);
 
@@ -63,6 +63,8 @@ BEGIN_MESSAGE_MAP(CSfxPackagerView, CListView)
 	ON_UPDATE_COMMAND_UI(ID_ADJUSTPOS_DOWN, &CSfxPackagerView::OnUpdateAdjustPos)
 	ON_UPDATE_COMMAND_UI(ID_ADJUSTPOS_TOP, &CSfxPackagerView::OnUpdateAdjustPos)
 	ON_UPDATE_COMMAND_UI(ID_ADJUSTPOS_BOTTOM, &CSfxPackagerView::OnUpdateAdjustPos)
+	ON_WM_DESTROY()
+	ON_MESSAGE(WM_IMPORTBATCH, &CSfxPackagerView::OnImportBatch)
 END_MESSAGE_MAP()
 
 // CSfxPackagerView construction/destruction
@@ -74,10 +76,18 @@ CSfxPackagerView::CSfxPackagerView()
 	m_Splitter = nullptr;
 	m_ScriptEditor = nullptr;
 	m_hAccelTable = LoadAccelerators(theApp.m_hInstance, MAKEINTRESOURCE(IDR_MAINFRAME));
+
+	InitializeCriticalSection(&m_ImportLock);
+	m_hImportThread = NULL;
+	m_bImporting = false;
+	m_bImportPosted = false;
+	m_bCancelImport = false;
+	m_ImportCount = 0;
 }
 
 CSfxPackagerView::~CSfxPackagerView()
 {
+	DeleteCriticalSection(&m_ImportLock);
 }
 
 CSfxPackagerView *CSfxPackagerView::GetView()
@@ -97,7 +107,8 @@ CSfxPackagerView *CSfxPackagerView::GetView()
 
 BOOL CSfxPackagerView::PreCreateWindow(CREATESTRUCT& cs)
 {
-	cs.style |= LVS_REPORT | LVS_SHOWSELALWAYS;
+	// rows are drawn straight from the document (see OnLvnGetdispinfo), so a project of any size costs the list nothing
+	cs.style |= LVS_REPORT | LVS_SHOWSELALWAYS | LVS_OWNERDATA;
 	cs.dwExStyle |= WS_EX_ACCEPTFILES;
 
 	return CListView::PreCreateWindow(cs);
@@ -198,18 +209,8 @@ void CSfxPackagerView::OnUpdate(CView* /*pSender*/, LPARAM /*lHint*/, CObject* /
 
 			CSfxPackagerDoc *pDoc = GetDocument();
 
-			LVITEM lvi;
-			lvi.mask = LVIF_TEXT | LVIF_PARAM;
-			lvi.pszText = LPSTR_TEXTCALLBACK;
-
-			for (UINT i = 0; i < pDoc->GetNumFiles(); i++)
-			{
-				lvi.iItem = i;
-				lvi.lParam = i;
-
-				for (lvi.iSubItem = 0; lvi.iSubItem < 4; lvi.iSubItem++)
-					list.InsertItem(&lvi);
-			}
+			pDoc->GetFileHandles(m_Handles);
+			list.SetItemCountEx((int)m_Handles.size(), LVSICF_NOSCROLL);
 		}
 	}
 }
@@ -248,51 +249,104 @@ void CSfxPackagerView::ImportLivingFolder(const TCHAR *dir, const TCHAR *include
 #endif
 
 		CSfxPackagerDoc *pDoc = GetDocument();
-		UINT handle = pDoc->AddFile(e, dir, _T("\\"), _T(""), _T(""));
+		m_Handles.push_back(pDoc->AddFile(e, dir, _T("\\"), _T(""), _T("")));
 
 		CListCtrl &list = GetListCtrl();
+		if (list.GetSafeHwnd())
+			list.SetItemCountEx((int)m_Handles.size(), LVSICF_NOINVALIDATEALL | LVSICF_NOSCROLL);
+	}
+}
+
+void CSfxPackagerView::ImportFiles(const TStringArray &paths)
+{
+	if (paths.empty())
+		return;
 
-		LVINSERTMARK im;
-		ZeroMemory(&im, sizeof(LVINSERTMARK));
-		im.cbSize = sizeof(LVINSERTMARK);
-		int idx = list.GetItemCount();
+	EnterCriticalSection(&m_ImportLock);
+	m_ImportQueue.insert(m_ImportQueue.end(), paths.begin(), paths.end());
+	bool start = !m_bImporting;
+	m_bImporting = true;
+	LeaveCriticalSection(&m_ImportLock);
 
-		if (list.GetSafeHwnd())
+	// if the thread is already going, it'll get to these when it's done with what it has
+	if (start)
+	{
+		if (m_hImportThread)
+			CloseHandle(m_hImportThread);
+
+		m_bCancelImport = false;
+		m_hImportThread = CreateThread(NULL, 0, ImportThreadProc, this, 0, NULL);
+	}
+}
+
+DWORD WINAPI CSfxPackagerView::ImportThreadProc(LPVOID param)
+{
+	CSfxPackagerView *_this = (CSfxPackagerView *)param;
+
+	std::vector<SImportItem> pending;
+	ULONGLONG lastpost = GetTickCount64();
+
+	for (;;)
+	{
+		EnterCriticalSection(&_this->m_ImportLock);
+		if (_this->m_ImportQueue.empty() || _this->m_bCancelImport)
 		{
-			LVITEM lvi;
-			lvi.mask = LVIF_TEXT | LVIF_PARAM;
-			lvi.iItem = idx;
-			lvi.lParam = handle;
-			lvi.pszText = LPSTR_TEXTCALLBACK;
-
-			for (lvi.iSubItem = 0; lvi.iSubItem < 4; lvi.iSubItem++)
-				list.InsertItem(&lvi);
+			_this->m_ImportQueue.clear();
+			_this->m_bImporting = false;
+			LeaveCriticalSection(&_this->m_ImportLock);
+			break;
 		}
+
+		tstring path = _this->m_ImportQueue.front();
+		_this->m_ImportQueue.pop_front();
+		LeaveCriticalSection(&_this->m_ImportLock);
+
+		// a folder's files are installed under a folder of the same name; a file goes in the root
+		tstring dst;
+		if (PathIsDirectory(path.c_str()) && !PathIsDirectoryEmpty(path.c_str()))
+			dst = PathFindFileName(path.c_str());
+
+		_this->ImportPath(path.c_str(), dst, pending, lastpost);
+
+		_this->PostImportBatch(pending);
 	}
+
+	// one last message, so the view knows it's over
+	_this->PostMessage(WM_IMPORTBATCH);
+
+	return 0;
 }
 
-void CSfxPackagerView::ImportFile(const TCHAR *filename, UINT depth, bool refresh_props)
+void CSfxPackagerView::ImportPath(const TCHAR *path, const tstring &dst, std::vector<SImportItem> &pending, ULONGLONG &lastpost)
 {
-	if (m_hPackageThread != NULL)
-		false;
-
-	if (PathIsDirectory(filename) && !PathIsDirectoryEmpty(filename))
+	if (PathIsDirectory(path) && !PathIsDirectoryEmpty(path))
 	{
 		TCHAR filepath[MAX_PATH];
-		PathCombine(filepath, filename, _T("*.*"));
+		PathCombine(filepath, path, _T("*.*"));
 		TCHAR *s = PathFindFileName(filepath);
 
 		WIN32_FIND_DATA fd;
-		HANDLE hf = FindFirstFile(filepath, &fd);
+		HANDLE hf = FindFirstFileEx(filepath, FindExInfoBasic, &fd, FindExSearchNameMatch, NULL, FIND_FIRST_EX_LARGE_FETCH);
 		if (hf == INVALID_HANDLE_VALUE)
 			return;
 
 		do
 		{
+			if (m_bCancelImport)
+				break;
+
 			if (_tcscmp(fd.cFileName, _T(".")) && _tcscmp(fd.cFileName, _T("..")))
 			{
-				_tcscpy_s(s, MAX_PATH, fd.cFileName);
-				ImportFile(filepath, depth + 1, refresh_props);
+				_tcscpy_s(s, MAX_PATH - (s - filepath), fd.cFileName);
+
+				tstring subdst = dst;
+				if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+				{
+					subdst += _T('\\');
+					subdst += fd.cFileName;
+				}
+
+				ImportPath(filepath, subdst, pending, lastpost);
 			}
 		}
 		while (FindNextFile(hf, &fd));
@@ -302,65 +356,99 @@ void CSfxPackagerView::ImportFile(const TCHAR *filename, UINT depth, bool refres
 		return;
 	}
 
-	MSG msg;
-	BOOL bRet; 
-	if ((bRet = GetMessage(&msg, NULL, 0, 0)) != FALSE)
-	{ 
-		if (bRet != -1)
-		{
-			TranslateMessage(&msg); 
-			DispatchMessage(&msg); 
-		}
-	} 
+	SImportItem item;
+	item.m_Name = PathFindFileName(path);
+	item.m_Src = path;
+	item.m_Dst = dst.empty() ? _T("\\") : dst;
+	pending.push_back(item);
 
-	CSfxPackagerDoc *pDoc = GetDocument();
-	TCHAR srcdir[MAX_PATH];
-	_tcscpy_s(srcdir, MAX_PATH, filename);
+	// the view gets what's been found a few times a second, rather than a message per file
+	ULONGLONG now = GetTickCount64();
+	if ((pending.size() >= 1024) || ((now - lastpost) >= 100))
+	{
+		PostImportBatch(pending);
+		lastpost = now;
+	}
+}
 
-	TCHAR dstdir[MAX_PATH];
-	_tcscpy_s(dstdir, MAX_PATH, srcdir);
-	PathRemoveFileSpec(dstdir);
+void CSfxPackagerView::PostImportBatch(std::vector<SImportItem> &pending)
+{
+	if (pending.empty())
+		return;
+
+	EnterCriticalSection(&m_ImportLock);
+
+	m_ImportBatch.insert(m_ImportBatch.end(), std::make_move_iterator(pending.begin()), std::make_move_iterator(pending.end()));
+
+	// there only needs to be one message waiting at a time; it'll pick up everything that's been added since
+	bool post = !m_bImportPosted;
+	m_bImportPosted = true;
+
+	LeaveCriticalSection(&m_ImportLock);
+
+	pending.clear();
+
+	if (post)
+		PostMessage(WM_IMPORTBATCH);
+}
+
+LRESULT CSfxPackagerView::OnImportBatch(WPARAM wparam, LPARAM lparam)
+{
+	std::vector<SImportItem> batch;
+
+	EnterCriticalSection(&m_ImportLock);
+	batch.swap(m_ImportBatch);
+	m_bImportPosted = false;
+	bool importing = m_bImporting;
+	LeaveCriticalSection(&m_ImportLock);
 
-	_tcsrev(dstdir);
-	TCHAR *tmp = depth ? dstdir : NULL;
-	TCHAR *start = tmp;
-	while (depth && tmp)
+	CSfxPackagerDoc *pDoc = GetDocument();
+
+	if (!batch.empty())
 	{
-		tmp = _tcschr(tmp, _T('\\'));
-		if (tmp)
-			tmp++;
+		m_Handles.reserve(m_Handles.size() + batch.size());
+
+		for (const auto &item : batch)
+			m_Handles.push_back(pDoc->AddFile(item.m_Name.c_str(), item.m_Src.c_str(), item.m_Dst.c_str(), _T(""), _T("")));
 
-		depth--;
+		m_ImportCount += (UINT)batch.size();
+
+		// the list only needs to know how many rows there are; it asks for the text of the ones it actually shows
+		GetListCtrl().SetItemCountEx((int)m_Handles.size(), LVSICF_NOINVALIDATEALL | LVSICF_NOSCROLL);
 	}
 
-	if (tmp)
+	CString s;
+	if (importing)
 	{
-		*tmp = _T('\0');
-		_tcsrev(start);
+		s.Format(_T("Importing... %u file(s) added"), m_ImportCount);
 	}
+	else
+	{
+		s.Format(_T("Imported %u file(s)"), m_ImportCount);
+		m_ImportCount = 0;
 
-	CListCtrl &list = GetListCtrl();
-	UINT handle = pDoc->AddFile(PathFindFileName(filename), srcdir, start ? start : _T("\\"), _T(""), _T(""));
+		RefreshProperties();
+	}
 
-	LVINSERTMARK im;
-	ZeroMemory(&im, sizeof(LVINSERTMARK));
-	im.cbSize = sizeof(LVINSERTMARK);
-	int idx = list.GetItemCount();
+	CMainFrame *pmf = (CMainFrame *)(AfxGetApp()->m_pMainWnd);
+	if (pmf && pmf->GetSafeHwnd())
+		pmf->GetStatusBarWnd().PostStatusText(s);
 
-	if (list.GetSafeHwnd())
+	return 0;
+}
+
+void CSfxPackagerView::OnDestroy()
+{
+	// an import that's still going would be adding to a view that's no longer there
+	if (m_hImportThread)
 	{
-		LVITEM lvi;
-		lvi.mask = LVIF_TEXT | LVIF_PARAM;
-		lvi.iItem = idx;
-		lvi.lParam = handle;
-		lvi.pszText = LPSTR_TEXTCALLBACK;
-
-		for (lvi.iSubItem = 0; lvi.iSubItem < 4; lvi.iSubItem++)
-			list.InsertItem(&lvi);
+		m_bCancelImport = true;
+		WaitForSingleObject(m_hImportThread, INFINITE);
+		CloseHandle(m_hImportThread);
+		m_hImportThread = NULL;
 	}
 
-	if (refresh_props)
-		RefreshProperties();
+	CListView::OnDestroy();
 }
 
 void CSfxPackagerView::OnDropFiles(HDROP hDropInfo)
@@ -374,6 +462,8 @@ void CSfxPackagerView::OnDropFiles(HDROP hDropInfo)
 	bool got_dir = false;
 	bool living_folders = false;
 
+	TStringArray paths;
+
 	for (UINT i = 0; i < numfiles; i++)
 	{
 		DragQueryFile(hDropInfo, i, dropfile, MAX_PATH * sizeof(TCHAR));
@@ -396,9 +486,12 @@ void CSfxPackagerView::OnDropFiles(HDROP hDropInfo)
 			}
 		}
 
-		ImportFile(dropfile, 0, false);
+		paths.push_back(dropfile);
 	}
 
+	// the files and folders are read in the background; living folders were added above
+	ImportFiles(paths);
+
 	RefreshProperties();
 
 	EndWaitCursor();
@@ -412,7 +505,8 @@ void CSfxPackagerView::OnLvnGetdispinfo(NMHDR *pNMHDR, LRESULT *pResult)
 	NMLVDISPINFO *pDispInfo = reinterpret_cast<NMLVDISPINFO*>(pNMHDR);
 	CSfxPackagerDoc *pdoc = GetDocument();
 
-	pDispInfo->item.pszText = (TCHAR *)pdoc->GetFileData((UINT)pDispInfo->item.lParam, (CSfxPackagerDoc::EFileDataType)(pDispInfo->item.iSubItem));
+	if ((pDispInfo->item.mask & LVIF_TEXT) && (pDispInfo->item.iItem < (int)m_Handles.size()))
+		pDispInfo->item.pszText = (TCHAR *)pdoc->GetFileData(m_Handles[pDispInfo->item.iItem], (CSfxPackagerDoc::EFileDataType)(pDispInfo->item.iSubItem));
 
 	*pResult = 0;
 }
@@ -448,19 +542,21 @@ void CSfxPackagerView::OnEditDelete()
 		{
 			item = list.GetNextItem(item, LVNI_SELECTED);
 
-			UINT handle = (UINT)list.GetItemData(item);
-
-			pDoc->RemoveFile(handle);
+			pDoc->RemoveFile(GetFileHandle(item));
 
 			pdi[i] = item;
 		}
 
+		// selected items come back in ascending order, so erasing from the end keeps the earlier indices valid
 		while (selcount)
 		{
 			selcount--;
 
-			list.DeleteItem(pdi[selcount]);
+			m_Handles.erase(m_Handles.begin() + pdi[selcount]);
 		}
+
+		list.SetItemState(-1, 0, LVIS_SELECTED);
+		list.SetItemCountEx((int)m_Handles.size(), LVSICF_NOSCROLL);
 	}
 
 	list.RedrawItems(list.GetTopIndex(), list.GetTopIndex() + list.GetCountPerPage());
@@ -485,12 +581,16 @@ void CSfxPackagerView::OnEditNewfile()
 
 	if (dlg.DoModal() == IDOK)
 	{
+		TStringArray paths;
+
 		POSITION pos = dlg.GetStartPosition();
 		while (pos)
 		{
 			CString s = dlg.GetNextPathName(pos);
-			ImportFile((LPCTSTR)s);
+			paths.push_back((LPCTSTR)s);
 		}
+
+		ImportFiles(paths);
 	}
 
 	filename.ReleaseBuffer();
@@ -530,10 +630,7 @@ void CSfxPackagerView::OnEditNewfile()
 void CSfxPackagerView::OnSelectall()
 {
 	CListCtrl &list = GetListCtrl();
-	for (UINT i = 0, maxi = list.GetItemCount(); i < maxi; i++)
-	{
-		list.SetItemState(i, LVIS_SELECTED, LVIS_SELECTED);
-	}
+	list.SetItemState(-1, LVIS_SELECTED, LVIS_SELECTED);
 
 	RefreshProperties();
 }
@@ -594,7 +691,7 @@ void CSfxPackagerView::OnLvnKeydown(NMHDR *pNMHDR, LRESULT *pResult)
 void CSfxPackagerView::OnUpdateAppBuildsfx(CCmdUI *pCmdUI)
 {
 	CListCtrl &list = GetListCtrl();
-	pCmdUI->Enable(list.GetSafeHwnd() && list.GetItemCount() && (m_hPackageThread == NULL));
+	pCmdUI->Enable(list.GetSafeHwnd() && list.GetItemCount() && (m_hPackageThread == NULL) && !IsImporting());
 }
 
 
@@ -629,7 +726,7 @@ BOOL CSfxPackagerView::DestroyWindow()
 void CSfxPackagerView::OnUpdateEditNewfile(CCmdUI *pCmdUI)
 {
 	CListCtrl &list = GetListCtrl();
-	pCmdUI->Enable(list.GetSafeHwnd() && (m_hPackageThread == NULL));
+	pCmdUI->Enable(list.GetSafeHwnd() && (m_hPackageThread == NULL) && !IsImporting());
 }
 
 void CSfxPackagerView::DonePackaging()
@@ -652,7 +749,7 @@ void CSfxPackagerView::SetDestFolderForSelection(const TCHAR *dst, const TCHAR *
 		{
 			item = list.GetNextItem(item, LVNI_SELECTED);
 
-			UINT handle = (UINT)list.GetItemData(item);
+			UINT handle = GetFileHandle(item);
 
 			CString val = pDoc->GetFileData(handle, CSfxPackagerDoc::FDT_DSTPATH);
 			if (val.IsEmpty())
@@ -685,7 +782,7 @@ void CSfxPackagerView::SetSrcFolderForSelection(const TCHAR *src, const TCHAR *r
 		{
 			item = list.GetNextItem(item, LVNI_SELECTED);
 
-			UINT handle = (UINT)list.GetItemData(item);
+			UINT handle = GetFileHandle(item);
 
 			CString val = pDoc->GetFileData(handle, CSfxPackagerDoc::FDT_SRCPATH);
 			val.Replace(rootsrc, src);
@@ -713,7 +810,7 @@ void CSfxPackagerView::SetFilenameForSelection(const TCHAR *name)
 	{
 		item = list.GetNextItem(item, LVNI_SELECTED);
 
-		UINT handle = (UINT)list.GetItemData(item);
+		UINT handle = GetFileHandle(item);
 
 		pDoc->SetFileData(handle, CSfxPackagerDoc::FDT_NAME, name);
 	}
@@ -739,7 +836,7 @@ void CSfxPackagerView::SetExclusionsForSelection(const TCHAR *exclude)
 		{
 			item = list.GetNextItem(item, LVNI_SELECTED);
 
-			UINT handle = (UINT)list.GetItemData(item);
+			UINT handle = GetFileHandle(item);
 
 			pDoc->SetFileData(handle, CSfxPackagerDoc::FDT_EXCLUDE, exclude);
 		}
@@ -766,7 +863,7 @@ void CSfxPackagerView::SetScriptSnippetForSelection(const TCHAR *snippet)
 		{
 			item = list.GetNextItem(item, LVNI_SELECTED);
 
-			UINT handle = (UINT)list.GetItemData(item);
+			UINT handle = GetFileHandle(item);
 
 			pDoc->SetFileData(handle, CSfxPackagerDoc::FDT_SNIPPET, snippet);
 		}
@@ -822,7 +919,7 @@ void CSfxPackagerView::OnEditRepathSource()
 		{
 			item = list.GetNextItem(item, LVNI_SELECTED);
 
-			UINT handle = (UINT)list.GetItemData(item);
+			UINT handle = GetFileHandle(item);
 			if (i == 0)
 				_tcscpy_s(rootpath, MAX_PATH, pDoc->GetFileData(handle, CSfxPackagerDoc::FDT_SRCPATH));
 			else
@@ -844,7 +941,7 @@ void CSfxPackagerView::OnEditRepathSource()
 			{
 				item = list.GetNextItem(item, LVNI_SELECTED);
 
-				UINT handle = (UINT)list.GetItemData(item);
+				UINT handle = GetFileHandle(item);
 
 				CString newpath = pDoc->GetFileData(handle, CSfxPackagerDoc::FDT_SRCPATH);
 				newpath.Replace(rootpath, rpdlg.m_Path);
@@ -926,14 +1023,15 @@ void CSfxPackagerView::AdjustSelectionPos(CSfxPackagerDoc::EMoveType mt)
 		return;
 
 	item = list.GetNextItem(item, LVNI_SELECTED);
-	UINT handle = (UINT)list.GetItemData(item);
+	UINT handle = GetFileHandle(item);
 	UINT swap_handle;
 	if (pDoc->AdjustFileOrder(handle, mt, &swap_handle))
 	{
-		for (int i = 0, maxi = list.GetItemCount(); i < maxi; i++)
-		{
-			list.SetItemState(i, (list.GetItemData(i) == swap_handle) ? (LVIS_SELECTED | LVIS_FOCUSED) : 0, LVIS_SELECTED | LVIS_FOCUSED);
-		}
+		list.SetItemState(-1, 0, LVIS_SELECTED | LVIS_FOCUSED);
+
+		std::vector<UINT>::const_iterator it = std::find(m_Handles.cbegin(), m_Handles.cend(), swap_handle);
+		if (it != m_Handles.cend())
+			list.SetItemState((int)(it - m_Handles.cbegin()), LVIS_SELECTED | LVIS_FOCUSED, LVIS_SELECTED | LVIS_FOCUSED);
 
 		list.RedrawItems(0, list.GetItemCount());
 		RefreshProperties();
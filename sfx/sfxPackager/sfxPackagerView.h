@@ -51,6 +51,11 @@ public:
 	void DonePackaging();
 	bool IsPackaging() { return (m_hPackageThread != NULL); }
 
+	bool IsImporting() { return m_bImporting; }
+
+	// The list doesn't store anything itself (it's LVS_OWNERDATA), so this is how a row is mapped to the document's file
+	UINT GetFileHandle(int item) const { return m_Handles[item]; }
+
 	void TestSfx();
 
 	void SetDestFolderForSelection(const TCHAR *dst, const TCHAR *rootdst);
@@ -60,8 +65,26 @@ public:
 	void SetScriptSnippetForSelection(const TCHAR *snippet);
 
 protected:
+	enum { WM_IMPORTBATCH = WM_APP + 1 };
+
+	struct SImportItem
+	{
+		tstring m_Name;
+		tstring m_Src;
+		tstring m_Dst;
+	};
+
 	void ImportLivingFolder(const TCHAR *dir, const TCHAR *include_ext = _T("*"), const TCHAR *exclude_ext = NULL);
-	void ImportFile(const TCHAR *filename, UINT depth = 0, bool refresh_props = true);
+
+	// Adds files, and the contents of folders as individual files, on a worker thread; they show up in batches
+	void ImportFiles(const TStringArray &paths);
+
+	static DWORD WINAPI ImportThreadProc(LPVOID param);
+
+	void ImportPath(const TCHAR *path, const tstring &dst, std::vector<SImportItem> &pending, ULONGLONG &lastpost);
+
+	// Hands what the import thread has found so far over to the view
+	void PostImportBatch(std::vector<SImportItem> &pending);
 
 	void AdjustSelectionPos(CSfxPackagerDoc::EMoveType mt);
 
@@ -71,6 +94,18 @@ protected:
 	CScriptEditView *m_ScriptEditor;
 	HACCEL m_hAccelTable;
 
+	// the document handle of each row, in order
+	std::vector<UINT> m_Handles;
+
+	CRITICAL_SECTION m_ImportLock;
+	std::deque<tstring> m_ImportQueue;
+	std::vector<SImportItem> m_ImportBatch;
+	HANDLE m_hImportThread;
+	bool m_bImporting;
+	bool m_bImportPosted;
+	volatile bool m_bCancelImport;
+	UINT m_ImportCount;
+
 // Generated message map functions
 	afx_msg void OnFilePrintPreview();
 	afx_msg void OnRButtonUp(UINT nFlags, CPoint point);
@@ -109,6 +144,8 @@ public:
 	afx_msg void OnAdjustPosBottom();
 	afx_msg void OnUpdateAdjustPos(CCmdUI *pCmdUI);
 	afx_msg void OnUpdateAppTestSfx(CCmdUI *pCmdUI);
+	afx_msg void OnDestroy();
+	afx_msg LRESULT OnImportBatch(WPARAM wparam, LPARAM lparam);
 
 	virtual BOOL PreTranslateMessage(MSG *pMsg);
 };
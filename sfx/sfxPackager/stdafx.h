@@ -62,6 +62,7 @@
 #include <inttypes.h>
 
 #include <string>
+#include <string_view>
 #include <deque>
 #include <map>
 #include <vector>
@@ -75,6 +76,7 @@
 #include <afxwin.h>
 
 typedef std::basic_string<TCHAR> tstring;
+typedef std::basic_string_view<TCHAR> tstring_view;
 
 
 